@@ -0,0 +1,26 @@
+#pragma once
+#include <Arduino.h>
+
+#define BEACON_NAME_MAX_LEN 100
+#define BLE_MAC_LEN 6
+#define BEACON_ADDR_PUBLIC 0x00 // Advertiser address types, as reported in scan results
+#define BEACON_ADDR_RANDOM 0x01
+
+// AD structure types that carry the advertised device name
+#define AD_TYPE_SHORT_NAME 0x08
+#define AD_TYPE_COMPLETE_NAME 0x09
+
+// Precomputed identity of a beacon so adverts can be matched without touching the heap
+typedef struct {
+  char name[BEACON_NAME_MAX_LEN];
+  uint8_t name_len;
+  uint32_t name_hash;
+  uint8_t mac[BLE_MAC_LEN];
+  bool mac_known; // Learnt from the first advert that matches by name
+  uint8_t mac_type; // BEACON_ADDR_PUBLIC or BEACON_ADDR_RANDOM
+} BEACONMATCHER;
+
+uint32_t hashBeaconName(const uint8_t *name, uint8_t len);
+void initBeaconMatcher(BEACONMATCHER *matcher, const char *name);
+bool beaconAddressIsStable(const BEACONMATCHER *matcher);
+bool findAdvertName(const uint8_t *payload, size_t payloadLen, const uint8_t **name, uint8_t *nameLen);
@@ -0,0 +1,44 @@
+#pragma once
+#include <Arduino.h>
+#include "beaconMatcher.hpp"
+#include "rssiFilter.hpp"
+#include "thresholdCalibrator.hpp"
+
+#define BEACON_REGISTRY_MAX 32
+#define BEACON_REGISTRY_BUCKETS 64 // Power of two, keeps the lookup tables at most half full
+#define BEACON_REGISTRY_EMPTY 0xFF // Returned when an advert or name isn't registered
+#define BEACON_REGISTRY_NAME_LEN 32 // Longest name persisted, including the length byte
+#define BEACON_RECORD_SIZE 48 // Stride of each entry in the persisted registry
+
+#define BEACON_THRESHOLD_GLOBAL 0 // Entry uses the global threshold from getTuning() rather than its own
+#define BEACON_DOORS_ALL 0xFF // Door mask of a beacon that may open every door
+
+// Permission flags per beacon
+#define BEACON_PERM_OPEN 0x01 // Beacon may open the door, otherwise it is only tracked
+#define BEACON_PERM_CALIBRATE 0x02 // Open threshold is learnt from the beacon's visits rather than set by hand
+
+// Everything the firmware knows about a single dog's beacon
+typedef struct {
+  BEACONMATCHER matcher; // Name, name hash and learnt MAC
+  RSSIFILTER rssi;
+  BEACONCALIBRATION calibration; // Visit history for learning open_threshold, not persisted
+  int8_t open_threshold;
+  uint8_t permissions;
+  uint8_t doors; // Bit per door (row of doorTable in doorControl.cpp) it opens, with BEACON_PERM_OPEN
+  uint32_t last_seen_ms;
+  bool in_use;
+} BEACONENTRY;
+
+uint8_t lookupBeaconAdvert(const uint8_t *payload, size_t payloadLen, const uint8_t *mac, uint8_t macType);
+uint8_t addBeacon(const char *name, int8_t openThreshold, uint8_t permissions);
+bool removeBeacon(uint8_t index);
+bool setBeaconPermissions(uint8_t index, uint8_t permissions);
+bool setBeaconThreshold(uint8_t index, int8_t openThreshold);
+bool setBeaconDoors(uint8_t index, uint8_t doors);
+BEACONENTRY *getBeacon(uint8_t index);
+uint8_t getBeaconCount();
+bool beaconAddressesKnown();
+uint8_t getStableBeaconAddresses(uint8_t (*macs)[BLE_MAC_LEN], uint8_t *macTypes, uint8_t max);
+uint32_t getRegistryGeneration();
+void loadBeaconRegistry();
+void saveBeaconRegistry();
@@ -0,0 +1,17 @@
+#pragma once
+#include <Arduino.h>
+#include "scanScheduler.hpp"
+
+#define SCAN_WHITELIST_MAX 8 // Accept list entries used, the ESP32 controller holds 12
+#define SCAN_UNFILTERED_EVERY 30 // With the filter on every Nth window still hears everything, catching a beacon whose address changed
+
+#ifndef SCAN_CONTROLLER_FILTER
+#define SCAN_CONTROLLER_FILTER 1 // Default for the accept list filter, can also be switched at runtime from the web page
+#endif
+
+void initBLEScanner(QueueHandle_t detectionQueue, void (*windowComplete)());
+bool startScanWindow(const SCANPROFILE *profile, uint32_t durationS);
+void stopScanWindow();
+void setScanFilterEnabled(bool enabled);
+bool getScanFilterEnabled();
+bool scanWindowFiltered();
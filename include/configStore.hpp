@@ -0,0 +1,44 @@
+#pragma once
+#include <Arduino.h>
+
+#define CONFIG_MAGIC 0x444F4F52 // "DOOR"
+#define CONFIG_VERSION 1
+#define EEPROM_SIZE 2048 // Flash the EEPROM emulation sets aside, the store has all of it
+
+// Record IDs, each has a fixed slot in the store
+typedef enum {
+  config_wifi_ssid = 0x00,
+  config_wifi_password,
+  config_dog_name,
+  config_beacon_registry,
+  config_door_schedule,
+  config_mqtt_broker, // Appended last so stores written before it keep their layout
+  config_record_count
+} CONFIGRECORD;
+
+// Storage the config store sits on, e.g. ESP32 EEPROM emulation or a RAM/file image on Linux
+typedef struct {
+  bool (*read)(uint32_t addr, uint8_t *data, uint16_t len);
+  bool (*write)(uint32_t addr, const uint8_t *data, uint16_t len);
+  bool (*commit)(); // Makes everything written so far persistent, the expensive part
+  uint32_t size;
+} CONFIGBACKEND;
+
+// Counters for judging flash wear
+typedef struct {
+  uint32_t commits;
+  uint32_t bytes_written;
+  uint32_t writes_skipped; // Writes that matched what was already stored
+} CONFIGSTATS;
+
+bool configBegin(const CONFIGBACKEND *backend);
+int32_t configRead(CONFIGRECORD record, void *data, uint16_t capacity);
+bool configWrite(CONFIGRECORD record, const void *data, uint16_t len);
+bool configReadString(CONFIGRECORD record, char *str, uint16_t capacity);
+bool configWriteString(CONFIGRECORD record, const char *str);
+bool configCommit();
+void configErase(CONFIGRECORD record);
+uint16_t configCapacity(CONFIGRECORD record);
+CONFIGSTATS getConfigStats();
+
+extern const CONFIGBACKEND memoryConfigBackend;
@@ -0,0 +1,92 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+#define DOOR_MAX 4 // Doors one board can drive, each has a bit in a door mask
+#define DOOR_ALL 0xFF // Door mask for every door
+#define DOOR_NO_PIN 0xFF
+#define LOCKOUT_SWITCH_LOCKED 0 // Switch is closed
+#define LOCKOUT_SWITCH_UNLOCKED 1 // Switch is open
+#define LOCKOUT_DEBOUNCE_MS 30 // Switch level is read once it has been quiet this long
+
+#define DOOR_EVENT_QUEUE_LEN 16
+#define DOOR_MAX_WAIT_MS 3600000 // Longest single sleep of the door task, keeps the wait inside a tick count
+
+// What a door can be locked by, it ignores the others
+#define DOOR_LOCK_BY_SWITCH 0x01 // Its own lockout switch
+#define DOOR_LOCK_BY_WEB 0x02
+#define DOOR_LOCK_BY_SCHEDULE 0x04 // Curfews and timed locks
+
+// One door the board drives, the rows are in doorControl.cpp
+typedef struct {
+  const char *name;
+  uint8_t relay_pin;
+  uint8_t switch_pin; // Lockout switch, DOOR_NO_PIN if it hasn't got one
+  uint32_t open_time_ms; // 0 to use the open time passed to initDoorControl()
+  uint8_t lock_sources;
+} DOORSPEC;
+
+typedef enum {
+  door_closed = 0x00,
+  door_open = 0x01
+} DOORSTATUS;
+
+typedef enum {
+  door_unlocked = 0x00,
+  door_locked_wifi,
+  door_locked_switch,
+  door_locked_both
+} DOORLOCKSTATE;
+
+typedef enum {
+  door_event_switch_locked = 0x00, // Debounced lockout switch level
+  door_event_switch_unlocked,
+  door_event_ble_approach, // A permitted beacon decided the door should open
+  door_event_web_open,
+  door_event_web_lock,
+  door_event_web_unlock,
+  door_event_timeout, // Door has been open for its open time
+  door_event_switch_edge, // Raw edge from the ISR, only used to start the debounce
+  door_event_schedule_lock, // A curfew or timed lock started, locks as the web page would
+  door_event_schedule_unlock, // ...and ended, only sent if that lock is still the one in place
+  door_event_timed_lock, // Lock for detail minutes from the web page, 0 ends it early
+  door_event_schedule_changed // Curfews or the wall clock changed, the door task re-plans its timers
+} DOOREVENTTYPE;
+
+typedef struct {
+  DOOREVENTTYPE type;
+  uint32_t timestamp_us; // When the cause happened, used for open latency
+  uint8_t detail; // e.g. which beacon, recorded in the journal
+  uint8_t doors; // Bit per door it is for
+} DOOREVENT;
+
+typedef enum {
+  door_action_none = 0x00,
+  door_action_energise, // Relay on, door may be pushed open
+  door_action_release
+} DOORACTION;
+
+typedef struct {
+  DOORSTATUS status;
+  DOORLOCKSTATE lock;
+} DOORSTATE;
+
+// Pure transition function, no hardware or time, so every (state, event) pair can be checked off the board
+DOORACTION applyDoorEvent(DOORSTATE *state, DOOREVENTTYPE event);
+
+void initDoorControl(uint32_t openTimeMs);
+void handle_door_lock( void * parameter );
+uint32_t serviceDoorControl(uint32_t maxWaitMs);
+bool postDoorEvent(DOOREVENTTYPE type, uint32_t timestamp_us, uint8_t detail = 0, uint8_t doors = DOOR_ALL);
+void setUnlockCycles(uint32_t cycles);
+uint8_t getDoorCount();
+const DOORSPEC *getDoorSpec(uint8_t door);
+
+// Published by the door task, safe to read from any task
+DOORSTATUS getDoorStatus(uint8_t door);
+DOORLOCKSTATE getDoorLockState(uint8_t door);
+uint8_t getOpenableDoors();
+uint32_t getUnlockCycles();
+uint32_t getLastOpenLatency();
+uint32_t getMaxOpenLatency();
+uint32_t getLastOpenTime();
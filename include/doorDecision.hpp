@@ -0,0 +1,16 @@
+#pragma once
+#include <Arduino.h>
+#include "rssiFilter.hpp"
+
+// A single sighting of a registered beacon, handed from the BLE callback to loop()
+typedef struct {
+  int rssi;
+  uint32_t timestamp_us; // micros() when the advert was received
+  uint32_t timestamp_ms; // millis() when the advert was received
+  uint8_t beacon_index; // Entry in the beacon registry
+} BEACONDETECTION;
+
+// Shared by the firmware and the simulator so both take exactly the same path from advert to door event
+bool detectBeaconAdvert(const uint8_t *payload, size_t payloadLen, const uint8_t *mac, uint8_t macType, int rssi, BEACONDETECTION *detection);
+RSSIDECISION handleBeaconDetection(const BEACONDETECTION *detection, int openThreshold, int approachRate);
+bool calibrateBeaconThresholds(uint32_t now_ms, int openThreshold);
@@ -0,0 +1,33 @@
+#pragma once
+#include <Arduino.h>
+
+#define SCHEDULE_MAX_CURFEWS 4
+#define SCHEDULE_MINUTES_PER_DAY 1440
+#define SCHEDULE_BLOB_LEN (3 + SCHEDULE_MAX_CURFEWS * 4) // Count, UTC offset, then start/end of each curfew
+#define SCHEDULE_NTP_SERVER "pool.ntp.org"
+#define TIMED_LOCK_MAX_MIN 255 // Longest /lock/for, it travels in the door event's detail byte
+
+// Door is locked every day from start to end, in minutes after local midnight, an end before the start runs overnight
+typedef struct {
+  uint16_t start_min;
+  uint16_t end_min;
+} CURFEW;
+
+typedef struct {
+  uint8_t count;
+  int16_t utc_offset_min; // Local time minus UTC, the page sends the browser's so curfews follow the household's clock
+  CURFEW curfews[SCHEDULE_MAX_CURFEWS];
+} DOORSCHEDULE;
+
+// Pure, no clock of its own, so it can be checked off the board
+bool curfewActive(const DOORSCHEDULE *schedule, uint64_t wall_ms, uint64_t *change_ms);
+
+void setWallClock(uint64_t epoch_ms);
+bool getWallClock(uint64_t uptime_ms, uint64_t *wall_ms);
+
+// Edits are saved and passed to the door task straight away
+bool addCurfew(uint16_t startMin, uint16_t endMin);
+bool removeCurfew(uint8_t index);
+void setScheduleUtcOffset(int16_t offsetMin);
+DOORSCHEDULE getDoorSchedule();
+void loadDoorSchedule();
@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+
+/* Build-time profiles, pick one with e.g. build_flags = -DDOOR_PROFILE=door_profile_low_power
+  * Scan timing and the open time are fixed by the profile. The open threshold and approach rate start from it and
+  * can be tuned at runtime, unless the build also sets -DDOOR_TUNING_FIXED to fold them into the decision path too.
+*/
+typedef enum {
+  door_profile_balanced = 0x00,
+  door_profile_low_latency,
+  door_profile_low_power,
+  door_profile_crowded_rf,
+  door_profile_count
+} DOORPROFILEID;
+
+typedef struct {
+  const char *name;
+  uint8_t scan_duration_s; // Length of each scan window, scanning restarts as soon as one ends
+  uint16_t scan_interval_ms; // Most loop() sleeps if a window's end never arrives, or after a scan failed to start
+  uint16_t open_time_s; // How long the door stays open
+  int8_t open_threshold; // Filtered RSSI at which the door opens
+  uint8_t approach_rate; // Rise in dB/s near the threshold that opens the door early
+} DOORPROFILE;
+
+static constexpr DOORPROFILE doorProfiles[door_profile_count] = {
+    // name,          scan_s, interval_ms, open_s, threshold, approach
+    { "balanced",     1,      2000,        10,     -78,       5 },
+    { "low-latency",  1,      500,         12,     -82,       4 }, // Opens from further out, and earlier on an approach
+    { "low-power",    3,      5000,        10,     -76,       6 }, // A third of the scan restarts, the dog has to come closer
+    { "crowded-rf",   1,      2000,        8,      -72,       8 } // Other devices' adverts swamp the channel, wants a clearer signal and approach
+};
+
+#ifndef DOOR_PROFILE
+#define DOOR_PROFILE door_profile_balanced
+#endif
+
+static constexpr DOORPROFILE doorProfile = doorProfiles[DOOR_PROFILE];
+
+// What can change while running, read by the decision path for every detection
+typedef struct {
+  int8_t open_threshold;
+  uint8_t approach_rate;
+} DOORTUNING;
+
+#ifdef DOOR_TUNING_FIXED
+// Specialised build, the decision path sees compile-time constants
+constexpr DOORTUNING getTuning() {
+    return DOORTUNING { doorProfile.open_threshold, doorProfile.approach_rate };
+}
+#else
+DOORTUNING getTuning();
+#endif
+bool setTuning(DOORTUNING tuning);
+uint32_t getTuningVersion();
+bool tuningFixed();
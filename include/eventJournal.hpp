@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+
+#define JOURNAL_PARTITION_LABEL "journal"
+#define JOURNAL_PARTITION_SUBTYPE 0x40
+#define JOURNAL_SECTOR_SIZE 4096
+#define JOURNAL_STAGING_LEN 32 // Records buffered in RAM between flash writes
+#define JOURNAL_FLUSH_THRESHOLD 16 // Flush early once this many records are waiting
+#define JOURNAL_FLUSH_MS 30000 // Otherwise flush at least this often
+#define JOURNAL_CHUNK_RECORDS 128 // Records per HTTP chunk
+
+typedef enum {
+  journal_boot = 0x00,
+  journal_door_open,
+  journal_door_close,
+  journal_lock,
+  journal_unlock,
+  journal_task_restart // detail is the TASKID, see taskTable.hpp
+} JOURNALEVENT;
+
+typedef enum {
+  journal_src_system = 0x00,
+  journal_src_beacon,
+  journal_src_web,
+  journal_src_switch,
+  journal_src_timeout,
+  journal_src_schedule // Curfew or a timed lock
+} JOURNALSOURCE;
+#define JOURNAL_DOOR_SHIFT 5 // Door events carry the door in the top bits of source, 0 is the first door
+#define JOURNAL_SOURCE_MASK 0x1F
+
+/* Fixed size record, 256 to a flash sector
+  * A record lives in slot (sequence % capacity), so position and sequence never disagree
+*/
+typedef struct {
+  uint32_t sequence;
+  uint32_t uptime_ms;
+  uint32_t unlock_cycles; // Running count at the time, restores the counter after a reboot
+  uint8_t type;
+  uint8_t source;
+  uint8_t detail; // e.g. beacon registry index
+  uint8_t crc; // CRC-8 of the preceding bytes, never 0xFF so a torn write fails this
+} JOURNALRECORD;
+
+bool initJournal();
+bool journalAppend(JOURNALEVENT type, JOURNALSOURCE source, uint8_t detail, uint32_t unlockCycles);
+uint32_t journalRecoveredUnlockCycles();
+uint32_t journalNextSequence();
+uint32_t journalDropCount();
+uint16_t journalReadChunk(uint32_t fromSequence, JOURNALRECORD *records, uint16_t maxRecords, uint32_t *nextSequence);
@@ -0,0 +1,67 @@
+#pragma once
+#include <Arduino.h>
+
+#define HTTP_MAX_REQUEST_LINE 320 // Longest "GET <target> HTTP/1.1", a longer one gets a 414 before the rest arrives
+#define HTTP_MAX_HEADER_LINE 512 // Longest single header line
+#define HTTP_MAX_HEADERS 32
+
+typedef enum {
+  http_get = 0x00,
+  http_head,
+  http_post,
+  http_method_other // Parsed, but no route takes it
+} HTTPMETHOD;
+
+typedef enum {
+  http_parse_incomplete = 0x00, // Needs more bytes
+  http_parse_done,
+  http_parse_error // parser->error holds the status to answer with, the connection can't be trusted after it
+} HTTPPARSESTATUS;
+
+typedef enum {
+  http_line_request = 0x00,
+  http_line_header
+} HTTPLINE;
+
+/* Incremental parser state for one connection, nothing is copied
+  * Resumes where the last call stopped, so a head that trickles in a byte at a time is scanned once
+*/
+typedef struct {
+  HTTPLINE line;
+  uint16_t pos; // Bytes of the buffer already scanned
+  uint16_t line_start;
+  uint16_t headers;
+  uint16_t error;
+  HTTPMETHOD method;
+  uint16_t path_start;
+  uint16_t path_len;
+  uint16_t query_start;
+  uint16_t query_len;
+  uint16_t etag_start; // If-None-Match value
+  uint16_t etag_len;
+  bool accepts_gzip;
+  bool keep_alive;
+} HTTPPARSER;
+
+// Views into the connection's request buffer, valid until the handler returns
+typedef struct {
+  HTTPMETHOD method;
+  const char *path;
+  uint16_t path_len;
+  const char *query; // After the '?', not decoded
+  uint16_t query_len;
+  const char *if_none_match;
+  uint16_t if_none_match_len;
+  bool accepts_gzip; // Accept-Encoding lists gzip (or *) without q=0, false if the header is missing
+  bool keep_alive;
+} HTTPREQUEST;
+
+// FNV-1a, constexpr so route tables hash their paths at compile time
+constexpr uint32_t httpPathHash(const char *path, uint32_t hash = 2166136261u) {
+    return *path == '\0' ? hash : httpPathHash(path + 1, (hash ^ (uint8_t) *path) * 16777619u);
+}
+
+uint32_t hashRequestPath(const HTTPREQUEST *request);
+void resetHttpParser(HTTPPARSER *parser);
+HTTPPARSESTATUS parseHttpRequest(HTTPPARSER *parser, const char *buf, uint16_t len, HTTPREQUEST *request);
+bool getQueryParam(const HTTPREQUEST *request, const char *name, char *value, size_t valueLen);
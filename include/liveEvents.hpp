@@ -0,0 +1,29 @@
+#pragma once
+#include <Arduino.h>
+#include "webServer.hpp"
+
+#ifndef LIVE_EVENT_INTERVAL_MS
+#define LIVE_EVENT_INTERVAL_MS 250 // Changes are coalesced and pushed to viewers at most this often
+#endif
+#define LIVE_EVENT_INTERVAL_MIN_MS 50
+#define LIVE_EVENT_INTERVAL_MAX_MS 5000
+#define LIVE_EVENT_RETRY_MS 2000 // How long a browser waits before reconnecting a dropped stream
+
+// Latest sample from one beacon, overwritten by each new one until it has been pushed
+typedef struct {
+  int8_t rssi;
+  int8_t filtered;
+  uint32_t heard_ms; // 0 if never heard
+} LIVESAMPLE;
+
+typedef void (*LIVESTATERENDERER)(WEBRESPONSE *event);
+
+// Producers, cheap enough for the detection path: a copy and a flag under a spinlock, no formatting
+void publishRssiSample(uint8_t beaconIndex, int rssi, int filtered, uint32_t heardMs);
+void publishStateChange();
+
+// Consumers, run in the web server task
+void initLiveEvents(LIVESTATERENDERER renderState);
+void renderLiveEvents(WEBRESPONSE *event);
+void renderLiveCatchUp(WEBRESPONSE *event);
+void renderLiveSnapshot(WEBRESPONSE *response);
@@ -0,0 +1,66 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Records above this level are compiled out entirely, override with -DLOG_LEVEL=... in build_flags
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_LEN 64 // Power of two
+#define LOG_MAX_ARGS 4
+#define LOG_LINE_LEN 160
+#define LOG_DRAIN_INTERVAL_MS 20
+
+/* Binary record, formatted later by the drain task
+  * Args are stored as raw words so only integers and pointers to strings that outlive
+  * the record (literals, registry names) may be logged
+*/
+typedef struct {
+  uint32_t timestamp_ms;
+  const char *format;
+  uintptr_t args[LOG_MAX_ARGS];
+  uint8_t level;
+} LOGRECORD;
+
+bool pushLogRecord(uint8_t level, const char *format, const uintptr_t *args, uint8_t argCount);
+uint32_t getLogDropCount();
+void initLogger();
+
+// Packs each argument into a word so the call site costs a few stores and one atomic
+template<typename... Args>
+inline void logRecord(uint8_t level, const char *format, Args... args) {
+  uintptr_t packed[] = { 0, (uintptr_t) args... };
+  static_assert(sizeof...(args) <= LOG_MAX_ARGS, "Too many log arguments");
+  pushLogRecord(level, format, packed + 1, sizeof...(args));
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logRecord(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logRecord(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logRecord(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logRecord(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include "webServer.hpp"
+
+#define METRIC_MAX_BUCKETS 10
+
+// Fixed bucket histogram, observing is a short bucket search and three relaxed atomic adds
+// Sum is 32 bit and will wrap, Prometheus treats that like a counter reset
+typedef struct {
+  const char *name;
+  const char *help;
+  const uint32_t *bounds; // Upper bound of each bucket, ascending
+  uint8_t bucket_count;
+  std::atomic<uint32_t> buckets[METRIC_MAX_BUCKETS + 1]; // Last one is +Inf
+  std::atomic<uint32_t> sum;
+  std::atomic<uint32_t> count;
+} METRICHISTOGRAM;
+
+// Points in the boot, each recorded once as ms since reset
+typedef enum {
+  boot_first_scan = 0x00, // BLE scanning started
+  boot_door_ready, // Scanning with a beacon registered, the first moment the door could open for a dog
+  boot_wifi_connected,
+  boot_milestone_count
+} BOOTMILESTONE;
+
+void observeHistogram(METRICHISTOGRAM *histogram, uint32_t value);
+
+void recordScanCycle(uint32_t ms);
+void recordOpenLatency(uint32_t us);
+void recordDoorEventWait(uint32_t us);
+void recordHttpHandling(uint32_t us);
+void recordHttpParse(uint32_t us, bool complete);
+void recordHttpRejected(uint16_t status);
+void countAdvert(bool matched);
+void recordScanWindow(uint32_t hostUs, uint32_t adverts, bool filtered, uint32_t heapBefore, uint32_t heapAfter, uint32_t heapMinFree);
+void recordLiveEventDelay(uint32_t ms);
+void recordTelemetryDelay(uint32_t ms);
+void recordEventFanout(uint32_t renderUs, uint32_t sendUs, uint8_t delivered, uint8_t skipped);
+void recordBootMilestone(BOOTMILESTONE milestone);
+void renderMetrics(WEBRESPONSE *response);
@@ -0,0 +1,33 @@
+#pragma once
+#include <Arduino.h>
+
+#define MQTT_DEFAULT_PORT 1883
+#define MQTT_KEEPALIVE_S 30 // A ping goes out after half of this without other traffic
+#define MQTT_PACKET_MAX 1280 // Largest packet sent or received, a full telemetry message and its topic fit
+#define MQTT_CONNECT_TIMEOUT_MS 5000 // For the TCP connect and again for the CONNACK
+#define MQTT_SEND_TIMEOUT_MS 2000 // A send blocked this long means the broker has gone, the connection is dropped
+
+// Called from mqttPoll() for each message on a subscribed topic, neither string is terminated
+typedef void (*MQTTMESSAGEHANDLER)(const char *topic, uint16_t topicLen, const uint8_t *payload, size_t payloadLen);
+
+/* Minimal MQTT 3.1.1 client, QoS 0 only, over an lwIP socket
+  * Built for one task to own: sends block for at most MQTT_SEND_TIMEOUT_MS and nothing else waits on them
+*/
+typedef struct {
+  int fd; // -1 while disconnected
+  uint32_t last_sent_ms; // For keepalive pings
+  uint32_t ping_sent_ms; // 0 when no ping is outstanding
+  uint16_t next_packet_id;
+  MQTTMESSAGEHANDLER on_message;
+  uint8_t rx[MQTT_PACKET_MAX];
+  size_t rx_len;
+  uint8_t tx[MQTT_PACKET_MAX];
+} MQTTCLIENT;
+
+void initMqttClient(MQTTCLIENT *client, MQTTMESSAGEHANDLER onMessage);
+bool mqttConnect(MQTTCLIENT *client, const char *host, uint16_t port, const char *clientId, const char *willTopic, const char *willMessage);
+bool mqttConnected(const MQTTCLIENT *client);
+bool mqttSubscribe(MQTTCLIENT *client, const char *topicFilter);
+bool mqttPublish(MQTTCLIENT *client, const char *topic, const char *payload, size_t len, bool retain);
+bool mqttPoll(MQTTCLIENT *client, uint32_t waitMs);
+void mqttDisconnect(MQTTCLIENT *client);
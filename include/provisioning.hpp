@@ -0,0 +1,26 @@
+#pragma once
+#include <Arduino.h>
+
+#define PROVISIONING_POLL_MS 100 // Serial and WiFi are both checked this often
+#define PROVISIONING_PROMPT_MS 5000 // How long a "change this?" prompt waits for an answer
+#define PROVISIONING_LINE_LEN 101 // Longest line read from serial, fits a beacon name
+#define WIFI_CREDENTIAL_LEN 65
+#define WIFI_CONNECT_TIMEOUT_MS 15000 // An attempt that hasn't associated by now is abandoned
+#define WIFI_BACKOFF_MIN_MS 1000 // Delay before the first retry, doubled after each failure
+#define WIFI_BACKOFF_MAX_MS 60000
+
+typedef enum {
+  wifi_unconfigured = 0x00, // No credentials yet, waiting on serial provisioning
+  wifi_waiting, // Backing off before the next attempt
+  wifi_connecting,
+  wifi_connected
+} WIFISTATE;
+
+/* Runs on separate core
+  * Serial prompts for the beacon name and WiFi credentials, then keeps WiFi connected,
+  * so none of it holds up BLE detection or the door at boot
+*/
+void handle_provisioning( void * parameter );
+
+WIFISTATE getWiFiState();
+uint32_t getWiFiReconnects();
@@ -0,0 +1,44 @@
+#pragma once
+#include <Arduino.h>
+#include "beaconMatcher.hpp"
+#include "webServer.hpp"
+
+#define CAPTURE_PARTITION_LABEL "rssitrace"
+#define CAPTURE_PARTITION_SUBTYPE 0x41
+#define CAPTURE_SECTOR_SIZE 4096
+#define CAPTURE_BUFFER_RECORDS (CAPTURE_SECTOR_SIZE / sizeof(CAPTURERECORD)) // Each half of the double buffer fills one sector
+#define CAPTURE_CHUNK_RECORDS 256 // Records per HTTP chunk
+#define CAPTURE_CHANNEL_UNKNOWN 0xFF
+#define CAPTURE_FLAG_NAME 0x01 // The advert (or scan response) carried the beacon's name
+
+/* One matched advert, 256 to a flash sector
+  * Records are written from the start of the partition in order, the first erased slot ends the capture
+*/
+typedef struct {
+  uint32_t offset_ms; // Since the capture started
+  uint8_t mac[BLE_MAC_LEN];
+  uint8_t mac_type;
+  uint8_t beacon_index; // Registry entry it matched, 0xFF only in an erased slot
+  int8_t rssi;
+  uint8_t channel; // Advertising channel, CAPTURE_CHANNEL_UNKNOWN as the ESP32 scan results don't report it
+  uint8_t flags;
+  uint8_t reserved;
+} CAPTURERECORD;
+
+typedef struct {
+  bool active;
+  bool full; // Stopped itself when the partition filled up
+  bool writing; // A full buffer, or what was left at the stop, is still going to flash
+  uint32_t records; // Written to flash, the ones still in RAM are added as each buffer fills
+  uint32_t capacity;
+  uint32_t dropped; // Arrived while both buffers were full
+} CAPTURESTATUS;
+
+bool initRssiCapture();
+bool startRssiCapture();
+void stopRssiCapture();
+void captureAdvert(const uint8_t *payload, size_t payloadLen, const uint8_t *mac, uint8_t macType, int rssi, uint8_t beaconIndex);
+CAPTURESTATUS getCaptureStatus();
+uint16_t captureReadChunk(uint32_t from, CAPTURERECORD *records, uint16_t maxRecords, uint32_t *next);
+void renderCaptureStatus(WEBRESPONSE *response);
+void renderCaptureChunk(const HTTPREQUEST *request, WEBRESPONSE *response);
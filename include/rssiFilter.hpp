@@ -0,0 +1,40 @@
+#pragma once
+#include <Arduino.h>
+
+#define RSSI_HISTORY_LEN 16 // Samples kept per beacon
+#define RSSI_FIXED_SHIFT 8 // Filter state is held in Q8 fixed point
+#define RSSI_FILTER_ALPHA 96 // Q8 gain applied to the level (~0.375)
+#define RSSI_FILTER_BETA 16 // Q8 gain applied to the velocity (~0.06)
+#define RSSI_SPIKE_LIMIT 8 // dB, residuals beyond this are clamped so a single spike can't open the door
+#define RSSI_STALE_MS 3000 // Gap after which the filter restarts from the next sample
+#define RSSI_MIN_DT_MS 50 // Lower bound on sample spacing used for the velocity update
+#define RSSI_CONFIDENCE_WINDOW_MS 2000 // Window in which RSSI_MIN_SAMPLES must have been heard
+#define RSSI_MIN_SAMPLES 3
+#define RSSI_APPROACH_MARGIN 6 // dB below the open threshold at which a confident approach may pre-open
+
+typedef struct {
+  int8_t rssi;
+  uint32_t timestamp_ms;
+} RSSISAMPLE;
+
+// Per-beacon ring buffer of samples plus alpha-beta (steady state Kalman) filter state
+typedef struct {
+  RSSISAMPLE samples[RSSI_HISTORY_LEN];
+  uint8_t head; // Next slot to be written
+  uint8_t count;
+  int32_t level_q8; // Filtered RSSI in dBm
+  int32_t velocity_q8; // Rate of change of RSSI in dB/s, positive when approaching
+} RSSIFILTER;
+
+typedef enum {
+  rssi_hold = 0x00,
+  rssi_open_near, // Filtered level is above the open threshold
+  rssi_open_approach // Close to the threshold and approaching fast enough to pre-open
+} RSSIDECISION;
+
+void resetRSSIFilter(RSSIFILTER *filter);
+void updateRSSIFilter(RSSIFILTER *filter, int rssi, uint32_t timestamp_ms);
+int getFilteredRSSI(const RSSIFILTER *filter);
+int getRSSIVelocity(const RSSIFILTER *filter);
+uint8_t countRecentRSSISamples(const RSSIFILTER *filter, uint32_t now_ms, uint32_t window_ms);
+RSSIDECISION evaluateRSSIFilter(const RSSIFILTER *filter, uint32_t now_ms, int openThreshold, int approachVelocity);
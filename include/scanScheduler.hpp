@@ -0,0 +1,40 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+#define SCAN_ALERT_HOLD_MS 120000 // Stay on aggressive scanning this long after a registered beacon was last near
+#define SCAN_ALERT_MARGIN_DB 12 // A beacon within this much of its open threshold counts as near, e.g. the dog asleep across the house doesn't
+
+// Rough figures from the ESP32 datasheet, only meant for comparing profiles against each other
+#define SCAN_MODEL_RADIO_RX_MA 70 // Extra current while the radio is listening
+#define SCAN_MODEL_ACTIVE_MA 3 // Scan requests sent during active scanning
+#define SCAN_MODEL_CPU_MA_PER_MHZ_X100 16 // CPU current above 80MHz, per MHz, in hundredths of a mA
+#define SCAN_MODEL_BASE_MA 25 // Everything else with the CPU at 80MHz, the lowest the radio allows
+
+typedef enum {
+  scan_mode_idle = 0x00, // No beacon around, passive and low duty
+  scan_mode_idle_active, // As idle, but actively scanning until every beacon's address is known
+  scan_mode_alert, // A beacon has been heard recently, scan as fast as possible
+  scan_mode_count
+} SCANMODE;
+
+typedef struct {
+  bool active; // Active scans ask for the scan response, which is where some beacons put their name
+  uint16_t interval_ms;
+  uint16_t window_ms; // Listening time per interval, at most interval_ms
+  uint32_t cpu_mhz;
+} SCANPROFILE;
+
+void initScanScheduler(bool adaptive, uint32_t now_ms);
+void noteBeaconHeard(uint32_t now_ms, int filteredRSSI, int openThreshold);
+void updateScanScheduler(uint32_t now_ms);
+SCANMODE getScanMode();
+const SCANPROFILE *getScanProfile(SCANMODE mode);
+uint32_t getScanModeTime(SCANMODE mode, uint32_t now_ms);
+
+// Energy model
+uint32_t scanProfileCurrent_uA(const SCANPROFILE *profile);
+uint64_t scanEnergy_uAms(uint32_t now_ms);
+
+// Whether an advert at now_ms lands in a scan window, given when the current scan was started
+bool scanProfileHears(const SCANPROFILE *profile, uint32_t windowStart_ms, uint32_t now_ms);
@@ -0,0 +1,46 @@
+#pragma once
+#include <Arduino.h>
+#include "webServer.hpp"
+
+#define TASK_CHECKIN_MS 1000 // Supervised tasks wake at least this often to check in
+#define TASK_SUPERVISOR_PERIOD_MS 500
+#define TASK_REPORT_MAX 32 // Tasks in the CPU report, WiFi and Bluetooth bring around 20 of their own
+
+typedef enum {
+  task_door = 0x00,
+  task_web,
+  task_provisioning,
+  task_journal,
+  task_log,
+  task_capture,
+  task_mqtt,
+  task_supervisor,
+  task_loop, // Created by the Arduino core, listed so it is reported with the rest
+  task_count
+} TASKID;
+
+// Everything that decides where and how a subsystem runs, one row per task in taskTable.cpp
+typedef struct {
+  const char *name;
+  uint32_t stack_bytes; // ESP-IDF counts task stacks in bytes, not words like stock FreeRTOS
+  UBaseType_t priority;
+  BaseType_t core;
+  uint32_t watchdog_ms; // Restarted if it goes this long without checking in, 0 if it isn't supervised
+} TASKSPEC;
+
+/* Supervised tasks (a watchdog_ms in their row) end themselves in taskCheckIn() when the supervisor asks, so:
+  *  - check in only where nothing is held, at the top of the task's loop
+  *  - take the mutexes, the config store's storeLock (through configRead/Write/Commit and the saves that use
+  *    them) and the registry's blobLock (through saveBeaconRegistry(), before storeLock), only between
+  *    check-ins, each is given back before the call that took it returns
+  *  - keep whatever must survive a restart in module statics, not on the stack
+  * A task that can't get back to a check-in within a second watchdog_ms reboots the board.
+*/
+
+TaskHandle_t startTask(TASKID id, TaskFunction_t function);
+void adoptTask(TASKID id);
+void taskCheckIn(TASKID id);
+void handle_task_supervisor(void *parameter);
+uint32_t getTaskRestarts(TASKID id);
+void renderTaskMetrics(WEBRESPONSE *response);
+void renderTaskReport(WEBRESPONSE *response);
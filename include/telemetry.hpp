@@ -0,0 +1,52 @@
+#pragma once
+#include <Arduino.h>
+#include "doorControl.hpp"
+#include "webServer.hpp"
+
+#define TELEMETRY_TOPIC_PREFIX "dogdoor"
+#define TELEMETRY_BROKER_LEN 64 // "host:port", stored as config_mqtt_broker
+#define TELEMETRY_EVENT_RING 64 // State changes waiting to be sent, the oldest is dropped when full
+#define TELEMETRY_OUTBOX_LEN 8 // Rendered messages held while the broker is away, the oldest is dropped when full
+#define TELEMETRY_MESSAGE_LEN 1024
+#define TELEMETRY_POLL_MS 50 // Longest the task sleeps in the socket while connected, so new events wait at most this long to be batched
+#define TELEMETRY_BATCH_MS 100 // Events this close together go out as one message
+#ifndef TELEMETRY_SUMMARY_MS
+#define TELEMETRY_SUMMARY_MS 60000 // RSSI and health summary period
+#endif
+#define TELEMETRY_PRESENCE_TIMEOUT_MS 30000 // A beacon unheard this long is reported away
+#define TELEMETRY_RECONNECT_MIN_MS 1000 // Reconnect backoff doubles from here after each failure...
+#define TELEMETRY_RECONNECT_MAX_MS 60000 // ...up to here
+
+typedef enum {
+  telemetry_door = 0x00, // value is the DOORSTATUS, detail the DOORLOCKSTATE
+  telemetry_presence // value is 1 when the beacon arrived, 0 when it went away
+} TELEMETRYEVENTTYPE;
+
+// One state change, copied into the ring by the producer, nothing is formatted until the telemetry task sends it
+typedef struct {
+  uint32_t ms;
+  uint8_t type; // TELEMETRYEVENTTYPE
+  uint8_t subject; // Door or beacon index
+  uint8_t value;
+  uint8_t detail;
+} TELEMETRYEVENT;
+
+typedef struct {
+  bool configured;
+  bool connected;
+  uint32_t connects;
+  uint32_t messages_sent;
+  uint32_t messages_dropped; // Outbox overflowed while the broker was away
+  uint32_t events_dropped; // Event ring overflowed before the task could batch it
+  uint32_t commands; // Accepted by the door task's queue
+} TELEMETRYSTATS;
+
+// Producers, a flag check until telemetry has been started and a short copy under a spinlock after
+void telemetryDoorChanged(uint8_t door, DOORSTATUS status, DOORLOCKSTATE lock);
+void telemetryRssiSample(uint8_t beaconIndex, int rssi, uint32_t heardMs);
+
+void initTelemetry();
+bool setTelemetryBroker(const char *broker);
+void handle_telemetry(void *parameter);
+TELEMETRYSTATS getTelemetryStats();
+void renderTelemetryStatus(WEBRESPONSE *response);
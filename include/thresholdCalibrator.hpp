@@ -0,0 +1,42 @@
+#pragma once
+#include <Arduino.h>
+
+#define CALIBRATION_BINS 32
+#define CALIBRATION_BIN_DB 2
+#define CALIBRATION_RSSI_MIN -104 // Lower edge of the first bin, the last bin ends at -40
+#define CALIBRATION_VISIT_GAP_MS 10000 // A beacon not heard this long has left, ending its visit
+#define CALIBRATION_VISIT_MAX_MS 60000 // Long stays (e.g. asleep by the door) are counted a minute at a time
+#define CALIBRATION_PASSAGE_WINDOW_MS 20000 // After the door opens the signal must drop or vanish within this long to count as going through
+#define CALIBRATION_PASSAGE_DROP_DB 10 // Drop from the visit's peak that marks the dog on the other side of the door
+#define CALIBRATION_FALSE_OPEN_PERMILLE 5 // Target share of visits without a passage that would still open the door
+#define CALIBRATION_COVERAGE_PERMILLE 950 // Share of passages that must still reach the threshold, this wins over the false open target
+#define CALIBRATION_MIN_PASSAGES 20 // Data needed before a threshold is learnt
+#define CALIBRATION_MIN_NEARBY 60
+#define CALIBRATION_HISTORY_NEARBY 4000 // Histograms are halved past these totals, so old behaviour fades out
+#define CALIBRATION_HISTORY_PASSAGES 400
+#define CALIBRATION_UPDATE_MS 3600000 // Learnt thresholds are recomputed (and saved if changed) at most this often
+#define CALIBRATION_MAX_STEP_DB 2 // Largest change applied per update
+#define CALIBRATION_THRESHOLD_MIN -95
+#define CALIBRATION_THRESHOLD_MAX -50
+
+/* Per-beacon record of how strong the signal got on each visit, split by whether the dog went through the door
+  * A visit goes through when the door opened during it and the signal then dropped sharply or vanished
+*/
+typedef struct {
+  uint16_t nearby[CALIBRATION_BINS]; // Peak filtered RSSI of visits that didn't go through
+  uint16_t passed[CALIBRATION_BINS]; // Peak filtered RSSI of visits that did
+  uint16_t nearby_total;
+  uint16_t passed_total;
+  bool visiting;
+  bool opened; // Door opened during the current visit
+  int8_t peak;
+  uint32_t visit_start_ms;
+  uint32_t last_heard_ms;
+  uint32_t opened_ms;
+} BEACONCALIBRATION;
+
+void resetCalibration(BEACONCALIBRATION *calibration);
+void updateCalibration(BEACONCALIBRATION *calibration, int filteredRSSI, uint32_t now_ms, uint32_t lastOpen_ms);
+void serviceCalibration(BEACONCALIBRATION *calibration, uint32_t now_ms, uint32_t lastOpen_ms);
+int computeCalibratedThreshold(const BEACONCALIBRATION *calibration);
+uint16_t calibrationPassageCoverage(const BEACONCALIBRATION *calibration, int threshold);
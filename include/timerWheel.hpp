@@ -0,0 +1,48 @@
+#pragma once
+#include <Arduino.h>
+#include "esp_timer.h"
+
+#define TIMER_WHEEL_BITS 6 // Each level has 2^bits slots
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 6 // 1ms ticks, the top level spans about 795 days
+#define TIMER_NEVER UINT64_MAX
+
+typedef struct TIMERENTRY TIMERENTRY;
+typedef void (*TIMERCALLBACK)(TIMERENTRY *timer);
+
+// Intrusive, so arming never allocates, the owner keeps the entry (usually static) for as long as it is armed
+struct TIMERENTRY {
+  TIMERENTRY *next;
+  TIMERENTRY *prev;
+  uint64_t deadline_ms;
+  uint32_t period_ms; // Re-armed this far after each expiry, 0 for one-shot
+  TIMERCALLBACK callback;
+  uint8_t level;
+  uint8_t slot;
+  bool armed;
+};
+
+/* Hierarchical timing wheel on the 64 bit uptime
+  * A timer sits in the lowest level whose slot span still separates its deadline from now, and is moved
+  * down a level each time now reaches the start of its slot. Occupancy bitmaps let runTimers() jump
+  * straight past empty slots, so catching up after a long sleep costs nothing per idle tick.
+*/
+typedef struct {
+  uint64_t now_ms; // Everything due by here has fired
+  uint64_t occupied[TIMER_WHEEL_LEVELS]; // Bit per non-empty slot
+  TIMERENTRY *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  TIMERENTRY *overflow; // Beyond the top level, placed again as each of its spans starts
+  uint32_t armed;
+} TIMERWHEEL;
+
+// Milliseconds since boot, doesn't wrap for 584 million years unlike millis()
+static inline uint64_t uptimeMs() {
+    return (uint64_t) esp_timer_get_time() / 1000;
+}
+
+void initTimerWheel(TIMERWHEEL *wheel, uint64_t now_ms);
+void initTimer(TIMERENTRY *timer, TIMERCALLBACK callback);
+void armTimer(TIMERWHEEL *wheel, TIMERENTRY *timer, uint64_t deadline_ms, uint32_t period_ms = 0);
+void cancelTimer(TIMERWHEEL *wheel, TIMERENTRY *timer);
+uint64_t nextTimerTick(const TIMERWHEEL *wheel);
+uint32_t runTimers(TIMERWHEEL *wheel, uint64_t now_ms);
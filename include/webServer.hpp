@@ -0,0 +1,82 @@
+#pragma once
+#include <Arduino.h>
+#include "httpParser.hpp"
+
+#ifndef WEB_SERVER_PORT
+#define WEB_SERVER_PORT 80 // The native build listens on an unprivileged port instead
+#endif
+#define WEB_MAX_CONNECTIONS 4 // Concurrent clients, further connections are refused until one frees up
+#define WEB_REQUEST_BUF_LEN 1024 // Longest request head accepted, larger requests get a 431 (see httpParser.hpp for single lines)
+#define WEB_RESPONSE_BUF_LEN 8192 // Status line, headers and any dynamic body, /metrics is the largest
+#define WEB_HEADER_RESERVE 320 // Space kept ahead of the body so headers can be prepended without a copy
+#define WEB_IDLE_TIMEOUT_MS 5000 // Keep-alive connections idle this long are closed
+#define WEB_SELECT_TIMEOUT_MS 1000 // Longest the server sleeps without socket activity, bounds idle checks
+#define WEB_MAX_STREAMS 3 // Event stream viewers, one connection is always left for ordinary requests
+#define WEB_EVENT_BUF_LEN 1024 // Largest single push to the event streams
+#define WEB_STREAM_KEEPALIVE_MS 15000 // A comment is sent on quiet streams so proxies and browsers keep them open
+
+typedef enum {
+  conn_free = 0x00,
+  conn_reading, // Waiting for the end of a request head
+  conn_writing, // Response queued, waiting for the socket to accept it
+  conn_streaming // Event stream, events are pushed until the client goes away
+} CONNSTATE;
+
+typedef struct {
+  int fd;
+  CONNSTATE state;
+  char request[WEB_REQUEST_BUF_LEN];
+  uint16_t request_len;
+  HTTPPARSER parser; // Picks up where it left off as more of the head arrives
+  char response[WEB_RESPONSE_BUF_LEN] __attribute__((aligned(4))); // Aligned so handlers can place records in the body
+  uint16_t response_start; // Offset of the first header byte within response
+  uint16_t response_len;
+  const uint8_t *static_body; // Body sent straight from flash after the headers
+  uint32_t static_len;
+  uint32_t response_sent; // Counts across the headers and any static body
+  bool keep_alive;
+  bool event_stream; // Becomes conn_streaming once the response is written, response then holds any unsent event
+  bool event_owed; // Missed an event while behind, gets a catch-up rather than the next change once it has drained
+  uint32_t last_activity_ms;
+} WEBCONNECTION;
+
+// Filled in by the request handler, either body (rendered in place) or static_body is sent
+typedef struct {
+  uint16_t status;
+  const char *content_type;
+  const char *extra_headers; // Already formatted, each line ending in \r\n
+  char *body;
+  size_t body_cap;
+  size_t body_len;
+  const uint8_t *static_body;
+  size_t static_len;
+  bool event_stream; // Response (with no length) starts an event stream fed by the event source
+} WEBRESPONSE;
+
+typedef void (*WEBROUTEHANDLER)(const HTTPREQUEST *request, WEBRESPONSE *response);
+typedef void (*WEBEVENTSOURCE)(WEBRESPONSE *event); // Leaves event empty if there is nothing to push
+
+// One entry of a route table, build them with WEB_ROUTE so the path hash is worked out by the compiler
+typedef struct {
+  HTTPMETHOD method;
+  const char *path;
+  uint16_t path_len;
+  uint32_t path_hash;
+  const char *param; // Query parameter the handler can't do without, the request gets a 400 without it
+  WEBROUTEHANDLER handler;
+} WEBROUTE;
+
+#define WEB_ROUTE(method, path, param, handler) { method, path, sizeof(path) - 1, httpPathHash(path), param, handler }
+
+// For a static_assert on each table, a repeated method and path would shadow the later entry
+constexpr bool webRouteUniqueFrom(const WEBROUTE *routes, size_t count, size_t i, size_t j) {
+    return j >= count || ((routes[i].path_hash != routes[j].path_hash || routes[i].method != routes[j].method) && webRouteUniqueFrom(routes, count, i, j + 1));
+}
+
+constexpr bool webRoutesUnique(const WEBROUTE *routes, size_t count, size_t i = 0) {
+    return i >= count || (webRouteUniqueFrom(routes, count, i, i + 1) && webRoutesUnique(routes, count, i + 1));
+}
+
+void runWebServer(const WEBROUTE *routes, size_t count);
+void setWebEventSource(WEBEVENTSOURCE source, WEBEVENTSOURCE catchUp, uint32_t intervalMs);
+void appendResponse(WEBRESPONSE *response, const char *format, ...) __attribute__((format(printf, 2, 3)));
@@ -0,0 +1,59 @@
+#pragma once
+// Host stand-in for the parts of the Arduino-ESP32 core the door logic uses, see simHal.hpp
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define IRAM_ATTR
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Virtual clock, only moved by the simulator
+unsigned long millis();
+unsigned long micros();
+// Real time sleep, only the background tasks (logger, web server) call this
+void delay(uint32_t ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+#define digitalPinToInterrupt(p) (p)
+
+// Writes to stderr so the simulator's own report on stdout stays machine readable
+class HardwareSerial {
+public:
+  bool muted = false; // Set before any task starts, the log benchmark keeps the drain's output out of its report
+  void begin(unsigned long baud) {}
+  size_t write(const uint8_t *buffer, size_t size) { return muted ? size : fwrite(buffer, 1, size, stderr); }
+  size_t print(const char *str) { return muted ? 0 : fputs(str, stderr); }
+  size_t print(unsigned long value) { return muted ? 0 : fprintf(stderr, "%lu", value); }
+  size_t println(const char *str) { return muted ? 0 : fprintf(stderr, "%s\n", str); }
+  size_t println() { return muted ? 0 : fputs("\n", stderr); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+extern HardwareSerial Serial;
+
+// No heap to report on the host, all zero
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMaxAllocHeap() { return 0; }
+  uint32_t getMinFreeHeap() { return 0; }
+  void restart() { exit(3); } // Only the task supervisor reboots, the simulator doesn't run it
+};
+extern EspClass ESP;
@@ -0,0 +1,13 @@
+#pragma once
+// Host stand-in for the ESP-IDF task watchdog, there's nothing to reset on the host
+#include "freertos/FreeRTOS.h"
+
+typedef int esp_err_t;
+
+static inline esp_err_t esp_task_wdt_add(TaskHandle_t task) {
+    return 0;
+}
+
+static inline esp_err_t esp_task_wdt_reset() {
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+// Host stand-in for esp_timer, only the high resolution uptime, which follows the simulator's clock
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
@@ -0,0 +1,3 @@
+#pragma once
+// lwIP's resolver has the BSD getaddrinfo() interface, the host's own stands in for it
+#include <netdb.h>
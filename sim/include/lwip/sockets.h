@@ -0,0 +1,9 @@
+#pragma once
+// lwIP's socket API is BSD sockets, so the host's own serve the web server unchanged
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
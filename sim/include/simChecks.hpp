@@ -0,0 +1,9 @@
+#pragma once
+#include <Arduino.h>
+
+// Standalone checks and benchmarks, run by the simulator instead of a replay. Each prints what it found and returns the exit code
+int runTransitionTest();
+int runWheelSelfTest();
+int runJournalSelfTest();
+int runLogBench();
+int runRegistryBench();
@@ -0,0 +1,31 @@
+#pragma once
+#include <Arduino.h>
+
+#define SIM_PIN_COUNT 40
+#define SIM_FLASH_SIZE 0x90000 // The journal and rssitrace partitions from partitions.csv, back to back
+#define SIM_FLASH_SECTOR_SIZE 4096
+
+// Virtual clock, millis() and micros() only move when the simulator says so
+void simSetTimeUs(uint64_t us);
+uint64_t simTimeUs();
+// After a replay, let the clock run on in real time so the web server's timeouts work
+void simFollowRealTime();
+
+// Drives an input pin as the outside world would, firing any interrupt attached to it
+void simSetPinLevel(uint8_t pin, int level);
+// Called whenever firmware writes an output pin, e.g. so the simulator can report relay changes
+typedef void (*SIMPINLISTENER)(uint8_t pin, int level);
+void simOnPinWrite(SIMPINLISTENER listener);
+
+// Items waiting in all queues, the simulator keeps stepping until these are handled
+uint32_t simQueuedItems();
+// True once the newest task of that name is blocked in ulTaskNotifyTake() with nothing pending, or there is none
+bool simTaskIdle(const char *name);
+
+// Power cut: flash takes this many more bytes of writes and erases, then ignores the rest until simFlashPowerOn()
+void simFlashCutAfter(uint32_t bytes);
+void simFlashPowerOn();
+
+// Heap allocations so far, by the firmware and the stand-ins alike (on glibc everything, elsewhere only operator new)
+uint32_t simAllocations();
+uint64_t simAllocatedBytes(); // Bytes those allocations asked for, a realloc counts its whole new size
@@ -0,0 +1,621 @@
+#include "simChecks.hpp"
+#include "simHal.hpp"
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <esp_partition.h>
+#include "beaconRegistry.hpp"
+#include "doorControl.hpp"
+#include "eventJournal.hpp"
+#include "logger.hpp"
+#include "timerWheel.hpp"
+
+/* Door transitions
+  * Every (status, lock, event) combination goes through applyDoorEvent() and is checked against the table below,
+  * written out from the door's rules rather than from the code: locks stack by source, locking closes an open door,
+  * only a closed, unlocked door opens.
+*/
+
+typedef enum {
+    expect_none = 0x00, // Status unchanged, no relay action
+    expect_close, // An open door is released, a closed one stays as it is
+    expect_open // A closed, unlocked door is energised, anything else stays as it is
+} EXPECTEDEFFECT;
+
+typedef struct {
+    DOOREVENTTYPE event;
+    DOORLOCKSTATE next_lock[4]; // Indexed by the lock state before the event
+    EXPECTEDEFFECT effect;
+} EXPECTEDTRANSITION;
+
+#define UNLOCKED door_unlocked
+#define WIFI door_locked_wifi
+#define SWITCH door_locked_switch
+#define BOTH door_locked_both
+
+static const EXPECTEDTRANSITION expectedTransitions[] = {
+    // event,                        unlocked, wifi,     switch,   both     effect
+    { door_event_switch_locked,      { SWITCH,   BOTH,     SWITCH,   BOTH },   expect_close },
+    { door_event_switch_unlocked,    { UNLOCKED, WIFI,     UNLOCKED, WIFI },   expect_none },
+    { door_event_ble_approach,       { UNLOCKED, WIFI,     SWITCH,   BOTH },   expect_open },
+    { door_event_web_open,           { UNLOCKED, WIFI,     SWITCH,   BOTH },   expect_open },
+    { door_event_web_lock,           { WIFI,     WIFI,     BOTH,     BOTH },   expect_close },
+    { door_event_web_unlock,         { UNLOCKED, UNLOCKED, SWITCH,   SWITCH }, expect_none },
+    { door_event_timeout,            { UNLOCKED, WIFI,     SWITCH,   BOTH },   expect_close },
+    { door_event_switch_edge,        { UNLOCKED, WIFI,     SWITCH,   BOTH },   expect_none }, // Only starts the debounce
+    { door_event_schedule_lock,      { WIFI,     WIFI,     BOTH,     BOTH },   expect_close }, // Locks as the web page would
+    { door_event_schedule_unlock,    { UNLOCKED, UNLOCKED, SWITCH,   SWITCH }, expect_none },
+    { door_event_timed_lock,         { UNLOCKED, WIFI,     SWITCH,   BOTH },   expect_none }, // Sends schedule_lock once planned
+    { door_event_schedule_changed,   { UNLOCKED, WIFI,     SWITCH,   BOTH },   expect_none }
+};
+static_assert(sizeof(expectedTransitions) / sizeof(expectedTransitions[0]) == door_event_schedule_changed + 1,
+    "A door event has no row in expectedTransitions");
+
+#undef UNLOCKED
+#undef WIFI
+#undef SWITCH
+#undef BOTH
+
+int runTransitionTest() {
+    static const char *statusNames[] = { "closed", "open" };
+    static const char *lockNames[] = { "unlocked", "wifi", "switch", "both" };
+    static const char *actionNames[] = { "none", "energise", "release" };
+    uint32_t checked = 0;
+    uint32_t failed = 0;
+
+    for (uint8_t row = 0; row < sizeof(expectedTransitions) / sizeof(expectedTransitions[0]); row++) {
+        const EXPECTEDTRANSITION *expected = &expectedTransitions[row];
+
+        if (expected->event != row) {
+            fprintf(stderr, "expectedTransitions row %u is for event %u, keep the rows in DOOREVENTTYPE order\n", row, expected->event);
+            return 1;
+        }
+
+        for (uint8_t status = door_closed; status <= door_open; status++) {
+            for (uint8_t lock = door_unlocked; lock <= door_locked_both; lock++) {
+                DOORSTATE state = { (DOORSTATUS) status, (DOORLOCKSTATE) lock };
+                DOORSTATUS nextStatus = (DOORSTATUS) status;
+                DOORACTION action = door_action_none;
+
+                if (expected->effect == expect_close && status == door_open) {
+                    nextStatus = door_closed;
+                    action = door_action_release;
+                } else if (expected->effect == expect_open && status == door_closed && lock == door_unlocked) {
+                    nextStatus = door_open;
+                    action = door_action_energise;
+                }
+
+                DOORACTION got = applyDoorEvent(&state, expected->event);
+                checked++;
+                if (got != action || state.status != nextStatus || state.lock != expected->next_lock[lock]) {
+                    fprintf(stderr, "FAIL event %u from %s/%s: got %s/%s and %s, expected %s/%s and %s\n", expected->event,
+                        statusNames[status], lockNames[lock], statusNames[state.status], lockNames[state.lock], actionNames[got],
+                        statusNames[nextStatus], lockNames[expected->next_lock[lock]], actionNames[action]);
+                    failed++;
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "door transitions: %u checked, %u failed\n", checked, failed);
+
+    return failed == 0 ? 0 : 1;
+}
+
+/* Timer wheel against a reference
+  * Random timers, one-shot and periodic, are armed, moved and cancelled while time jumps forward by anything from
+  * a millisecond to years, from starts either side of the 32 bit millis() wrap and deep into the 64 bit range.
+  * Every expiry must come exactly at the time a plain list of deadlines says, in order, and nothing due may be
+  * left behind after runTimers().
+*/
+
+#define WHEEL_TEST_TIMERS 512
+#define WHEEL_TEST_EXPIRIES 40000 // Per start time
+#define WHEEL_TEST_MAX_STEPS 2000000
+
+typedef struct {
+    bool armed;
+    uint64_t deadline_ms;
+    uint64_t due_ms; // When the wheel must fire it, the deadline or the wheel's time when armed if that was later
+    uint32_t period_ms;
+} WHEELREFERENCE;
+
+static TIMERWHEEL testWheel;
+static TIMERENTRY testTimers[WHEEL_TEST_TIMERS];
+static WHEELREFERENCE reference[WHEEL_TEST_TIMERS];
+static uint64_t testRandomState;
+static uint64_t runTarget; // now_ms passed to the runTimers() in progress
+static uint64_t lastFired;
+static uint32_t expiries;
+static uint32_t wheelFailures;
+
+static uint64_t testRandom() {
+    testRandomState ^= testRandomState << 13;
+    testRandomState ^= testRandomState >> 7;
+    testRandomState ^= testRandomState << 17;
+
+    return testRandomState;
+}
+
+// Mostly near, sometimes far: a random number of bits up to 2^40ms (about 35 years)
+static uint64_t randomSpan() {
+    return testRandom() % ((uint64_t) 1 << (testRandom() % 41));
+}
+
+static void wheelFail(const char *what, uint16_t index, uint64_t expected, uint64_t got) {
+    if (wheelFailures++ < 10) {
+        fprintf(stderr, "FAIL %s: timer %u, expected %llu, got %llu (wheel at %llu)\n", what, index, (unsigned long long) expected,
+            (unsigned long long) got, (unsigned long long) testWheel.now_ms);
+    }
+
+    return;
+}
+
+static void testArm(uint16_t index, uint64_t deadline, uint32_t period) {
+    armTimer(&testWheel, &testTimers[index], deadline, period);
+    reference[index].armed = true;
+    reference[index].deadline_ms = deadline;
+    reference[index].due_ms = deadline > testWheel.now_ms ? deadline : testWheel.now_ms;
+    reference[index].period_ms = period;
+
+    return;
+}
+
+static void testTimerFired(TIMERENTRY *timer) {
+    uint16_t index = timer - testTimers;
+    WHEELREFERENCE *expected = &reference[index];
+
+    if (!expected->armed) {
+        wheelFail("fired while not armed", index, 0, testWheel.now_ms);
+    } else if (testWheel.now_ms != expected->due_ms) {
+        wheelFail("fired at the wrong time", index, expected->due_ms, testWheel.now_ms);
+    }
+    if (testWheel.now_ms < lastFired) {
+        wheelFail("fired out of order", index, lastFired, testWheel.now_ms);
+    }
+    lastFired = testWheel.now_ms;
+    expiries++;
+
+    if (expected->period_ms > 0) {
+        // A periodic timer that fell behind skips what it missed, the next expiry is a period after the run's time
+        uint64_t next = expected->deadline_ms + expected->period_ms;
+        expected->deadline_ms = next > runTarget ? next : runTarget + expected->period_ms;
+        expected->due_ms = expected->deadline_ms;
+    } else {
+        expected->armed = false;
+        // Now and then a callback arms itself again, sometimes already due
+        if (testRandom() % 8 == 0) {
+            testArm(index, testWheel.now_ms + (testRandom() % 2 == 0 ? 0 : randomSpan()), 0);
+        }
+    }
+
+    return;
+}
+
+static uint32_t runWheelFrom(uint64_t start, uint64_t seed) {
+    uint32_t steps = 0;
+
+    testRandomState = seed;
+    initTimerWheel(&testWheel, start);
+    for (uint16_t i = 0; i < WHEEL_TEST_TIMERS; i++) {
+        initTimer(&testTimers[i], testTimerFired);
+        reference[i].armed = false;
+    }
+    lastFired = start;
+    expiries = 0;
+
+    while (expiries < WHEEL_TEST_EXPIRIES && steps++ < WHEEL_TEST_MAX_STEPS && wheelFailures == 0) {
+        for (uint8_t op = 0; op < 4; op++) {
+            uint16_t index = testRandom() % WHEEL_TEST_TIMERS;
+            uint32_t choice = testRandom() % 16;
+
+            if (choice < 9) {
+                testArm(index, testWheel.now_ms + randomSpan(), 0);
+            } else if (choice < 11) {
+                uint64_t overdue = testRandom() % 1000;
+                testArm(index, testWheel.now_ms - (overdue < testWheel.now_ms ? overdue : testWheel.now_ms), 0); // Already due
+            } else if (choice < 13) {
+                testArm(index, testWheel.now_ms + randomSpan(), 1 + testRandom() % ((uint32_t) 1 << (testRandom() % 24)));
+            } else {
+                cancelTimer(&testWheel, &testTimers[index]);
+                reference[index].armed = false;
+            }
+        }
+
+        // Small steps mostly, now and then a long sleep
+        runTarget = testWheel.now_ms + (testRandom() % 64 == 0 ? randomSpan() : testRandom() % 5000);
+        runTimers(&testWheel, runTarget);
+
+        uint32_t armed = 0;
+        uint64_t earliest = TIMER_NEVER;
+        for (uint16_t i = 0; i < WHEEL_TEST_TIMERS; i++) {
+            if (!reference[i].armed) {
+                continue;
+            }
+            armed++;
+            if (reference[i].due_ms <= runTarget) {
+                wheelFail("left behind", i, reference[i].due_ms, runTarget);
+            }
+            earliest = reference[i].due_ms < earliest ? reference[i].due_ms : earliest;
+        }
+        if (armed != testWheel.armed) {
+            wheelFail("armed count", 0, armed, testWheel.armed);
+        }
+        if (nextTimerTick(&testWheel) > earliest) {
+            wheelFail("next tick after the earliest deadline", 0, earliest, nextTimerTick(&testWheel));
+        }
+    }
+
+    return steps;
+}
+
+int runWheelSelfTest() {
+    // From boot, either side of the 32 bit millis() wrap, and far into the 64 bit range
+    static const uint64_t starts[] = { 0, 0xFFFFFFFFULL - 20000, 0x100000000ULL, (uint64_t) 1 << 40, ((uint64_t) 1 << 62) - 12345 };
+    uint32_t total = 0;
+
+    wheelFailures = 0;
+    for (uint8_t i = 0; i < sizeof(starts) / sizeof(starts[0]) && wheelFailures == 0; i++) {
+        uint32_t steps = runWheelFrom(starts[i], 0x9E3779B97F4A7C15ULL * (i + 1));
+        fprintf(stderr, "timer wheel from %llu: %u expiries in %u steps, reached %llu\n", (unsigned long long) starts[i], expiries, steps,
+            (unsigned long long) testWheel.now_ms);
+        total += expiries;
+    }
+
+    fprintf(stderr, "timer wheel: %u expiries checked, %u failures\n", total, wheelFailures);
+
+    return wheelFailures == 0 ? 0 : 1;
+}
+
+/* Journal power cuts
+  * Flash loses power after each byte of a flush in turn, part way through the sector erase or the record writes,
+  * and the journal then recovers as it would at the next boot. The boot record must follow the newest record that
+  * survived, the unlock count must come back from that record, and reading the journal back must return only
+  * records exactly as they were appended.
+*/
+
+#define JOURNAL_TEST_BATCH JOURNAL_FLUSH_THRESHOLD // Records staged per flush, the journal task writes once this many wait
+
+static const esp_partition_t *journalPartition;
+static uint32_t journalSlots;
+static std::vector<JOURNALRECORD> appendedRecords; // Indexed by sequence, sequence 0 where nothing was appended
+static uint32_t journalFailures;
+
+// The journal's CRC-8, so the test can build records as they should land in flash
+static uint8_t journalTestCrc(const JOURNALRECORD *record) {
+    const uint8_t *data = (const uint8_t *) record;
+    uint8_t crc = 0;
+
+    for (uint8_t i = 0; i < sizeof(JOURNALRECORD) - 1; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+
+    return crc == 0xFF ? 0xFE : crc; // Never erased
+}
+
+static void expectRecord(uint32_t sequence, JOURNALEVENT type, JOURNALSOURCE source, uint8_t detail, uint32_t unlockCycles) {
+    if (sequence >= appendedRecords.size()) {
+        return; // Far beyond anything the test wrote, the checks report it
+    }
+    JOURNALRECORD *record = &appendedRecords[sequence];
+
+    memset(record, 0, sizeof(JOURNALRECORD));
+    record->sequence = sequence;
+    record->uptime_ms = millis();
+    record->unlock_cycles = unlockCycles;
+    record->type = type;
+    record->source = source;
+    record->detail = detail;
+    record->crc = journalTestCrc(record);
+
+    return;
+}
+
+static bool recordAsAppended(const JOURNALRECORD *record) {
+    return record->sequence < appendedRecords.size() && appendedRecords[record->sequence].sequence == record->sequence
+        && memcmp(record, &appendedRecords[record->sequence], sizeof(JOURNALRECORD)) == 0;
+}
+
+static void journalFail(const char *scenario, uint32_t cutAfter, const char *what, uint32_t expected, uint32_t got) {
+    if (journalFailures++ < 10) {
+        fprintf(stderr, "FAIL %s, power cut after %u bytes: %s, expected %u, got %u\n", scenario, cutAfter, what, expected, got);
+    }
+
+    return;
+}
+
+// Boots the journal on whatever flash holds, its boot record is the first of the batch
+static uint32_t bootJournal() {
+    initJournal();
+    uint32_t sequence = journalNextSequence() - 1;
+    expectRecord(sequence, journal_boot, journal_src_system, 0, journalRecoveredUnlockCycles());
+
+    return sequence;
+}
+
+// Appends until a batch is staged, which wakes the journal task, then waits for it to finish writing
+static void flushBatch(uint32_t staged, uint32_t unlockCycles) {
+    for (; staged < JOURNAL_TEST_BATCH; staged++, unlockCycles++) {
+        uint32_t sequence = journalNextSequence();
+        expectRecord(sequence, journal_door_open, journal_src_beacon, staged, unlockCycles);
+        journalAppend(journal_door_open, journal_src_beacon, staged, unlockCycles);
+    }
+    while (!simTaskIdle("journal")) {
+        std::this_thread::yield();
+    }
+
+    return;
+}
+
+// Flash is set up and the journal booted, cuts the power during the next flush and checks the boot after it
+static uint32_t tearJournalFlush(const char *scenario, uint32_t cutAfter, uint32_t staged, uint32_t unlockCycles) {
+    JOURNALRECORD record;
+    uint32_t newest = 0;
+    uint32_t newestCycles = 0;
+
+    simFlashCutAfter(cutAfter);
+    flushBatch(staged, unlockCycles);
+    simFlashPowerOn();
+
+    for (uint32_t slot = 0; slot < journalSlots; slot++) {
+        esp_partition_read(journalPartition, slot * sizeof(JOURNALRECORD), &record, sizeof(JOURNALRECORD));
+        if (recordAsAppended(&record) && record.sequence >= newest) {
+            newest = record.sequence;
+            newestCycles = record.unlock_cycles;
+        }
+    }
+
+    // Torn slots after the newest survivor may be skipped, but never past the end of its sector
+    uint32_t boot = bootJournal();
+    if (boot <= newest || boot - newest > JOURNAL_SECTOR_SIZE / sizeof(JOURNALRECORD)) {
+        journalFail(scenario, cutAfter, "boot record's sequence just after the newest that survived", newest + 1, boot);
+    }
+    if (journalRecoveredUnlockCycles() != newestCycles) {
+        journalFail(scenario, cutAfter, "recovered unlock cycles", newestCycles, journalRecoveredUnlockCycles());
+    }
+    flushBatch(1, newestCycles);
+
+    // Every record read back must be one appended, unchanged, in order, and nothing from this boot may be missing
+    static JOURNALRECORD chunk[JOURNAL_CHUNK_RECORDS];
+    uint32_t from = 0;
+    uint32_t next;
+    uint32_t previous = 0;
+    uint32_t found = 0;
+    uint32_t read = 0;
+    uint16_t count;
+    while ((count = journalReadChunk(from, chunk, JOURNAL_CHUNK_RECORDS, &next)) > 0) {
+        for (uint16_t i = 0; i < count; i++) {
+            if (!recordAsAppended(&chunk[i])) {
+                journalFail(scenario, cutAfter, "torn record read back, sequence", 0, chunk[i].sequence);
+            } else if (read > 0 && chunk[i].sequence <= previous) {
+                journalFail(scenario, cutAfter, "records out of order, sequence after", previous, chunk[i].sequence);
+            }
+            found += chunk[i].sequence == newest || (chunk[i].sequence >= boot && chunk[i].sequence < boot + JOURNAL_TEST_BATCH);
+            previous = chunk[i].sequence;
+            read++;
+        }
+        from = next;
+    }
+    uint32_t expected = JOURNAL_TEST_BATCH + (newest != 0);
+    if (found != expected) {
+        journalFail(scenario, cutAfter, "newest survivor and this boot's records read back", expected, found);
+    }
+
+    return read;
+}
+
+static void eraseJournal() {
+    esp_partition_erase_range(journalPartition, 0, journalPartition->size);
+    appendedRecords.assign(3 * journalSlots, JOURNALRECORD());
+
+    return;
+}
+
+int runJournalSelfTest() {
+    uint32_t cuts = 0;
+    uint64_t read = 0;
+
+    journalPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) JOURNAL_PARTITION_SUBTYPE, JOURNAL_PARTITION_LABEL);
+    journalSlots = journalPartition->size / sizeof(JOURNALRECORD);
+    journalFailures = 0;
+
+    // Appends: one batch is in flash, the power goes during the writes of the next
+    uint32_t batchBytes = JOURNAL_TEST_BATCH * sizeof(JOURNALRECORD);
+    for (uint32_t cutAfter = 0; cutAfter <= batchBytes; cutAfter++, cuts++) {
+        eraseJournal();
+        bootJournal();
+        flushBatch(1, 1);
+        read += tearJournalFlush("append", cutAfter, 0, JOURNAL_TEST_BATCH);
+    }
+
+    // Erases: a whole lap of the ring is in flash, the power goes while the oldest sector is erased for the next
+    std::vector<JOURNALRECORD> lap(journalSlots);
+    for (uint32_t slot = 0; slot < journalSlots; slot++) {
+        uint32_t sequence = journalSlots + slot;
+        memset(&lap[slot], 0, sizeof(JOURNALRECORD));
+        lap[slot].sequence = sequence;
+        lap[slot].unlock_cycles = sequence;
+        lap[slot].type = journal_door_close;
+        lap[slot].source = journal_src_timeout;
+        lap[slot].crc = journalTestCrc(&lap[slot]);
+    }
+    for (uint32_t cutAfter = 0; cutAfter <= JOURNAL_SECTOR_SIZE + batchBytes; cutAfter++, cuts++) {
+        eraseJournal();
+        esp_partition_write(journalPartition, 0, lap.data(), journalSlots * sizeof(JOURNALRECORD));
+        for (uint32_t slot = 0; slot < journalSlots; slot++) {
+            appendedRecords[lap[slot].sequence] = lap[slot];
+        }
+        bootJournal();
+        read += tearJournalFlush("erase", cutAfter, 1, 2 * journalSlots);
+    }
+
+    fprintf(stderr, "journal: %u power cuts, %llu records read back, %u failures\n", cuts, (unsigned long long) read, journalFailures);
+
+    return journalFailures == 0 ? 0 : 1;
+}
+
+/* Logger call cost
+  * Times the LOG_* call sites themselves, not the drain: a level compiled out, records the drain keeps up with, and
+  * records dropped because the ring is full. The drain runs as it does on the device but its output is muted.
+*/
+
+#define LOG_BENCH_CALLS 1000000 // Compiled out and dropped
+#define LOG_BENCH_BURSTS 100 // Of LOG_RING_LEN records each, with a pause for the drain after every one
+
+static uint64_t elapsedNs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+int runLogBench() {
+    Serial.muted = true;
+    initLogger();
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+    fprintf(stderr, "log calls: LOG_DEBUG is enabled in this build, build with a lower LOG_LEVEL to time a filtered call\n");
+#else
+    for (uint32_t i = 0; i < LOG_BENCH_CALLS; i++) {
+        LOG_DEBUG("bench record %u of %u", i, LOG_BENCH_CALLS);
+    }
+    fprintf(stderr, "log calls: %.1fns filtered out (LOG_DEBUG above LOG_LEVEL, %u calls)\n", (double) elapsedNs(started) / LOG_BENCH_CALLS,
+        LOG_BENCH_CALLS);
+#endif
+
+    // A ring's worth at a time, then long enough for the drain to wake and empty it, so nothing is dropped
+    uint32_t dropsBefore = getLogDropCount();
+    uint64_t enabledNs = 0;
+    for (uint32_t burst = 0; burst < LOG_BENCH_BURSTS; burst++) {
+        started = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < LOG_RING_LEN; i++) {
+            LOG_ERROR("bench record %u of %u", i, LOG_RING_LEN);
+        }
+        enabledNs += elapsedNs(started);
+        delay(2 * LOG_DRAIN_INTERVAL_MS);
+    }
+    uint32_t enabledCalls = LOG_BENCH_BURSTS * LOG_RING_LEN;
+    uint32_t enabledDrops = getLogDropCount() - dropsBefore;
+
+    // Far more records than the ring holds in one go, all but the first few dozen are dropped
+    dropsBefore = getLogDropCount();
+    started = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < LOG_BENCH_CALLS; i++) {
+        LOG_ERROR("bench record %u of %u", i, LOG_BENCH_CALLS);
+    }
+    double droppingNs = (double) elapsedNs(started) / LOG_BENCH_CALLS;
+    uint32_t droppingDrops = getLogDropCount() - dropsBefore;
+
+    fprintf(stderr, "log calls: %.1fns into the ring (%u calls, %u dropped)\n", (double) enabledNs / enabledCalls, enabledCalls, enabledDrops);
+    fprintf(stderr, "log calls: %.1fns with the ring full (%u calls, %u dropped)\n", droppingNs, LOG_BENCH_CALLS, droppingDrops);
+
+    return 0;
+}
+
+/* Registry lookup cost
+  * lookupBeaconAdvert() runs for every advert heard, mostly for other people's phones. Times it with 1, 8, 16 and
+  * 32 beacons registered: a beacon whose address is known, a beacon heard from a new address (learnt, so the tables
+  * are rebuilt) and an advert from a stranger, with a name and without.
+*/
+
+#define REGISTRY_BENCH_LOOKUPS 1000000
+#define REGISTRY_BENCH_ROTATIONS 100000 // Each one rebuilds the tables
+#define REGISTRY_BENCH_STRANGERS 256
+
+typedef struct {
+    uint8_t payload[31];
+    size_t len;
+    uint8_t mac[BLE_MAC_LEN];
+} BENCHADVERT;
+
+// Flags, then the name as replayAdvert() builds it, no name if NULL
+static void buildBenchAdvert(BENCHADVERT *advert, const char *name, uint8_t macHigh, uint32_t macLow) {
+    static const uint8_t flags[] = { 0x02, 0x01, 0x06 };
+
+    memcpy(advert->payload, flags, sizeof(flags));
+    advert->len = sizeof(flags);
+    if (name != NULL) {
+        size_t nameLen = strlen(name);
+        advert->payload[advert->len++] = nameLen + 1;
+        advert->payload[advert->len++] = AD_TYPE_COMPLETE_NAME;
+        memcpy(advert->payload + advert->len, name, nameLen);
+        advert->len += nameLen;
+    }
+    uint8_t mac[BLE_MAC_LEN] = { macHigh, 0x7F, 0x51, (uint8_t) (macLow >> 16), (uint8_t) (macLow >> 8), (uint8_t) macLow };
+    memcpy(advert->mac, mac, BLE_MAC_LEN);
+
+    return;
+}
+
+static BENCHADVERT beaconAdverts[BEACON_REGISTRY_MAX];
+static BENCHADVERT namedStrangers[REGISTRY_BENCH_STRANGERS];
+static BENCHADVERT namelessStrangers[REGISTRY_BENCH_STRANGERS];
+
+// ns per lookup, or -1 if any lookup came back with the wrong beacon
+static double timeLookups(const BENCHADVERT *adverts, uint32_t advertCount, uint32_t lookups, bool matched) {
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    uint32_t wrong = 0;
+
+    for (uint32_t i = 0; i < lookups; i++) {
+        const BENCHADVERT *advert = &adverts[i % advertCount];
+        uint8_t index = lookupBeaconAdvert(advert->payload, advert->len, advert->mac, BEACON_ADDR_PUBLIC);
+        wrong += matched ? index != i % advertCount : index != BEACON_REGISTRY_EMPTY;
+    }
+    uint64_t ns = elapsedNs(started);
+
+    return wrong == 0 ? (double) ns / lookups : -1;
+}
+
+int runRegistryBench() {
+    static const uint8_t sizes[] = { 1, 8, 16, 32 };
+    static_assert(BEACON_REGISTRY_MAX >= 32, "The registry bench fills the registry to 32 beacons");
+    char name[BEACON_REGISTRY_NAME_LEN];
+    uint8_t registered = 0;
+
+    for (uint16_t i = 0; i < REGISTRY_BENCH_STRANGERS; i++) {
+        snprintf(name, sizeof(name), "Phone%03u", i);
+        buildBenchAdvert(&namedStrangers[i], name, 0x5C, 0x100000 + i);
+        buildBenchAdvert(&namelessStrangers[i], NULL, 0x5C, 0x200000 + i);
+    }
+
+    fprintf(stderr, "beacons  known address  new address  stranger  nameless stranger (ns per lookup)\n");
+    for (uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (; registered < sizes[s]; registered++) {
+            snprintf(name, sizeof(name), "Dog%02u", registered);
+            if (addBeacon(name, BEACON_THRESHOLD_GLOBAL, BEACON_PERM_OPEN) != registered) {
+                fprintf(stderr, "FAIL adding beacon %s\n", name);
+                return 1;
+            }
+            buildBenchAdvert(&beaconAdverts[registered], name, 0xC4, registered);
+            lookupBeaconAdvert(beaconAdverts[registered].payload, beaconAdverts[registered].len, beaconAdverts[registered].mac, BEACON_ADDR_PUBLIC);
+        }
+
+        double known = timeLookups(beaconAdverts, registered, REGISTRY_BENCH_LOOKUPS, true);
+        double stranger = timeLookups(namedStrangers, REGISTRY_BENCH_STRANGERS, REGISTRY_BENCH_LOOKUPS, false);
+        double nameless = timeLookups(namelessStrangers, REGISTRY_BENCH_STRANGERS, REGISTRY_BENCH_LOOKUPS, false);
+
+        // Each beacon moves to an address the registry hasn't seen, then back, so every lookup learns a MAC
+        static BENCHADVERT rotated[2 * BEACON_REGISTRY_MAX];
+        for (uint8_t i = 0; i < registered; i++) {
+            rotated[2 * i] = beaconAdverts[i];
+            rotated[2 * i].mac[0] = 0xC5;
+            rotated[2 * i + 1] = beaconAdverts[i];
+        }
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        uint32_t wrong = 0;
+        for (uint32_t i = 0; i < REGISTRY_BENCH_ROTATIONS; i++) {
+            const BENCHADVERT *advert = &rotated[i % (2 * registered)];
+            wrong += lookupBeaconAdvert(advert->payload, advert->len, advert->mac, BEACON_ADDR_PUBLIC) != (i % (2 * registered)) / 2;
+        }
+        double moved = wrong == 0 ? (double) elapsedNs(started) / REGISTRY_BENCH_ROTATIONS : -1;
+
+        if (known < 0 || moved < 0 || stranger < 0 || nameless < 0) {
+            fprintf(stderr, "FAIL lookups with %u beacons returned the wrong beacon\n", registered);
+            return 1;
+        }
+        fprintf(stderr, "%7u  %13.1f  %11.1f  %8.1f  %17.1f\n", registered, known, moved, stranger, nameless);
+    }
+
+    return 0;
+}
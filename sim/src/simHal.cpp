@@ -0,0 +1,507 @@
+#include "simHal.hpp"
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include "freertos/semphr.h"
+#include <stdarg.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+/* Clock */
+
+static std::atomic<uint64_t> virtualUs(0);
+static std::atomic<bool> realTime(false);
+static std::chrono::steady_clock::time_point realTimeBase;
+static uint64_t realTimeBaseUs = 0;
+
+void simSetTimeUs(uint64_t us) {
+    virtualUs.store(us, std::memory_order_release);
+
+    return;
+}
+
+uint64_t simTimeUs() {
+    if (realTime.load(std::memory_order_acquire)) {
+        return realTimeBaseUs + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - realTimeBase).count();
+    }
+
+    return virtualUs.load(std::memory_order_acquire);
+}
+
+void simFollowRealTime() {
+    realTimeBaseUs = simTimeUs();
+    realTimeBase = std::chrono::steady_clock::now();
+    realTime.store(true, std::memory_order_release);
+
+    return;
+}
+
+unsigned long millis() {
+    return (unsigned long) (uint32_t) (simTimeUs() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long) (uint32_t) simTimeUs();
+}
+
+int64_t esp_timer_get_time() {
+    return (int64_t) simTimeUs();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+
+    return;
+}
+
+size_t HardwareSerial::printf(const char *format, ...) {
+    va_list args;
+
+    if (muted) {
+        return 0;
+    }
+    va_start(args, format);
+    int len = vfprintf(stderr, format, args);
+    va_end(args);
+
+    return len < 0 ? 0 : len;
+}
+
+/* GPIO */
+
+static int pinLevels[SIM_PIN_COUNT];
+static void (*pinInterrupts[SIM_PIN_COUNT])(void);
+static SIMPINLISTENER pinListener = NULL;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < SIM_PIN_COUNT && mode == INPUT_PULLUP) {
+        pinLevels[pin] = HIGH; // Nothing is pulling it low until the simulator says so
+    }
+
+    return;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    if (pin < SIM_PIN_COUNT && pinLevels[pin] != level) {
+        pinLevels[pin] = level;
+        if (pinListener != NULL) {
+            pinListener(pin, level);
+        }
+    }
+
+    return;
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < SIM_PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+// Every attach is treated as CHANGE, which is all the firmware uses
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode) {
+    if (pin < SIM_PIN_COUNT) {
+        pinInterrupts[pin] = isr;
+    }
+
+    return;
+}
+
+void simSetPinLevel(uint8_t pin, int level) {
+    if (pin < SIM_PIN_COUNT && pinLevels[pin] != level) {
+        pinLevels[pin] = level;
+        if (pinInterrupts[pin] != NULL) {
+            pinInterrupts[pin]();
+        }
+    }
+
+    return;
+}
+
+void simOnPinWrite(SIMPINLISTENER listener) {
+    pinListener = listener;
+
+    return;
+}
+
+/* Critical sections */
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    while (__atomic_exchange_n(&mux->locked, 1, __ATOMIC_ACQUIRE)) {
+        std::this_thread::yield();
+    }
+
+    return;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE);
+
+    return;
+}
+
+/* Tasks, each one a detached host thread. Waits with a timeout use real time */
+
+struct SimTask {
+    const char *name;
+    std::mutex lock;
+    std::condition_variable notified;
+    uint32_t notifications;
+    bool waiting; // In ulTaskNotifyTake()
+};
+
+static thread_local SimTask *currentTask = NULL;
+static SimTask mainTask = { "main" };
+static std::mutex tasksLock;
+static std::vector<SimTask *> tasks; // Every task created, newest last
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter,
+    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    SimTask *created = new SimTask();
+
+    created->name = name;
+    created->notifications = 0;
+    created->waiting = false;
+    if (handle != NULL) {
+        *handle = created;
+    }
+    {
+        std::lock_guard<std::mutex> guard(tasksLock);
+        tasks.push_back(created);
+    }
+
+    std::thread([task, parameter, created]() {
+        currentTask = created;
+        task(parameter);
+    }).detach();
+
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return currentTask != NULL ? currentTask : &mainTask;
+}
+
+// Only the task supervisor deletes tasks and it doesn't run on the host, a thread can't be killed from outside anyway
+void vTaskDelete(TaskHandle_t task) {
+    fprintf(stderr, "vTaskDelete(%s) isn't supported by the simulator\n", task != NULL ? task->name : "self");
+    abort();
+}
+
+// Host threads have no fixed stack to measure
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    delay(ticks * portTICK_PERIOD_MS);
+
+    return;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> guard(task->lock);
+
+    task->notifications++;
+    task->notified.notify_one();
+
+    return;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    SimTask *task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> guard(task->lock);
+
+    task->waiting = true;
+    if (ticks == portMAX_DELAY) {
+        task->notified.wait(guard, [task]() { return task->notifications > 0; });
+    } else {
+        task->notified.wait_for(guard, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), [task]() { return task->notifications > 0; });
+    }
+    task->waiting = false;
+
+    uint32_t count = task->notifications;
+    if (count > 0) {
+        task->notifications = clearOnExit ? 0 : count - 1;
+    }
+
+    return count;
+}
+
+bool simTaskIdle(const char *name) {
+    SimTask *task = NULL;
+
+    {
+        std::lock_guard<std::mutex> guard(tasksLock);
+        for (size_t i = 0; i < tasks.size(); i++) {
+            if (strcmp(tasks[i]->name, name) == 0) {
+                task = tasks[i];
+            }
+        }
+    }
+    if (task == NULL) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> guard(task->lock);
+
+    return task->waiting && task->notifications == 0;
+}
+
+/* Queues, storage allocated up front as FreeRTOS does so sending never touches the heap */
+
+struct SimQueue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<uint8_t> storage; // length items, a ring
+    UBaseType_t head;
+    UBaseType_t count;
+    UBaseType_t length;
+    UBaseType_t item_size;
+};
+
+static std::atomic<uint32_t> queuedItems(0);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    SimQueue *queue = new SimQueue();
+
+    queue->storage.resize(length * itemSize);
+    queue->head = 0;
+    queue->count = 0;
+    queue->length = length;
+    queue->item_size = itemSize;
+
+    return queue;
+}
+
+// The firmware only ever sends without waiting, so a full queue fails straight away
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+
+    if (queue->count >= queue->length) {
+        return pdFALSE;
+    }
+
+    memcpy(&queue->storage[(queue->head + queue->count) % queue->length * queue->item_size], item, queue->item_size);
+    queue->count++;
+    queuedItems.fetch_add(1, std::memory_order_relaxed);
+    queue->changed.notify_one();
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    if (woken != NULL) {
+        *woken = pdFALSE;
+    }
+
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    std::unique_lock<std::mutex> guard(queue->lock);
+
+    if (ticks == portMAX_DELAY) {
+        queue->changed.wait(guard, [queue]() { return queue->count > 0; });
+    } else if (ticks > 0) {
+        queue->changed.wait_for(guard, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), [queue]() { return queue->count > 0; });
+    }
+
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+
+    memcpy(item, &queue->storage[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    queuedItems.fetch_sub(1, std::memory_order_relaxed);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+
+    return queue->count;
+}
+
+uint32_t simQueuedItems() {
+    return queuedItems.load(std::memory_order_relaxed);
+}
+
+/* Mutexes, the firmware only ever waits forever on them */
+
+struct SimMutex {
+    std::mutex lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new SimMutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    semaphore->lock.lock();
+
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    semaphore->lock.unlock();
+
+    return pdTRUE;
+}
+
+/* Flash, erased bytes read 0xFF and writes can only clear bits */
+
+// address is the partition's offset into simFlash rather than into the chip
+static const esp_partition_t simPartitions[] = {
+    { ESP_PARTITION_TYPE_DATA, 0x40, 0x00000, 0x10000, "journal" },
+    { ESP_PARTITION_TYPE_DATA, 0x41, 0x10000, 0x80000, "rssitrace" }
+};
+static uint8_t simFlash[SIM_FLASH_SIZE];
+static bool simFlashReady = false;
+static int64_t flashBudget = -1; // Bytes left to write or erase before the power cut, -1 while there isn't one
+
+void simFlashCutAfter(uint32_t bytes) {
+    flashBudget = bytes;
+
+    return;
+}
+
+void simFlashPowerOn() {
+    flashBudget = -1;
+
+    return;
+}
+
+// Whether the next byte still gets to flash
+static bool flashPowered() {
+    if (flashBudget == 0) {
+        return false;
+    }
+    if (flashBudget > 0) {
+        flashBudget--;
+    }
+
+    return true;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    if (!simFlashReady) {
+        memset(simFlash, 0xFF, sizeof(simFlash));
+        simFlashReady = true;
+    }
+
+    for (size_t i = 0; i < sizeof(simPartitions) / sizeof(simPartitions[0]); i++) {
+        if (simPartitions[i].type == type && simPartitions[i].subtype == subtype && (label == NULL || strcmp(simPartitions[i].label, label) == 0)) {
+            return &simPartitions[i];
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size) {
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(dst, simFlash + partition->address + offset, size);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size) {
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const uint8_t *bytes = (const uint8_t *) src;
+    for (size_t i = 0; i < size && flashPowered(); i++) {
+        simFlash[partition->address + offset + i] &= bytes[i];
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (offset % SIM_FLASH_SECTOR_SIZE != 0 || size % SIM_FLASH_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Torn in address order, a real erase leaves no such pattern but what's left is just as unusable
+    for (size_t i = 0; i < size && flashPowered(); i++) {
+        simFlash[partition->address + offset + i] = 0xFF;
+    }
+
+    return ESP_OK;
+}
+
+/* Heap, every allocation and the bytes it asked for are counted so the simulator can show which paths allocate */
+
+static std::atomic<uint32_t> allocations(0);
+static std::atomic<uint64_t> allocatedBytes(0);
+
+uint32_t simAllocations() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t simAllocatedBytes() {
+    return allocatedBytes.load(std::memory_order_relaxed);
+}
+
+static void countAllocation(size_t bytes) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    return;
+}
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+// operator new comes through here too
+extern "C" void *malloc(size_t size) {
+    countAllocation(size);
+
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    countAllocation(count * size);
+
+    return __libc_calloc(count, size);
+}
+
+// The whole new size is counted, the block may have moved
+extern "C" void *realloc(void *ptr, size_t size) {
+    countAllocation(size);
+
+    return __libc_realloc(ptr, size);
+}
+#else
+// Elsewhere only C++ allocations are seen
+void *operator new(size_t size) {
+    countAllocation(size);
+    void *ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+#endif
@@ -0,0 +1,779 @@
+/* Host simulator
+  * Replays a household trace through the same beacon, filter and door code as the firmware on a virtual clock,
+  * so a day of adverts takes seconds and always produces the same relay timeline.
+  *
+  * Usage: door_sim <trace|-> [--open-time-ms N] [--threshold dBm] [--approach-rate dB/s] [--scan adaptive|fixed]
+  *                 [--controller-filter on|off] [--calibrate on|off] [--start-ms N] [--capture] [--serve [--mqtt host:port]]
+  *        door_sim --selftest transitions|wheel|journal
+  *        door_sim --bench log|registry
+  *
+  * Trace lines are "<ms> <event> <args>", in time order, '#' starts a comment:
+  *   <ms> beacon <name> [threshold] [doors]  register a beacon allowed to open the door, or the doors in a mask
+  *   <ms> advert <mac> <name|-> <rssi>  an advert heard by the scanner, '-' for one with no name
+  *   <ms> switch locked|unlocked [door] lockout switch position, of the first door unless given
+  *   <ms> web open|lock|unlock [door]   a command from the web page, to every door unless given
+  *   <ms> web lock-for <minutes>        a timed lock from the web page, 0 ends it
+  *   <ms> clock <epoch seconds>         what NTP would have set the wall clock to, taken as local time
+  *   <ms> curfew <HH:MM> <HH:MM>        add a daily curfew, the door is locked from the first time to the second
+  *   <ms> at-door <name>                the dog reached the door wanting through, only used to score the run
+  *                                      (a "web open" while it waits is the owner letting it through, and only
+  *                                      opens the door if the beacon hasn't)
+  *
+  * Adverts only get through while the scan scheduler's current profile is listening, and passive scans are
+  * assumed to miss the name (worst case, it's in the scan response). --scan fixed keeps the old always-alert scanning
+  * for comparison, see tools/scan_benchmark.py. With the controller filter on (as the firmware defaults to) a window
+  * only passes adverts from the accept list bleScanner would have loaded, every SCAN_UNFILTERED_EVERY window excepted.
+  *
+  * Beacons learn their own thresholds as the firmware's do, --calibrate off keeps them on the global one. Traces with
+  * at-door lines get a score: how long the dog waited, visits the door never opened for and opens with no dog.
+  *
+  * The summary also has a "filter alone" line: every advert from a registered beacon, heard or not, straight into an
+  * RSSI filter of its own on the trace or global threshold, with no scan gating, calibration or locks. The door is
+  * taken to stay open for the open time after each open. It gives the opens, the time from the first advert of a visit
+  * to its open, and with at-door lines the waits, missed visits and false opens, so a filter change can be judged alone.
+  *
+  * --start-ms starts the clock that far after boot, trace times are relative to it. Starting just short of
+  * 4294967296 runs the trace across the 32 bit millis() wrap, the relay timeline should come out the same.
+  *
+  * --capture records every matched advert as the firmware's RSSI capture does, from boot to the end of the replay.
+  * Served from /api/capture, tools/capture_to_trace.py turns it back into a trace.
+  *
+  * Relay changes are written to stdout as "<ms> relay on|off" so runs can be diffed, the summary goes to stderr.
+  * Builds with more than one door (e.g. -DDOOR_GARAGE_FLAP) write "<ms> relay <door name> on|off" for the others,
+  * the stats and at-door scores are for the first door.
+  * --serve then keeps /metrics and a JSON summary of the run up on WEB_SERVER_PORT, with --mqtt it also connects to
+  * that broker and takes telemetry commands as the firmware does, see tools/mqtt_bench.py
+  *
+  * The summary also times the decision path and each advert that opened the door through to the relay in host time,
+  * counts heap allocations and bytes in the advert path, and the flash commits the beacons and curfews the trace added made
+  * (not the one formatting the empty store at boot, nor calibration saves), see tools/perf_suite.py
+  *
+  * --selftest runs one of the checks in simChecks.cpp instead of a trace, exiting 1 if it fails:
+  *   transitions  every door status, lock and event through applyDoorEvent() against a table of the door's rules
+  *   wheel        random timers on the timer wheel against a plain list of deadlines, across the millis() wrap
+  *   journal      the power cut at every byte of a journal flush, erase and writes, then the journal recovered
+  * --bench times one piece of the hot path on its own and reports ns per call:
+  *   log          LOG_* calls compiled out, into the ring with the drain keeping up, and dropped with the ring full
+  *   registry     lookupBeaconAdvert() with 1 to 32 beacons registered, for beacons and strangers alike
+*/
+#include "simHal.hpp"
+#include "simChecks.hpp"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "beaconRegistry.hpp"
+#include "bleScanner.hpp"
+#include "configStore.hpp"
+#include "doorControl.hpp"
+#include "doorDecision.hpp"
+#include "doorSchedule.hpp"
+#include "doorTuning.hpp"
+#include "eventJournal.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "rssiCapture.hpp"
+#include "scanScheduler.hpp"
+#include "taskTable.hpp"
+#include "telemetry.hpp"
+#include "webServer.hpp"
+
+#define SIM_LINE_LEN 256
+#define SIM_SETTLE_MS 1000 // Extra time replayed after the last line so deadlines (e.g. door close) are reached
+#define SIM_SCAN_WINDOW_MS (doorProfile.scan_duration_s * 1000) // As main.cpp, the scheduler is consulted between windows
+#define SIM_EARLY_OPEN_MS 5000 // An open this long before the dog reached the door still counts as for it
+#define SIM_GAVE_UP_MS 30000 // Wait after which the door is scored as never having opened for the dog
+
+typedef struct {
+    uint32_t lines;
+    uint32_t adverts;
+    uint32_t unheard; // Sent while the scanner wasn't listening
+    uint32_t filtered; // Dropped by the controller accept list, never reaching the host
+    uint32_t windows;
+    uint32_t filtered_windows;
+    uint32_t detections;
+    uint32_t opens;
+    uint64_t open_ms;
+    uint64_t opened_at_ms;
+    uint64_t decision_ns; // Host time spent in the decision path, as loop() runs it for each detection
+    uint32_t advert_allocations; // Heap allocations made by the scanner callback and decision path
+    uint64_t advert_bytes; // Bytes they asked for
+    uint32_t config_changes; // Beacons and curfews added by the trace
+    uint32_t change_commits; // Flash commits those made
+    uint32_t change_bytes; // Bytes they wrote
+} SIMSTATS;
+
+static SIMSTATS stats;
+static uint32_t openTimeMs = doorProfile.open_time_s * 1000;
+static bool adaptiveScan = true;
+static SCANMODE scanMode = scan_mode_alert;
+static uint64_t scanStartedMs = 0;
+static uint64_t nextScanMs = SIM_SCAN_WINDOW_MS;
+static bool controllerFilter = SCAN_CONTROLLER_FILTER;
+static uint8_t whitelist[SCAN_WHITELIST_MAX][BLE_MAC_LEN];
+static uint8_t whitelistCount = 0; // 0 while the window is unfiltered
+static bool calibrate = true;
+static std::vector<uint64_t> openTimes;
+static std::vector<uint64_t> atDoorTimes;
+static uint64_t webOpenMs = UINT64_MAX; // Time of the last "web open" line, an open then is the owner's not the beacon's
+static std::vector<uint64_t> ownerOpenTimes;
+static uint64_t traceStartMs = 0; // Uptime trace time 0 maps to
+static bool capture = false;
+static std::chrono::steady_clock::time_point advertHeard; // Host time the latest detection's advert was handed over
+static bool advertPending = false;
+static std::vector<uint32_t> advertToRelayNs;
+
+// The RSSI filter alone, one per beacon the trace registered
+typedef struct {
+    uint8_t index; // In the registry, for the name
+    uint8_t mac[BLE_MAC_LEN]; // Learnt from its named adverts, as the registry does
+    bool mac_known;
+    int8_t open_threshold; // BEACON_THRESHOLD_GLOBAL for the tuning's
+    RSSIFILTER rssi;
+    uint64_t last_heard_ms;
+    uint64_t visit_started_ms; // First advert after a gap longer than RSSI_STALE_MS
+    bool visit_opened;
+} FILTERALONE;
+
+static FILTERALONE aloneBeacons[BEACON_REGISTRY_MAX];
+static uint8_t aloneCount = 0;
+static uint64_t aloneClosesMs = 0; // The door modelled as open until then
+static uint32_t aloneVisits = 0;
+static std::vector<uint64_t> aloneOpenTimes;
+static std::vector<uint64_t> aloneLatencies; // First advert of a visit to its open
+
+static void relayChanged(uint8_t pin, int level) {
+    uint64_t now = simTimeUs() / 1000;
+    uint8_t door = 0;
+
+    while (door < getDoorCount() && getDoorSpec(door)->relay_pin != pin) {
+        door++;
+    }
+    if (door == getDoorCount()) {
+        return;
+    }
+    if (door > 0) {
+        printf("%llu relay %s %s\n", (unsigned long long) (now - traceStartMs), getDoorSpec(door)->name, level == HIGH ? "on" : "off");
+        return;
+    }
+
+    if (level == HIGH) {
+        stats.opens++;
+        if (now == webOpenMs) {
+            ownerOpenTimes.push_back(now);
+        } else {
+            openTimes.push_back(now);
+            if (advertPending) {
+                advertToRelayNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - advertHeard).count());
+            }
+        }
+        stats.opened_at_ms = now;
+    } else {
+        stats.open_ms += now - stats.opened_at_ms;
+    }
+    printf("%llu relay %s\n", (unsigned long long) (now - traceStartMs), level == HIGH ? "on" : "off");
+
+    return;
+}
+
+// Same as startScanWindow(): load the accept list if every beacon's address is known and stable
+static void startWindow(uint64_t startMs) {
+    uint8_t macTypes[SCAN_WHITELIST_MAX];
+
+    scanStartedMs = startMs;
+    nextScanMs = startMs + SIM_SCAN_WINDOW_MS;
+    stats.windows++;
+
+    whitelistCount = 0;
+    if (controllerFilter && stats.windows % SCAN_UNFILTERED_EVERY != 0) {
+        whitelistCount = getStableBeaconAddresses(whitelist, macTypes, SCAN_WHITELIST_MAX);
+        if (whitelistCount == BEACON_REGISTRY_EMPTY) {
+            whitelistCount = 0;
+        }
+    }
+    if (whitelistCount > 0) {
+        stats.filtered_windows++;
+    }
+
+    return;
+}
+
+// Same as loop(): the scheduler picks a profile as each window starts, a change restarts the scan
+static void runScanner(uint64_t nowMs) {
+    while (nextScanMs <= nowMs) {
+        updateScanScheduler(nextScanMs);
+        if (calibrateBeaconThresholds(nextScanMs, getTuning().open_threshold)) {
+            saveBeaconRegistry();
+        }
+        scanMode = getScanMode();
+        startWindow(nextScanMs);
+    }
+
+    return;
+}
+
+static bool whitelisted(const uint8_t *mac) {
+    for (uint8_t i = 0; i < whitelistCount; i++) {
+        if (memcmp(whitelist[i], mac, BLE_MAC_LEN) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Lets the door task handle everything queued or due, jumping the clock from deadline to deadline up to targetMs
+static void runUntil(uint64_t targetMs) {
+    for(;;) {
+        uint32_t wait = serviceDoorControl(0);
+
+        if (wait == 0 || simQueuedItems() > 0) {
+            continue;
+        }
+        if (wait == portMAX_DELAY || simTimeUs() / 1000 + wait > targetMs) {
+            break;
+        }
+        simSetTimeUs((simTimeUs() / 1000 + wait) * 1000);
+    }
+
+    if (targetMs * 1000 > simTimeUs()) {
+        simSetTimeUs(targetMs * 1000);
+    }
+
+    return;
+}
+
+static bool parseMac(const char *text, uint8_t *mac) {
+    unsigned int bytes[BLE_MAC_LEN];
+
+    if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != BLE_MAC_LEN) {
+        return false;
+    }
+    for (uint8_t i = 0; i < BLE_MAC_LEN; i++) {
+        mac[i] = bytes[i];
+    }
+
+    return true;
+}
+
+// Every advert a registered beacon sent, whether or not the scanner would have heard it
+static void filterAloneAdvert(const uint8_t *mac, const char *name, int rssi) {
+    uint64_t now = simTimeUs() / 1000;
+    FILTERALONE *beacon = NULL;
+
+    for (uint8_t i = 0; i < aloneCount && beacon == NULL; i++) {
+        if (strcmp(name, "-") != 0 ? strncmp(getBeacon(aloneBeacons[i].index)->matcher.name, name, BEACON_REGISTRY_NAME_LEN - 1) == 0
+                : aloneBeacons[i].mac_known && memcmp(aloneBeacons[i].mac, mac, BLE_MAC_LEN) == 0) {
+            beacon = &aloneBeacons[i];
+        }
+    }
+    if (beacon == NULL) {
+        return;
+    }
+    if (strcmp(name, "-") != 0) {
+        memcpy(beacon->mac, mac, BLE_MAC_LEN);
+        beacon->mac_known = true;
+    }
+
+    if (beacon->last_heard_ms == 0 || now - beacon->last_heard_ms > RSSI_STALE_MS) {
+        beacon->visit_started_ms = now;
+        beacon->visit_opened = false;
+        aloneVisits++;
+    }
+    beacon->last_heard_ms = now;
+    updateRSSIFilter(&beacon->rssi, rssi, (uint32_t) now);
+
+    DOORTUNING tuning = getTuning();
+    int threshold = beacon->open_threshold != BEACON_THRESHOLD_GLOBAL ? beacon->open_threshold : tuning.open_threshold;
+    if (now < aloneClosesMs || evaluateRSSIFilter(&beacon->rssi, (uint32_t) now, threshold, tuning.approach_rate) == rssi_hold) {
+        return;
+    }
+
+    aloneOpenTimes.push_back(now);
+    aloneClosesMs = now + openTimeMs;
+    if (!beacon->visit_opened) {
+        aloneLatencies.push_back(now - beacon->visit_started_ms);
+        beacon->visit_opened = true;
+    }
+
+    return;
+}
+
+// Builds the advert the scanner would have handed over: flags, then the complete local name if there is one
+static void replayAdvert(const char *macText, const char *name, int rssi) {
+    uint8_t payload[31] = { 0x02, 0x01, 0x06 };
+    size_t len = 3;
+    uint8_t mac[BLE_MAC_LEN];
+    BEACONDETECTION detection;
+
+    if (!parseMac(macText, mac)) {
+        fprintf(stderr, "line %u: bad MAC %s\n", stats.lines, macText);
+        return;
+    }
+
+    stats.adverts++;
+    filterAloneAdvert(mac, name, rssi);
+    if (!scanProfileHears(getScanProfile(scanMode), scanStartedMs, simTimeUs() / 1000)) {
+        stats.unheard++;
+        return;
+    }
+    if (whitelistCount > 0 && !whitelisted(mac)) {
+        stats.filtered++;
+        return;
+    }
+
+    size_t nameLen = strcmp(name, "-") == 0 || !getScanProfile(scanMode)->active ? 0 : strlen(name);
+    if (nameLen > sizeof(payload) - len - 2) {
+        nameLen = sizeof(payload) - len - 2; // Real adverts can't carry more either
+    }
+    if (nameLen > 0) {
+        payload[len++] = nameLen + 1;
+        payload[len++] = AD_TYPE_COMPLETE_NAME;
+        memcpy(payload + len, name, nameLen);
+        len += nameLen;
+    }
+
+    // Traces don't record the address type, static random addresses have the top two bits set
+    uint8_t macType = (mac[0] & 0xC0) == 0xC0 ? BEACON_ADDR_RANDOM : BEACON_ADDR_PUBLIC;
+    std::chrono::steady_clock::time_point heard = std::chrono::steady_clock::now();
+    uint32_t allocated = simAllocations();
+    uint64_t allocatedBytes = simAllocatedBytes();
+    bool detected = detectBeaconAdvert(payload, len, mac, macType, rssi, &detection);
+    // A day of adverts replays in seconds, give the capture task the time it would have had to write each buffer
+    while (capture && getCaptureStatus().writing) {
+        std::this_thread::yield();
+    }
+    if (detected) {
+        stats.detections++;
+        std::chrono::steady_clock::time_point decided = std::chrono::steady_clock::now();
+        DOORTUNING tuning = getTuning();
+        handleBeaconDetection(&detection, tuning.open_threshold, tuning.approach_rate);
+        stats.decision_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - decided).count();
+        stats.advert_allocations += simAllocations() - allocated;
+        stats.advert_bytes += simAllocatedBytes() - allocatedBytes;
+
+        if (getScanMode() != scanMode) {
+            // loop() stops the scan and starts a new one with the alert profile
+            scanMode = getScanMode();
+            startWindow(simTimeUs() / 1000);
+        }
+
+        // The door task would wake for whatever the decision queued now rather than at the next trace line
+        advertHeard = heard;
+        advertPending = true;
+        runUntil(simTimeUs() / 1000);
+        advertPending = false;
+    } else {
+        stats.advert_allocations += simAllocations() - allocated;
+        stats.advert_bytes += simAllocatedBytes() - allocatedBytes;
+    }
+
+    return;
+}
+
+// Door mask for a trace line's optional door id, every door if it hasn't got one
+static uint8_t traceDoors(const char *id, bool given) {
+    if (!given) {
+        return DOOR_ALL;
+    }
+
+    return atoi(id) < getDoorCount() ? 1 << atoi(id) : 0;
+}
+
+static void replayLine(char *line) {
+    unsigned long long timeMs;
+    char event[16], arg1[BEACON_NAME_MAX_LEN], arg2[BEACON_NAME_MAX_LEN], arg3[16];
+
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+
+    int fields = sscanf(line, "%llu %15s %99s %99s %15s", &timeMs, event, arg1, arg2, arg3);
+    if (fields <= 0) {
+        return; // Blank or comment
+    }
+    if (fields < 3) {
+        fprintf(stderr, "line %u: expected \"<ms> <event> <args>\"\n", stats.lines);
+        return;
+    }
+    timeMs += traceStartMs;
+
+    runUntil(timeMs);
+    runScanner(timeMs);
+
+    uint32_t changes = stats.config_changes;
+    CONFIGSTATS config = getConfigStats();
+
+    if (strcmp(event, "advert") == 0 && fields == 5) {
+        replayAdvert(arg1, arg2, atoi(arg3));
+    } else if (strcmp(event, "beacon") == 0) {
+        int8_t threshold = fields >= 4 ? atoi(arg2) : BEACON_THRESHOLD_GLOBAL;
+        uint8_t index = addBeacon(arg1, threshold, BEACON_PERM_OPEN | (calibrate ? BEACON_PERM_CALIBRATE : 0));
+        if (index == BEACON_REGISTRY_EMPTY) {
+            fprintf(stderr, "line %u: registry full\n", stats.lines);
+        } else {
+            stats.config_changes++;
+            if (fields >= 5) {
+                setBeaconDoors(index, strtoul(arg3, NULL, 0));
+            }
+            saveBeaconRegistry(); // As the web page's add and door routes do
+        }
+        if (index != BEACON_REGISTRY_EMPTY && index >= aloneCount) {
+            FILTERALONE *beacon = &aloneBeacons[aloneCount++];
+            beacon->index = index;
+            beacon->open_threshold = threshold;
+            resetRSSIFilter(&beacon->rssi);
+        }
+    } else if (strcmp(event, "at-door") == 0) {
+        atDoorTimes.push_back(timeMs);
+    } else if (strcmp(event, "switch") == 0) {
+        const DOORSPEC *door = getDoorSpec(fields >= 4 ? atoi(arg2) : 0);
+        if (door == NULL || door->switch_pin == DOOR_NO_PIN) {
+            fprintf(stderr, "line %u: no such door or it has no switch\n", stats.lines);
+        } else {
+            simSetPinLevel(door->switch_pin, strcmp(arg1, "locked") == 0 ? LOCKOUT_SWITCH_LOCKED : LOCKOUT_SWITCH_UNLOCKED);
+        }
+    } else if (strcmp(event, "web") == 0 && strcmp(arg1, "open") == 0) {
+        webOpenMs = timeMs;
+        postDoorEvent(door_event_web_open, micros(), 0, traceDoors(arg2, fields >= 4));
+    } else if (strcmp(event, "web") == 0 && strcmp(arg1, "lock") == 0) {
+        postDoorEvent(door_event_web_lock, micros(), 0, traceDoors(arg2, fields >= 4));
+    } else if (strcmp(event, "web") == 0 && strcmp(arg1, "unlock") == 0) {
+        postDoorEvent(door_event_web_unlock, micros(), 0, traceDoors(arg2, fields >= 4));
+    } else if (strcmp(event, "web") == 0 && strcmp(arg1, "lock-for") == 0 && fields >= 4) {
+        postDoorEvent(door_event_timed_lock, micros(), constrain(atoi(arg2), 0, TIMED_LOCK_MAX_MIN));
+    } else if (strcmp(event, "clock") == 0) {
+        setWallClock(strtoull(arg1, NULL, 10) * 1000);
+    } else if (strcmp(event, "curfew") == 0 && fields >= 4) {
+        unsigned int startHour, startMinute, endHour, endMinute;
+        if (sscanf(arg1, "%u:%u", &startHour, &startMinute) != 2 || sscanf(arg2, "%u:%u", &endHour, &endMinute) != 2 ||
+                !addCurfew(startHour * 60 + startMinute, endHour * 60 + endMinute)) {
+            fprintf(stderr, "line %u: bad or too many curfews\n", stats.lines);
+        } else {
+            stats.config_changes++;
+        }
+    } else {
+        fprintf(stderr, "line %u: unknown event %s\n", stats.lines, event);
+    }
+
+    if (stats.config_changes != changes) {
+        stats.change_commits += getConfigStats().commits - config.commits;
+        stats.change_bytes += getConfigStats().bytes_written - config.bytes_written;
+    }
+
+    return;
+}
+
+// Pairs each time the dog reached the door with the first unclaimed open around it, sorted waits and counts are returned
+// Returns the opens no visit claimed
+static uint32_t pairDoorVisits(const std::vector<uint64_t> &openTimes, std::vector<uint64_t> *waits, uint32_t *missed) {
+    std::vector<bool> claimed(openTimes.size(), false);
+
+    *missed = 0;
+    for (size_t i = 0; i < atDoorTimes.size(); i++) {
+        uint64_t arrived = atDoorTimes[i];
+        size_t open = 0;
+
+        while (open < openTimes.size() && (claimed[open] || openTimes[open] + SIM_EARLY_OPEN_MS < arrived)) {
+            open++;
+        }
+        // The owner letting the dog through first means the beacon didn't
+        std::vector<uint64_t>::iterator owner = std::lower_bound(ownerOpenTimes.begin(), ownerOpenTimes.end(), arrived);
+        uint64_t ownerOpened = owner == ownerOpenTimes.end() ? UINT64_MAX : *owner;
+        if (open == openTimes.size() || openTimes[open] > arrived + SIM_GAVE_UP_MS || openTimes[open] > ownerOpened) {
+            (*missed)++;
+            continue;
+        }
+
+        claimed[open] = true;
+        waits->push_back(openTimes[open] > arrived ? openTimes[open] - arrived : 0);
+    }
+
+    uint32_t falseOpens = 0;
+    for (size_t i = 0; i < claimed.size(); i++) {
+        falseOpens += !claimed[i];
+    }
+    std::sort(waits->begin(), waits->end());
+
+    return falseOpens;
+}
+
+static uint64_t meanOf(const std::vector<uint64_t> &values) {
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < values.size(); i++) {
+        total += values[i];
+    }
+
+    return values.empty() ? 0 : total / values.size();
+}
+
+static uint64_t p95Of(const std::vector<uint64_t> &sorted) {
+    return sorted.empty() ? 0 : sorted[sorted.size() * 95 / 100];
+}
+
+static void scoreDoorVisits() {
+    std::vector<uint64_t> waits;
+    uint32_t missed;
+    uint32_t falseOpens = pairDoorVisits(openTimes, &waits, &missed);
+
+    fprintf(stderr, "at door %u: waited mean %llums, p95 %llums, not opened by the beacon %u (owner opened %u), opens with no dog %u\n",
+        (unsigned) atDoorTimes.size(), (unsigned long long) meanOf(waits), (unsigned long long) p95Of(waits), missed,
+        (unsigned) ownerOpenTimes.size(), falseOpens);
+
+    return;
+}
+
+static void scoreFilterAlone() {
+    std::sort(aloneLatencies.begin(), aloneLatencies.end());
+    fprintf(stderr, "filter alone: %u opens, %u of %u visits opened, approach to open mean %llums, p95 %llums\n",
+        (unsigned) aloneOpenTimes.size(), (unsigned) aloneLatencies.size(), aloneVisits, (unsigned long long) meanOf(aloneLatencies),
+        (unsigned long long) p95Of(aloneLatencies));
+
+    if (!atDoorTimes.empty()) {
+        std::vector<uint64_t> waits;
+        uint32_t missed;
+        uint32_t falseOpens = pairDoorVisits(aloneOpenTimes, &waits, &missed);
+        fprintf(stderr, "filter alone at the door: waited mean %llums, p95 %llums, missed %u of %u, false opens %u\n",
+            (unsigned long long) meanOf(waits), (unsigned long long) p95Of(waits), missed, (unsigned) atDoorTimes.size(), falseOpens);
+    }
+
+    return;
+}
+
+// Read only view of the replay once it has finished
+static void handleSimSummary(const HTTPREQUEST *request, WEBRESPONSE *response) {
+    response->content_type = "application/json";
+    appendResponse(response, "{\"sim_time_ms\":%llu,\"unheard\":%u,\"filtered\":%u,\"adverts\":%u,\"detections\":%u,\"opens\":%u,\"open_ms\":%llu,\"unlock_cycles\":%u,\"max_open_latency_us\":%u,\"allocations\":%u,\"config_commits\":%u,",
+        (unsigned long long) (simTimeUs() / 1000), stats.unheard, stats.filtered, stats.adverts, stats.detections, stats.opens, (unsigned long long) stats.open_ms,
+        getUnlockCycles(), getMaxOpenLatency(), simAllocations(), getConfigStats().commits);
+
+    // Trace names are plain words, no escaping needed
+    appendResponse(response, "\"beacons\":[");
+    bool first = true;
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        BEACONENTRY *beacon = getBeacon(i);
+        if (beacon != NULL) {
+            appendResponse(response, "%s{\"id\":%u,\"name\":\"%.*s\"}", first ? "" : ",", i, beacon->matcher.name_len, beacon->matcher.name);
+            first = false;
+        }
+    }
+    appendResponse(response, "],\"capture\":");
+    renderCaptureStatus(response);
+    appendResponse(response, ",\"mqtt\":");
+    renderTelemetryStatus(response);
+    appendResponse(response, "}");
+
+    return;
+}
+
+static void handleSimMetrics(const HTTPREQUEST *request, WEBRESPONSE *response) {
+    renderMetrics(response);
+
+    return;
+}
+
+// Once serving, the door runs on its own task as on the board, so these act straight away
+static void handleSimLockOn(const HTTPREQUEST *request, WEBRESPONSE *response) {
+    postDoorEvent(door_event_web_lock, micros());
+    handleSimSummary(request, response);
+
+    return;
+}
+
+static void handleSimLockOff(const HTTPREQUEST *request, WEBRESPONSE *response) {
+    postDoorEvent(door_event_web_unlock, micros());
+    handleSimSummary(request, response);
+
+    return;
+}
+
+static void handleSimTasks(const HTTPREQUEST *request, WEBRESPONSE *response) {
+    renderTaskReport(response);
+
+    return;
+}
+
+static constexpr WEBROUTE simRoutes[] = {
+    WEB_ROUTE(http_get, "/", NULL, handleSimSummary),
+    WEB_ROUTE(http_get, "/api/status", NULL, handleSimSummary),
+    WEB_ROUTE(http_get, "/metrics", NULL, handleSimMetrics),
+    WEB_ROUTE(http_get, "/api/tasks", NULL, handleSimTasks),
+    WEB_ROUTE(http_get, "/lock/on", NULL, handleSimLockOn),
+    WEB_ROUTE(http_get, "/lock/off", NULL, handleSimLockOff),
+    WEB_ROUTE(http_get, "/api/capture", NULL, renderCaptureChunk)
+};
+static_assert(webRoutesUnique(simRoutes, sizeof(simRoutes) / sizeof(simRoutes[0])), "Route table has a path listed twice");
+
+int main(int argc, char **argv) {
+    const char *tracePath = NULL;
+    bool serve = false;
+    const char *mqttBroker = NULL;
+    const char *selfTest = NULL;
+    const char *bench = NULL;
+    DOORTUNING tuning = getTuning();
+    char line[SIM_LINE_LEN];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--open-time-ms") == 0 && i + 1 < argc) {
+            openTimeMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            tuning.open_threshold = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--approach-rate") == 0 && i + 1 < argc) {
+            tuning.approach_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scan") == 0 && i + 1 < argc) {
+            adaptiveScan = strcmp(argv[++i], "fixed") != 0;
+        } else if (strcmp(argv[i], "--controller-filter") == 0 && i + 1 < argc) {
+            controllerFilter = strcmp(argv[++i], "off") != 0;
+        } else if (strcmp(argv[i], "--calibrate") == 0 && i + 1 < argc) {
+            calibrate = strcmp(argv[++i], "off") != 0;
+        } else if (strcmp(argv[i], "--start-ms") == 0 && i + 1 < argc) {
+            traceStartMs = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--capture") == 0) {
+            capture = true;
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            serve = true;
+        } else if (strcmp(argv[i], "--mqtt") == 0 && i + 1 < argc) {
+            mqttBroker = argv[++i];
+        } else if (strcmp(argv[i], "--selftest") == 0 && i + 1 < argc) {
+            selfTest = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench = argv[++i];
+        } else if (tracePath == NULL) {
+            tracePath = argv[i];
+        } else {
+            tracePath = NULL;
+            break;
+        }
+    }
+    if (selfTest != NULL && strcmp(selfTest, "transitions") == 0) {
+        return runTransitionTest();
+    }
+    if (selfTest != NULL && strcmp(selfTest, "wheel") == 0) {
+        return runWheelSelfTest();
+    }
+    if (selfTest != NULL && strcmp(selfTest, "journal") == 0) {
+        return runJournalSelfTest();
+    }
+    if (bench != NULL && strcmp(bench, "log") == 0) {
+        return runLogBench();
+    }
+    if (bench != NULL && strcmp(bench, "registry") == 0) {
+        return runRegistryBench();
+    }
+    if (tracePath == NULL || selfTest != NULL || bench != NULL) {
+        fprintf(stderr, "usage: %s <trace|-> [--open-time-ms N] [--threshold dBm] [--approach-rate dB/s] [--scan adaptive|fixed] [--controller-filter on|off] [--calibrate on|off] [--start-ms N] [--capture] [--serve [--mqtt host:port]]\n"
+            "       %s --selftest transitions|wheel|journal\n"
+            "       %s --bench log|registry\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+
+    if (!setTuning(tuning)) {
+        fprintf(stderr, "built with DOOR_TUNING_FIXED, the %s profile opens at %d with an approach rate of %d\n",
+            doorProfile.name, doorProfile.open_threshold, doorProfile.approach_rate);
+        return 2;
+    }
+
+    FILE *trace = strcmp(tracePath, "-") == 0 ? stdin : fopen(tracePath, "r");
+    if (trace == NULL) {
+        perror(tracePath);
+        return 1;
+    }
+
+    // Same bring-up order as setup(), minus the radio and WiFi
+    simSetTimeUs(traceStartMs * 1000);
+    simOnPinWrite(relayChanged);
+    initLogger();
+    initDoorControl(openTimeMs);
+    initJournal();
+    setUnlockCycles(journalRecoveredUnlockCycles());
+    initRssiCapture();
+    if (capture) {
+        startRssiCapture();
+    }
+    configBegin(&memoryConfigBackend);
+    loadBeaconRegistry();
+    loadDoorSchedule();
+    initScanScheduler(adaptiveScan, millis());
+    startWindow(traceStartMs);
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    while (fgets(line, sizeof(line), trace) != NULL) {
+        stats.lines++;
+        replayLine(line);
+    }
+    runUntil(simTimeUs() / 1000 + openTimeMs + SIM_SETTLE_MS);
+    if (capture) {
+        stopRssiCapture();
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    if (trace != stdin) {
+        fclose(trace);
+    }
+    fflush(stdout);
+
+    double simSeconds = (simTimeUs() / 1000 - traceStartMs) / 1e3;
+    fprintf(stderr, "replayed %u lines, %.1fs of trace in %.3fs (%.0fx)\n", stats.lines, simSeconds, wallSeconds,
+        wallSeconds > 0 ? simSeconds / wallSeconds : 0.0);
+    fprintf(stderr, "adverts %u (%u unheard), detections %u, opens %u, open for %llums, unlock cycles %u\n",
+        stats.adverts, stats.unheard, stats.detections, stats.opens, (unsigned long long) stats.open_ms, getUnlockCycles());
+    uint32_t hostAdverts = stats.adverts - stats.unheard - stats.filtered;
+    fprintf(stderr, "host adverts %u (%u filtered by the controller), %.1f per window, %u of %u windows filtered\n",
+        hostAdverts, stats.filtered, stats.windows > 0 ? (double) hostAdverts / stats.windows : 0.0, stats.filtered_windows, stats.windows);
+    fprintf(stderr, "decision path: %.0fns per detection, %s profile with %s tuning\n", stats.detections > 0 ? (double) stats.decision_ns / stats.detections : 0.0,
+        doorProfile.name, tuningFixed() ? "fixed" : "runtime");
+    std::sort(advertToRelayNs.begin(), advertToRelayNs.end());
+    if (!advertToRelayNs.empty()) {
+        fprintf(stderr, "advert to relay: %u opens, p50 %.1fus, p99 %.1fus, max %.1fus\n", (unsigned) advertToRelayNs.size(),
+            advertToRelayNs[advertToRelayNs.size() / 2] / 1e3, advertToRelayNs[advertToRelayNs.size() * 99 / 100] / 1e3, advertToRelayNs.back() / 1e3);
+    }
+    fprintf(stderr, "heap: %u allocations in the advert path, %.2f per advert heard, %llu bytes, %.1f per advert heard\n", stats.advert_allocations,
+        hostAdverts > 0 ? (double) stats.advert_allocations / hostAdverts : 0.0, (unsigned long long) stats.advert_bytes,
+        hostAdverts > 0 ? (double) stats.advert_bytes / hostAdverts : 0.0);
+    fprintf(stderr, "config: %u changes, %u flash commits (%.2f per change), %u bytes written, %u commits in all\n", stats.config_changes,
+        stats.change_commits, stats.config_changes > 0 ? (double) stats.change_commits / stats.config_changes : 0.0, stats.change_bytes,
+        getConfigStats().commits);
+
+    uint32_t endMs = millis();
+    uint64_t elapsedMs = simTimeUs() / 1000 - traceStartMs;
+    fprintf(stderr, "scan modes: idle %us, idle (active) %us, alert %us\n", getScanModeTime(scan_mode_idle, endMs) / 1000,
+        getScanModeTime(scan_mode_idle_active, endMs) / 1000, getScanModeTime(scan_mode_alert, endMs) / 1000);
+    fprintf(stderr, "energy model: %.2fmAh, average %.1fmA\n", scanEnergy_uAms(endMs) / 3.6e9,
+        elapsedMs > 0 ? scanEnergy_uAms(endMs) / 1000.0 / elapsedMs : 0.0);
+
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        BEACONENTRY *beacon = getBeacon(i);
+        if (beacon != NULL) {
+            int threshold = beacon->open_threshold != BEACON_THRESHOLD_GLOBAL ? beacon->open_threshold : tuning.open_threshold;
+            fprintf(stderr, "beacon %s: threshold %d, %u visits, %u passages, %u%% of passages reach it\n", beacon->matcher.name, threshold,
+                beacon->calibration.nearby_total, beacon->calibration.passed_total, calibrationPassageCoverage(&beacon->calibration, threshold) / 10);
+        }
+    }
+    if (!atDoorTimes.empty()) {
+        scoreDoorVisits();
+    }
+    scoreFilterAlone();
+    if (capture) {
+        CAPTURESTATUS status = getCaptureStatus();
+        while (status.writing) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            status = getCaptureStatus();
+        }
+        fprintf(stderr, "capture: %u records of %u, %u dropped%s\n", status.records, status.capacity, status.dropped, status.full ? ", partition full" : "");
+    }
+
+    if (serve) {
+        fprintf(stderr, "serving results on port %d\n", WEB_SERVER_PORT);
+        simFollowRealTime();
+        startTask(task_door, handle_door_lock);
+        if (mqttBroker != NULL) {
+            initTelemetry();
+            setTelemetryBroker(mqttBroker);
+        }
+        runWebServer(simRoutes, sizeof(simRoutes) / sizeof(simRoutes[0]));
+    }
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "beaconMatcher.hpp"
+
+// FNV-1a, cheap enough to run on every advert and good enough to reject non-matching names
+uint32_t hashBeaconName(const uint8_t *name, uint8_t len) {
+    uint32_t hash = 2166136261UL;
+
+    for (uint8_t i = 0; i < len; i++) {
+        hash ^= name[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+void initBeaconMatcher(BEACONMATCHER *matcher, const char *name) {
+    size_t len = strnlen(name, BEACON_NAME_MAX_LEN - 1);
+
+    memcpy(matcher->name, name, len);
+    matcher->name[len] = '\0';
+    matcher->name_len = len;
+    matcher->name_hash = hashBeaconName((const uint8_t *) matcher->name, len);
+    memset(matcher->mac, 0, BLE_MAC_LEN);
+    matcher->mac_known = false;
+    matcher->mac_type = BEACON_ADDR_PUBLIC;
+
+    return;
+}
+
+// Public and random static addresses stay put, resolvable and non-resolvable private ones rotate
+// mac[0] is the most significant byte, its top two bits give the random address sub-type
+bool beaconAddressIsStable(const BEACONMATCHER *matcher) {
+    if (!matcher->mac_known) {
+        return false;
+    }
+
+    return matcher->mac_type == BEACON_ADDR_PUBLIC || (matcher->mac[0] & 0xC0) == 0xC0;
+}
+
+// Walks the AD structures of a raw advert (and scan response) in place
+// Returns true and points name at the name bytes within payload if one is present
+bool findAdvertName(const uint8_t *payload, size_t payloadLen, const uint8_t **name, uint8_t *nameLen) {
+    size_t i = 0;
+
+    while (i < payloadLen) {
+        uint8_t fieldLen = payload[i]; // Length covers the type byte and the data
+
+        if (fieldLen == 0 || i + 1 + fieldLen > payloadLen) {
+            break; // End of significant data or malformed advert
+        }
+
+        uint8_t fieldType = payload[i + 1];
+        if (fieldType == AD_TYPE_COMPLETE_NAME || fieldType == AD_TYPE_SHORT_NAME) {
+            *name = &payload[i + 2];
+            *nameLen = fieldLen - 1;
+            return true;
+        }
+
+        i += 1 + fieldLen;
+    }
+
+    return false;
+}
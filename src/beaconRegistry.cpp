@@ -0,0 +1,387 @@
+#include "beaconRegistry.hpp"
+#include "configStore.hpp"
+#include "freertos/semphr.h"
+
+static BEACONENTRY beacons[BEACON_REGISTRY_MAX];
+static uint8_t beaconCount = 0;
+
+// Open addressing tables of (index + 1) into beacons[], one keyed by MAC and one by name hash
+// Zero marks an empty bucket so the tables are valid before anything is loaded
+static uint8_t macTable[BEACON_REGISTRY_BUCKETS];
+static uint8_t nameTable[BEACON_REGISTRY_BUCKETS];
+
+// Lookups run in the BLE callback while edits come from the web task
+static portMUX_TYPE registryMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t generation = 0; // Bumped on every change to the set of beacons or their addresses
+
+static void insertIntoTable(uint8_t *table, uint32_t hash, uint8_t index) {
+    uint32_t bucket = hash & (BEACON_REGISTRY_BUCKETS - 1);
+
+    while (table[bucket] != 0) {
+        bucket = (bucket + 1) & (BEACON_REGISTRY_BUCKETS - 1);
+    }
+
+    table[bucket] = index + 1;
+}
+
+// Tables are small enough that removals just rebuild them
+static void rebuildTables() {
+    generation++;
+    memset(macTable, 0, sizeof(macTable));
+    memset(nameTable, 0, sizeof(nameTable));
+
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        if (!beacons[i].in_use) {
+            continue;
+        }
+
+        insertIntoTable(nameTable, beacons[i].matcher.name_hash, i);
+        if (beacons[i].matcher.mac_known) {
+            insertIntoTable(macTable, hashBeaconName(beacons[i].matcher.mac, BLE_MAC_LEN), i);
+        }
+    }
+}
+
+static uint8_t findByMAC(const uint8_t *mac) {
+    uint32_t bucket = hashBeaconName(mac, BLE_MAC_LEN) & (BEACON_REGISTRY_BUCKETS - 1);
+
+    while (macTable[bucket] != 0) {
+        uint8_t index = macTable[bucket] - 1;
+        if (memcmp(beacons[index].matcher.mac, mac, BLE_MAC_LEN) == 0) {
+            return index;
+        }
+        bucket = (bucket + 1) & (BEACON_REGISTRY_BUCKETS - 1);
+    }
+
+    return BEACON_REGISTRY_EMPTY;
+}
+
+/* Backward shift delete of a beacon's current MAC from the linear probing table
+ * Entries further along the run move back into the gap unless that would put them before their home bucket,
+ * so every remaining key is still reachable without tombstones
+*/
+static void removeFromMacTable(uint8_t index) {
+    uint32_t bucket = hashBeaconName(beacons[index].matcher.mac, BLE_MAC_LEN) & (BEACON_REGISTRY_BUCKETS - 1);
+
+    while (macTable[bucket] != index + 1) {
+        if (macTable[bucket] == 0) {
+            return; // Not in the table
+        }
+        bucket = (bucket + 1) & (BEACON_REGISTRY_BUCKETS - 1);
+    }
+
+    uint32_t gap = bucket;
+    bucket = (bucket + 1) & (BEACON_REGISTRY_BUCKETS - 1);
+
+    while (macTable[bucket] != 0) {
+        uint8_t other = macTable[bucket] - 1;
+        uint32_t home = hashBeaconName(beacons[other].matcher.mac, BLE_MAC_LEN) & (BEACON_REGISTRY_BUCKETS - 1);
+
+        // The gap lies between this entry's home bucket and where it sits, so it can move back
+        if (((bucket - home) & (BEACON_REGISTRY_BUCKETS - 1)) >= ((bucket - gap) & (BEACON_REGISTRY_BUCKETS - 1))) {
+            macTable[gap] = macTable[bucket];
+            gap = bucket;
+        }
+        bucket = (bucket + 1) & (BEACON_REGISTRY_BUCKETS - 1);
+    }
+
+    macTable[gap] = 0;
+}
+
+// Moves one beacon to a new address, touching only its own MAC bucket, caller holds registryMux
+static void learnMAC(uint8_t index, const uint8_t *mac, uint8_t macType) {
+    if (beacons[index].matcher.mac_known) {
+        removeFromMacTable(index);
+    }
+
+    memcpy(beacons[index].matcher.mac, mac, BLE_MAC_LEN);
+    beacons[index].matcher.mac_known = true;
+    beacons[index].matcher.mac_type = macType;
+    insertIntoTable(macTable, hashBeaconName(mac, BLE_MAC_LEN), index);
+    generation++;
+}
+
+static uint8_t findByName(const uint8_t *name, uint8_t nameLen) {
+    uint32_t hash = hashBeaconName(name, nameLen);
+    uint32_t bucket = hash & (BEACON_REGISTRY_BUCKETS - 1);
+
+    while (nameTable[bucket] != 0) {
+        uint8_t index = nameTable[bucket] - 1;
+        BEACONMATCHER *matcher = &beacons[index].matcher;
+        if (matcher->name_hash == hash && matcher->name_len == nameLen && memcmp(matcher->name, name, nameLen) == 0) {
+            return index;
+        }
+        bucket = (bucket + 1) & (BEACON_REGISTRY_BUCKETS - 1);
+    }
+
+    return BEACON_REGISTRY_EMPTY;
+}
+
+/* Called for every advert heard, cost is constant regardless of how many beacons are registered
+ * A new or rotated address moves only that beacon's MAC entry, so two beacons sharing a name
+ * and taking turns on the address costs a few probes per advert rather than a table rebuild
+*/
+// Returns the index of the matching beacon, or BEACON_REGISTRY_EMPTY
+uint8_t lookupBeaconAdvert(const uint8_t *payload, size_t payloadLen, const uint8_t *mac, uint8_t macType) {
+    uint8_t index;
+
+    portENTER_CRITICAL(&registryMux);
+
+    index = findByMAC(mac);
+
+    if (index == BEACON_REGISTRY_EMPTY) {
+        const uint8_t *name;
+        uint8_t nameLen;
+
+        // Unknown or rotated address, fall back to the advertised name and learn the new MAC
+        if (findAdvertName(payload, payloadLen, &name, &nameLen)) {
+            index = findByName(name, nameLen);
+            if (index != BEACON_REGISTRY_EMPTY) {
+                learnMAC(index, mac, macType);
+            }
+        }
+    }
+
+    portEXIT_CRITICAL(&registryMux);
+
+    return index;
+}
+
+// Returns the index of the new (or already registered) beacon, or BEACON_REGISTRY_EMPTY if full
+uint8_t addBeacon(const char *name, int8_t openThreshold, uint8_t permissions) {
+    uint8_t nameLen = strnlen(name, BEACON_REGISTRY_NAME_LEN - 1);
+    uint8_t index;
+
+    portENTER_CRITICAL(&registryMux);
+
+    index = findByName((const uint8_t *) name, nameLen);
+
+    if (index == BEACON_REGISTRY_EMPTY && beaconCount < BEACON_REGISTRY_MAX) {
+        for (index = 0; beacons[index].in_use; index++);
+
+        char truncated[BEACON_REGISTRY_NAME_LEN];
+        memcpy(truncated, name, nameLen);
+        truncated[nameLen] = '\0';
+
+        initBeaconMatcher(&beacons[index].matcher, truncated);
+        resetRSSIFilter(&beacons[index].rssi);
+        resetCalibration(&beacons[index].calibration);
+        beacons[index].open_threshold = openThreshold;
+        beacons[index].permissions = permissions;
+        beacons[index].doors = BEACON_DOORS_ALL;
+        beacons[index].last_seen_ms = 0;
+        beacons[index].in_use = true;
+        beaconCount++;
+
+        insertIntoTable(nameTable, beacons[index].matcher.name_hash, index);
+        generation++;
+    }
+
+    portEXIT_CRITICAL(&registryMux);
+
+    return index;
+}
+
+bool removeBeacon(uint8_t index) {
+    if (index >= BEACON_REGISTRY_MAX || !beacons[index].in_use) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&registryMux);
+    beacons[index].in_use = false;
+    beaconCount--;
+    rebuildTables();
+    portEXIT_CRITICAL(&registryMux);
+
+    return true;
+}
+
+bool setBeaconPermissions(uint8_t index, uint8_t permissions) {
+    if (index >= BEACON_REGISTRY_MAX || !beacons[index].in_use) {
+        return false;
+    }
+
+    beacons[index].permissions = permissions;
+
+    return true;
+}
+
+bool setBeaconThreshold(uint8_t index, int8_t openThreshold) {
+    if (index >= BEACON_REGISTRY_MAX || !beacons[index].in_use) {
+        return false;
+    }
+
+    beacons[index].open_threshold = openThreshold;
+
+    return true;
+}
+
+bool setBeaconDoors(uint8_t index, uint8_t doors) {
+    if (index >= BEACON_REGISTRY_MAX || !beacons[index].in_use) {
+        return false;
+    }
+
+    beacons[index].doors = doors;
+
+    return true;
+}
+
+BEACONENTRY *getBeacon(uint8_t index) {
+    if (index >= BEACON_REGISTRY_MAX || !beacons[index].in_use) {
+        return NULL;
+    }
+
+    return &beacons[index];
+}
+
+uint8_t getBeaconCount() {
+    return beaconCount;
+}
+
+// True once every registered beacon has been heard by name, so adverts without a name (e.g. passive scans) still match
+bool beaconAddressesKnown() {
+    bool known = true;
+
+    portENTER_CRITICAL(&registryMux);
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        if (beacons[i].in_use && !beacons[i].matcher.mac_known) {
+            known = false;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&registryMux);
+
+    return known;
+}
+
+// Fills in the address of every registered beacon for the controller's accept list
+// Returns BEACON_REGISTRY_EMPTY if any beacon has no address yet, a rotating one, or there are more than max
+uint8_t getStableBeaconAddresses(uint8_t (*macs)[BLE_MAC_LEN], uint8_t *macTypes, uint8_t max) {
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&registryMux);
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        if (!beacons[i].in_use) {
+            continue;
+        }
+        if (count == max || !beaconAddressIsStable(&beacons[i].matcher)) {
+            count = BEACON_REGISTRY_EMPTY;
+            break;
+        }
+
+        memcpy(macs[count], beacons[i].matcher.mac, BLE_MAC_LEN);
+        macTypes[count] = beacons[i].matcher.mac_type;
+        count++;
+    }
+    portEXIT_CRITICAL(&registryMux);
+
+    return count;
+}
+
+uint32_t getRegistryGeneration() {
+    portENTER_CRITICAL(&registryMux);
+    uint32_t current = generation;
+    portEXIT_CRITICAL(&registryMux);
+
+    return current;
+}
+
+#define BEACON_REGISTRY_BLOB_LEN (1 + BEACON_REGISTRY_MAX * BEACON_RECORD_SIZE)
+
+// Staging buffer for the config record, only used while loading or saving and only with blobLock held
+// loop() saves after calibration, the web task and provisioning after edits, so saves can overlap
+static uint8_t registryBlob[BEACON_REGISTRY_BLOB_LEN];
+static SemaphoreHandle_t blobLock = NULL; // Taken before the config store's own lock, never the other way round
+
+/* Layout of the config_beacon_registry record
+  * byte 0: number of records
+  * then BEACON_RECORD_SIZE per record:
+  *   [name len][name][open threshold][permissions][mac known][mac][mac type][doors]
+  * Records saved before there were several doors have 0 for doors, and open all of them
+*/
+void loadBeaconRegistry() {
+    if (blobLock == NULL) {
+        blobLock = xSemaphoreCreateMutex(); // Loaded in setup() before any task that saves is started
+    }
+    xSemaphoreTake(blobLock, portMAX_DELAY);
+
+    int32_t len = configRead(config_beacon_registry, registryBlob, BEACON_REGISTRY_BLOB_LEN);
+    uint8_t count = len > 0 ? registryBlob[0] : 0;
+
+    portENTER_CRITICAL(&registryMux);
+    memset(beacons, 0, sizeof(beacons));
+    beaconCount = 0;
+    rebuildTables();
+    portEXIT_CRITICAL(&registryMux);
+
+    if (count > BEACON_REGISTRY_MAX || len < 1 + count * BEACON_RECORD_SIZE) {
+        xSemaphoreGive(blobLock);
+        return; // Missing or corrupt
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        const uint8_t *record = &registryBlob[1 + i * BEACON_RECORD_SIZE];
+
+        uint8_t nameLen = record[0];
+        if (nameLen == 0 || nameLen >= BEACON_REGISTRY_NAME_LEN) {
+            continue;
+        }
+
+        char name[BEACON_REGISTRY_NAME_LEN];
+        memcpy(name, &record[1], nameLen);
+        name[nameLen] = '\0';
+
+        uint8_t index = addBeacon(name, (int8_t) record[BEACON_REGISTRY_NAME_LEN], record[BEACON_REGISTRY_NAME_LEN + 1]);
+        if (index != BEACON_REGISTRY_EMPTY && record[BEACON_REGISTRY_NAME_LEN + 2]) {
+            portENTER_CRITICAL(&registryMux);
+            learnMAC(index, &record[BEACON_REGISTRY_NAME_LEN + 3], record[BEACON_REGISTRY_NAME_LEN + 3 + BLE_MAC_LEN]);
+            portEXIT_CRITICAL(&registryMux);
+        }
+        if (index != BEACON_REGISTRY_EMPTY && record[BEACON_REGISTRY_NAME_LEN + 4 + BLE_MAC_LEN] != 0) {
+            setBeaconDoors(index, record[BEACON_REGISTRY_NAME_LEN + 4 + BLE_MAC_LEN]);
+        }
+    }
+
+    xSemaphoreGive(blobLock);
+
+    return;
+}
+
+// Whole registry is one record, committed once (and not at all if nothing changed)
+// The blob is composed, written and committed under blobLock, so one save never stores half of another's
+void saveBeaconRegistry() {
+    uint8_t count = 0;
+
+    xSemaphoreTake(blobLock, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        uint8_t *record = &registryBlob[1 + count * BEACON_RECORD_SIZE];
+
+        portENTER_CRITICAL(&registryMux);
+        if (!beacons[i].in_use) {
+            portEXIT_CRITICAL(&registryMux);
+            continue;
+        }
+
+        memset(record, 0, BEACON_RECORD_SIZE);
+        record[0] = beacons[i].matcher.name_len;
+        memcpy(&record[1], beacons[i].matcher.name, beacons[i].matcher.name_len);
+        record[BEACON_REGISTRY_NAME_LEN] = (uint8_t) beacons[i].open_threshold;
+        record[BEACON_REGISTRY_NAME_LEN + 1] = beacons[i].permissions;
+        record[BEACON_REGISTRY_NAME_LEN + 2] = beacons[i].matcher.mac_known;
+        memcpy(&record[BEACON_REGISTRY_NAME_LEN + 3], beacons[i].matcher.mac, BLE_MAC_LEN);
+        record[BEACON_REGISTRY_NAME_LEN + 3 + BLE_MAC_LEN] = beacons[i].matcher.mac_type;
+        record[BEACON_REGISTRY_NAME_LEN + 4 + BLE_MAC_LEN] = beacons[i].doors;
+        portEXIT_CRITICAL(&registryMux);
+
+        count++;
+    }
+
+    registryBlob[0] = count;
+    configWrite(config_beacon_registry, registryBlob, 1 + count * BEACON_RECORD_SIZE);
+    configCommit();
+
+    xSemaphoreGive(blobLock);
+
+    return;
+}
@@ -0,0 +1,150 @@
+#include "bleScanner.hpp"
+#include <BLEDevice.h>
+#include <esp_gap_ble_api.h>
+#include <atomic>
+#include "beaconRegistry.hpp"
+#include "doorDecision.hpp"
+#include "metrics.hpp"
+
+/* Drives GAP scanning directly rather than through BLEScan, which builds a BLEAdvertisedDevice (heap, strings)
+  * for every advert before the application sees it. Adverts go straight from the scan result to the registry lookup.
+  * When every registered beacon has a stable address those addresses are loaded into the controller's
+  * accept list, so everyone else's adverts are dropped by the radio and never reach the host at all.
+*/
+
+static QueueHandle_t detections;
+static void (*onWindowComplete)() = NULL;
+static volatile bool scanning = false;
+static bool filterEnabled = SCAN_CONTROLLER_FILTER;
+static bool windowFiltered = false;
+static uint32_t windowCount = 0;
+static uint32_t windowHeapFree = 0; // Free heap as the current window started
+
+// Accept list as last loaded into the controller, BEACON_REGISTRY_EMPTY if the software filter is needed
+static uint8_t whitelistCount = BEACON_REGISTRY_EMPTY;
+static uint32_t whitelistGeneration = 0;
+
+// Host side cost of the current window, added to from the BLE task
+static std::atomic<uint32_t> windowHostUs(0);
+static std::atomic<uint32_t> windowAdverts(0);
+
+// Runs in the BLE task for every GAP event
+static void handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    if (event != ESP_GAP_BLE_SCAN_RESULT_EVT || !scanning) {
+        return;
+    }
+
+    if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT) {
+        uint32_t started = micros();
+        BEACONDETECTION detection;
+
+        // Adverts and scan responses arrive as separate results, either may carry the name
+        if (detectBeaconAdvert(param->scan_rst.ble_adv, param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len,
+                param->scan_rst.bda, param->scan_rst.ble_addr_type, param->scan_rst.rssi, &detection)) {
+            // Never block the BLE stack - if loop() has fallen this far behind, drop the detection
+            xQueueSend(detections, &detection, 0);
+        }
+
+        windowAdverts.fetch_add(1, std::memory_order_relaxed);
+        windowHostUs.fetch_add(micros() - started, std::memory_order_relaxed);
+    } else if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT) {
+        scanning = false;
+        onWindowComplete();
+    }
+
+    return;
+}
+
+// Reloads the accept list when the registry has changed, only called between windows
+// The controller refuses accept list changes while a filtered scan is running
+static void syncWhitelist() {
+    uint8_t macs[SCAN_WHITELIST_MAX][BLE_MAC_LEN];
+    uint8_t macTypes[SCAN_WHITELIST_MAX];
+    uint32_t generation = getRegistryGeneration();
+
+    if (generation == whitelistGeneration && whitelistCount != BEACON_REGISTRY_EMPTY) {
+        return;
+    }
+
+    whitelistGeneration = generation;
+    whitelistCount = getStableBeaconAddresses(macs, macTypes, SCAN_WHITELIST_MAX);
+    esp_ble_gap_clear_whitelist();
+
+    if (whitelistCount == BEACON_REGISTRY_EMPTY) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < whitelistCount; i++) {
+        esp_ble_gap_update_whitelist(true, macs[i], macTypes[i] == BEACON_ADDR_RANDOM ? BLE_WL_ADDR_TYPE_RANDOM : BLE_WL_ADDR_TYPE_PUBLIC);
+    }
+
+    return;
+}
+
+// Call after BLEDevice::init(), windowComplete is called from the BLE task as each window ends
+void initBLEScanner(QueueHandle_t detectionQueue, void (*windowComplete)()) {
+    detections = detectionQueue;
+    onWindowComplete = windowComplete;
+    BLEDevice::setCustomGapHandler(handleGapEvent);
+
+    return;
+}
+
+// Returns false if the stack wouldn't start the scan
+bool startScanWindow(const SCANPROFILE *profile, uint32_t durationS) {
+    esp_ble_scan_params_t params;
+
+    // Account for the window that has just ended
+    uint32_t heapFree = ESP.getFreeHeap();
+    if (windowCount > 0) {
+        recordScanWindow(windowHostUs.exchange(0, std::memory_order_relaxed), windowAdverts.exchange(0, std::memory_order_relaxed), windowFiltered,
+            windowHeapFree, heapFree, ESP.getMinFreeHeap());
+    }
+    windowHeapFree = heapFree;
+    windowCount++;
+
+    if (filterEnabled) {
+        syncWhitelist();
+    }
+    windowFiltered = filterEnabled && whitelistCount != BEACON_REGISTRY_EMPTY && whitelistCount > 0 && windowCount % SCAN_UNFILTERED_EVERY != 0;
+
+    memset(&params, 0, sizeof(params));
+    params.scan_type = profile->active ? BLE_SCAN_TYPE_ACTIVE : BLE_SCAN_TYPE_PASSIVE;
+    params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+    params.scan_filter_policy = windowFiltered ? BLE_SCAN_FILTER_ALLOW_ONLY_WLST : BLE_SCAN_FILTER_ALLOW_ALL;
+    params.scan_interval = profile->interval_ms * 8 / 5; // 0.625ms units
+    params.scan_window = profile->window_ms * 8 / 5;
+    params.scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE; // Every advert of the beacon is another RSSI sample
+
+    scanning = true;
+    if (esp_ble_gap_set_scan_params(&params) != ESP_OK || esp_ble_gap_start_scanning(durationS) != ESP_OK) {
+        scanning = false;
+        return false;
+    }
+
+    return true;
+}
+
+// Ends the current window early, no completion callback follows
+void stopScanWindow() {
+    scanning = false;
+    esp_ble_gap_stop_scanning();
+
+    return;
+}
+
+// Takes effect from the next window
+void setScanFilterEnabled(bool enabled) {
+    filterEnabled = enabled;
+    whitelistCount = BEACON_REGISTRY_EMPTY; // Reload the accept list when it's next used
+
+    return;
+}
+
+bool getScanFilterEnabled() {
+    return filterEnabled;
+}
+
+bool scanWindowFiltered() {
+    return windowFiltered;
+}
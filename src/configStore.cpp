@@ -0,0 +1,289 @@
+#include "configStore.hpp"
+#include "freertos/semphr.h"
+
+/* Layout
+  * Header: magic (4), version (2), record count (2)
+  * Then one slot per record: length (2), CRC-32 of the data (4), data (capacity)
+  * A slot with length 0xFFFF has never been written
+  * New records are appended, so a store with fewer slots than config_record_count keeps its version and has the
+  * slots it hasn't got yet added on the next boot. Changing a slot's capacity needs a new CONFIG_VERSION.
+*/
+#define CONFIG_HEADER_LEN 8
+#define CONFIG_SLOT_HEADER_LEN 6
+#define CONFIG_LEN_EMPTY 0xFFFF
+
+// Data capacity of each record's slot, indexed by CONFIGRECORD
+static constexpr uint16_t recordCapacity[config_record_count] = {
+    64, // config_wifi_ssid
+    64, // config_wifi_password
+    100, // config_dog_name
+    1540, // config_beacon_registry
+    32, // config_door_schedule
+    64 // config_mqtt_broker
+};
+
+static constexpr uint32_t layoutEnd(uint8_t records) {
+    return records == 0 ? CONFIG_HEADER_LEN : layoutEnd(records - 1) + CONFIG_SLOT_HEADER_LEN + recordCapacity[records - 1];
+}
+static_assert(layoutEnd(config_record_count) <= EEPROM_SIZE, "Config records don't fit in EEPROM_SIZE");
+
+static const CONFIGBACKEND *store = NULL;
+static SemaphoreHandle_t storeLock = NULL; // Provisioning and the web server can both write
+static bool dirty = false;
+static CONFIGSTATS stats = { 0, 0, 0 };
+
+static uint32_t crc32(const uint8_t *data, uint16_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint16_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static uint32_t slotAddress(CONFIGRECORD record) {
+    uint32_t addr = CONFIG_HEADER_LEN;
+
+    for (uint8_t i = 0; i < record; i++) {
+        addr += CONFIG_SLOT_HEADER_LEN + recordCapacity[i];
+    }
+
+    return addr;
+}
+
+static void writeHeader() {
+    uint8_t header[CONFIG_HEADER_LEN];
+    uint32_t magic = CONFIG_MAGIC;
+    uint16_t version = CONFIG_VERSION;
+    uint16_t count = config_record_count;
+
+    memcpy(&header[0], &magic, 4);
+    memcpy(&header[4], &version, 2);
+    memcpy(&header[6], &count, 2);
+    store->write(0, header, CONFIG_HEADER_LEN);
+
+    return;
+}
+
+static void eraseSlot(CONFIGRECORD record) {
+    uint8_t slotHeader[CONFIG_SLOT_HEADER_LEN];
+
+    memset(slotHeader, 0xFF, CONFIG_SLOT_HEADER_LEN);
+    store->write(slotAddress(record), slotHeader, CONFIG_SLOT_HEADER_LEN);
+    stats.bytes_written += CONFIG_SLOT_HEADER_LEN;
+    dirty = true;
+
+    return;
+}
+
+static bool commitStore() {
+    if (!dirty) {
+        return true;
+    }
+
+    dirty = false;
+    stats.commits++;
+
+    return store->commit();
+}
+
+// Returns false if the backend holds no store, or one from a different version, and formats it
+bool configBegin(const CONFIGBACKEND *backend) {
+    uint8_t header[CONFIG_HEADER_LEN];
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+
+    if (storeLock == NULL) {
+        storeLock = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+
+    store = backend;
+    dirty = false;
+
+    store->read(0, header, CONFIG_HEADER_LEN);
+    memcpy(&magic, &header[0], 4);
+    memcpy(&version, &header[4], 2);
+    memcpy(&count, &header[6], 2);
+
+    if (magic == CONFIG_MAGIC && version == CONFIG_VERSION) {
+        // Written before the last records were added, start those out empty and leave the rest as they are
+        if (count < config_record_count) {
+            writeHeader();
+            for (uint8_t i = count; i < config_record_count; i++) {
+                eraseSlot((CONFIGRECORD) i);
+            }
+            commitStore();
+        }
+        xSemaphoreGive(storeLock);
+        return true;
+    }
+
+    // Unformatted (or an incompatible layout), start every record out empty
+    writeHeader();
+    for (uint8_t i = 0; i < config_record_count; i++) {
+        eraseSlot((CONFIGRECORD) i);
+    }
+    commitStore();
+    xSemaphoreGive(storeLock);
+
+    return false;
+}
+
+// Returns the record length, or -1 if it is missing, corrupt or doesn't fit capacity
+int32_t configRead(CONFIGRECORD record, void *data, uint16_t capacity) {
+    uint8_t slotHeader[CONFIG_SLOT_HEADER_LEN];
+    uint32_t addr = slotAddress(record);
+    uint16_t len;
+    uint32_t crc;
+
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    store->read(addr, slotHeader, CONFIG_SLOT_HEADER_LEN);
+    memcpy(&len, &slotHeader[0], 2);
+    memcpy(&crc, &slotHeader[2], 4);
+
+    if (len == CONFIG_LEN_EMPTY || len > recordCapacity[record] || len > capacity) {
+        xSemaphoreGive(storeLock);
+        return -1;
+    }
+
+    store->read(addr + CONFIG_SLOT_HEADER_LEN, (uint8_t *) data, len);
+    xSemaphoreGive(storeLock);
+
+    if (crc32((const uint8_t *) data, len) != crc) {
+        return -1;
+    }
+
+    return len;
+}
+
+// Compares the stored data with data a piece at a time, so a record as big as the registry needs no buffer of its size
+static bool storedDataMatches(uint32_t addr, const uint8_t *data, uint16_t len) {
+    uint8_t stored[32];
+
+    for (uint16_t offset = 0; offset < len; offset += sizeof(stored)) {
+        uint16_t piece = (uint16_t) (len - offset) < sizeof(stored) ? len - offset : sizeof(stored);
+        store->read(addr + offset, stored, piece);
+        if (memcmp(stored, data + offset, piece) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Stages a record, nothing reaches flash until configCommit()
+// Identical data is skipped so rewriting unchanged settings costs no flash wear, a slot whose header matches but
+// whose data has gone bad is rewritten so it can be repaired
+bool configWrite(CONFIGRECORD record, const void *data, uint16_t len) {
+    uint8_t slotHeader[CONFIG_SLOT_HEADER_LEN];
+    uint32_t addr = slotAddress(record);
+    uint32_t crc = crc32((const uint8_t *) data, len);
+    uint16_t storedLen;
+    uint32_t storedCrc;
+
+    if (len > recordCapacity[record]) {
+        return false;
+    }
+
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    store->read(addr, slotHeader, CONFIG_SLOT_HEADER_LEN);
+    memcpy(&storedLen, &slotHeader[0], 2);
+    memcpy(&storedCrc, &slotHeader[2], 4);
+
+    if (storedLen == len && storedCrc == crc && storedDataMatches(addr + CONFIG_SLOT_HEADER_LEN, (const uint8_t *) data, len)) {
+        stats.writes_skipped++;
+        xSemaphoreGive(storeLock);
+        return true;
+    }
+
+    memcpy(&slotHeader[0], &len, 2);
+    memcpy(&slotHeader[2], &crc, 4);
+    store->write(addr, slotHeader, CONFIG_SLOT_HEADER_LEN);
+    store->write(addr + CONFIG_SLOT_HEADER_LEN, (const uint8_t *) data, len);
+
+    stats.bytes_written += CONFIG_SLOT_HEADER_LEN + len;
+    dirty = true;
+    xSemaphoreGive(storeLock);
+
+    return true;
+}
+
+bool configReadString(CONFIGRECORD record, char *str, uint16_t capacity) {
+    int32_t len = configRead(record, str, capacity - 1);
+
+    if (len < 0) {
+        str[0] = '\0';
+        return false;
+    }
+
+    str[len] = '\0';
+
+    return true;
+}
+
+bool configWriteString(CONFIGRECORD record, const char *str) {
+    return configWrite(record, str, strlen(str));
+}
+
+// Ends a transaction, one backend commit however many records changed
+bool configCommit() {
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    bool committed = commitStore();
+    xSemaphoreGive(storeLock);
+
+    return committed;
+}
+
+void configErase(CONFIGRECORD record) {
+    xSemaphoreTake(storeLock, portMAX_DELAY);
+    eraseSlot(record);
+    xSemaphoreGive(storeLock);
+
+    return;
+}
+
+uint16_t configCapacity(CONFIGRECORD record) {
+    return recordCapacity[record];
+}
+
+CONFIGSTATS getConfigStats() {
+    return stats;
+}
+
+// ** RAM backend, for running the store off the board ** //
+
+#define MEMORY_BACKEND_SIZE EEPROM_SIZE
+
+static uint8_t memoryImage[MEMORY_BACKEND_SIZE];
+
+static bool memoryRead(uint32_t addr, uint8_t *data, uint16_t len) {
+    if (addr + len > MEMORY_BACKEND_SIZE) {
+        return false;
+    }
+
+    memcpy(data, &memoryImage[addr], len);
+
+    return true;
+}
+
+static bool memoryWrite(uint32_t addr, const uint8_t *data, uint16_t len) {
+    if (addr + len > MEMORY_BACKEND_SIZE) {
+        return false;
+    }
+
+    memcpy(&memoryImage[addr], data, len);
+
+    return true;
+}
+
+static bool memoryCommit() {
+    return true;
+}
+
+const CONFIGBACKEND memoryConfigBackend = { memoryRead, memoryWrite, memoryCommit, MEMORY_BACKEND_SIZE };
@@ -0,0 +1,476 @@
+#include "doorControl.hpp"
+#include "doorSchedule.hpp"
+#include "logger.hpp"
+#include "eventJournal.hpp"
+#include "liveEvents.hpp"
+#include "metrics.hpp"
+#include "timerWheel.hpp"
+#include "taskTable.hpp"
+#include "telemetry.hpp"
+
+/* Every door this board drives, one row each
+  * Adverts are matched once whatever the number of doors, and a beacon's approach goes to the doors in its door
+  * mask as a single event. Web commands take ?door=<row>, and go to every door without it.
+  * Build with -DDOOR_GARAGE_FLAP for a second relay and switch.
+*/
+static const DOORSPEC doorTable[] = {
+    // name,    relay, switch, open ms, locked by
+    { "back",   4,     17,     0,       DOOR_LOCK_BY_SWITCH | DOOR_LOCK_BY_WEB | DOOR_LOCK_BY_SCHEDULE },
+#ifdef DOOR_GARAGE_FLAP
+    { "garage", 25,    13,     5000,    DOOR_LOCK_BY_SWITCH | DOOR_LOCK_BY_WEB } // Indoors, curfews don't apply
+#endif
+};
+#define DOOR_COUNT (sizeof(doorTable) / sizeof(doorTable[0]))
+#define DOOR_MASK ((1 << DOOR_COUNT) - 1)
+static_assert(DOOR_COUNT <= DOOR_MAX, "More doors than a door mask has bits");
+
+static QueueHandle_t door_event_queue;
+static uint32_t door_open_time_ms; // For doors without an open time of their own
+
+// Only the door task writes these
+static std::atomic<uint8_t> publishedStatus[DOOR_COUNT];
+static std::atomic<uint8_t> publishedLock[DOOR_COUNT];
+static std::atomic<uint8_t> openableDoors(DOOR_MASK); // Bit per door that's closed and unlocked
+static std::atomic<uint32_t> unlock_cycles(0); // Number of times this has been unlocked
+static std::atomic<uint32_t> last_open_latency_us(0); // Time from the cause (e.g. beacon advert) to relay being energised
+static std::atomic<uint32_t> max_open_latency_us(0);
+static std::atomic<uint32_t> last_opened_ms(0); // millis() of the last open, 0 if it hasn't opened since boot
+
+// What the door task keeps for each door
+typedef struct {
+  DOORSTATE state;
+  int switch_level; // -1 forces the first read to produce an event
+  bool schedule_held; // The schedule locked it, and it hasn't been changed by hand since
+  TIMERENTRY close_timer; // Door has been open for its open time
+  TIMERENTRY debounce_timer; // Switch has been quiet for LOCKOUT_DEBOUNCE_MS
+} DOORRUNTIME;
+
+// Owned by whichever context runs serviceDoorControl(), the door task on the board
+static DOORRUNTIME doors[DOOR_COUNT];
+static uint64_t timedLockUntil = 0; // Uptime the current /lock/for ends, 0 if there isn't one
+static bool scheduleWanted = false; // A curfew or timed lock was asking for the lock at the last look
+
+// Every deadline the doors have lives on this wheel, the door task sleeps until the earliest
+static TIMERWHEEL doorTimers;
+static TIMERENTRY curfewTimer; // Next curfew start or end
+static TIMERENTRY timedLockTimer; // End of the current /lock/for
+
+static void handleDoorEvent(const DOOREVENT *event);
+
+static DOORLOCKSTATE addLock(DOORLOCKSTATE current, DOORLOCKSTATE source) {
+    // Handle flagging the source of the door lock
+    if (current == door_unlocked) {
+        return source;
+    } else if (current != source) {
+        return door_locked_both;
+    }
+
+    return current;
+}
+
+static DOORLOCKSTATE removeLock(DOORLOCKSTATE current, DOORLOCKSTATE source) {
+    // Handling clearing of locks
+    if (current == source) {
+        return door_unlocked;
+    } else if (current == door_locked_both) {
+        return source == door_locked_switch ? door_locked_wifi : door_locked_switch;
+    }
+
+    return current;
+}
+
+DOORACTION applyDoorEvent(DOORSTATE *state, DOOREVENTTYPE event) {
+    switch (event) {
+        case door_event_switch_locked:
+        case door_event_web_lock:
+        case door_event_schedule_lock:
+            state->lock = addLock(state->lock, event == door_event_switch_locked ? door_locked_switch : door_locked_wifi);
+            if (state->status == door_open) {
+                state->status = door_closed;
+                return door_action_release;
+            }
+            return door_action_none;
+
+        case door_event_switch_unlocked:
+        case door_event_web_unlock:
+        case door_event_schedule_unlock:
+            state->lock = removeLock(state->lock, event == door_event_switch_unlocked ? door_locked_switch : door_locked_wifi);
+            return door_action_none;
+
+        case door_event_ble_approach:
+        case door_event_web_open:
+            if (state->status == door_closed && state->lock == door_unlocked) {
+                state->status = door_open;
+                return door_action_energise;
+            }
+            return door_action_none;
+
+        case door_event_timeout:
+            if (state->status == door_open) {
+                state->status = door_closed;
+                return door_action_release;
+            }
+            return door_action_none;
+
+        default:
+            return door_action_none;
+    }
+}
+
+// Journal source of an event, with the door it happened to in the top bits
+static JOURNALSOURCE journalSource(DOOREVENTTYPE event, uint8_t door) {
+    JOURNALSOURCE source;
+
+    switch (event) {
+        case door_event_switch_locked:
+        case door_event_switch_unlocked:
+            source = journal_src_switch;
+            break;
+        case door_event_ble_approach:
+            source = journal_src_beacon;
+            break;
+        case door_event_timeout:
+            source = journal_src_timeout;
+            break;
+        case door_event_schedule_lock:
+        case door_event_schedule_unlock:
+            source = journal_src_schedule;
+            break;
+        default:
+            source = journal_src_web;
+            break;
+    }
+
+    return (JOURNALSOURCE) (source | (door << JOURNAL_DOOR_SHIFT));
+}
+
+// Every edge (including bounces) on any door's switch just wakes the door task, which reads the levels once they settle
+static void IRAM_ATTR lockout_switch_isr() {
+    DOOREVENT event = { door_event_switch_edge, 0, 0, DOOR_ALL };
+    BaseType_t woken = pdFALSE;
+
+    xQueueSendFromISR(door_event_queue, &event, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Timers are embedded in each door's runtime, find which door one belongs to
+static uint8_t timerDoor(const TIMERENTRY *timer) {
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        if (timer == &doors[i].close_timer || timer == &doors[i].debounce_timer) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+static void doorCloseDue(TIMERENTRY *timer) {
+    DOOREVENT event = { door_event_timeout, (uint32_t) micros(), 0, (uint8_t) (1 << timerDoor(timer)) };
+
+    handleDoorEvent(&event);
+
+    return;
+}
+
+static void switchSettled(TIMERENTRY *timer) {
+    uint8_t door = timerDoor(timer);
+    int level = digitalRead(doorTable[door].switch_pin);
+
+    if (level == doors[door].switch_level) {
+        return; // Bounced back to where it was, or it was another door's switch that moved
+    }
+    doors[door].switch_level = level;
+
+    DOOREVENT event = { level == LOCKOUT_SWITCH_LOCKED ? door_event_switch_locked : door_event_switch_unlocked, (uint32_t) micros(), 0, (uint8_t) (1 << door) };
+    handleDoorEvent(&event);
+
+    return;
+}
+
+/* Locks the doors curfews apply to as a curfew or timed lock starts and unlocks them once none is left, then
+  * arms the next change. Only those edges act, so a lock or unlock by hand in between is left alone, and a lock
+  * that was already on when a curfew started is still on after it.
+*/
+static void serviceSchedule(TIMERENTRY *timer) {
+    uint64_t now = uptimeMs();
+    DOORSCHEDULE schedule = getDoorSchedule();
+    uint64_t wallMs;
+    uint64_t changeMs = UINT64_MAX;
+    bool curfew = false;
+
+    if (getWallClock(now, &wallMs)) {
+        curfew = curfewActive(&schedule, wallMs, &changeMs);
+    }
+    bool wanted = curfew || now < timedLockUntil;
+
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        DOORRUNTIME *door = &doors[i];
+
+        if (!(doorTable[i].lock_sources & DOOR_LOCK_BY_SCHEDULE)) {
+            continue;
+        }
+        if (wanted && !scheduleWanted) {
+            door->schedule_held = door->state.lock == door_unlocked || door->state.lock == door_locked_switch;
+            if (door->schedule_held) {
+                DOOREVENT event = { door_event_schedule_lock, (uint32_t) micros(), 0, (uint8_t) (1 << i) };
+                handleDoorEvent(&event);
+            }
+        } else if (!wanted && scheduleWanted && door->schedule_held) {
+            door->schedule_held = false;
+            DOOREVENT event = { door_event_schedule_unlock, (uint32_t) micros(), 0, (uint8_t) (1 << i) };
+            handleDoorEvent(&event);
+        }
+    }
+    scheduleWanted = wanted;
+
+    if (changeMs != UINT64_MAX) {
+        armTimer(&doorTimers, &curfewTimer, now + (changeMs - wallMs));
+    } else {
+        cancelTimer(&doorTimers, &curfewTimer);
+    }
+    if (now < timedLockUntil) {
+        armTimer(&doorTimers, &timedLockTimer, timedLockUntil);
+    } else {
+        cancelTimer(&doorTimers, &timedLockTimer);
+    }
+
+    return;
+}
+
+void initDoorControl(uint32_t openTimeMs) {
+    door_open_time_ms = openTimeMs;
+    door_event_queue = xQueueCreate(DOOR_EVENT_QUEUE_LEN, sizeof(DOOREVENT));
+
+    initTimerWheel(&doorTimers, uptimeMs());
+    initTimer(&curfewTimer, serviceSchedule);
+    initTimer(&timedLockTimer, serviceSchedule);
+
+    for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+        const DOORSPEC *spec = &doorTable[i];
+        DOORRUNTIME *door = &doors[i];
+
+        door->state.status = door_closed;
+        door->state.lock = door_unlocked;
+        door->switch_level = -1;
+        door->schedule_held = false;
+        initTimer(&door->close_timer, doorCloseDue);
+        initTimer(&door->debounce_timer, switchSettled);
+
+        // Set up relay pin
+        pinMode(spec->relay_pin, OUTPUT);
+        digitalWrite(spec->relay_pin, LOW);
+        // Set up switch pin, and pick up its position at boot as if it had just settled
+        if (spec->switch_pin != DOOR_NO_PIN && (spec->lock_sources & DOOR_LOCK_BY_SWITCH)) {
+            pinMode(spec->switch_pin, INPUT_PULLUP);
+            attachInterrupt(digitalPinToInterrupt(spec->switch_pin), lockout_switch_isr, CHANGE);
+            armTimer(&doorTimers, &door->debounce_timer, uptimeMs() + LOCKOUT_DEBOUNCE_MS);
+        }
+    }
+
+    return;
+}
+
+// Never blocks, returns false if the door task is too far behind to take the event
+bool postDoorEvent(DOOREVENTTYPE type, uint32_t timestamp_us, uint8_t detail, uint8_t doors) {
+    DOOREVENT event = { type, timestamp_us, detail, doors };
+
+    return xQueueSend(door_event_queue, &event, 0) == pdTRUE;
+}
+
+// Time until the timer wheel next has work, portMAX_DELAY if nothing is armed
+static uint32_t nextDoorWait() {
+    uint64_t next = nextTimerTick(&doorTimers);
+    uint64_t now = uptimeMs();
+
+    if (next == TIMER_NEVER) {
+        return portMAX_DELAY;
+    }
+    if (next <= now) {
+        return 0;
+    }
+
+    return next - now < DOOR_MAX_WAIT_MS ? next - now : DOOR_MAX_WAIT_MS;
+}
+
+// Whether a door takes this kind of event at all, given what it can be locked by
+static bool doorTakesEvent(const DOORSPEC *spec, DOOREVENTTYPE type) {
+    switch (type) {
+        case door_event_web_lock:
+        case door_event_web_unlock:
+            return spec->lock_sources & DOOR_LOCK_BY_WEB;
+        case door_event_schedule_lock:
+        case door_event_schedule_unlock:
+            return spec->lock_sources & DOOR_LOCK_BY_SCHEDULE;
+        default:
+            return true;
+    }
+}
+
+static void handleDoorEventFor(uint8_t index, const DOOREVENT *event) {
+    const DOORSPEC *spec = &doorTable[index];
+    DOORRUNTIME *door = &doors[index];
+
+    if (!doorTakesEvent(spec, event->type)) {
+        return;
+    }
+    if (event->type == door_event_web_lock || event->type == door_event_web_unlock) {
+        door->schedule_held = false; // Taken over by hand, the schedule won't undo it
+    }
+
+    DOORSTATE previous = door->state;
+    DOORACTION action = applyDoorEvent(&door->state, event->type);
+    JOURNALSOURCE source = journalSource(event->type, index);
+
+    if (action == door_action_energise) {
+        digitalWrite(spec->relay_pin, HIGH);
+        armTimer(&doorTimers, &door->close_timer, uptimeMs() + (spec->open_time_ms != 0 ? spec->open_time_ms : door_open_time_ms));
+        uint32_t openedAt = millis();
+        last_opened_ms.store(openedAt == 0 ? 1 : openedAt, std::memory_order_relaxed);
+        unlock_cycles.fetch_add(1, std::memory_order_relaxed);
+
+        uint32_t latency = micros() - event->timestamp_us;
+        last_open_latency_us.store(latency, std::memory_order_relaxed);
+        if (latency > max_open_latency_us.load(std::memory_order_relaxed)) {
+            max_open_latency_us.store(latency, std::memory_order_relaxed);
+        }
+        recordOpenLatency(latency);
+        LOG_INFO("Door %s opened (%s), cause to relay latency: %uus",
+            spec->name, event->type == door_event_ble_approach ? "beacon" : "web", latency);
+        journalAppend(journal_door_open, source, event->detail, getUnlockCycles());
+    } else if (action == door_action_release) {
+        digitalWrite(spec->relay_pin, LOW);
+        cancelTimer(&doorTimers, &door->close_timer);
+        LOG_INFO("Door %s closed", spec->name);
+        journalAppend(journal_door_close, source, event->detail, getUnlockCycles());
+    }
+
+    if (door->state.lock != previous.lock) {
+        bool locking = event->type == door_event_switch_locked || event->type == door_event_web_lock || event->type == door_event_schedule_lock;
+        journalAppend(locking ? journal_lock : journal_unlock, source, door->state.lock, getUnlockCycles());
+    }
+
+    publishedStatus[index].store(door->state.status, std::memory_order_release);
+    publishedLock[index].store(door->state.lock, std::memory_order_release);
+    if (door->state.status != previous.status || door->state.lock != previous.lock) {
+        uint8_t bit = 1 << index;
+        bool openable = door->state.status == door_closed && door->state.lock == door_unlocked;
+        uint8_t current = openableDoors.load(std::memory_order_relaxed);
+        openableDoors.store(openable ? current | bit : current & ~bit, std::memory_order_release);
+        publishStateChange();
+        telemetryDoorChanged(index, door->state.status, door->state.lock);
+    }
+
+    return;
+}
+
+static void handleDoorEvent(const DOOREVENT *event) {
+    switch (event->type) {
+        case door_event_switch_edge:
+            // Restart the quiet period on every edge, each switch is read again once it settles
+            for (uint8_t i = 0; i < DOOR_COUNT; i++) {
+                if (doorTable[i].switch_pin != DOOR_NO_PIN && (doorTable[i].lock_sources & DOOR_LOCK_BY_SWITCH)) {
+                    armTimer(&doorTimers, &doors[i].debounce_timer, uptimeMs() + LOCKOUT_DEBOUNCE_MS);
+                }
+            }
+            return;
+
+        case door_event_timed_lock:
+            timedLockUntil = event->detail == 0 ? 0 : uptimeMs() + event->detail * 60000ULL;
+            serviceSchedule(NULL);
+            return;
+
+        case door_event_schedule_changed:
+            serviceSchedule(NULL);
+            return;
+
+        default:
+            break;
+    }
+
+    uint8_t targets = event->doors & DOOR_MASK;
+    for (uint8_t i = 0; targets != 0; i++, targets >>= 1) {
+        if (targets & 1) {
+            handleDoorEventFor(i, event);
+        }
+    }
+
+    return;
+}
+
+/* Single owner of the relays and door/lock states, driven by events from the lockout switch ISR,
+  * BLE detections and web commands, and by its timers (door close, switch debounce, curfews).
+  * Waits up to maxWaitMs for the next event or deadline and handles it, then returns how long
+  * it may next sleep so the simulator can jump its clock straight there
+*/
+uint32_t serviceDoorControl(uint32_t maxWaitMs) {
+    DOOREVENT event;
+    uint32_t wait = nextDoorWait();
+
+    if (maxWaitMs < wait) {
+        wait = maxWaitMs;
+    }
+
+    if (xQueueReceive(door_event_queue, &event, wait == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(wait)) == pdTRUE) {
+        // Beacon approaches are timed from the advert (door_open_latency_us), switch edges aren't timestamped
+        if (event.type != door_event_ble_approach && event.timestamp_us != 0) {
+            recordDoorEventWait(micros() - event.timestamp_us);
+        }
+        handleDoorEvent(&event);
+    }
+    runTimers(&doorTimers, uptimeMs());
+
+    return nextDoorWait();
+}
+
+/* Runs on core 1, above loop()
+  * Sleeps until the next event or deadline, waking at least every TASK_CHECKIN_MS to tell the supervisor it's alive
+*/
+void handle_door_lock( void * parameter ) {
+    for(;;) {
+        taskCheckIn(task_door);
+        serviceDoorControl(TASK_CHECKIN_MS);
+    }
+}
+
+uint8_t getDoorCount() {
+    return DOOR_COUNT;
+}
+
+const DOORSPEC *getDoorSpec(uint8_t door) {
+    return door < DOOR_COUNT ? &doorTable[door] : NULL;
+}
+
+DOORSTATUS getDoorStatus(uint8_t door) {
+    return (DOORSTATUS) publishedStatus[door].load(std::memory_order_acquire);
+}
+
+DOORLOCKSTATE getDoorLockState(uint8_t door) {
+    return (DOORLOCKSTATE) publishedLock[door].load(std::memory_order_acquire);
+}
+
+// Bit per door a beacon could open right now, one load for the detection path however many doors there are
+uint8_t getOpenableDoors() {
+    return openableDoors.load(std::memory_order_acquire);
+}
+
+// Restores the count after a reboot, call before the door task starts
+void setUnlockCycles(uint32_t cycles) {
+    unlock_cycles.store(cycles, std::memory_order_relaxed);
+}
+
+uint32_t getUnlockCycles() {
+    return unlock_cycles.load(std::memory_order_relaxed);
+}
+
+uint32_t getLastOpenLatency() {
+    return last_open_latency_us.load(std::memory_order_relaxed);
+}
+
+uint32_t getMaxOpenLatency() {
+    return max_open_latency_us.load(std::memory_order_relaxed);
+}
+
+// Used to tell which beacon visits ended with the dog going through, any door counts
+uint32_t getLastOpenTime() {
+    return last_opened_ms.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,107 @@
+#include "doorDecision.hpp"
+#include "beaconRegistry.hpp"
+#include "doorControl.hpp"
+#include "liveEvents.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "rssiCapture.hpp"
+#include "scanScheduler.hpp"
+#include "telemetry.hpp"
+
+// Runs in the BLE callback for every advert heard, returns true if it came from a registered beacon
+bool detectBeaconAdvert(const uint8_t *payload, size_t payloadLen, const uint8_t *mac, uint8_t macType, int rssi, BEACONDETECTION *detection) {
+    uint8_t beaconIndex = lookupBeaconAdvert(payload, payloadLen, mac, macType);
+
+    countAdvert(beaconIndex != BEACON_REGISTRY_EMPTY);
+    if (beaconIndex == BEACON_REGISTRY_EMPTY) {
+        return false;
+    }
+    captureAdvert(payload, payloadLen, mac, macType, rssi, beaconIndex);
+
+    detection->rssi = rssi;
+    detection->timestamp_us = micros();
+    detection->timestamp_ms = millis();
+    detection->beacon_index = beaconIndex;
+
+    return true;
+}
+
+// Feeds a detection through its beacon's filter and asks the door task to open if the filter says so
+// openThreshold is the global threshold, used unless the beacon has its own
+RSSIDECISION handleBeaconDetection(const BEACONDETECTION *detection, int openThreshold, int approachRate) {
+    BEACONENTRY *beacon = getBeacon(detection->beacon_index);
+
+    if (beacon == NULL) {
+        return rssi_hold; // Removed from the registry since the advert was queued
+    }
+
+    beacon->last_seen_ms = detection->timestamp_ms;
+
+    // Each beacon carries its own history, a stale filter restarts itself from this sample
+    if (beacon->open_threshold != BEACON_THRESHOLD_GLOBAL) {
+        openThreshold = beacon->open_threshold;
+    }
+    updateRSSIFilter(&beacon->rssi, detection->rssi, detection->timestamp_ms);
+    RSSIDECISION decision = evaluateRSSIFilter(&beacon->rssi, detection->timestamp_ms, openThreshold, approachRate);
+    noteBeaconHeard(detection->timestamp_ms, getFilteredRSSI(&beacon->rssi), openThreshold);
+    updateCalibration(&beacon->calibration, getFilteredRSSI(&beacon->rssi), detection->timestamp_ms, getLastOpenTime());
+    publishRssiSample(detection->beacon_index, detection->rssi, getFilteredRSSI(&beacon->rssi), detection->timestamp_ms);
+    telemetryRssiSample(detection->beacon_index, detection->rssi, detection->timestamp_ms);
+
+    if (decision != rssi_hold && (beacon->permissions & BEACON_PERM_OPEN)) {
+        // Either the dog is close enough, or is close and approaching quickly enough to open early
+        // One event for all of the beacon's doors that could open, the door task measures advert to relay latency from its timestamp
+        uint8_t doors = beacon->doors & getOpenableDoors();
+        if (doors != 0 && postDoorEvent(door_event_ble_approach, detection->timestamp_us, detection->beacon_index, doors)) {
+            LOG_DEBUG("Open requested (%s) for %s", decision == rssi_open_near ? "near" : "approach", beacon->matcher.name);
+        }
+    }
+
+    LOG_DEBUG("%s RSSI: %d Filtered: %d Velocity: %ddB/s",
+        beacon->matcher.name, detection->rssi, getFilteredRSSI(&beacon->rssi), getRSSIVelocity(&beacon->rssi));
+
+    return decision;
+}
+
+/* Call between scan windows. Ends beacon visits that have timed out and, once an hour, moves each calibrating
+  * beacon's threshold towards the learnt one. openThreshold is the global threshold, a beacon's starting point
+  * Returns true if a threshold changed and the registry should be saved
+*/
+bool calibrateBeaconThresholds(uint32_t now_ms, int openThreshold) {
+    static uint32_t lastUpdate = 0;
+    uint32_t lastOpen = getLastOpenTime();
+    bool update = now_ms - lastUpdate >= CALIBRATION_UPDATE_MS;
+    bool changed = false;
+
+    if (update) {
+        lastUpdate = now_ms;
+    }
+
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        BEACONENTRY *beacon = getBeacon(i);
+        if (beacon == NULL) {
+            continue;
+        }
+
+        serviceCalibration(&beacon->calibration, now_ms, lastOpen);
+        if (!update || !(beacon->permissions & BEACON_PERM_CALIBRATE)) {
+            continue;
+        }
+
+        int learnt = computeCalibratedThreshold(&beacon->calibration);
+        if (learnt == BEACON_THRESHOLD_GLOBAL) {
+            continue;
+        }
+
+        // Small steps, so one odd day can't swing the door from never opening to always opening
+        int current = beacon->open_threshold != BEACON_THRESHOLD_GLOBAL ? beacon->open_threshold : openThreshold;
+        int next = constrain(learnt, current - CALIBRATION_MAX_STEP_DB, current + CALIBRATION_MAX_STEP_DB);
+        if (next != beacon->open_threshold) {
+            LOG_INFO("%s threshold %d -> %d (learnt %d)", beacon->matcher.name, current, next, learnt);
+            setBeaconThreshold(i, next);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
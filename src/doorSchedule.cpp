@@ -0,0 +1,173 @@
+#include "doorSchedule.hpp"
+#include "configStore.hpp"
+#include "doorControl.hpp"
+#include "logger.hpp"
+#include "timerWheel.hpp"
+
+#define MS_PER_MINUTE 60000
+
+// Written by the web server and provisioning, read by the door task
+static portMUX_TYPE scheduleMux = portMUX_INITIALIZER_UNLOCKED;
+static DOORSCHEDULE schedule = { 0, 0, {} };
+static uint64_t wallOffsetMs = 0; // Wall clock minus uptime, 0 until something has told us the time
+static uint8_t scheduleBlob[SCHEDULE_BLOB_LEN];
+
+/* Whether wall_ms falls inside any curfew, and in change_ms the wall time of the next curfew start or end
+  * (UINT64_MAX if there are none). Overlapping curfews can make that a boundary where nothing changes,
+  * the caller just looks again then.
+*/
+bool curfewActive(const DOORSCHEDULE *schedule, uint64_t wall_ms, uint64_t *change_ms) {
+    int64_t local = (int64_t) wall_ms + (int64_t) schedule->utc_offset_min * MS_PER_MINUTE;
+    uint16_t minute = (local / MS_PER_MINUTE) % SCHEDULE_MINUTES_PER_DAY;
+    uint64_t minuteStart = wall_ms - local % MS_PER_MINUTE;
+    uint32_t soonest = UINT32_MAX; // Minutes from minuteStart
+    bool active = false;
+
+    for (uint8_t i = 0; i < schedule->count; i++) {
+        uint16_t start = schedule->curfews[i].start_min;
+        uint16_t end = schedule->curfews[i].end_min;
+
+        if (start == end) {
+            continue;
+        }
+        if (start < end ? (minute >= start && minute < end) : (minute >= start || minute < end)) {
+            active = true;
+        }
+
+        // A boundary at this minute has already taken effect, its next turn is tomorrow
+        uint16_t boundaries[2] = { start, end };
+        for (uint8_t b = 0; b < 2; b++) {
+            uint32_t ahead = (boundaries[b] + SCHEDULE_MINUTES_PER_DAY - minute) % SCHEDULE_MINUTES_PER_DAY;
+            if (ahead == 0) {
+                ahead = SCHEDULE_MINUTES_PER_DAY;
+            }
+            if (ahead < soonest) {
+                soonest = ahead;
+            }
+        }
+    }
+
+    *change_ms = soonest == UINT32_MAX ? UINT64_MAX : minuteStart + (uint64_t) soonest * MS_PER_MINUTE;
+
+    return active;
+}
+
+// From NTP, or the simulator's trace, the door task re-plans the curfews against it
+void setWallClock(uint64_t epoch_ms) {
+    portENTER_CRITICAL(&scheduleMux);
+    wallOffsetMs = epoch_ms - uptimeMs();
+    portEXIT_CRITICAL(&scheduleMux);
+
+    postDoorEvent(door_event_schedule_changed, micros());
+
+    return;
+}
+
+// Returns false until the wall clock has been set
+bool getWallClock(uint64_t uptime_ms, uint64_t *wall_ms) {
+    portENTER_CRITICAL(&scheduleMux);
+    uint64_t offset = wallOffsetMs;
+    portEXIT_CRITICAL(&scheduleMux);
+
+    *wall_ms = uptime_ms + offset;
+
+    return offset != 0;
+}
+
+static void saveDoorSchedule() {
+    DOORSCHEDULE copy = getDoorSchedule();
+
+    scheduleBlob[0] = copy.count;
+    memcpy(&scheduleBlob[1], &copy.utc_offset_min, 2);
+    for (uint8_t i = 0; i < copy.count; i++) {
+        memcpy(&scheduleBlob[3 + i * 4], &copy.curfews[i].start_min, 2);
+        memcpy(&scheduleBlob[5 + i * 4], &copy.curfews[i].end_min, 2);
+    }
+    configWrite(config_door_schedule, scheduleBlob, 3 + copy.count * 4);
+    configCommit();
+
+    postDoorEvent(door_event_schedule_changed, micros());
+
+    return;
+}
+
+bool addCurfew(uint16_t startMin, uint16_t endMin) {
+    if (startMin >= SCHEDULE_MINUTES_PER_DAY || endMin >= SCHEDULE_MINUTES_PER_DAY || startMin == endMin) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&scheduleMux);
+    bool added = schedule.count < SCHEDULE_MAX_CURFEWS;
+    if (added) {
+        schedule.curfews[schedule.count].start_min = startMin;
+        schedule.curfews[schedule.count].end_min = endMin;
+        schedule.count++;
+    }
+    portEXIT_CRITICAL(&scheduleMux);
+
+    if (added) {
+        saveDoorSchedule();
+    }
+
+    return added;
+}
+
+bool removeCurfew(uint8_t index) {
+    portENTER_CRITICAL(&scheduleMux);
+    bool removed = index < schedule.count;
+    if (removed) {
+        memmove(&schedule.curfews[index], &schedule.curfews[index + 1], (schedule.count - index - 1) * sizeof(CURFEW));
+        schedule.count--;
+    }
+    portEXIT_CRITICAL(&scheduleMux);
+
+    if (removed) {
+        saveDoorSchedule();
+    }
+
+    return removed;
+}
+
+void setScheduleUtcOffset(int16_t offsetMin) {
+    portENTER_CRITICAL(&scheduleMux);
+    bool changed = schedule.utc_offset_min != offsetMin;
+    schedule.utc_offset_min = offsetMin;
+    portEXIT_CRITICAL(&scheduleMux);
+
+    if (changed) {
+        saveDoorSchedule();
+    }
+
+    return;
+}
+
+DOORSCHEDULE getDoorSchedule() {
+    portENTER_CRITICAL(&scheduleMux);
+    DOORSCHEDULE copy = schedule;
+    portEXIT_CRITICAL(&scheduleMux);
+
+    return copy;
+}
+
+// Call after configBegin(), before the door task starts
+void loadDoorSchedule() {
+    int32_t len = configRead(config_door_schedule, scheduleBlob, SCHEDULE_BLOB_LEN);
+    uint8_t count = len > 0 ? scheduleBlob[0] : 0;
+
+    if (count > SCHEDULE_MAX_CURFEWS || len < 3 + count * 4) {
+        return; // Missing or corrupt
+    }
+
+    portENTER_CRITICAL(&scheduleMux);
+    schedule.count = count;
+    memcpy(&schedule.utc_offset_min, &scheduleBlob[1], 2);
+    for (uint8_t i = 0; i < count; i++) {
+        memcpy(&schedule.curfews[i].start_min, &scheduleBlob[3 + i * 4], 2);
+        memcpy(&schedule.curfews[i].end_min, &scheduleBlob[5 + i * 4], 2);
+    }
+    portEXIT_CRITICAL(&scheduleMux);
+
+    LOG_INFO("Loaded %u curfews", count);
+
+    return;
+}
@@ -0,0 +1,65 @@
+#include "doorTuning.hpp"
+#include <atomic>
+
+/* Runtime tuning as a versioned snapshot
+  * Two copies, a change is written to the one readers aren't being pointed at and then published by bumping the
+  * version, whose low bit says which copy is current. Readers copy the current one and retry if the version moved
+  * while they did, so the decision path never takes a lock and never sees half of a change.
+*/
+
+#ifndef DOOR_TUNING_FIXED
+
+static DOORTUNING snapshots[2] = {
+    { doorProfile.open_threshold, doorProfile.approach_rate },
+    { doorProfile.open_threshold, doorProfile.approach_rate }
+};
+static std::atomic<uint32_t> version(0);
+static portMUX_TYPE writerMux = portMUX_INITIALIZER_UNLOCKED; // Writers take turns, readers never wait
+
+DOORTUNING getTuning() {
+    DOORTUNING tuning;
+    uint32_t seen;
+
+    do {
+        seen = version.load(std::memory_order_acquire);
+        tuning = snapshots[seen & 1];
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (version.load(std::memory_order_relaxed) != seen);
+
+    return tuning;
+}
+
+bool setTuning(DOORTUNING tuning) {
+    portENTER_CRITICAL(&writerMux);
+    uint32_t next = version.load(std::memory_order_relaxed) + 1;
+    snapshots[next & 1] = tuning;
+    version.store(next, std::memory_order_release);
+    portEXIT_CRITICAL(&writerMux);
+
+    return true;
+}
+
+uint32_t getTuningVersion() {
+    return version.load(std::memory_order_relaxed);
+}
+
+bool tuningFixed() {
+    return false;
+}
+
+#else
+
+// Built fixed, only the profile's own values are accepted
+bool setTuning(DOORTUNING tuning) {
+    return tuning.open_threshold == doorProfile.open_threshold && tuning.approach_rate == doorProfile.approach_rate;
+}
+
+uint32_t getTuningVersion() {
+    return 0;
+}
+
+bool tuningFixed() {
+    return true;
+}
+
+#endif
@@ -1,84 +1,114 @@
 #include "eepromHandler.hpp"
+#include "beaconRegistry.hpp"
 
-void writeStringToEEPROM(uint32_t addrOffset, const char *string){
+String readStringFromEEPROM(uint32_t addrOffset){
 
-    uint8_t strLen = strlen(string); // Get length of character array
+    uint8_t newStrLen = EEPROM.read(addrOffset); // Get length of character array
 
-    EEPROM.write(addrOffset, strLen); // First write the length of the character array that follows
+    char data[newStrLen + 1];
 
-    // Write each character of the character array to an incremental address
-    for (uint16_t i = 0; i < strLen; i++) {
-        EEPROM.write(addrOffset + 1 + i, string[i]); 
+    // Read each char of the character array and store it
+    for (uint16_t i = 0; i < newStrLen; i++) {
+        data[i] = EEPROM.read(addrOffset + 1 + i);
     }
 
-    EEPROM.commit();
+    data[newStrLen] = '\0'; // Null terminate character array
 
-    return;
+    return String(data);
 }
 
-void readStringFromEEPROM(uint32_t addrOffset, char *string){
-    /* This function may need modifications similarly to the String readStringFromEEPROM() function */
-    uint8_t newStrLen = EEPROM.read(addrOffset); // Get length of character array
+uint8_t checkForEEPROMData(uint32_t address){
+    return EEPROM.read(address);
+}
 
-    // Read each char of the character array and store it
-    for (uint16_t i = 0; i < newStrLen; i++) {
-        string[i] = EEPROM.read(addrOffset + 1 + i);
-    }
+void clearEEPROM(uint16_t addr_l, uint16_t addr_h) {
 
-    string[newStrLen] = '\0'; // Null terminate character array
+  for (int i = addr_l; i <= addr_h; i++) {
+    EEPROM.write(i, 0);
+  }
 
-    return;
+  EEPROM.commit();
 }
 
-// ** Overloads for the String data type included in arduino framework ** //
+void initEEPROM(uint16_t size) {
+    EEPROM.begin(size);
+}
 
-void writeStringToEEPROM(uint32_t addrOffset, const String &str){
+/* Moves settings from the fixed-address layout into the config store on the first boot after updating
+  * Returns true if anything was migrated
+*/
+bool migrateLegacyEEPROM() {
+    uint32_t magic;
 
-    uint8_t strLen = str.length(); // Get length of character array
+    EEPROM.get(0, magic);
+    if (magic == CONFIG_MAGIC) {
+        return false; // Already a config store
+    }
 
-    EEPROM.write(addrOffset, strLen); // First write the length of the character array that follows
+    // Pull everything into RAM first, formatting the store overwrites the old layout
+    // Legacy strings were stored with the trailing character from the serial monitor's line ending, hence trim()
+    String ssid = readStringFromEEPROM(WIFI_SSID_EEP_ADDR);
+    String password = readStringFromEEPROM(WIFI_PWD_EEP_ADDR);
+    String dogName = readStringFromEEPROM(DOG_NAME_EEP_ADDR);
+    uint8_t ssidLen = checkForEEPROMData(WIFI_SSID_EEP_ADDR);
+    uint8_t dogNameLen = checkForEEPROMData(DOG_NAME_EEP_ADDR);
+    uint8_t beaconCount = checkForEEPROMData(BEACON_REGISTRY_EEP_ADDR);
+    uint16_t registryLen = beaconCount <= BEACON_REGISTRY_MAX ? 1 + beaconCount * BEACON_RECORD_SIZE : 0;
+    uint8_t registry[registryLen > 0 ? registryLen : 1];
+
+    for (uint16_t i = 0; i < registryLen; i++) {
+        registry[i] = EEPROM.read(BEACON_REGISTRY_EEP_ADDR + i);
+    }
 
+    configBegin(&eepromConfigBackend);
 
-    // Write each character of the character array to an incremental address
-    for (uint16_t i = 0; i < strLen; i++) {
-        EEPROM.write(addrOffset + 1 + i, str[i]); 
+    if (ssidLen != 0x00 && ssidLen != 0xFF) {
+        ssid.trim();
+        password.trim();
+        configWriteString(config_wifi_ssid, ssid.c_str());
+        configWriteString(config_wifi_password, password.c_str());
+    }
+    if (dogNameLen != 0x00 && dogNameLen != 0xFF) {
+        dogName.trim();
+        configWriteString(config_dog_name, dogName.c_str());
+    }
+    if (registryLen > 1) {
+        configWrite(config_beacon_registry, registry, registryLen);
     }
 
+    configCommit();
 
-    EEPROM.commit();
-
-    return;
+    return true;
 }
 
-String readStringFromEEPROM(uint32_t addrOffset){
-
-    uint8_t newStrLen = EEPROM.read(addrOffset); // Get length of character array
-
-    char data[newStrLen];
+// ** Config store backend on the ESP32's emulated EEPROM, writes land in its RAM copy until commit ** //
 
-    // Read each char of the character array and store it
-    for (uint16_t i = 0; i < newStrLen-1; i++) {
-        data[i] = EEPROM.read(addrOffset + 1 + i);
+static bool eepromRead(uint32_t addr, uint8_t *data, uint16_t len) {
+    if (addr + len > EEPROM_SIZE) {
+        return false;
     }
 
-    data[newStrLen] = '\0'; // Null terminate character array
+    for (uint16_t i = 0; i < len; i++) {
+        data[i] = EEPROM.read(addr + i);
+    }
 
-    return String(data);
+    return true;
 }
 
-uint8_t checkForEEPROMData(uint32_t address){
-    return EEPROM.read(address);
-}
+static bool eepromWrite(uint32_t addr, const uint8_t *data, uint16_t len) {
+    if (addr + len > EEPROM_SIZE) {
+        return false;
+    }
 
-void clearEEPROM(uint16_t addr_l, uint16_t addr_h) {
+    for (uint16_t i = 0; i < len; i++) {
+        EEPROM.write(addr + i, data[i]);
+    }
 
-  for (int i = addr_l; i <= addr_h; i++) {
-    EEPROM.write(i, 0);
-  }
+    return true;
+}
 
-  EEPROM.commit();
+static bool eepromCommit() {
+    return EEPROM.commit();
 }
 
-void initEEPROM(uint16_t size) {
-    EEPROM.begin(size);
-}
\ No newline at end of file
+const CONFIGBACKEND eepromConfigBackend = { eepromRead, eepromWrite, eepromCommit, EEPROM_SIZE };
@@ -0,0 +1,282 @@
+#include "eventJournal.hpp"
+#include "logger.hpp"
+#include "taskTable.hpp"
+#include <esp_partition.h>
+
+#define JOURNAL_RECORDS_PER_SECTOR (JOURNAL_SECTOR_SIZE / sizeof(JOURNALRECORD))
+
+static const esp_partition_t *partition = NULL;
+static uint32_t capacity = 0; // Records the partition holds
+static uint32_t flashSequence = 1; // Sequence of the next record to be written to flash
+static uint32_t recoveredUnlockCycles = 0;
+
+// Staging buffer, appended to by the door task and emptied by the journal task
+static JOURNALRECORD staging[JOURNAL_STAGING_LEN];
+static uint8_t stagedCount = 0;
+static uint32_t stagedSequence = 1; // Sequence of the next record to be appended
+static uint32_t droppedRecords = 0;
+static bool flushInFlight = false; // Records taken from staging but not yet counted in flashSequence
+static portMUX_TYPE stagingMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t journal_task;
+
+static uint8_t crc8(const uint8_t *data, uint8_t len) {
+    uint8_t crc = 0;
+
+    for (uint8_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+// The CRC byte is written last, so one still reading erased means the write never finished
+// A CRC that comes out as 0xFF is stored as 0xFE, otherwise 1 in 256 torn records would pass
+static uint8_t recordCrc(const JOURNALRECORD *record) {
+    uint8_t crc = crc8((const uint8_t *) record, sizeof(JOURNALRECORD) - 1);
+
+    return crc == 0xFF ? 0xFE : crc;
+}
+
+static bool recordValid(const JOURNALRECORD *record) {
+    return record->sequence != 0xFFFFFFFF && recordCrc(record) == record->crc;
+}
+
+static bool slotErased(const JOURNALRECORD *record) {
+    const uint8_t *bytes = (const uint8_t *) record;
+
+    for (uint8_t i = 0; i < sizeof(JOURNALRECORD); i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void readSlot(uint32_t slot, JOURNALRECORD *record) {
+    esp_partition_read(partition, slot * sizeof(JOURNALRECORD), record, sizeof(JOURNALRECORD));
+}
+
+/* Finds where writing left off, whatever state a power cut left the partition in
+  * The newest valid record sets the sequence, then any slots after it that aren't erased
+  * (torn writes) are skipped, since flash can't be rewritten without an erase
+*/
+static void recoverJournal() {
+    JOURNALRECORD record;
+    uint32_t newest = 0;
+
+    recoveredUnlockCycles = 0;
+    for (uint32_t slot = 0; slot < capacity; slot++) {
+        readSlot(slot, &record);
+        if (recordValid(&record) && record.sequence % capacity == slot && record.sequence >= newest) {
+            newest = record.sequence;
+            recoveredUnlockCycles = record.unlock_cycles;
+        }
+    }
+
+    if (newest == 0) {
+        // Nothing valid, start on a sector boundary so the first write erases whatever was there
+        flashSequence = JOURNAL_RECORDS_PER_SECTOR;
+        stagedSequence = flashSequence;
+        return;
+    }
+
+    flashSequence = newest + 1;
+
+    while (flashSequence % JOURNAL_RECORDS_PER_SECTOR != 0) {
+        readSlot(flashSequence % capacity, &record);
+        if (slotErased(&record)) {
+            break;
+        }
+        flashSequence++;
+    }
+
+    stagedSequence = flashSequence;
+
+    return;
+}
+
+// Writes a run of consecutive records, erasing each sector just before its first slot is used
+static void writeRecords(const JOURNALRECORD *records, uint8_t count) {
+    while (count > 0) {
+        uint32_t slot = flashSequence % capacity;
+        uint32_t slotInSector = slot % JOURNAL_RECORDS_PER_SECTOR;
+        uint32_t run = JOURNAL_RECORDS_PER_SECTOR - slotInSector;
+
+        if (run > count) {
+            run = count;
+        }
+
+        if (slotInSector == 0) {
+            // Oldest sector of the ring is lost here
+            esp_partition_erase_range(partition, slot * sizeof(JOURNALRECORD), JOURNAL_SECTOR_SIZE);
+        }
+
+        esp_partition_write(partition, slot * sizeof(JOURNALRECORD), records, run * sizeof(JOURNALRECORD));
+
+        flashSequence += run;
+        records += run;
+        count -= run;
+    }
+
+    return;
+}
+
+static void flushJournal() {
+    JOURNALRECORD pending[JOURNAL_STAGING_LEN];
+    uint8_t count;
+
+    // Take the staged records and release the buffer before the slow flash write
+    portENTER_CRITICAL(&stagingMux);
+    count = stagedCount;
+    memcpy(pending, staging, count * sizeof(JOURNALRECORD));
+    stagedCount = 0;
+    flushInFlight = count > 0;
+    portEXIT_CRITICAL(&stagingMux);
+
+    if (count > 0) {
+        writeRecords(pending, count);
+
+        portENTER_CRITICAL(&stagingMux);
+        flushInFlight = false;
+        portEXIT_CRITICAL(&stagingMux);
+    }
+
+    return;
+}
+
+/* Runs at low priority
+  * Batches staged records into flash writes, woken early when the staging buffer fills up
+*/
+static void handle_journal( void * parameter ) {
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(JOURNAL_FLUSH_MS));
+        flushJournal();
+    }
+}
+
+bool initJournal() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) JOURNAL_PARTITION_SUBTYPE, JOURNAL_PARTITION_LABEL);
+
+    if (partition == NULL) {
+        LOG_ERROR("No journal partition, events won't be recorded");
+        return false;
+    }
+
+    capacity = (partition->size / JOURNAL_SECTOR_SIZE) * JOURNAL_RECORDS_PER_SECTOR;
+    recoverJournal();
+
+    // Only the first call starts the task, the simulator's journal self-test recovers again after each power cut
+    if (journal_task == NULL) {
+        journal_task = startTask(task_journal, handle_journal);
+    }
+
+    journalAppend(journal_boot, journal_src_system, 0, recoveredUnlockCycles);
+
+    return true;
+}
+
+// Only copies into RAM, never touches flash, so it is safe from the door task
+// Returns false (and counts a drop) if the journal task has fallen behind
+bool journalAppend(JOURNALEVENT type, JOURNALSOURCE source, uint8_t detail, uint32_t unlockCycles) {
+    JOURNALRECORD record;
+    bool wake;
+
+    if (partition == NULL) {
+        return false;
+    }
+
+    record.uptime_ms = millis();
+    record.unlock_cycles = unlockCycles;
+    record.type = type;
+    record.source = source;
+    record.detail = detail;
+
+    portENTER_CRITICAL(&stagingMux);
+    if (stagedCount == JOURNAL_STAGING_LEN) {
+        droppedRecords++;
+        portEXIT_CRITICAL(&stagingMux);
+        return false;
+    }
+    record.sequence = stagedSequence++;
+    record.crc = recordCrc(&record);
+    staging[stagedCount++] = record;
+    wake = stagedCount >= JOURNAL_FLUSH_THRESHOLD;
+    portEXIT_CRITICAL(&stagingMux);
+
+    if (wake) {
+        xTaskNotifyGive(journal_task);
+    }
+
+    return true;
+}
+
+uint32_t journalRecoveredUnlockCycles() {
+    return recoveredUnlockCycles;
+}
+
+uint32_t journalNextSequence() {
+    return stagedSequence;
+}
+
+uint32_t journalDropCount() {
+    return droppedRecords;
+}
+
+/* Copies up to maxRecords starting at fromSequence (or the oldest retained record, if later)
+  * Reads flash a record at a time, so the log is never loaded whole; records still staged come from RAM
+  * nextSequence is where the following chunk should start, an empty chunk only ever means there is nothing newer
+*/
+uint16_t journalReadChunk(uint32_t fromSequence, JOURNALRECORD *records, uint16_t maxRecords, uint32_t *nextSequence) {
+    uint16_t count = 0;
+    uint32_t sequence = fromSequence;
+
+    if (partition == NULL) {
+        *nextSequence = fromSequence;
+        return 0;
+    }
+
+    for (;;) {
+        uint32_t flushed = flashSequence; // Snapshot, the journal task may flush while we read
+
+        if (flushed > capacity && sequence < flushed - capacity) {
+            sequence = flushed - capacity; // Older records have been overwritten
+        }
+
+        for (; sequence < flushed && count < maxRecords; sequence++) {
+            readSlot(sequence % capacity, &records[count]);
+            if (recordValid(&records[count]) && records[count].sequence == sequence) {
+                count++; // Torn or already-erased slots are skipped
+            }
+        }
+
+        // Staged records only follow on if they pick up where flash left off, anything between was taken by a flush
+        portENTER_CRITICAL(&stagingMux);
+        for (uint8_t i = 0; i < stagedCount && count < maxRecords; i++) {
+            if (staging[i].sequence == sequence) {
+                records[count++] = staging[i];
+                sequence++;
+            }
+        }
+        bool missed = count < maxRecords && sequence < stagedSequence;
+        bool writing = flushInFlight;
+        bool moved = flashSequence != flushed;
+        portEXIT_CRITICAL(&stagingMux);
+
+        // Part of a chunk is fine, the client comes back for the rest; an empty one would end its download early
+        if (count > 0 || !missed || !(writing || moved)) {
+            break;
+        }
+        if (writing) {
+            delay(1); // The flush's records are in neither place until the write finishes
+        }
+    }
+
+    *nextSequence = sequence;
+
+    return count;
+}
@@ -0,0 +1,289 @@
+#include "httpParser.hpp"
+
+static HTTPPARSESTATUS fail(HTTPPARSER *parser, uint16_t status) {
+    parser->error = status;
+
+    return http_parse_error;
+}
+
+// Case-insensitive match of a header name or value against a lower case word
+static bool tokenIs(const char *buf, uint16_t start, uint16_t end, const char *word) {
+    size_t len = strlen(word);
+
+    return (size_t) (end - start) == len && strncasecmp(buf + start, word, len) == 0;
+}
+
+// "<method> <origin-form target> HTTP/1.x", returns the status to reject it with, 0 if it's fine
+static uint16_t parseRequestLine(HTTPPARSER *parser, const char *buf, uint16_t start, uint16_t end) {
+    uint16_t i = start;
+
+    while (i < end && buf[i] >= 'A' && buf[i] <= 'Z') {
+        i++;
+    }
+    if (i == start || i == end || buf[i] != ' ') {
+        return 400;
+    }
+    if (tokenIs(buf, start, i, "get")) {
+        parser->method = http_get;
+    } else if (tokenIs(buf, start, i, "head")) {
+        parser->method = http_head;
+    } else if (tokenIs(buf, start, i, "post")) {
+        parser->method = http_post;
+    } else {
+        parser->method = http_method_other;
+    }
+
+    // Only paths, no absolute URLs or "*"
+    uint16_t target = ++i;
+    if (i == end || buf[i] != '/') {
+        return 400;
+    }
+    while (i < end && buf[i] != ' ' && buf[i] != '?') {
+        i++;
+    }
+    parser->path_start = target;
+    parser->path_len = i - target;
+    parser->query_start = i;
+    parser->query_len = 0;
+    if (i < end && buf[i] == '?') {
+        parser->query_start = ++i;
+        while (i < end && buf[i] != ' ') {
+            i++;
+        }
+        parser->query_len = i - parser->query_start;
+    }
+
+    if (i == end || end - i != 9 || strncmp(buf + i, " HTTP/1.", 8) != 0) {
+        return i < end && strncmp(buf + i, " HTTP/", 6) == 0 ? 505 : 400;
+    }
+    if (buf[i + 8] == '1') {
+        parser->keep_alive = true; // HTTP/1.1 defaults to keep-alive, HTTP/1.0 has to ask for it
+    } else if (buf[i + 8] != '0') {
+        return 505;
+    }
+
+    return 0;
+}
+
+// A q parameter of zero, "q=0", "q=0.0" and so on, marks a coding as not acceptable
+static bool weightIsZero(const char *buf, uint16_t start, uint16_t end) {
+    if (end - start < 3 || (buf[start] != 'q' && buf[start] != 'Q') || buf[start + 1] != '=' || buf[start + 2] != '0') {
+        return false;
+    }
+    for (uint16_t i = start + 3; i < end; i++) {
+        if (buf[i] != '.' && buf[i] != '0') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Whether an Accept-Encoding value takes gzip: "gzip, deflate", "br;q=1.0, gzip;q=0.8" or "*" do, "gzip;q=0" doesn't
+static bool acceptsGzip(const char *buf, uint16_t start, uint16_t end) {
+    uint16_t i = start;
+
+    while (i < end) {
+        uint16_t element = i;
+        while (i < end && buf[i] != ',') {
+            i++;
+        }
+        uint16_t elementEnd = i++;
+
+        // "<coding> *( OWS ";" OWS <param> )", each piece trimmed
+        bool first = true;
+        bool gzip = false;
+        bool refused = false;
+        for (uint16_t piece = element; piece < elementEnd; first = false) {
+            uint16_t pieceEnd = piece;
+            while (pieceEnd < elementEnd && buf[pieceEnd] != ';') {
+                pieceEnd++;
+            }
+            uint16_t next = pieceEnd + 1;
+            while (piece < pieceEnd && (buf[piece] == ' ' || buf[piece] == '\t')) {
+                piece++;
+            }
+            while (pieceEnd > piece && (buf[pieceEnd - 1] == ' ' || buf[pieceEnd - 1] == '\t')) {
+                pieceEnd--;
+            }
+
+            if (first) {
+                gzip = tokenIs(buf, piece, pieceEnd, "gzip") || tokenIs(buf, piece, pieceEnd, "x-gzip") || tokenIs(buf, piece, pieceEnd, "*");
+            } else {
+                refused = refused || weightIsZero(buf, piece, pieceEnd);
+            }
+            piece = next;
+        }
+
+        if (gzip && !refused) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// "<name>: <value>", only the few headers the server acts on are kept
+static bool parseHeader(HTTPPARSER *parser, const char *buf, uint16_t start, uint16_t end) {
+    uint16_t colon = start;
+
+    while (colon < end && buf[colon] != ':') {
+        if (buf[colon] == ' ' || buf[colon] == '\t') {
+            return false; // No whitespace in or after a name
+        }
+        colon++;
+    }
+    if (colon == start || colon == end) {
+        return false;
+    }
+
+    uint16_t value = colon + 1;
+    while (value < end && (buf[value] == ' ' || buf[value] == '\t')) {
+        value++;
+    }
+    uint16_t valueEnd = end;
+    while (valueEnd > value && (buf[valueEnd - 1] == ' ' || buf[valueEnd - 1] == '\t')) {
+        valueEnd--;
+    }
+
+    if (tokenIs(buf, start, colon, "connection")) {
+        if (tokenIs(buf, value, valueEnd, "close")) {
+            parser->keep_alive = false;
+        } else if (tokenIs(buf, value, valueEnd, "keep-alive")) {
+            parser->keep_alive = true;
+        }
+    } else if (tokenIs(buf, start, colon, "if-none-match")) {
+        parser->etag_start = value;
+        parser->etag_len = valueEnd - value;
+    } else if (tokenIs(buf, start, colon, "accept-encoding")) {
+        parser->accepts_gzip = parser->accepts_gzip || acceptsGzip(buf, value, valueEnd);
+    }
+
+    return true;
+}
+
+void resetHttpParser(HTTPPARSER *parser) {
+    memset(parser, 0, sizeof(HTTPPARSER));
+    parser->line = http_line_request;
+
+    return;
+}
+
+/* Scans whatever has arrived since the last call, buf holds the request head from its first byte
+  * Bad bytes and overlong lines are rejected as soon as they arrive rather than once the head is complete.
+  * On http_parse_done parser->pos is the length of the head, anything after it is the next request.
+*/
+HTTPPARSESTATUS parseHttpRequest(HTTPPARSER *parser, const char *buf, uint16_t len, HTTPREQUEST *request) {
+    if (parser->error != 0) {
+        return http_parse_error;
+    }
+
+    while (parser->pos < len) {
+        char c = buf[parser->pos++];
+
+        if (c != '\n') {
+            // Controls other than CR and tab never appear in a request head
+            if (((uint8_t) c < 0x20 && c != '\r' && c != '\t') || c == 0x7F) {
+                return fail(parser, 400);
+            }
+            uint16_t lineLen = parser->pos - parser->line_start;
+            if (parser->line == http_line_request && lineLen > HTTP_MAX_REQUEST_LINE) {
+                return fail(parser, 414);
+            } else if (parser->line == http_line_header && lineLen > HTTP_MAX_HEADER_LINE) {
+                return fail(parser, 431);
+            }
+            continue;
+        }
+
+        // Lines end in CRLF, a bare LF is tolerated, a CR anywhere else isn't
+        uint16_t start = parser->line_start;
+        uint16_t end = parser->pos - 1;
+        if (end > start && buf[end - 1] == '\r') {
+            end--;
+        }
+        if (memchr(buf + start, '\r', end - start) != NULL) {
+            return fail(parser, 400);
+        }
+        parser->line_start = parser->pos;
+
+        if (parser->line == http_line_request) {
+            if (end == start) {
+                continue; // Blank lines ahead of a request are allowed
+            }
+            uint16_t status = parseRequestLine(parser, buf, start, end);
+            if (status != 0) {
+                return fail(parser, status);
+            }
+            parser->line = http_line_header;
+        } else if (end == start) {
+            request->method = parser->method;
+            request->path = buf + parser->path_start;
+            request->path_len = parser->path_len;
+            request->query = buf + parser->query_start;
+            request->query_len = parser->query_len;
+            request->if_none_match = parser->etag_len > 0 ? buf + parser->etag_start : NULL;
+            request->if_none_match_len = parser->etag_len;
+            request->accepts_gzip = parser->accepts_gzip;
+            request->keep_alive = parser->keep_alive;
+            return http_parse_done;
+        } else if (++parser->headers > HTTP_MAX_HEADERS) {
+            return fail(parser, 431);
+        } else if (!parseHeader(parser, buf, start, end)) {
+            return fail(parser, 400);
+        }
+    }
+
+    return http_parse_incomplete;
+}
+
+// Same hash as httpPathHash(), over the path of a parsed request
+uint32_t hashRequestPath(const HTTPREQUEST *request) {
+    uint32_t hash = 2166136261u;
+
+    for (uint16_t i = 0; i < request->path_len; i++) {
+        hash = (hash ^ (uint8_t) request->path[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Copies the URL decoded value of a query parameter, truncated to fit value
+// With a NULL value it only reports whether the parameter is there
+bool getQueryParam(const HTTPREQUEST *request, const char *name, char *value, size_t valueLen) {
+    size_t nameLen = strlen(name);
+    const char *query = request->query;
+    const char *queryEnd = request->query + request->query_len;
+
+    while (query < queryEnd) {
+        const char *paramEnd = (const char *) memchr(query, '&', queryEnd - query);
+        if (paramEnd == NULL) {
+            paramEnd = queryEnd;
+        }
+
+        if ((size_t) (paramEnd - query) > nameLen && strncmp(query, name, nameLen) == 0 && query[nameLen] == '=') {
+            const char *src = query + nameLen + 1;
+            size_t len = 0;
+
+            if (value == NULL) {
+                return true;
+            }
+            while (src < paramEnd && len + 1 < valueLen) {
+                if (*src == '%' && paramEnd - src > 2 && isxdigit(src[1]) && isxdigit(src[2])) {
+                    char hex[3] = { src[1], src[2], '\0' };
+                    value[len++] = strtol(hex, NULL, 16);
+                    src += 3;
+                } else {
+                    value[len++] = *src == '+' ? ' ' : *src;
+                    src++;
+                }
+            }
+
+            value[len] = '\0';
+            return true;
+        }
+
+        query = paramEnd + 1;
+    }
+
+    return false;
+}
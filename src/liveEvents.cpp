@@ -0,0 +1,160 @@
+#include "liveEvents.hpp"
+#include "beaconRegistry.hpp"
+#include "metrics.hpp"
+
+/* Push updates for the control page
+  * Producers only record that something changed, the web server renders one event per interval from the latest
+  * values and the same bytes go to every viewer. A burst of adverts costs one event, however many viewers there are.
+*/
+
+static portMUX_TYPE liveMux = portMUX_INITIALIZER_UNLOCKED;
+static LIVESAMPLE samples[BEACON_REGISTRY_MAX];
+static uint32_t pendingSamples = 0; // One bit per beacon with a sample not yet pushed
+static bool pendingState = false;
+static uint32_t pendingSinceMs = 0; // When the oldest unpushed change happened
+static LIVESTATERENDERER stateRenderer = NULL;
+
+static_assert(BEACON_REGISTRY_MAX <= 32, "pendingSamples has one bit per beacon");
+
+// Called with liveMux held
+static void notePending(uint32_t now) {
+    if (pendingSamples == 0 && !pendingState) {
+        pendingSinceMs = now;
+    }
+
+    return;
+}
+
+void publishRssiSample(uint8_t beaconIndex, int rssi, int filtered, uint32_t heardMs) {
+    if (beaconIndex >= BEACON_REGISTRY_MAX) {
+        return;
+    }
+
+    portENTER_CRITICAL(&liveMux);
+    notePending(heardMs);
+    samples[beaconIndex].rssi = (int8_t) rssi;
+    samples[beaconIndex].filtered = (int8_t) filtered;
+    samples[beaconIndex].heard_ms = heardMs == 0 ? 1 : heardMs;
+    pendingSamples |= 1UL << beaconIndex;
+    portEXIT_CRITICAL(&liveMux);
+
+    return;
+}
+
+// Door, lock or threshold changed, the state event is rendered fresh when it's pushed
+void publishStateChange() {
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&liveMux);
+    notePending(now);
+    pendingState = true;
+    portEXIT_CRITICAL(&liveMux);
+
+    return;
+}
+
+// renderState appends the state event's JSON, it is called from the web server task
+void initLiveEvents(LIVESTATERENDERER renderState) {
+    stateRenderer = renderState;
+
+    return;
+}
+
+static void renderState(WEBRESPONSE *event) {
+    appendResponse(event, "event: state\ndata: ");
+    stateRenderer(event);
+    appendResponse(event, "\n\n");
+
+    return;
+}
+
+// Samples as [beacon, raw, filtered] triples, only beacons set in mask
+static void renderSamples(WEBRESPONSE *event, const LIVESAMPLE *copy, uint32_t mask) {
+    bool first = true;
+
+    appendResponse(event, "event: rssi\ndata: {\"t\":%u,\"s\":[", (unsigned) millis());
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        if (mask & (1UL << i)) {
+            appendResponse(event, "%s[%u,%d,%d]", first ? "" : ",", i, copy[i].rssi, copy[i].filtered);
+            first = false;
+        }
+    }
+    appendResponse(event, "]}\n\n");
+
+    return;
+}
+
+// Web server's event source, leaves the event empty if nothing has changed since the last one
+void renderLiveEvents(WEBRESPONSE *event) {
+    LIVESAMPLE copy[BEACON_REGISTRY_MAX];
+    uint32_t mask;
+    bool state;
+    uint32_t since;
+
+    portENTER_CRITICAL(&liveMux);
+    mask = pendingSamples;
+    state = pendingState;
+    since = pendingSinceMs;
+    pendingSamples = 0;
+    pendingState = false;
+    if (mask != 0) {
+        memcpy(copy, samples, sizeof(copy));
+    }
+    portEXIT_CRITICAL(&liveMux);
+
+    if (mask == 0 && !state) {
+        return;
+    }
+
+    recordLiveEventDelay(millis() - since);
+    if (state) {
+        renderState(event);
+    }
+    if (mask != 0) {
+        renderSamples(event, copy, mask);
+    }
+
+    return;
+}
+
+// The state and every beacon's latest sample, for a viewer that fell behind and missed a change
+// Pending changes are left for the next event
+void renderLiveCatchUp(WEBRESPONSE *event) {
+    LIVESAMPLE copy[BEACON_REGISTRY_MAX];
+    uint32_t heard = 0;
+
+    portENTER_CRITICAL(&liveMux);
+    memcpy(copy, samples, sizeof(copy));
+    portEXIT_CRITICAL(&liveMux);
+
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        if (copy[i].heard_ms != 0) {
+            heard |= 1UL << i;
+        }
+    }
+
+    renderState(event);
+    if (heard != 0) {
+        renderSamples(event, copy, heard);
+    }
+
+    return;
+}
+
+// First response on a new stream: everything a viewer needs, later events only carry changes
+void renderLiveSnapshot(WEBRESPONSE *response) {
+    portENTER_CRITICAL(&liveMux);
+    if (pendingSamples != 0 || pendingState) {
+        pendingSinceMs = millis(); // Changes from before anyone was watching aren't late, the snapshot covers them
+    }
+    portEXIT_CRITICAL(&liveMux);
+
+    response->content_type = "text/event-stream";
+    response->extra_headers = "Cache-Control: no-store\r\n";
+    response->event_stream = true;
+
+    appendResponse(response, "retry: %u\n\n", LIVE_EVENT_RETRY_MS);
+    renderLiveCatchUp(response);
+
+    return;
+}
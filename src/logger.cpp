@@ -0,0 +1,111 @@
+#include "logger.hpp"
+#include "taskTable.hpp"
+
+// Bounded multi-producer queue, each slot's sequence number says whether it is free or holds a record
+// Producers never block or take a lock, when the ring is full the record is dropped and counted
+typedef struct {
+  std::atomic<uint32_t> sequence;
+  LOGRECORD record;
+} LOGSLOT;
+
+static LOGSLOT ring[LOG_RING_LEN];
+static std::atomic<uint32_t> ringHead(0); // Next slot to claim, shared by producers
+static uint32_t ringTail = 0; // Next slot to drain, only touched by the drain task
+static std::atomic<uint32_t> droppedRecords(0);
+
+static TaskHandle_t log_drain_task;
+
+static const char *levelNames[] = { "", "E", "W", "I", "D" };
+
+bool pushLogRecord(uint8_t level, const char *format, const uintptr_t *args, uint8_t argCount) {
+    uint32_t pos = ringHead.load(std::memory_order_relaxed);
+    LOGSLOT *slot;
+
+    for (;;) {
+        slot = &ring[pos & (LOG_RING_LEN - 1)];
+        int32_t diff = (int32_t) (slot->sequence.load(std::memory_order_acquire) - pos);
+
+        if (diff == 0) {
+            // Slot is free, try to claim it
+            if (ringHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Drain task hasn't caught up, the ring is full
+            droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = ringHead.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->record.timestamp_ms = millis();
+    slot->record.format = format;
+    slot->record.level = level;
+    for (uint8_t i = 0; i < LOG_MAX_ARGS; i++) {
+        slot->record.args[i] = i < argCount ? args[i] : 0;
+    }
+
+    slot->sequence.store(pos + 1, std::memory_order_release); // Publish to the drain task
+
+    return true;
+}
+
+uint32_t getLogDropCount() {
+    return droppedRecords.load(std::memory_order_relaxed);
+}
+
+static bool popLogRecord(LOGRECORD *record) {
+    LOGSLOT *slot = &ring[ringTail & (LOG_RING_LEN - 1)];
+
+    if ((int32_t) (slot->sequence.load(std::memory_order_acquire) - (ringTail + 1)) < 0) {
+        return false; // Empty
+    }
+
+    *record = slot->record;
+    slot->sequence.store(ringTail + LOG_RING_LEN, std::memory_order_release); // Hand the slot back to producers
+    ringTail++;
+
+    return true;
+}
+
+/* Runs at the lowest priority
+  * Formats queued records and writes them to Serial, so the blocking UART write never lands on a hot path
+*/
+static void drain_log( void * parameter ) {
+    uint32_t reportedDrops = 0;
+    char line[LOG_LINE_LEN];
+    LOGRECORD record;
+
+    for(;;) {
+        while (popLogRecord(&record)) {
+            int len = snprintf(line, sizeof(line), "[%lu][%s] ", (unsigned long) record.timestamp_ms, levelNames[record.level]);
+            len += snprintf(line + len, sizeof(line) - len, record.format,
+                record.args[0], record.args[1], record.args[2], record.args[3]);
+            if (len >= (int) sizeof(line)) {
+                len = sizeof(line) - 1;
+            }
+
+            Serial.write((const uint8_t *) line, len);
+            Serial.println();
+        }
+
+        uint32_t drops = getLogDropCount();
+        if (drops != reportedDrops) {
+            Serial.print("[log] "); Serial.print(drops - reportedDrops); Serial.println(" records dropped");
+            reportedDrops = drops;
+        }
+
+        delay(LOG_DRAIN_INTERVAL_MS);
+    }
+}
+
+void initLogger() {
+    for (uint32_t i = 0; i < LOG_RING_LEN; i++) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    log_drain_task = startTask(task_log, drain_log);
+
+    return;
+}
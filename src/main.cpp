@@ -1,506 +1,626 @@
 #include <Arduino.h>
 #include <BLEDevice.h>
-#include <BLEUtils.h>
-#include <BLEScan.h>
-#include <BLEAdvertisedDevice.h>
 #include <WiFi.h>
 #include "main.hpp"
 #include "eepromHandler.hpp"
+#include "logger.hpp"
+#include "doorControl.hpp"
+#include "doorSchedule.hpp"
+#include "eventJournal.hpp"
+#include "beaconRegistry.hpp"
+#include "webServer.hpp"
+#include "doorDecision.hpp"
+#include "provisioning.hpp"
+#include "scanScheduler.hpp"
+#include "bleScanner.hpp"
+#include "metrics.hpp"
+#include "liveEvents.hpp"
+#include "timerWheel.hpp"
+#include "taskTable.hpp"
+#include "rssiCapture.hpp"
+#include "telemetry.hpp"
+#include "doorTuning.hpp"
+#include "webPage.h"
 
 /* Define Global Vars */
 
-/* Configuration variables - not const as they I may add support for editing them via webpage */
-int SCAN_DURATION = 1; //In seconds
-uint32_t SCAN_INTERVAL = 1; // Time between scans in ms
-int RSSI_INC_THRESHOLD = 5; // If RSSI increases by this amount between pings, door should be opened
-int RSSI_DOOR_OVERRIDE = -78; // Threshold for RSSI to determine if door should be opened
-uint32_t door_open_time = 10; // Time in seconds that door should be open for
+// Scan timing and the open time come from the build's profile, the open threshold and approach rate from getTuning()
 
 /* Temporal variables */
-int previousRSSI = 0; // Allow for us to track if RSSI is increasing (Stronger signal = Ellie closer)
-int currentRSSI = 0;
-DOORSTATUS door_status = door_closed; // 0x00 = closed, 0x01 = open
-DOORLOCKSTATE doorLockState = door_unlocked;  
-uint32_t time_of_door_open = 0; // Time in seconds that door was opened
-uint32_t consecutiveFalsePings = 0;
-uint32_t unlock_cycles = 0; // Number of times this has been unlocked
-unsigned long uptime_hours = 0; // System uptime
-unsigned long uptime_days = 0; // System uptime
+int currentRSSI = 0; // Most recent raw sample from any registered beacon
 float coreTemp;
-char BLEDogName[100]; // Name registered in dog's BLE beacon - could make this an array of strings and check each one
-String BLEDogNameTemp;
+char BLEDogName[BEACON_NAME_MAX_LEN]; // Name of the first dog's BLE beacon, seeds the beacon registry
 
-// BLE Object
-BLEScan* pBLEScan;
+// BLE
+QueueHandle_t detection_queue; // Beacon detections from the BLE callback, consumed by loop()
+volatile bool scan_window_complete = true; // Set when a scan window ends so loop() can restart it
+uint32_t scan_window_started_ms = 0; // For the scan cycle histogram
+SCANMODE applied_scan_mode = scan_mode_count; // Profile the scanner and CPU are currently set up for
 
 
 TaskHandle_t door_lockout_task;
 
-// Flags when ellie beacon is found
-bool pinged = false;
-
 
 /* WIFI Variables */
 TaskHandle_t webserver_task;
-WiFiServer server(80); // Create server on port 80
-String header; // To store HTTP request
-
-// Current time
-unsigned long currentTime = millis();
-// Previous time
-unsigned long previousTime = 0; 
-// Define timeout time in milliseconds (example: 2000ms = 2s)
-const long timeoutTime = 2000;
+TaskHandle_t provisioning_task; // Serial prompts and WiFi connect/reconnect
 
 
 /* Declare Functions */
-void handle_door_lock( void * parameter );
 void handle_webserver( void * parameter );
-void open_door();
-void close_door();
-void unlock_door(DOORLOCKSTATE dls);
-void lock_door(DOORLOCKSTATE dls);
+void render_status_json(WEBRESPONSE *response);
+void render_live_state(WEBRESPONSE *event);
+void render_doors_json(WEBRESPONSE *response);
+void render_journal_chunk(const HTTPREQUEST *request, WEBRESPONSE *response);
 void get_core_temp();
-
-/* Define class for BLE */
-class MyAdvertisedDeviceCallbacks: public BLEAdvertisedDeviceCallbacks {
-    void onResult(BLEAdvertisedDevice advertisedDevice) {
-      if(advertisedDevice.getName() == BLEDogName) {
-        currentRSSI = advertisedDevice.getRSSI();
-        pinged = true;
-        consecutiveFalsePings = 0;
-      }
-    }
-};
-
-
+void scan_complete_cb();
+void apply_scan_profile(SCANMODE mode);
 
 /* Define Functions */
 void setup() {
   // put your setup code here, to run once:
   Serial.begin(115200);
   Serial.println("Ellie Door starting.");
+  initLogger();
+
+  // Relay, lockout switch interrupt and door event queue
+  initDoorControl(doorProfile.open_time_s * 1000);
+
+  // Event journal picks up where it left off, including the unlock count
+  if(initJournal()) {
+    setUnlockCycles(journalRecoveredUnlockCycles());
+  }
+  // Raw RSSI capture, idle until started from the web page
+  initRssiCapture();
 
-  // Set up relay pin
-  pinMode(RELAY_PIN, OUTPUT);
-  // Set up button pin
-  pinMode(LOCKOUT_SWITCH_PIN, INPUT_PULLUP);
+  // Door works from the stored configuration, nothing below waits on serial or WiFi
+  initEEPROM(EEPROM_SIZE);
+  if(migrateLegacyEEPROM()) {
+    Serial.println("---Moved stored settings to the config store---");
+  }
+  configBegin(&eepromConfigBackend);
+
+  // Registry holds every dog's beacon, seed it with the stored name on first boot
+  loadBeaconRegistry();
+  if(getBeaconCount() == 0 && configReadString(config_dog_name, BLEDogName, sizeof(BLEDogName))) {
+    addBeacon(BLEDogName, BEACON_THRESHOLD_GLOBAL, BEACON_PERM_OPEN | BEACON_PERM_CALIBRATE);
+    saveBeaconRegistry();
+  }
+  Serial.print("Registered beacons: "); Serial.println(getBeaconCount());
+
+  // Curfews wait for the wall clock, which provisioning gets from NTP once WiFi is up
+  loadDoorSchedule();
+
+  detection_queue = xQueueCreate(DETECTION_QUEUE_LEN, sizeof(BEACONDETECTION));
 
+  // Adverts are matched straight from the GAP scan results, detections arrive via detection_queue
   BLEDevice::init("");
-  pBLEScan = BLEDevice::getScan(); //create new scan
-  pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
-  pBLEScan->setActiveScan(true); //active scan uses more power, but get results faster
-  pBLEScan->setInterval(100);
-  pBLEScan->setWindow(99);  // less or equal setInterval value
-
-  setCpuFrequencyMhz(240);
-  Serial.print("CPU: "); Serial.print(getCpuFrequencyMhz()); Serial.println("MHz");
-  Serial.print("APB: "); Serial.print(getApbFrequency()); Serial.println("Hz");
-
-  initEEPROM(512);
-  
-
-  // Ensure we have name of dog to start with
-  bool requestNewName = false;
-  if(checkForEEPROMData(DOG_NAME_EEP_ADDR) == 0x00) {
-    requestNewName = true;
-    // Dog name not stored in EEPROM
-    Serial.println("---Unable to find BLE Beacon name in storage---");
-
-  } else { // Located BLE Dog name
-    uint32_t time_of_BLEName_prompt = millis();
-    BLEDogNameTemp = readStringFromEEPROM(DOG_NAME_EEP_ADDR);
-
-    Serial.print("Found BLE Name '"); Serial.print(BLEDogNameTemp); Serial.println("' - Would you like to change this? (y/N)");
-
-    // Wait 5s for user input
-    while(time_of_BLEName_prompt + 5000 > millis()) {
-      if( Serial.available() > 0) {
-        uint8_t conf = Serial.read();
-
-        if(conf == 'y') {
-          requestNewName = true;
-          break;
-        } else if(conf == 'n') {
-          requestNewName = false;
-          break;
-        }
-      }
+  initBLEScanner(detection_queue, scan_complete_cb);
+  // Scan settings and CPU clock follow whether a beacon is around, applied as each scan window starts
+  initScanScheduler(true, millis());
+
+  // Brings up the network stack so the web server can listen before WiFi has associated
+  // The provisioning task does its own reconnects, with backoff
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
+
+  // Core, priority and stack of each task are in the table in taskTable.cpp
+  door_lockout_task = startTask(task_door, handle_door_lock);
+
+  // Control page viewers get pushed changes rather than polling
+  initLiveEvents(render_live_state);
+  setWebEventSource(renderLiveEvents, renderLiveCatchUp, LIVE_EVENT_INTERVAL_MS);
+
+  webserver_task = startTask(task_web, handle_webserver);
+  // Door, lock and presence changes to an MQTT broker once one is set, commands come back the same way
+  initTelemetry();
+  provisioning_task = startTask(task_provisioning, handle_provisioning);
+
+  // Restarts the door or web task if either stops checking in, loop() is on the hardware watchdog
+  startTask(task_supervisor, handle_task_supervisor);
+  adoptTask(task_loop);
+  enableLoopWDT();
+
+  Serial.println("Startup has finished.");
+}
+
+
+void loop() {
+  BEACONDETECTION detection;
+
+  // Scan window has ended - release its results and immediately start the next one
+  if(scan_window_complete) {
+    scan_window_complete = false;
+
+    uint32_t now = millis();
+    if(scan_window_started_ms != 0) {
+      recordScanCycle(now - scan_window_started_ms);
+    }
+    scan_window_started_ms = now;
+    recordBootMilestone(boot_first_scan);
+    if(getBeaconCount() > 0) {
+      recordBootMilestone(boot_door_ready);
     }
-  }
 
-  if(requestNewName) {
-    Serial.println("Please enter the name of the dog's BLE Beacon as it appears in bluetooth: ");
+    get_core_temp();
 
-    while(Serial.available() == 0) {
-      delay(1);
+    updateScanScheduler(now);
+    if(calibrateBeaconThresholds(now, getTuning().open_threshold)) {
+      saveBeaconRegistry();
+    }
+    if(getScanMode() != applied_scan_mode) {
+      apply_scan_profile(getScanMode());
     }
 
-    // Read the SSID into the variable
-    BLEDogNameTemp = Serial.readStringUntil('\n');//.c_str();
+    if(!startScanWindow(getScanProfile(applied_scan_mode), doorProfile.scan_duration_s)) { // Non-blocking, detections arrive via detection_queue
+      LOG_WARN("Scan failed to start, retrying");
+      scan_window_complete = true;
+    }
+  }
 
-    writeStringToEEPROM(DOG_NAME_EEP_ADDR, BLEDogNameTemp);
+  // Act on each detection as soon as it arrives rather than at the end of the scan window
+  // Sleeps until then, or until the end of the window wakes it
+  if(xQueueReceive(detection_queue, &detection, pdMS_TO_TICKS(doorProfile.scan_interval_ms)) == pdTRUE && detection.beacon_index != BEACON_REGISTRY_EMPTY) { // A dog's beacon was located
+    DOORTUNING tuning = getTuning(); // One snapshot per detection, a change from the web page lands whole
+    currentRSSI = detection.rssi;
+    handleBeaconDetection(&detection, tuning.open_threshold, tuning.approach_rate);
+
+    if(getScanMode() != applied_scan_mode) {
+      // A beacon turned up during a low duty window, restart straight away rather than let the window run out
+      stopScanWindow();
+      scan_window_complete = true;
+    }
   }
 
-  memcpy(BLEDogName, BLEDogNameTemp.c_str(), strlen(BLEDogNameTemp.c_str()) -1 ); // Copy string to c-str and remove trailing charater 
+}
 
+// Scan settings are passed to the scanner as each window starts, the CPU clock changes straight away
+void apply_scan_profile(SCANMODE mode) {
+  static const char *modeNames[] = { "idle", "idle (active)", "alert" };
+  const SCANPROFILE *profile = getScanProfile(mode);
 
-  // Wifi vars
-  String ssid = "";
-  String password = "";
+  setCpuFrequencyMhz(profile->cpu_mhz);
 
-  char ssid_processed[100];
-  char password_processed[100];
+  applied_scan_mode = mode;
+  LOG_INFO("Scan mode %s, CPU %uMHz", modeNames[mode], getCpuFrequencyMhz());
+}
 
+// Called from the BLE stack when a scan window finishes, loop() restarts scanning
+void scan_complete_cb() {
+  BEACONDETECTION wake;
 
-  uint32_t time_of_wifi_prompt = millis();
-  bool forceWifiCredentials = false;
+  scan_window_complete = true;
+  // An empty detection wakes loop() from its wait on the queue
+  wake.beacon_index = BEACON_REGISTRY_EMPTY;
+  xQueueSend(detection_queue, &wake, 0);
+}
 
-  Serial.println("Would you like to enter new WIFI Credentials? (y/N)");
-  // Wait 5s for user input
-  while(time_of_wifi_prompt + 5000 > millis()) {
-    if( Serial.available() > 0) {
-      uint8_t conf = Serial.read();
+/* Route handlers, called by the web server with each parsed request
+  * Commands answer with the status JSON so the page can redraw from the reply
+*/
+void route_page(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  // Only the gzip copy is in flash, a client that can't take it is told so rather than sent bytes it can't read
+  if (!request->accepts_gzip) {
+    response->status = 406;
+    response->content_type = "text/plain";
+    response->extra_headers = "Vary: Accept-Encoding\r\n";
+    appendResponse(response, "The page is only served gzip compressed, send Accept-Encoding: gzip\n");
+    return;
+  }
 
-      if(conf == 'y') {
-        forceWifiCredentials = true;
-        break;
-      } else if(conf == 'n') {
-        break;
-      }
-    }
+  // Page never changes at runtime, browsers revalidate and get a 304 unless the firmware was updated
+  response->extra_headers = "Cache-Control: no-cache\r\nVary: Accept-Encoding\r\nETag: " WEB_PAGE_ETAG "\r\n";
+  if (request->if_none_match != NULL && request->if_none_match_len == sizeof(WEB_PAGE_ETAG) - 1 && memcmp(request->if_none_match, WEB_PAGE_ETAG, request->if_none_match_len) == 0) {
+    response->status = 304;
+    return;
   }
+  response->extra_headers = "Content-Encoding: gzip\r\nCache-Control: no-cache\r\nVary: Accept-Encoding\r\nETag: " WEB_PAGE_ETAG "\r\n";
+  response->static_body = WEB_PAGE_GZ;
+  response->static_len = WEB_PAGE_GZ_LEN;
 
-  
-  // Attempt to read SSID from EEPROM
-  if(checkForEEPROMData(WIFI_SSID_EEP_ADDR) == 0x00 || forceWifiCredentials) {
+  return;
+}
 
-    Serial.println("---Unable to find WIFI credentials in storage---");
+void route_status(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  render_status_json(response);
 
-    // Get WIFI SSID from user
-    Serial.println("Please enter your WiFi SSID: ");
-    // Wait for data
-    while(Serial.available() == 0) {
-      delay(1);
-    }
+  return;
+}
 
-    // Read the SSID into the variable
-    ssid = Serial.readStringUntil('\n');
+// Door commands take ?door=<id> from the status JSON's doors, and go to every door without it
+uint8_t requested_doors(const HTTPREQUEST *request) {
+  char param[8];
 
-    // Get WIFI password from user
-    Serial.println("Please enter your WiFI Password: ");
-    // Wait for data
-    while(Serial.available() == 0) {
-      delay(1);
-    }
+  if (!getQueryParam(request, "door", param, sizeof(param))) {
+    return DOOR_ALL;
+  }
+  uint8_t door = atoi(param);
+
+  return door < getDoorCount() ? 1 << door : 0;
+}
+
+// Lockout controls
+void route_lock_on(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  LOG_INFO("Turning Lockout on");
+  postDoorEvent(door_event_web_lock, micros(), 0, requested_doors(request));
+  render_status_json(response);
+
+  return;
+}
+
+void route_lock_off(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  LOG_INFO("Turning Lockout off");
+  postDoorEvent(door_event_web_unlock, micros(), 0, requested_doors(request));
+  render_status_json(response);
+
+  return;
+}
+
+// e.g. while a delivery is at the door, 0 ends it early. Locks the doors curfews apply to
+void route_lock_for(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[8];
 
-    // Read the Password into the variable
-    password = Serial.readStringUntil('\n');
-
-    // Wifi.begin requires c-strings, create them from string objects
-    ssid.toCharArray(ssid_processed, ssid.length());
-    password.toCharArray(password_processed, password.length());
-  } else {
-    // Retrieve SSID and Password from EEPROM
-    ssid = readStringFromEEPROM(WIFI_SSID_EEP_ADDR);
-    password = readStringFromEEPROM(WIFI_PWD_EEP_ADDR);
-    Serial.println("---Located WIFI credentials in storage---");
-
-    // Wifi.begin requires c-strings, create them from string objects
-    ssid.toCharArray(ssid_processed, ssid.length());
-    password.toCharArray(password_processed, password.length());
+  getQueryParam(request, "min", param, sizeof(param));
+  postDoorEvent(door_event_timed_lock, micros(), constrain(atoi(param), 0, TIMED_LOCK_MAX_MIN));
+  render_status_json(response);
+
+  return;
+}
+
+// Daily curfews, times are minutes after local midnight
+void route_schedule_add(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char start[8];
+  char end[8];
+  char tz[8];
+
+  getQueryParam(request, "start", start, sizeof(start));
+  if (getQueryParam(request, "end", end, sizeof(end))) {
+    addCurfew(atoi(start), atoi(end));
   }
+  if (getQueryParam(request, "tz", tz, sizeof(tz))) {
+    setScheduleUtcOffset(atoi(tz));
+  }
+  render_status_json(response);
+
+  return;
+}
+
+void route_schedule_remove(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[8];
 
-  Serial.print("Connecting to ");
-  Serial.println( ssid );
+  getQueryParam(request, "id", param, sizeof(param));
+  removeCurfew(atoi(param));
+  render_status_json(response);
 
-  WiFi.begin(ssid_processed, password_processed);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
+  return;
+}
+
+// The page sends the browser's clock, for when NTP can't be reached
+void route_clock(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[24];
+  uint64_t wallMs;
+
+  getQueryParam(request, "ms", param, sizeof(param));
+  if (!getWallClock(uptimeMs(), &wallMs)) {
+    setWallClock(strtoull(param, NULL, 10));
   }
+  render_status_json(response);
 
-  // Store uname and pwd to EEPROM
-  writeStringToEEPROM(WIFI_SSID_EEP_ADDR, ssid);
-  writeStringToEEPROM(WIFI_PWD_EEP_ADDR, password);
-
-  // Print local IP address and start web server
-  Serial.println("");
-  Serial.println("WiFi connected.");
-  Serial.println("IP address: ");
-  Serial.println(WiFi.localIP());
-  server.begin();
-
-  xTaskCreatePinnedToCore(
-      handle_webserver, /* Function to implement the task */
-      "hdl_ws", /* Name of the task */
-      5000,  /* Stack size in words */
-      NULL,  /* Task input parameter */
-      0,  /* Priority of the task */
-      &webserver_task,  /* Task handle. */
-      0); /* Core where the task should run */
-
-  xTaskCreatePinnedToCore(
-      handle_door_lock, /* Function to implement the task */
-      "hdl_sw", /* Name of the task */
-      5000,  /* Stack size in words */
-      NULL,  /* Task input parameter */
-      0,  /* Priority of the task */
-      &door_lockout_task,  /* Task handle. */
-      0); /* Core where the task should run */
+  return;
+}
 
+// RSSI (sensitivity) controls, no change in a build with the tuning fixed
+void route_rssi_inc(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  DOORTUNING tuning = getTuning();
 
-  Serial.println("Startup has finished.");
+  tuning.open_threshold = constrain(tuning.open_threshold + 1, -127, 0);
+  setTuning(tuning);
+  publishStateChange();
+  render_status_json(response);
+
+  return;
 }
 
+void route_rssi_dec(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  DOORTUNING tuning = getTuning();
 
-void loop() {
+  tuning.open_threshold = constrain(tuning.open_threshold - 1, -127, 0);
+  setTuning(tuning);
+  publishStateChange();
+  render_status_json(response);
 
-  get_core_temp();
-
-  BLEScanResults foundDevices = pBLEScan->start(SCAN_DURATION, false);
-  
-  if(pinged) { // Ellie beacon was located
-    Serial.print("Previous RSSI: "); Serial.println(previousRSSI);
-    Serial.print("Current RSSI: "); Serial.println(currentRSSI);
-
-    if(currentRSSI > RSSI_DOOR_OVERRIDE) {
-      //Serial.println("Ellie is close enough to open the door!");
-      open_door();
-      
-    } else if(previousRSSI != 0 and currentRSSI - previousRSSI > RSSI_INC_THRESHOLD) {
-      //Serial.println("Ellie is getting closer!");
-      //open_door();
-      asm("nop");
-      
-    } else if(previousRSSI != 0 and currentRSSI - previousRSSI < 0) {
-      //Serial.println("Ellie is getting further away!");
-      asm("nop");
-    } else if(previousRSSI != 0){
-      asm("nop");
-      //Serial.println("Ellie is the same distance away!");
-    }
+  return;
+}
 
-    previousRSSI = currentRSSI;
-    pinged = false;
-  } else {
-    consecutiveFalsePings++;
-  }
+void route_door_open(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  postDoorEvent(door_event_web_open, micros(), 0, requested_doors(request));
+  render_status_json(response);
 
-  if(consecutiveFalsePings > 10) { // 10 scans in a row did not find ellie
-    previousRSSI = 0;
+  return;
+}
+
+// Beacon registry edits
+void route_beacon_add(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[BEACON_REGISTRY_NAME_LEN];
+
+  getQueryParam(request, "name", param, sizeof(param));
+  if (param[0] != '\0' && addBeacon(param, BEACON_THRESHOLD_GLOBAL, BEACON_PERM_OPEN | BEACON_PERM_CALIBRATE) != BEACON_REGISTRY_EMPTY) {
+    saveBeaconRegistry();
   }
+  render_status_json(response);
+
+  return;
+}
 
-  pBLEScan->clearResults();   // delete results fromBLEScan buffer to release memory
+void route_beacon_remove(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[8];
 
-  delay(SCAN_INTERVAL);
+  getQueryParam(request, "id", param, sizeof(param));
+  if (removeBeacon(atoi(param))) {
+    saveBeaconRegistry();
+  }
+  render_status_json(response);
 
+  return;
 }
 
+void route_beacon_perm(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[8];
+
+  getQueryParam(request, "id", param, sizeof(param));
+  BEACONENTRY *beacon = getBeacon(atoi(param));
+  if (beacon != NULL) {
+    setBeaconPermissions(atoi(param), beacon->permissions ^ BEACON_PERM_OPEN);
+    saveBeaconRegistry();
+  }
+  render_status_json(response);
 
+  return;
+}
 
+// Toggles whether the beacon opens ?door=<id>
+void route_beacon_door(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[8];
 
-void handle_webserver( void * parameter ) {
-  for(;;) {
-    WiFiClient client = server.available();   // Listen for incoming clients
-
-    if (client) {                             // If a new client connects,
-    currentTime = millis();
-    uptime_days = currentTime / 1000 / 60 / 60 / 24; // Days
-    uptime_hours = (currentTime / 1000 / 60 / 60) - (uptime_days * 24); // Hours
-    previousTime = currentTime;
-    Serial.println("New Client.");          // print a message out in the serial port
-    String currentLine = "";                // make a String to hold incoming data from the client
-    while (client.connected() && currentTime - previousTime <= timeoutTime) {  // loop while the client's connected
-      currentTime = millis();
-      if (client.available()) {             // if there's bytes to read from the client,
-        char c = client.read();             // read a byte, then
-        Serial.write(c);                    // print it out the serial monitor
-        header += c;
-        if (c == '\n') {                    // if the byte is a newline character
-          // if the current line is blank, you got two newline characters in a row.
-          // that's the end of the client HTTP request, so send a response:
-          if (currentLine.length() == 0) {
-            // HTTP headers always start with a response code (e.g. HTTP/1.1 200 OK)
-            // and a content-type so the client knows what's coming, then a blank line:
-            client.println("HTTP/1.1 200 OK");
-            client.println("Content-type:text/html");
-            client.println("Connection: close");
-            client.println();
-            
-            // turns the GPIOs on and off
-            if (header.indexOf("GET /lock/on") >= 0) {
-              Serial.println("Turning Lockout on");
-              lock_door(door_locked_wifi);
-              close_door();
-            } else if (header.indexOf("GET /lock/off") >= 0) {
-              Serial.println("Turning Lockout off");
-              unlock_door(door_locked_wifi); //*((bool*) parameter)
-            }
-            // RSSI (sensitivity) controls
-            if (header.indexOf("GET /rssi/inc") >= 0) {
-              RSSI_DOOR_OVERRIDE++;
-            } else if (header.indexOf("GET /rssi/dec") >= 0) {
-              RSSI_DOOR_OVERRIDE--;
-            }
-
-            if (header.indexOf("GET /door/open") >= 0) {
-              open_door();
-            }
-            
-            // Display the HTML web page
-            client.println("<!DOCTYPE html><html>");
-            client.println("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
-            client.println("<link rel=\"icon\" href=\"data:,\">");
-            // CSS to style the on/off buttons 
-            // Feel free to change the background-color and font-size attributes to fit your preferences
-            client.println("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
-            client.println(".button { background-color: #4CAF50; border: none; color: white; padding: 16px 40px;");
-            client.println("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
-            client.println(".button2 {background-color: #555555;}</style></head>");
-            
-            // Web Page Heading
-            client.println("<body><h1>Ellie Door Control</h1>");
-
-            client.println("<h2>Door Control</h2>");
-            
-            // If the outputlockState is off, it displays the ON button       
-            if (doorLockState==door_unlocked) {
-              // Display current state, and ON/OFF buttons for Lockout  
-              client.println("<p>Lockout state: UNLOCKED </p>");
-              client.println("<a href=\"/lock/on\"><button class=\"button\">LOCK</button></a>");
-              // Opening the door
-              client.println("<a href=\"/door/open\"><button class=\"button\">OPEN</button></a>");
-            } else if (doorLockState==door_locked_switch) {
-              // Display current state, and ON/OFF buttons for Lockout  
-              client.println("<p>Lockout state: LOCKED (By Switch) </p>");
-              client.println("<a href=\"/lock/on\"><button class=\"button\">LOCK</button></a>");
-              // Opening the door
-              client.println("<a href=\"/door/open\"><button class=\"button\" disabled>OPEN</button></a>");
-            } else {
-              // Display current state, and ON/OFF buttons for Lockout  
-              client.println("<p>Lockout state: LOCKED </p>");
-              client.println("<a href=\"/lock/off\"><button class=\"button\">UNLOCK</button></a>");
-              // Opening the door
-              client.println("<a href=\"/door/open\"><button class=\"button button2\" disabled>OPEN</button></a>");
-            } 
-
-            
-
-            // RSSI
-            client.println("<h2>Sensitivity</h2>");
-            client.println("<p>RSSI Threshold: " + String(RSSI_DOOR_OVERRIDE) + "</p>");
-            client.println("<a href=\"/rssi/inc\"><button class=\"button\">+1</button></a>");
-            client.println("<a href=\"/rssi/dec\"><button class=\"button\">-1</button></a>");
-            client.println("<p>Most recent RSSI: " + String(currentRSSI) + "</p>");
-
-            client.println("<h2>Stats</h2>");
-            client.println("<p>Uptime: " + String(uptime_days) + " days " + String(uptime_hours) + " hours </p>");
-            client.println("<p>Unlock cycles: " + String(unlock_cycles) + "</p>");
-            client.println("<p>Core temp:  " + String(coreTemp) + "c</p>");
-               
-            client.println("</body></html>");
-            
-            // The HTTP response ends with another blank line
-            client.println();
-            // Break out of the while loop
-            break;
-          } else { // if you got a newline, then clear currentLine
-            currentLine = "";
-          }
-        } else if (c != '\r') {  // if you got anything else but a carriage return character,
-          currentLine += c;      // add it to the end of the currentLine
-        }
-      }
-    }
-    // Clear the header variable
-    header = "";
-    // Close the connection
-    client.stop();
-    Serial.println("Client disconnected.");
-    Serial.println("");
+  getQueryParam(request, "id", param, sizeof(param));
+  BEACONENTRY *beacon = getBeacon(atoi(param));
+  uint8_t door = requested_doors(request);
+  if (beacon != NULL && door != DOOR_ALL) {
+    setBeaconDoors(atoi(param), beacon->doors ^ door);
+    saveBeaconRegistry();
   }
+  render_status_json(response);
 
-  delay(5000);
+  return;
+}
+
+// Switching back to manual keeps the learnt threshold until it's changed
+void route_beacon_calibrate(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[8];
 
+  getQueryParam(request, "id", param, sizeof(param));
+  BEACONENTRY *beacon = getBeacon(atoi(param));
+  if (beacon != NULL) {
+    setBeaconPermissions(atoi(param), beacon->permissions ^ BEACON_PERM_CALIBRATE);
+    saveBeaconRegistry();
   }
+  render_status_json(response);
+
+  return;
+}
+
+// Controller accept list for beacon adverts
+void route_scan_filter_on(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  setScanFilterEnabled(true);
+  render_status_json(response);
+
+  return;
+}
 
+void route_scan_filter_off(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  setScanFilterEnabled(false);
+  render_status_json(response);
 
+  return;
+}
+
+// Records every matched advert to flash until stopped or the partition fills, see tools/capture_to_trace.py
+void route_capture_start(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  startRssiCapture();
+  render_status_json(response);
+
+  return;
+}
+
+void route_capture_stop(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  stopRssiCapture();
+  render_status_json(response);
+
+  return;
 }
 
-/* Runs on separate core
-  * Handles locking and unlocking the door based on lockout switch
-  * position and door open time
+// Telemetry broker as host[:port], empty turns it off. See telemetry.cpp for the topics
+void route_mqtt_broker(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[TELEMETRY_BROKER_LEN + 1];
+
+  getQueryParam(request, "host", param, sizeof(param));
+  setTelemetryBroker(param);
+  render_status_json(response);
+
+  return;
+}
+
+// Push updates, the stream stays open after this response
+void route_events(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  renderLiveSnapshot(response);
+
+  return;
+}
+
+void route_events_interval(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  char param[12];
+
+  getQueryParam(request, "ms", param, sizeof(param));
+  setWebEventSource(renderLiveEvents, renderLiveCatchUp, constrain(atoi(param), LIVE_EVENT_INTERVAL_MIN_MS, LIVE_EVENT_INTERVAL_MAX_MS));
+  render_status_json(response);
+
+  return;
+}
+
+void route_metrics(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  renderMetrics(response);
+
+  return;
+}
+
+// Where each task runs and how much CPU it has used, see tools/task_stress.py
+void route_tasks(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  renderTaskReport(response);
+
+  return;
+}
+
+/* Every path the server answers, matched on a hash the compiler works out, anything else is a 404
+  * A route listing a parameter never sees a request without it, those get a 400
+*/
+static constexpr WEBROUTE webRoutes[] = {
+  WEB_ROUTE(http_get, "/", NULL, route_page),
+  WEB_ROUTE(http_get, "/api/status", NULL, route_status),
+  WEB_ROUTE(http_get, "/lock/on", NULL, route_lock_on),
+  WEB_ROUTE(http_get, "/lock/off", NULL, route_lock_off),
+  WEB_ROUTE(http_get, "/lock/for", "min", route_lock_for),
+  WEB_ROUTE(http_get, "/schedule/add", "start", route_schedule_add),
+  WEB_ROUTE(http_get, "/schedule/remove", "id", route_schedule_remove),
+  WEB_ROUTE(http_get, "/clock", "ms", route_clock),
+  WEB_ROUTE(http_get, "/rssi/inc", NULL, route_rssi_inc),
+  WEB_ROUTE(http_get, "/rssi/dec", NULL, route_rssi_dec),
+  WEB_ROUTE(http_get, "/door/open", NULL, route_door_open),
+  WEB_ROUTE(http_get, "/beacon/add", "name", route_beacon_add),
+  WEB_ROUTE(http_get, "/beacon/remove", "id", route_beacon_remove),
+  WEB_ROUTE(http_get, "/beacon/perm", "id", route_beacon_perm),
+  WEB_ROUTE(http_get, "/beacon/calibrate", "id", route_beacon_calibrate),
+  WEB_ROUTE(http_get, "/beacon/door", "id", route_beacon_door),
+  WEB_ROUTE(http_get, "/scan/filter/on", NULL, route_scan_filter_on),
+  WEB_ROUTE(http_get, "/scan/filter/off", NULL, route_scan_filter_off),
+  WEB_ROUTE(http_get, "/api/events", NULL, route_events),
+  WEB_ROUTE(http_get, "/api/events/interval", "ms", route_events_interval),
+  WEB_ROUTE(http_get, "/metrics", NULL, route_metrics),
+  WEB_ROUTE(http_get, "/api/tasks", NULL, route_tasks),
+  WEB_ROUTE(http_get, "/api/journal", NULL, render_journal_chunk),
+  WEB_ROUTE(http_get, "/capture/start", NULL, route_capture_start),
+  WEB_ROUTE(http_get, "/capture/stop", NULL, route_capture_stop),
+  WEB_ROUTE(http_get, "/api/capture", NULL, renderCaptureChunk),
+  WEB_ROUTE(http_get, "/mqtt/broker", "host", route_mqtt_broker)
+};
+static_assert(webRoutesUnique(webRoutes, sizeof(webRoutes) / sizeof(webRoutes[0])), "Route table has a path listed twice");
+
+/* Runs on core 0 alongside the network stack
+  * Serves the control page, sleeping until a client connects or sends data
 */
-void handle_door_lock( void * parameter ) {
-  for(;;) {
-    // Lock door if lockout switch is closed (Locked)
-    if(digitalRead(LOCKOUT_SWITCH_PIN) == LOCKOUT_SWITCH_LOCKED) {
-      close_door();
-      lock_door(door_locked_switch);
-    } else {
-      // Lockout switch is open (Unlocked)
-      unlock_door(door_locked_switch);
-
-      // Check if door has been open for too long
-      if(door_status == door_open && (millis() / 1000) - time_of_door_open > door_open_time) {
-        close_door();
-      }
+void handle_webserver( void * parameter ) {
+  runWebServer(webRoutes, sizeof(webRoutes) / sizeof(webRoutes[0]));
+}
+
+// Live values for the control page, rendered straight into the response buffer
+void render_status_json(WEBRESPONSE *response) {
+  uint32_t now = millis();
+
+  response->content_type = "application/json";
+  response->extra_headers = "Cache-Control: no-store\r\n";
+
+  appendResponse(response, "{");
+  render_doors_json(response);
+  DOORTUNING tuning = getTuning();
+  appendResponse(response, ",\"threshold\":%d,\"rssi\":%d,", tuning.open_threshold, currentRSSI);
+  appendResponse(response, "\"profile\":\"%s\",\"tunable\":%s,\"tuning_version\":%u,", doorProfile.name, tuningFixed() ? "false" : "true", (unsigned) getTuningVersion());
+  appendResponse(response, "\"wifi_reconnects\":%u,", (unsigned) getWiFiReconnects());
+  appendResponse(response, "\"scan_filter\":\"%s\",", !getScanFilterEnabled() ? "off" : (scanWindowFiltered() ? "controller" : "host"));
+  appendResponse(response, "\"uptime_s\":%u,\"unlock_cycles\":%u,\"open_latency_ms\":%.1f,\"max_open_latency_ms\":%.1f,\"core_temp\":%.1f,\"config_commits\":%u,\"beacons\":[",
+    (unsigned) (now / 1000), (unsigned) getUnlockCycles(), getLastOpenLatency() / 1000.0, getMaxOpenLatency() / 1000.0, coreTemp, (unsigned) getConfigStats().commits);
+
+  bool first = true;
+  for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+    BEACONENTRY *beacon = getBeacon(i);
+    if (beacon == NULL) {
+      continue;
     }
 
-    delay(200);
-    
+    appendResponse(response, "%s{\"id\":%u,\"name\":\"", first ? "" : ",", i);
+    // Names come from users, escape anything that would break the JSON
+    for (uint8_t c = 0; c < beacon->matcher.name_len; c++) {
+      char ch = beacon->matcher.name[c];
+      appendResponse(response, (ch == '"' || ch == '\\') ? "\\%c" : ((uint8_t) ch < 0x20 ? "?" : "%c"), ch);
+    }
+    appendResponse(response, "\",\"rssi\":%d,\"seen_s\":%d,\"allowed\":%s,",
+      getFilteredRSSI(&beacon->rssi), beacon->last_seen_ms == 0 ? -1 : (int) ((now - beacon->last_seen_ms) / 1000),
+      (beacon->permissions & BEACON_PERM_OPEN) ? "true" : "false");
+    appendResponse(response, "\"threshold\":%d,\"calibrate\":%s,\"visits\":%u,\"passages\":%u,\"doors\":%u}",
+      beacon->open_threshold != BEACON_THRESHOLD_GLOBAL ? beacon->open_threshold : tuning.open_threshold, (beacon->permissions & BEACON_PERM_CALIBRATE) ? "true" : "false",
+      beacon->calibration.nearby_total, beacon->calibration.passed_total, beacon->doors);
+    first = false;
   }
-}
 
+  DOORSCHEDULE schedule = getDoorSchedule();
+  uint64_t wallMs;
+  appendResponse(response, "],\"clock\":%s,\"utc_offset_min\":%d,\"curfews\":[", getWallClock(uptimeMs(), &wallMs) ? "true" : "false", schedule.utc_offset_min);
+  for (uint8_t i = 0; i < schedule.count; i++) {
+    appendResponse(response, "%s{\"id\":%u,\"start\":%u,\"end\":%u}", i == 0 ? "" : ",", i, schedule.curfews[i].start_min, schedule.curfews[i].end_min);
+  }
 
-// Allows ellie to go through the door
-void open_door(){
+  appendResponse(response, "],\"capture\":");
+  renderCaptureStatus(response);
+  appendResponse(response, ",\"mqtt\":");
+  renderTelemetryStatus(response);
+  appendResponse(response, "}");
 
-  if(door_status == door_closed && doorLockState == door_unlocked) {
-    // Open door
-    digitalWrite(RELAY_PIN, HIGH);
-    time_of_door_open = millis() / 1000;
-    door_status = door_open;
-    unlock_cycles++;
-  } 
-  
   return;
 }
 
-// Stops ellie from going through the door
-void close_door() {
-
-  digitalWrite(RELAY_PIN, LOW);
-  time_of_door_open = 0;
-  door_status = door_closed;
+// Data of the push stream's state event, the subset of the status JSON that changes without a reload
+void render_live_state(WEBRESPONSE *event) {
+  appendResponse(event, "{");
+  render_doors_json(event);
+  appendResponse(event, ",\"threshold\":%d}", getTuning().open_threshold);
 
   return;
 }
 
-void lock_door(DOORLOCKSTATE dls) {
-  // Handle flagging the source of the door lock
-  if(doorLockState == door_unlocked) {
-    doorLockState = dls;
-  } else if (doorLockState != dls) {
-    doorLockState = door_locked_both;
+// "doors": state of each door, its id is what door commands take as ?door=
+void render_doors_json(WEBRESPONSE *response) {
+  static const char *lockNames[] = { "unlocked", "wifi", "switch", "both" };
+
+  appendResponse(response, "\"doors\":[");
+  for (uint8_t i = 0; i < getDoorCount(); i++) {
+    appendResponse(response, "%s{\"id\":%u,\"name\":\"%s\",\"door\":\"%s\",\"lock\":\"%s\"}", i == 0 ? "" : ",",
+      i, getDoorSpec(i)->name, getDoorStatus(i) == door_open ? "open" : "closed", lockNames[getDoorLockState(i)]);
   }
+  appendResponse(response, "]");
 
   return;
 }
 
-// This func will return if already unlocked
-void unlock_door(DOORLOCKSTATE dls) {
-  // Handling clearing of locks
-  if(doorLockState == dls) {
-    doorLockState = door_unlocked;
-  } else if(doorLockState == door_locked_both) {
-    if(dls == door_locked_switch) {
-      doorLockState = door_locked_wifi;
-    } else {
-      doorLockState = door_locked_switch;
-    }
+/* Binary journal records starting at ?from=<sequence>, one chunk per request
+  * X-Journal-Next gives the sequence to ask for next, the download is complete when a chunk comes back empty
+*/
+void render_journal_chunk(const HTTPREQUEST *request, WEBRESPONSE *response) {
+  static char nextHeader[48]; // Must outlive this call, the web server formats headers after we return
+  char param[12];
+  uint32_t from = getQueryParam(request, "from", param, sizeof(param)) ? strtoul(param, NULL, 10) : 0;
+  uint32_t next;
+  uint16_t maxRecords = response->body_cap / sizeof(JOURNALRECORD);
+
+  if (maxRecords > JOURNAL_CHUNK_RECORDS) {
+    maxRecords = JOURNAL_CHUNK_RECORDS;
   }
+
+  // Records are copied straight into the response buffer
+  uint16_t count = journalReadChunk(from, (JOURNALRECORD *) response->body, maxRecords, &next);
+
+  snprintf(nextHeader, sizeof(nextHeader), "X-Journal-Next: %u\r\n", (unsigned) next);
+  response->content_type = "application/octet-stream";
+  response->extra_headers = nextHeader;
+  response->body_len = count * sizeof(JOURNALRECORD);
+
   return;
 }
 
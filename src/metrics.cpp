@@ -0,0 +1,276 @@
+#include "metrics.hpp"
+#include "taskTable.hpp"
+#include "logger.hpp"
+#include "eventJournal.hpp"
+#include "scanScheduler.hpp"
+#include "telemetry.hpp"
+
+static const uint32_t scanCycleBounds[] = { 900, 1000, 1050, 1100, 1250, 1500, 2000, 5000 };
+static const uint32_t openLatencyBounds[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 50000, 250000, 1000000 };
+static const uint32_t doorEventWaitBounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000 };
+static const uint32_t httpHandlingBounds[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 50000 };
+static const uint32_t liveDelayBounds[] = { 10, 50, 100, 250, 500, 1000, 2500, 5000 };
+static const uint32_t telemetryDelayBounds[] = { 250, 1000, 30000 };
+static const uint32_t scanHostBounds[] = { 100, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000 };
+static const uint32_t scanHeapBounds[] = { 0, 256, 1024, 4096, 16384, 65536 };
+
+static METRICHISTOGRAM scanCycle = { "door_scan_cycle_ms", "Time from one BLE scan window starting to the next",
+    scanCycleBounds, sizeof(scanCycleBounds) / sizeof(scanCycleBounds[0]) };
+static METRICHISTOGRAM openLatency = { "door_open_latency_us", "Time from the cause of an open (e.g. beacon advert) to the relay",
+    openLatencyBounds, sizeof(openLatencyBounds) / sizeof(openLatencyBounds[0]) };
+static METRICHISTOGRAM doorEventWait = { "door_event_wait_us", "Time from a switch change or web command being posted to the door task handling it",
+    doorEventWaitBounds, sizeof(doorEventWaitBounds) / sizeof(doorEventWaitBounds[0]) };
+static METRICHISTOGRAM httpHandling = { "door_http_handling_us", "Time spent handling one HTTP request",
+    httpHandlingBounds, sizeof(httpHandlingBounds) / sizeof(httpHandlingBounds[0]) };
+static METRICHISTOGRAM scanHost = { "door_scan_window_host_us", "Host CPU time spent on adverts during one scan window",
+    scanHostBounds, sizeof(scanHostBounds) / sizeof(scanHostBounds[0]) };
+static METRICHISTOGRAM scanHeap = { "door_scan_window_heap_drop_bytes", "Fall in free heap from the start of one scan window to its end, 0 if it grew",
+    scanHeapBounds, sizeof(scanHeapBounds) / sizeof(scanHeapBounds[0]) };
+
+static METRICHISTOGRAM liveDelay = { "door_live_event_delay_ms", "Time from a change to the push event carrying it being rendered",
+    liveDelayBounds, sizeof(liveDelayBounds) / sizeof(liveDelayBounds[0]) };
+static METRICHISTOGRAM telemetryDelay = { "door_mqtt_event_delay_ms", "Time from a change to the MQTT message carrying it being sent",
+    telemetryDelayBounds, sizeof(telemetryDelayBounds) / sizeof(telemetryDelayBounds[0]) };
+
+static std::atomic<uint32_t> advertsSeen(0);
+static std::atomic<uint32_t> advertsMatched(0);
+static std::atomic<uint32_t> scanWindows[2]; // Unfiltered, filtered by the controller accept list
+static std::atomic<uint32_t> scanWindowAdverts[2];
+static std::atomic<uint32_t> scanWindowHeapFree(0); // As of the last window boundary
+static std::atomic<uint32_t> scanWindowHeapMinFree(0);
+static std::atomic<uint32_t> httpParseUs(0);
+static std::atomic<uint32_t> httpParsed(0);
+static const uint16_t httpRejectStatuses[] = { 400, 414, 431, 505 };
+static std::atomic<uint32_t> httpRejected[sizeof(httpRejectStatuses) / sizeof(httpRejectStatuses[0]) + 1]; // Last one is any other status
+static std::atomic<uint32_t> liveEvents(0);
+static std::atomic<uint32_t> liveRenderUs(0);
+static std::atomic<uint32_t> liveSendUs(0);
+static std::atomic<uint32_t> liveDeliveries(0);
+static std::atomic<uint32_t> liveSkipped(0);
+static std::atomic<uint32_t> bootMilestones[boot_milestone_count]; // 0 until reached
+static const char *bootMilestoneNames[boot_milestone_count] = { "first_scan", "door_ready", "wifi_connected" };
+
+
+void observeHistogram(METRICHISTOGRAM *histogram, uint32_t value) {
+    uint8_t bucket = 0;
+
+    while (bucket < histogram->bucket_count && value > histogram->bounds[bucket]) {
+        bucket++;
+    }
+
+    histogram->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram->sum.fetch_add(value, std::memory_order_relaxed);
+    histogram->count.fetch_add(1, std::memory_order_relaxed);
+
+    return;
+}
+
+void recordScanCycle(uint32_t ms) {
+    observeHistogram(&scanCycle, ms);
+
+    return;
+}
+
+void recordOpenLatency(uint32_t us) {
+    observeHistogram(&openLatency, us);
+
+    return;
+}
+
+void recordDoorEventWait(uint32_t us) {
+    observeHistogram(&doorEventWait, us);
+
+    return;
+}
+
+void recordHttpHandling(uint32_t us) {
+    observeHistogram(&httpHandling, us);
+
+    return;
+}
+
+// Parser time is added up over every read of a request head, complete is set on the read that finished it
+void recordHttpParse(uint32_t us, bool complete) {
+    httpParseUs.fetch_add(us, std::memory_order_relaxed);
+    if (complete) {
+        httpParsed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return;
+}
+
+void recordHttpRejected(uint16_t status) {
+    uint8_t i = 0;
+
+    while (i < sizeof(httpRejectStatuses) / sizeof(httpRejectStatuses[0]) && httpRejectStatuses[i] != status) {
+        i++;
+    }
+    httpRejected[i].fetch_add(1, std::memory_order_relaxed);
+
+    return;
+}
+
+// Called for every advert heard, so just two counters and no clock reads
+void countAdvert(bool matched) {
+    advertsSeen.fetch_add(1, std::memory_order_relaxed);
+    if (matched) {
+        advertsMatched.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return;
+}
+
+// Once per scan window, with what reaching the host cost during it and the free heap either side of it
+void recordScanWindow(uint32_t hostUs, uint32_t adverts, bool filtered, uint32_t heapBefore, uint32_t heapAfter, uint32_t heapMinFree) {
+    observeHistogram(&scanHost, hostUs);
+    observeHistogram(&scanHeap, heapBefore > heapAfter ? heapBefore - heapAfter : 0);
+    scanWindowHeapFree.store(heapAfter, std::memory_order_relaxed);
+    scanWindowHeapMinFree.store(heapMinFree, std::memory_order_relaxed);
+    scanWindows[filtered].fetch_add(1, std::memory_order_relaxed);
+    scanWindowAdverts[filtered].fetch_add(adverts, std::memory_order_relaxed);
+
+    return;
+}
+
+void recordLiveEventDelay(uint32_t ms) {
+    observeHistogram(&liveDelay, ms);
+
+    return;
+}
+
+void recordTelemetryDelay(uint32_t ms) {
+    observeHistogram(&telemetryDelay, ms);
+
+    return;
+}
+
+// Once per pushed event, send time divided by deliveries is the cost of each extra viewer
+void recordEventFanout(uint32_t renderUs, uint32_t sendUs, uint8_t delivered, uint8_t skipped) {
+    liveEvents.fetch_add(1, std::memory_order_relaxed);
+    liveRenderUs.fetch_add(renderUs, std::memory_order_relaxed);
+    liveSendUs.fetch_add(sendUs, std::memory_order_relaxed);
+    liveDeliveries.fetch_add(delivered, std::memory_order_relaxed);
+    liveSkipped.fetch_add(skipped, std::memory_order_relaxed);
+
+    return;
+}
+
+// Only the first call for each milestone counts, later ones are a single load
+void recordBootMilestone(BOOTMILESTONE milestone) {
+    uint32_t expected = 0;
+
+    if (bootMilestones[milestone].load(std::memory_order_relaxed) == 0) {
+        uint32_t now = millis();
+        bootMilestones[milestone].compare_exchange_strong(expected, now == 0 ? 1 : now, std::memory_order_relaxed);
+    }
+
+    return;
+}
+
+// Histogram buckets are cumulative in the exposition format
+static void renderHistogram(WEBRESPONSE *response, METRICHISTOGRAM *histogram) {
+    uint32_t cumulative = 0;
+
+    appendResponse(response, "# HELP %s %s\n# TYPE %s histogram\n", histogram->name, histogram->help, histogram->name);
+
+    for (uint8_t i = 0; i < histogram->bucket_count; i++) {
+        cumulative += histogram->buckets[i].load(std::memory_order_relaxed);
+        appendResponse(response, "%s_bucket{le=\"%u\"} %u\n", histogram->name, (unsigned) histogram->bounds[i], (unsigned) cumulative);
+    }
+
+    cumulative += histogram->buckets[histogram->bucket_count].load(std::memory_order_relaxed);
+    appendResponse(response, "%s_bucket{le=\"+Inf\"} %u\n%s_sum %u\n%s_count %u\n", histogram->name, (unsigned) cumulative,
+        histogram->name, (unsigned) histogram->sum.load(std::memory_order_relaxed),
+        histogram->name, (unsigned) histogram->count.load(std::memory_order_relaxed));
+
+    return;
+}
+
+// Everything expensive (heap walk, stack marks) happens here, only when someone scrapes
+void renderMetrics(WEBRESPONSE *response) {
+    response->content_type = "text/plain; version=0.0.4";
+
+    renderHistogram(response, &scanCycle);
+    renderHistogram(response, &openLatency);
+    renderHistogram(response, &doorEventWait);
+    renderHistogram(response, &httpHandling);
+    renderHistogram(response, &scanHost);
+    renderHistogram(response, &scanHeap);
+    renderHistogram(response, &liveDelay);
+    renderHistogram(response, &telemetryDelay);
+
+    appendResponse(response, "# TYPE door_adverts_seen_total counter\ndoor_adverts_seen_total %u\n",
+        (unsigned) advertsSeen.load(std::memory_order_relaxed));
+    appendResponse(response, "# TYPE door_adverts_matched_total counter\ndoor_adverts_matched_total %u\n",
+        (unsigned) advertsMatched.load(std::memory_order_relaxed));
+
+    appendResponse(response, "# HELP door_http_parsed_total Request heads parsed\n# TYPE door_http_parsed_total counter\ndoor_http_parsed_total %u\n",
+        (unsigned) httpParsed.load(std::memory_order_relaxed));
+    appendResponse(response, "# HELP door_http_parse_us_total Time spent parsing request heads, including rejected ones\n# TYPE door_http_parse_us_total counter\ndoor_http_parse_us_total %u\n",
+        (unsigned) httpParseUs.load(std::memory_order_relaxed));
+    appendResponse(response, "# HELP door_http_rejected_total Requests refused before reaching a route\n# TYPE door_http_rejected_total counter\n");
+    for (uint8_t i = 0; i <= sizeof(httpRejectStatuses) / sizeof(httpRejectStatuses[0]); i++) {
+        if (i < sizeof(httpRejectStatuses) / sizeof(httpRejectStatuses[0])) {
+            appendResponse(response, "door_http_rejected_total{status=\"%u\"} %u\n", httpRejectStatuses[i], (unsigned) httpRejected[i].load(std::memory_order_relaxed));
+        } else {
+            appendResponse(response, "door_http_rejected_total{status=\"other\"} %u\n", (unsigned) httpRejected[i].load(std::memory_order_relaxed));
+        }
+    }
+
+    static const char *filterNames[2] = { "none", "controller" };
+    appendResponse(response, "# HELP door_scan_windows_total Scan windows by whether the controller filtered adverts\n# TYPE door_scan_windows_total counter\n");
+    for (uint8_t i = 0; i < 2; i++) {
+        appendResponse(response, "door_scan_windows_total{filter=\"%s\"} %u\n", filterNames[i], (unsigned) scanWindows[i].load(std::memory_order_relaxed));
+    }
+    appendResponse(response, "# HELP door_scan_window_adverts_total Adverts that reached the host by scan window filtering\n# TYPE door_scan_window_adverts_total counter\n");
+    for (uint8_t i = 0; i < 2; i++) {
+        appendResponse(response, "door_scan_window_adverts_total{filter=\"%s\"} %u\n", filterNames[i], (unsigned) scanWindowAdverts[i].load(std::memory_order_relaxed));
+    }
+    appendResponse(response, "# HELP door_scan_window_heap_free_bytes Free heap when the last scan window ended\n# TYPE door_scan_window_heap_free_bytes gauge\ndoor_scan_window_heap_free_bytes %u\n",
+        (unsigned) scanWindowHeapFree.load(std::memory_order_relaxed));
+    appendResponse(response, "# HELP door_scan_window_heap_min_free_bytes Lowest free heap since boot, as of the last scan window ending\n# TYPE door_scan_window_heap_min_free_bytes gauge\ndoor_scan_window_heap_min_free_bytes %u\n",
+        (unsigned) scanWindowHeapMinFree.load(std::memory_order_relaxed));
+
+    appendResponse(response, "# TYPE door_live_events_total counter\ndoor_live_events_total %u\n", (unsigned) liveEvents.load(std::memory_order_relaxed));
+    appendResponse(response, "# TYPE door_live_render_us_total counter\ndoor_live_render_us_total %u\n", (unsigned) liveRenderUs.load(std::memory_order_relaxed));
+    appendResponse(response, "# TYPE door_live_send_us_total counter\ndoor_live_send_us_total %u\n", (unsigned) liveSendUs.load(std::memory_order_relaxed));
+    appendResponse(response, "# HELP door_live_deliveries_total Push events written to a viewer\n# TYPE door_live_deliveries_total counter\ndoor_live_deliveries_total %u\n",
+        (unsigned) liveDeliveries.load(std::memory_order_relaxed));
+    appendResponse(response, "# HELP door_live_skipped_total Push events a slow viewer missed\n# TYPE door_live_skipped_total counter\ndoor_live_skipped_total %u\n",
+        (unsigned) liveSkipped.load(std::memory_order_relaxed));
+
+    appendResponse(response, "# TYPE door_log_dropped_total counter\ndoor_log_dropped_total %u\n", (unsigned) getLogDropCount());
+    appendResponse(response, "# TYPE door_journal_dropped_total counter\ndoor_journal_dropped_total %u\n", (unsigned) journalDropCount());
+
+    TELEMETRYSTATS telemetry = getTelemetryStats();
+    appendResponse(response, "# TYPE door_mqtt_connected gauge\ndoor_mqtt_connected %u\n", telemetry.connected ? 1 : 0);
+    appendResponse(response, "# TYPE door_mqtt_messages_total counter\ndoor_mqtt_messages_total %u\n", (unsigned) telemetry.messages_sent);
+    appendResponse(response, "# HELP door_mqtt_dropped_total Telemetry lost to a full event ring or outbox\n# TYPE door_mqtt_dropped_total counter\n");
+    appendResponse(response, "door_mqtt_dropped_total{stage=\"event\"} %u\ndoor_mqtt_dropped_total{stage=\"message\"} %u\n",
+        (unsigned) telemetry.events_dropped, (unsigned) telemetry.messages_dropped);
+
+    static const char *scanModeNames[scan_mode_count] = { "idle", "idle_active", "alert" };
+    uint32_t now = millis();
+    appendResponse(response, "# TYPE door_scan_mode_seconds_total counter\n");
+    for (uint8_t i = 0; i < scan_mode_count; i++) {
+        appendResponse(response, "door_scan_mode_seconds_total{mode=\"%s\"} %u\n", scanModeNames[i], (unsigned) (getScanModeTime((SCANMODE) i, now) / 1000));
+    }
+    appendResponse(response, "# HELP door_energy_model_mah Charge used since boot according to the scan energy model\n# TYPE door_energy_model_mah counter\ndoor_energy_model_mah %.2f\n",
+        scanEnergy_uAms(now) / 3.6e9);
+
+    appendResponse(response, "# HELP door_boot_milestone_ms Time since reset at which each boot stage was reached\n# TYPE door_boot_milestone_ms gauge\n");
+    for (uint8_t i = 0; i < boot_milestone_count; i++) {
+        uint32_t reachedAt = bootMilestones[i].load(std::memory_order_relaxed);
+        if (reachedAt != 0) {
+            appendResponse(response, "door_boot_milestone_ms{stage=\"%s\"} %u\n", bootMilestoneNames[i], (unsigned) reachedAt);
+        }
+    }
+
+    appendResponse(response, "# TYPE door_heap_free_bytes gauge\ndoor_heap_free_bytes %u\n", (unsigned) ESP.getFreeHeap());
+    appendResponse(response, "# TYPE door_heap_largest_free_block_bytes gauge\ndoor_heap_largest_free_block_bytes %u\n", (unsigned) ESP.getMaxAllocHeap());
+    appendResponse(response, "# TYPE door_heap_min_free_bytes gauge\ndoor_heap_min_free_bytes %u\n", (unsigned) ESP.getMinFreeHeap());
+
+    renderTaskMetrics(response);
+
+    return;
+}
@@ -0,0 +1,392 @@
+#include "mqttClient.hpp"
+#include "logger.hpp"
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+
+/* Packet types, the high nibble of the first byte
+  * Only what a QoS 0 client needs: everything it sends is fire and forget, and SUBACKs are read and ignored
+*/
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x82 // Type 8 with the reserved flags the spec requires
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+#define MQTT_CONNECT_CLEAN_SESSION 0x02
+#define MQTT_CONNECT_WILL 0x04
+#define MQTT_CONNECT_WILL_RETAIN 0x20
+#define MQTT_PUBLISH_RETAIN 0x01
+#define MQTT_PUBLISH_QOS_MASK 0x06
+
+#define MQTT_HEADER_MAX 5 // Type byte and up to four bytes of remaining length
+
+void initMqttClient(MQTTCLIENT *client, MQTTMESSAGEHANDLER onMessage) {
+    client->fd = -1;
+    client->last_sent_ms = 0;
+    client->ping_sent_ms = 0;
+    client->next_packet_id = 1;
+    client->on_message = onMessage;
+    client->rx_len = 0;
+
+    return;
+}
+
+bool mqttConnected(const MQTTCLIENT *client) {
+    return client->fd >= 0;
+}
+
+// Closes without a DISCONNECT, so the broker sends the will
+static void dropConnection(MQTTCLIENT *client) {
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+    client->rx_len = 0;
+    client->ping_sent_ms = 0;
+
+    return;
+}
+
+static void putString(uint8_t *buf, size_t *pos, const char *str) {
+    uint16_t len = strlen(str);
+
+    buf[(*pos)++] = len >> 8;
+    buf[(*pos)++] = len & 0xFF;
+    memcpy(&buf[*pos], str, len);
+    *pos += len;
+
+    return;
+}
+
+/* Variable header and payload are built from tx[MQTT_HEADER_MAX] on, the fixed header then goes in just in front
+  * Returns where the packet starts in tx, its length is written to packetLen
+*/
+static size_t finishPacket(MQTTCLIENT *client, uint8_t type, size_t bodyLen, size_t *packetLen) {
+    uint8_t length[4];
+    uint8_t lengthBytes = 0;
+    size_t remaining = bodyLen;
+
+    do {
+        length[lengthBytes] = remaining & 0x7F;
+        remaining >>= 7;
+        if (remaining > 0) {
+            length[lengthBytes] |= 0x80;
+        }
+        lengthBytes++;
+    } while (remaining > 0);
+
+    size_t start = MQTT_HEADER_MAX - 1 - lengthBytes;
+    client->tx[start] = type;
+    memcpy(&client->tx[start + 1], length, lengthBytes);
+    *packetLen = 1 + lengthBytes + bodyLen;
+
+    return start;
+}
+
+// Blocks for at most MQTT_SEND_TIMEOUT_MS per send, a broker that stops reading costs the connection
+static bool sendPacket(MQTTCLIENT *client, size_t start, size_t len) {
+    size_t sent = 0;
+
+    while (sent < len) {
+        ssize_t written = send(client->fd, &client->tx[start + sent], len - sent, MSG_NOSIGNAL);
+        if (written <= 0) {
+            LOG_WARN("MQTT send failed (%d), dropping the connection", errno);
+            dropConnection(client);
+            return false;
+        }
+        sent += written;
+    }
+
+    client->last_sent_ms = millis();
+
+    return true;
+}
+
+static bool sendEmptyPacket(MQTTCLIENT *client, uint8_t type) {
+    size_t len;
+    size_t start = finishPacket(client, type, 0, &len);
+
+    return sendPacket(client, start, len);
+}
+
+// Connects without blocking for longer than MQTT_CONNECT_TIMEOUT_MS, the socket is left blocking with a send timeout
+static int openSocket(const char *host, uint16_t port) {
+    struct addrinfo hints;
+    struct addrinfo *resolved = NULL;
+    char service[6];
+    int fd;
+    int one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &resolved) != 0 || resolved == NULL) {
+        LOG_WARN("MQTT broker not found"); // The caller logs which, host may not outlive the record
+        return -1;
+    }
+
+    fd = socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(resolved);
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int result = connect(fd, resolved->ai_addr, resolved->ai_addrlen);
+    freeaddrinfo(resolved);
+
+    if (result < 0 && errno == EINPROGRESS) {
+        fd_set writeFds;
+        struct timeval timeout = { MQTT_CONNECT_TIMEOUT_MS / 1000, (MQTT_CONNECT_TIMEOUT_MS % 1000) * 1000 };
+        int error = 0;
+        socklen_t errorLen = sizeof(error);
+
+        FD_ZERO(&writeFds);
+        FD_SET(fd, &writeFds);
+        if (select(fd + 1, NULL, &writeFds, NULL, &timeout) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) == 0 && error == 0) {
+            result = 0;
+        }
+    }
+    if (result < 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct timeval sendTimeout = { MQTT_SEND_TIMEOUT_MS / 1000, (MQTT_SEND_TIMEOUT_MS % 1000) * 1000 };
+    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Each publish is one small write, send it now
+
+    return fd;
+}
+
+// Reads until a CONNACK has arrived or MQTT_CONNECT_TIMEOUT_MS has passed
+static bool waitConnack(MQTTCLIENT *client) {
+    uint8_t connack[4];
+    size_t received = 0;
+    uint32_t started = millis();
+
+    while (received < sizeof(connack)) {
+        uint32_t waited = millis() - started;
+        if (waited >= MQTT_CONNECT_TIMEOUT_MS) {
+            return false;
+        }
+
+        uint32_t left = MQTT_CONNECT_TIMEOUT_MS - waited;
+        fd_set readFds;
+        struct timeval timeout = { (time_t) (left / 1000), (long) (left % 1000) * 1000 };
+        FD_ZERO(&readFds);
+        FD_SET(client->fd, &readFds);
+        if (select(client->fd + 1, &readFds, NULL, NULL, &timeout) != 1) {
+            return false;
+        }
+
+        ssize_t got = recv(client->fd, &connack[received], sizeof(connack) - received, MSG_DONTWAIT);
+        if (got <= 0) {
+            return false;
+        }
+        received += got;
+    }
+
+    if (connack[0] != MQTT_CONNACK || connack[1] != 2 || connack[3] != 0) {
+        LOG_WARN("MQTT broker refused the connection (%u)", connack[3]);
+        return false;
+    }
+
+    return true;
+}
+
+/* Opens a clean session, the will is published retained if the connection later drops without a DISCONNECT
+  * Returns once the broker has accepted, or failed within MQTT_CONNECT_TIMEOUT_MS for each of connect and CONNACK
+*/
+bool mqttConnect(MQTTCLIENT *client, const char *host, uint16_t port, const char *clientId, const char *willTopic, const char *willMessage) {
+    size_t pos = MQTT_HEADER_MAX;
+    size_t len;
+
+    dropConnection(client);
+    if (7 + 2 + 2 + strlen(clientId) + 2 + strlen(willTopic) + 2 + strlen(willMessage) > MQTT_PACKET_MAX - MQTT_HEADER_MAX) {
+        return false;
+    }
+
+    client->fd = openSocket(host, port);
+    if (client->fd < 0) {
+        return false;
+    }
+
+    putString(client->tx, &pos, "MQTT");
+    client->tx[pos++] = 4; // Protocol level, 3.1.1
+    client->tx[pos++] = MQTT_CONNECT_CLEAN_SESSION | MQTT_CONNECT_WILL | MQTT_CONNECT_WILL_RETAIN;
+    client->tx[pos++] = MQTT_KEEPALIVE_S >> 8;
+    client->tx[pos++] = MQTT_KEEPALIVE_S & 0xFF;
+    putString(client->tx, &pos, clientId);
+    putString(client->tx, &pos, willTopic);
+    putString(client->tx, &pos, willMessage);
+
+    size_t start = finishPacket(client, MQTT_CONNECT, pos - MQTT_HEADER_MAX, &len);
+    if (!sendPacket(client, start, len) || !waitConnack(client)) {
+        dropConnection(client);
+        return false;
+    }
+
+    return true;
+}
+
+// QoS 0, messages arrive in a later mqttPoll()
+bool mqttSubscribe(MQTTCLIENT *client, const char *topicFilter) {
+    size_t pos = MQTT_HEADER_MAX;
+    size_t len;
+
+    if (client->fd < 0 || 2 + 2 + strlen(topicFilter) + 1 > MQTT_PACKET_MAX - MQTT_HEADER_MAX) {
+        return false;
+    }
+
+    client->tx[pos++] = client->next_packet_id >> 8;
+    client->tx[pos++] = client->next_packet_id & 0xFF;
+    client->next_packet_id = client->next_packet_id == 0xFFFF ? 1 : client->next_packet_id + 1;
+    putString(client->tx, &pos, topicFilter);
+    client->tx[pos++] = 0; // Requested QoS
+
+    size_t start = finishPacket(client, MQTT_SUBSCRIBE, pos - MQTT_HEADER_MAX, &len);
+
+    return sendPacket(client, start, len);
+}
+
+// QoS 0, false if not connected, too big for MQTT_PACKET_MAX or the send failed
+bool mqttPublish(MQTTCLIENT *client, const char *topic, const char *payload, size_t payloadLen, bool retain) {
+    size_t pos = MQTT_HEADER_MAX;
+    size_t len;
+
+    if (client->fd < 0 || 2 + strlen(topic) + payloadLen > MQTT_PACKET_MAX - MQTT_HEADER_MAX) {
+        return false;
+    }
+
+    putString(client->tx, &pos, topic);
+    memcpy(&client->tx[pos], payload, payloadLen);
+    pos += payloadLen;
+
+    size_t start = finishPacket(client, MQTT_PUBLISH | (retain ? MQTT_PUBLISH_RETAIN : 0), pos - MQTT_HEADER_MAX, &len);
+
+    return sendPacket(client, start, len);
+}
+
+// Hands a PUBLISH to the message handler, anything else but a PINGRESP is ignored
+static void handlePacket(MQTTCLIENT *client, const uint8_t *packet, size_t headerLen, size_t bodyLen) {
+    const uint8_t *body = packet + headerLen;
+
+    if ((packet[0] & 0xF0) == MQTT_PINGRESP) {
+        client->ping_sent_ms = 0;
+    } else if ((packet[0] & 0xF0) == MQTT_PUBLISH && bodyLen >= 2) {
+        uint16_t topicLen = (body[0] << 8) | body[1];
+        size_t payloadAt = 2 + topicLen + ((packet[0] & MQTT_PUBLISH_QOS_MASK) ? 2 : 0); // A packet id follows the topic above QoS 0
+
+        if (payloadAt <= bodyLen && client->on_message != NULL) {
+            client->on_message((const char *) &body[2], topicLen, &body[payloadAt], bodyLen - payloadAt);
+        }
+    }
+
+    return;
+}
+
+// Handles every complete packet in rx and keeps the start of any partial one
+static bool parsePackets(MQTTCLIENT *client) {
+    size_t consumed = 0;
+
+    while (client->rx_len - consumed >= 2) {
+        const uint8_t *packet = &client->rx[consumed];
+        size_t available = client->rx_len - consumed;
+        size_t bodyLen = 0;
+        size_t headerLen = 1;
+        bool complete = false;
+
+        for (uint8_t shift = 0; headerLen < MQTT_HEADER_MAX && headerLen < available; shift += 7) {
+            uint8_t byte = packet[headerLen++];
+            bodyLen |= (size_t) (byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete) {
+            if (headerLen == MQTT_HEADER_MAX) {
+                return false; // Malformed length
+            }
+            break;
+        }
+        if (headerLen + bodyLen > MQTT_PACKET_MAX) {
+            LOG_WARN("MQTT packet of %u bytes is too big, dropping the connection", (unsigned) (headerLen + bodyLen));
+            return false;
+        }
+        if (headerLen + bodyLen > available) {
+            break;
+        }
+
+        handlePacket(client, packet, headerLen, bodyLen);
+        consumed += headerLen + bodyLen;
+    }
+
+    memmove(client->rx, &client->rx[consumed], client->rx_len - consumed);
+    client->rx_len -= consumed;
+
+    return true;
+}
+
+/* Waits up to waitMs for packets from the broker, handling any that arrive, and keeps the connection alive
+  * Returns false once the connection has gone: closed by the broker, a ping unanswered for a keepalive, or a bad packet
+*/
+bool mqttPoll(MQTTCLIENT *client, uint32_t waitMs) {
+    uint32_t now = millis();
+
+    if (client->fd < 0) {
+        return false;
+    }
+
+    if (client->ping_sent_ms != 0 && now - client->ping_sent_ms >= MQTT_KEEPALIVE_S * 1000) {
+        LOG_WARN("MQTT broker stopped answering pings");
+        dropConnection(client);
+        return false;
+    }
+    if (client->ping_sent_ms == 0 && now - client->last_sent_ms >= MQTT_KEEPALIVE_S * 500) {
+        if (!sendEmptyPacket(client, MQTT_PINGREQ)) {
+            return false;
+        }
+        client->ping_sent_ms = now == 0 ? 1 : now;
+    }
+
+    fd_set readFds;
+    struct timeval timeout = { (time_t) (waitMs / 1000), (long) (waitMs % 1000) * 1000 };
+    FD_ZERO(&readFds);
+    FD_SET(client->fd, &readFds);
+    if (select(client->fd + 1, &readFds, NULL, NULL, &timeout) != 1) {
+        return true;
+    }
+
+    ssize_t got = recv(client->fd, &client->rx[client->rx_len], sizeof(client->rx) - client->rx_len, MSG_DONTWAIT);
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        LOG_WARN("MQTT broker closed the connection");
+        dropConnection(client);
+        return false;
+    }
+    if (got > 0) {
+        client->rx_len += got;
+        if (!parsePackets(client)) {
+            dropConnection(client);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Clean close, the broker discards the will
+void mqttDisconnect(MQTTCLIENT *client) {
+    if (client->fd >= 0) {
+        sendEmptyPacket(client, MQTT_DISCONNECT);
+    }
+    dropConnection(client);
+
+    return;
+}
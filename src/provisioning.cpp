@@ -0,0 +1,259 @@
+#include "provisioning.hpp"
+#include <WiFi.h>
+#include <atomic>
+#include <esp_sntp.h>
+#include "configStore.hpp"
+#include "doorSchedule.hpp"
+#include "beaconRegistry.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+
+typedef enum {
+  prov_ask_name = 0x00, // Stored name found, offer to change it
+  prov_enter_name,
+  prov_ask_wifi, // Offer to enter new credentials
+  prov_enter_ssid,
+  prov_enter_password,
+  prov_done
+} PROVSTEP;
+
+// Only the provisioning task touches these
+static char dogName[BEACON_NAME_MAX_LEN];
+static char ssid[WIFI_CREDENTIAL_LEN];
+static char password[WIFI_CREDENTIAL_LEN];
+static bool credentialsUnsaved = false; // Typed in this boot, stored once they have worked
+static char line[PROVISIONING_LINE_LEN];
+static uint8_t lineLen = 0;
+
+static uint32_t backoffMs = WIFI_BACKOFF_MIN_MS;
+static uint32_t attemptAt = 0; // Start of the current attempt, or when the next one is due
+static bool everConnected = false;
+
+// Read by the web server and metrics
+static std::atomic<uint8_t> wifiState(wifi_unconfigured);
+static std::atomic<uint32_t> wifiReconnects(0);
+
+// SNTP calls this from the lwIP task each time it sets the system clock
+static void timeSynced(struct timeval *tv) {
+    setWallClock((uint64_t) tv->tv_sec * 1000 + tv->tv_usec / 1000);
+
+    return;
+}
+
+// Collects serial input a character at a time, returns true once a whole line has arrived
+static bool readLine(bool allowEmpty) {
+    while (Serial.available() > 0) {
+        char c = Serial.read();
+
+        if (c == '\n') {
+            line[lineLen] = '\0';
+            // Trim trailing whitespace, e.g. the \r of a CRLF terminal
+            while (lineLen > 0 && isspace((unsigned char) line[lineLen - 1])) {
+                line[--lineLen] = '\0';
+            }
+            bool complete = lineLen > 0 || allowEmpty;
+            lineLen = 0;
+            if (complete) {
+                return true;
+            }
+        } else if (lineLen < PROVISIONING_LINE_LEN - 1 && !(lineLen == 0 && isspace((unsigned char) c))) {
+            line[lineLen++] = c;
+        }
+    }
+
+    return false;
+}
+
+// Returns 'y', 'n' or 0 if neither has been typed yet
+static char readAnswer() {
+    while (Serial.available() > 0) {
+        char c = Serial.read();
+
+        if (c == 'y' || c == 'n') {
+            return c;
+        }
+    }
+
+    return 0;
+}
+
+// Drops the current connection (if any) and tries the credentials straight away
+static void restartWiFi() {
+    WiFi.disconnect();
+    backoffMs = WIFI_BACKOFF_MIN_MS;
+    attemptAt = millis();
+    wifiState.store(wifi_waiting, std::memory_order_relaxed);
+
+    return;
+}
+
+// One step of the connect/reconnect state machine, never blocks
+static void serviceWiFi() {
+    uint32_t now = millis();
+    WIFISTATE state = (WIFISTATE) wifiState.load(std::memory_order_relaxed);
+
+    if (state == wifi_unconfigured) {
+        return;
+    }
+
+    if (WiFi.status() == WL_CONNECTED) {
+        if (state != wifi_connected) {
+            IPAddress ip = WiFi.localIP();
+            LOG_INFO("WiFi connected, IP %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+            Serial.print("WiFi connected, IP address: "); Serial.println(ip);
+
+            if (everConnected) {
+                wifiReconnects.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (!everConnected) {
+                // Keeps resyncing by itself from here on
+                sntp_set_time_sync_notification_cb(timeSynced);
+                configTime(0, 0, SCHEDULE_NTP_SERVER);
+            }
+            everConnected = true;
+            recordBootMilestone(boot_wifi_connected);
+            backoffMs = WIFI_BACKOFF_MIN_MS;
+            wifiState.store(wifi_connected, std::memory_order_relaxed);
+
+            // Store uname and pwd, the config store skips the flash write when they haven't changed
+            if (credentialsUnsaved) {
+                configWriteString(config_wifi_ssid, ssid);
+                configWriteString(config_wifi_password, password);
+                configCommit();
+                credentialsUnsaved = false;
+            }
+        }
+        return;
+    }
+
+    if (state == wifi_connected) {
+        LOG_WARN("WiFi lost, reconnecting");
+        WiFi.disconnect();
+        attemptAt = now;
+        wifiState.store(wifi_waiting, std::memory_order_relaxed);
+        return;
+    }
+
+    if (state == wifi_connecting) {
+        if (now - attemptAt < WIFI_CONNECT_TIMEOUT_MS) {
+            return;
+        }
+
+        // Give up on this attempt and back off, so a missing router isn't hammered
+        LOG_WARN("WiFi connect timed out, retrying in %ums", backoffMs);
+        WiFi.disconnect();
+        attemptAt = now + backoffMs;
+        backoffMs = backoffMs * 2 > WIFI_BACKOFF_MAX_MS ? WIFI_BACKOFF_MAX_MS : backoffMs * 2;
+        wifiState.store(wifi_waiting, std::memory_order_relaxed);
+        return;
+    }
+
+    if ((int32_t) (now - attemptAt) >= 0) {
+        WiFi.begin(ssid, password);
+        attemptAt = now;
+        wifiState.store(wifi_connecting, std::memory_order_relaxed);
+    }
+
+    return;
+}
+
+void handle_provisioning( void * parameter ) {
+    PROVSTEP step = prov_ask_wifi;
+    uint32_t promptAt = millis();
+
+    // Start on the stored credentials right away, the prompts below can still replace them
+    if (configReadString(config_wifi_ssid, ssid, sizeof(ssid)) && configReadString(config_wifi_password, password, sizeof(password))) {
+        Serial.print("Connecting to "); Serial.println(ssid);
+        restartWiFi();
+    } else {
+        Serial.println("---Unable to find WIFI credentials in storage---");
+    }
+
+    if (configReadString(config_dog_name, dogName, sizeof(dogName))) {
+        Serial.print("Found BLE Name '"); Serial.print(dogName); Serial.println("' - Would you like to change this? (y/N)");
+        step = prov_ask_name;
+    } else {
+        Serial.println("---Unable to find BLE Beacon name in storage---");
+        Serial.println("Please enter the name of the dog's BLE Beacon as it appears in bluetooth: ");
+        step = prov_enter_name;
+    }
+
+    for(;;) {
+        switch (step) {
+            case prov_ask_name: {
+                char answer = readAnswer();
+                if (answer == 'y') {
+                    Serial.println("Please enter the name of the dog's BLE Beacon as it appears in bluetooth: ");
+                    step = prov_enter_name;
+                } else if (answer == 'n' || millis() - promptAt >= PROVISIONING_PROMPT_MS) {
+                    step = prov_ask_wifi;
+                    promptAt = millis();
+                    Serial.println("Would you like to enter new WIFI Credentials? (y/N)");
+                }
+                break;
+            }
+
+            case prov_enter_name:
+                if (readLine(false)) {
+                    strncpy(dogName, line, sizeof(dogName) - 1);
+                    configWriteString(config_dog_name, dogName);
+                    configCommit();
+
+                    // Registry holds every dog's beacon, seed it with this name if it is still empty
+                    if (getBeaconCount() == 0) {
+                        addBeacon(dogName, BEACON_THRESHOLD_GLOBAL, BEACON_PERM_OPEN | BEACON_PERM_CALIBRATE);
+                        saveBeaconRegistry();
+                    }
+
+                    step = prov_ask_wifi;
+                    promptAt = millis();
+                    Serial.println("Would you like to enter new WIFI Credentials? (y/N)");
+                }
+                break;
+
+            case prov_ask_wifi: {
+                char answer = readAnswer();
+                if (answer == 'y' || (wifiState.load(std::memory_order_relaxed) == wifi_unconfigured && millis() - promptAt >= PROVISIONING_PROMPT_MS)) {
+                    Serial.println("Please enter your WiFi SSID: ");
+                    step = prov_enter_ssid;
+                } else if (answer == 'n' || millis() - promptAt >= PROVISIONING_PROMPT_MS) {
+                    step = prov_done;
+                }
+                break;
+            }
+
+            case prov_enter_ssid:
+                if (readLine(false)) {
+                    strncpy(ssid, line, sizeof(ssid) - 1);
+                    Serial.println("Please enter your WiFI Password: ");
+                    step = prov_enter_password;
+                }
+                break;
+
+            case prov_enter_password:
+                if (readLine(true)) { // Open networks have no password
+                    strncpy(password, line, sizeof(password) - 1);
+                    Serial.print("Connecting to "); Serial.println(ssid);
+                    credentialsUnsaved = true;
+                    restartWiFi();
+                    step = prov_done;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        serviceWiFi();
+        vTaskDelay(pdMS_TO_TICKS(PROVISIONING_POLL_MS));
+    }
+}
+
+WIFISTATE getWiFiState() {
+    return (WIFISTATE) wifiState.load(std::memory_order_relaxed);
+}
+
+// Times the connection has come back after being lost or failing, not counting the first connect
+uint32_t getWiFiReconnects() {
+    return wifiReconnects.load(std::memory_order_relaxed);
+}
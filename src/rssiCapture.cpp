@@ -0,0 +1,314 @@
+#include "rssiCapture.hpp"
+#include "logger.hpp"
+#include "taskTable.hpp"
+#include <esp_partition.h>
+#include <atomic>
+
+/* Raw RSSI capture for tuning thresholds offline
+  * The BLE callback only copies each matched advert into one half of a RAM double buffer. When a half fills it is
+  * handed to the capture task, which writes it to the next flash sector in one go while the other half fills.
+  * Flash is never touched from the scan path, and a capture is one sequential run from the start of the partition.
+*/
+
+static_assert(CAPTURE_SECTOR_SIZE % sizeof(CAPTURERECORD) == 0, "Capture records must tile a sector");
+
+static const esp_partition_t *partition = NULL;
+static uint32_t capacity = 0; // Records the partition holds
+static std::atomic<uint32_t> flashRecords(0); // Written so far, only the capture task moves it during a capture
+static std::atomic<bool> capturing(false);
+
+// Double buffer, the BLE task fills buffers[activeBuffer] while the capture task writes out the other
+static CAPTURERECORD buffers[2][CAPTURE_BUFFER_RECORDS];
+static uint8_t activeBuffer = 0;
+static uint16_t activeCount = 0;
+static bool flushPending = false; // The other half is full and not yet written
+static bool draining = false; // Stopped, with records still to write
+static bool filled = false;
+static uint32_t acceptedRecords = 0;
+static uint32_t droppedRecords = 0;
+static uint32_t startedMs = 0;
+static portMUX_TYPE captureMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t capture_task;
+
+static inline bool slotErased(const CAPTURERECORD *record) {
+    return record->beacon_index == 0xFF;
+}
+
+static void readSlot(uint32_t slot, CAPTURERECORD *record) {
+    esp_partition_read(partition, slot * sizeof(CAPTURERECORD), record, sizeof(CAPTURERECORD));
+}
+
+// The last capture runs up to the first erased slot, found a sector at a time and then a slot at a time
+static void recoverCapture() {
+    CAPTURERECORD record;
+    uint32_t slot = 0;
+
+    while (slot + CAPTURE_BUFFER_RECORDS <= capacity) {
+        readSlot(slot + CAPTURE_BUFFER_RECORDS - 1, &record);
+        if (slotErased(&record)) {
+            break;
+        }
+        slot += CAPTURE_BUFFER_RECORDS;
+    }
+    while (slot < capacity) {
+        readSlot(slot, &record);
+        if (slotErased(&record)) {
+            break;
+        }
+        slot++;
+    }
+
+    flashRecords.store(slot, std::memory_order_relaxed);
+
+    return;
+}
+
+// Every write starts on a sector boundary, full halves are a sector each and only the last write of a capture is short
+static void writeRecords(const CAPTURERECORD *records, uint16_t count) {
+    uint32_t offset = flashRecords.load(std::memory_order_relaxed) * sizeof(CAPTURERECORD);
+
+    esp_partition_erase_range(partition, offset, CAPTURE_SECTOR_SIZE);
+    esp_partition_write(partition, offset, records, count * sizeof(CAPTURERECORD));
+    flashRecords.fetch_add(count, std::memory_order_release);
+
+    return;
+}
+
+// Called with captureMux held, gives the full half to the capture task if it has finished with the other one
+static bool swapBuffers() {
+    if (flushPending) {
+        return false;
+    }
+
+    flushPending = true;
+    activeBuffer ^= 1;
+    activeCount = 0;
+
+    return true;
+}
+
+static void flushCapture() {
+    bool pending;
+    uint8_t buffer;
+
+    portENTER_CRITICAL(&captureMux);
+    pending = flushPending;
+    buffer = activeBuffer ^ 1;
+    portEXIT_CRITICAL(&captureMux);
+
+    if (pending) {
+        writeRecords(buffers[buffer], CAPTURE_BUFFER_RECORDS);
+        portENTER_CRITICAL(&captureMux);
+        flushPending = false;
+        portEXIT_CRITICAL(&captureMux);
+    }
+
+    // Once stopped the BLE task no longer touches the buffers, so what's left of the active half can go out too
+    portENTER_CRITICAL(&captureMux);
+    bool stopped = draining && !flushPending;
+    portEXIT_CRITICAL(&captureMux);
+
+    if (stopped) {
+        if (activeCount > 0) {
+            writeRecords(buffers[activeBuffer], activeCount);
+        } else if (flashRecords.load(std::memory_order_relaxed) < capacity) {
+            // Ended on a sector boundary, erase the next one so an older capture there isn't read as part of this one
+            esp_partition_erase_range(partition, flashRecords.load(std::memory_order_relaxed) * sizeof(CAPTURERECORD), CAPTURE_SECTOR_SIZE);
+        }
+
+        portENTER_CRITICAL(&captureMux);
+        activeCount = 0;
+        draining = false;
+        portEXIT_CRITICAL(&captureMux);
+        LOG_INFO("RSSI capture stopped, %u records", flashRecords.load(std::memory_order_relaxed));
+    }
+
+    return;
+}
+
+/* Runs at low priority
+  * Writes each full half of the double buffer to flash, and the remainder once a capture stops
+*/
+static void handle_capture( void * parameter ) {
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        flushCapture();
+    }
+}
+
+bool initRssiCapture() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) CAPTURE_PARTITION_SUBTYPE, CAPTURE_PARTITION_LABEL);
+
+    if (partition == NULL) {
+        LOG_ERROR("No RSSI capture partition, capture is unavailable");
+        return false;
+    }
+
+    capacity = (partition->size / CAPTURE_SECTOR_SIZE) * CAPTURE_BUFFER_RECORDS;
+    recoverCapture();
+
+    capture_task = startTask(task_capture, handle_capture);
+
+    return true;
+}
+
+// Starts a new capture over the old one, false if there's no partition or the last one is still being written out
+bool startRssiCapture() {
+    if (partition == NULL) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&captureMux);
+    if (draining || flushPending || capturing.load(std::memory_order_relaxed)) {
+        bool active = capturing.load(std::memory_order_relaxed);
+        portEXIT_CRITICAL(&captureMux);
+        return active;
+    }
+    flashRecords.store(0, std::memory_order_relaxed);
+    activeBuffer = 0;
+    activeCount = 0;
+    acceptedRecords = 0;
+    droppedRecords = 0;
+    filled = false;
+    startedMs = millis();
+    capturing.store(true, std::memory_order_release);
+    portEXIT_CRITICAL(&captureMux);
+
+    LOG_INFO("RSSI capture started");
+
+    return true;
+}
+
+void stopRssiCapture() {
+    portENTER_CRITICAL(&captureMux);
+    if (capturing.load(std::memory_order_relaxed)) {
+        capturing.store(false, std::memory_order_relaxed);
+        draining = true;
+    }
+    portEXIT_CRITICAL(&captureMux);
+
+    xTaskNotifyGive(capture_task);
+
+    return;
+}
+
+// Runs in the BLE callback for every matched advert, a flag check when no capture is running
+void captureAdvert(const uint8_t *payload, size_t payloadLen, const uint8_t *mac, uint8_t macType, int rssi, uint8_t beaconIndex) {
+    CAPTURERECORD record;
+    const uint8_t *name;
+    uint8_t nameLen;
+    bool wake = false;
+
+    if (!capturing.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    record.offset_ms = millis() - startedMs;
+    memcpy(record.mac, mac, BLE_MAC_LEN);
+    record.mac_type = macType;
+    record.beacon_index = beaconIndex;
+    record.rssi = rssi < INT8_MIN ? INT8_MIN : (rssi > INT8_MAX ? INT8_MAX : rssi);
+    record.channel = CAPTURE_CHANNEL_UNKNOWN;
+    record.flags = findAdvertName(payload, payloadLen, &name, &nameLen) ? CAPTURE_FLAG_NAME : 0;
+    record.reserved = 0;
+
+    portENTER_CRITICAL(&captureMux);
+    if (!capturing.load(std::memory_order_relaxed)) {
+        portEXIT_CRITICAL(&captureMux);
+        return;
+    }
+    if (activeCount == CAPTURE_BUFFER_RECORDS && !swapBuffers()) {
+        droppedRecords++; // Flash is behind, both halves are full
+        portEXIT_CRITICAL(&captureMux);
+        return;
+    }
+
+    buffers[activeBuffer][activeCount++] = record;
+    acceptedRecords++;
+    if (acceptedRecords == capacity) {
+        // Partition full, stop here and write out what's buffered
+        capturing.store(false, std::memory_order_relaxed);
+        filled = true;
+        draining = true;
+        wake = true;
+    } else if (activeCount == CAPTURE_BUFFER_RECORDS) {
+        wake = swapBuffers();
+    }
+    portEXIT_CRITICAL(&captureMux);
+
+    if (wake) {
+        xTaskNotifyGive(capture_task);
+    }
+
+    return;
+}
+
+CAPTURESTATUS getCaptureStatus() {
+    CAPTURESTATUS status;
+
+    portENTER_CRITICAL(&captureMux);
+    status.active = capturing.load(std::memory_order_relaxed);
+    status.full = filled;
+    status.writing = draining || flushPending;
+    status.dropped = droppedRecords;
+    portEXIT_CRITICAL(&captureMux);
+    status.records = flashRecords.load(std::memory_order_acquire);
+    status.capacity = capacity;
+
+    return status;
+}
+
+/* Copies up to maxRecords written records starting at from, straight from flash in one read
+  * next is where the following chunk should start, a chunk comes back empty once everything written has been read
+*/
+uint16_t captureReadChunk(uint32_t from, CAPTURERECORD *records, uint16_t maxRecords, uint32_t *next) {
+    uint32_t written = flashRecords.load(std::memory_order_acquire);
+    uint16_t count = 0;
+
+    if (partition != NULL && from < written) {
+        count = written - from < maxRecords ? written - from : maxRecords;
+        esp_partition_read(partition, from * sizeof(CAPTURERECORD), records, count * sizeof(CAPTURERECORD));
+    }
+
+    *next = from + count;
+
+    return count;
+}
+
+// The "capture" object of the status JSON
+void renderCaptureStatus(WEBRESPONSE *response) {
+    CAPTURESTATUS status = getCaptureStatus();
+
+    appendResponse(response, "{\"available\":%s,\"active\":%s,\"full\":%s,\"writing\":%s,\"records\":%u,\"capacity\":%u,\"dropped\":%u}",
+        partition != NULL ? "true" : "false", status.active ? "true" : "false", status.full ? "true" : "false", status.writing ? "true" : "false",
+        (unsigned) status.records, (unsigned) status.capacity, (unsigned) status.dropped);
+
+    return;
+}
+
+/* Binary capture records starting at ?from=<record>, one chunk per request
+  * X-Capture-Next gives the record to ask for next, the download is complete when a chunk comes back empty.
+  * tools/capture_to_trace.py turns the download into a replay trace.
+*/
+void renderCaptureChunk(const HTTPREQUEST *request, WEBRESPONSE *response) {
+    static char nextHeader[48]; // Must outlive this call, the web server formats headers after we return
+    char param[12];
+    uint32_t from = getQueryParam(request, "from", param, sizeof(param)) ? strtoul(param, NULL, 10) : 0;
+    uint32_t next;
+    uint16_t maxRecords = response->body_cap / sizeof(CAPTURERECORD);
+
+    if (maxRecords > CAPTURE_CHUNK_RECORDS) {
+        maxRecords = CAPTURE_CHUNK_RECORDS;
+    }
+
+    // Records are copied straight into the response buffer
+    uint16_t count = captureReadChunk(from, (CAPTURERECORD *) response->body, maxRecords, &next);
+
+    snprintf(nextHeader, sizeof(nextHeader), "X-Capture-Next: %u\r\n", (unsigned) next);
+    response->content_type = "application/octet-stream";
+    response->extra_headers = nextHeader;
+    response->body_len = count * sizeof(CAPTURERECORD);
+
+    return;
+}
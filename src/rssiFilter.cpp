@@ -0,0 +1,94 @@
+#include "rssiFilter.hpp"
+
+void resetRSSIFilter(RSSIFILTER *filter) {
+    memset(filter, 0, sizeof(RSSIFILTER));
+}
+
+void updateRSSIFilter(RSSIFILTER *filter, int rssi, uint32_t timestamp_ms) {
+    int32_t measurement_q8 = (int32_t) rssi << RSSI_FIXED_SHIFT;
+
+    if (filter->count == 0) {
+        // First sample, nothing to predict from
+        filter->level_q8 = measurement_q8;
+        filter->velocity_q8 = 0;
+    } else {
+        const RSSISAMPLE *last = &filter->samples[(filter->head + RSSI_HISTORY_LEN - 1) % RSSI_HISTORY_LEN];
+        uint32_t dt = timestamp_ms - last->timestamp_ms;
+
+        if (dt > RSSI_STALE_MS) {
+            // Beacon has been out of range, previous trajectory is meaningless
+            filter->count = 0;
+            filter->level_q8 = measurement_q8;
+            filter->velocity_q8 = 0;
+        } else {
+            // Predict where the level should be now, then correct by the clamped residual
+            int32_t predicted_q8 = filter->level_q8 + (filter->velocity_q8 * (int32_t) dt) / 1000;
+            int32_t residual_q8 = measurement_q8 - predicted_q8;
+            int32_t limit_q8 = (int32_t) RSSI_SPIKE_LIMIT << RSSI_FIXED_SHIFT;
+
+            if (residual_q8 > limit_q8) {
+                residual_q8 = limit_q8;
+            } else if (residual_q8 < -limit_q8) {
+                residual_q8 = -limit_q8;
+            }
+
+            if (dt < RSSI_MIN_DT_MS) {
+                dt = RSSI_MIN_DT_MS;
+            }
+
+            filter->level_q8 = predicted_q8 + ((residual_q8 * RSSI_FILTER_ALPHA) >> RSSI_FIXED_SHIFT);
+            filter->velocity_q8 += ((residual_q8 * RSSI_FILTER_BETA) >> RSSI_FIXED_SHIFT) * 1000 / (int32_t) dt;
+        }
+    }
+
+    filter->samples[filter->head].rssi = rssi;
+    filter->samples[filter->head].timestamp_ms = timestamp_ms;
+    filter->head = (filter->head + 1) % RSSI_HISTORY_LEN;
+    if (filter->count < RSSI_HISTORY_LEN) {
+        filter->count++;
+    }
+
+    return;
+}
+
+int getFilteredRSSI(const RSSIFILTER *filter) {
+    return filter->level_q8 >> RSSI_FIXED_SHIFT;
+}
+
+int getRSSIVelocity(const RSSIFILTER *filter) {
+    return filter->velocity_q8 >> RSSI_FIXED_SHIFT;
+}
+
+uint8_t countRecentRSSISamples(const RSSIFILTER *filter, uint32_t now_ms, uint32_t window_ms) {
+    uint8_t recent = 0;
+
+    // Walk back from the newest sample until one falls outside the window
+    for (uint8_t i = 1; i <= filter->count; i++) {
+        const RSSISAMPLE *sample = &filter->samples[(filter->head + RSSI_HISTORY_LEN - i) % RSSI_HISTORY_LEN];
+        if (now_ms - sample->timestamp_ms > window_ms) {
+            break;
+        }
+        recent++;
+    }
+
+    return recent;
+}
+
+RSSIDECISION evaluateRSSIFilter(const RSSIFILTER *filter, uint32_t now_ms, int openThreshold, int approachVelocity) {
+    // Not enough recent evidence yet, a lone sample is treated as noise
+    if (countRecentRSSISamples(filter, now_ms, RSSI_CONFIDENCE_WINDOW_MS) < RSSI_MIN_SAMPLES) {
+        return rssi_hold;
+    }
+
+    int level = getFilteredRSSI(filter);
+
+    if (level > openThreshold) {
+        return rssi_open_near;
+    }
+
+    if (level > openThreshold - RSSI_APPROACH_MARGIN && getRSSIVelocity(filter) >= approachVelocity) {
+        return rssi_open_approach;
+    }
+
+    return rssi_hold;
+}
@@ -0,0 +1,119 @@
+#include "scanScheduler.hpp"
+#include "beaconRegistry.hpp"
+
+static const SCANPROFILE scanProfiles[scan_mode_count] = {
+    { false, 400, 100, 80 }, // scan_mode_idle, 25% duty still catches a beacon advertising every few hundred ms
+    { true, 400, 100, 80 }, // scan_mode_idle_active
+    { true, 100, 99, 240 } // scan_mode_alert, the original fixed settings
+};
+
+// Only loop() (or the simulator) changes the mode, the web server just reads it
+static bool adaptiveScanning = true;
+static uint32_t lastHeard_ms = 0; // Last time a beacon was near
+static std::atomic<uint8_t> currentMode(scan_mode_alert);
+static std::atomic<uint32_t> modeSince_ms(0);
+static std::atomic<uint32_t> modeTime_ms[scan_mode_count]; // Completed time in each mode
+
+static void enterMode(SCANMODE mode, uint32_t now_ms) {
+    SCANMODE current = getScanMode();
+
+    if (mode == current) {
+        return;
+    }
+
+    modeTime_ms[current].fetch_add(now_ms - modeSince_ms.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    modeSince_ms.store(now_ms, std::memory_order_relaxed);
+    currentMode.store(mode, std::memory_order_relaxed);
+
+    return;
+}
+
+// Starts out in alert, a dog may well be waiting at the door after a power cut
+// With adaptive off it stays there, which is how scanning always used to run
+void initScanScheduler(bool adaptive, uint32_t now_ms) {
+    adaptiveScanning = adaptive;
+    lastHeard_ms = now_ms;
+    modeSince_ms.store(now_ms, std::memory_order_relaxed);
+    currentMode.store(scan_mode_alert, std::memory_order_relaxed);
+
+    return;
+}
+
+// A registered beacon getting near switches straight to alert, the caller restarts the scan if the mode changed
+void noteBeaconHeard(uint32_t now_ms, int filteredRSSI, int openThreshold) {
+    if (filteredRSSI < openThreshold - SCAN_ALERT_MARGIN_DB) {
+        return;
+    }
+
+    lastHeard_ms = now_ms;
+    if (adaptiveScanning) {
+        enterMode(scan_mode_alert, now_ms);
+    }
+
+    return;
+}
+
+// Called between scan windows, drops back to idle once nothing has been heard for a while
+void updateScanScheduler(uint32_t now_ms) {
+    SCANMODE mode = getScanMode();
+
+    if (!adaptiveScanning) {
+        return;
+    }
+
+    if (mode == scan_mode_alert && now_ms - lastHeard_ms < SCAN_ALERT_HOLD_MS) {
+        return;
+    }
+
+    // Passive scans only carry the advert itself, beacons that put their name in the scan response
+    // can only be matched by address, so keep asking for scan responses until every address is learnt
+    enterMode(beaconAddressesKnown() ? scan_mode_idle : scan_mode_idle_active, now_ms);
+
+    return;
+}
+
+SCANMODE getScanMode() {
+    return (SCANMODE) currentMode.load(std::memory_order_relaxed);
+}
+
+const SCANPROFILE *getScanProfile(SCANMODE mode) {
+    return &scanProfiles[mode];
+}
+
+uint32_t getScanModeTime(SCANMODE mode, uint32_t now_ms) {
+    uint32_t time = modeTime_ms[mode].load(std::memory_order_relaxed);
+
+    if (mode == getScanMode()) {
+        time += now_ms - modeSince_ms.load(std::memory_order_relaxed);
+    }
+
+    return time;
+}
+
+// Average current of the whole board while running a profile
+uint32_t scanProfileCurrent_uA(const SCANPROFILE *profile) {
+    uint32_t current = SCAN_MODEL_BASE_MA * 1000;
+
+    current += (profile->cpu_mhz - 80) * SCAN_MODEL_CPU_MA_PER_MHZ_X100 * 10;
+    current += SCAN_MODEL_RADIO_RX_MA * 1000 * profile->window_ms / profile->interval_ms;
+    if (profile->active) {
+        current += SCAN_MODEL_ACTIVE_MA * 1000 * profile->window_ms / profile->interval_ms;
+    }
+
+    return current;
+}
+
+// Modelled charge used since boot, in uA x ms (3.6e9 to the mAh)
+uint64_t scanEnergy_uAms(uint32_t now_ms) {
+    uint64_t energy = 0;
+
+    for (uint8_t i = 0; i < scan_mode_count; i++) {
+        energy += (uint64_t) getScanModeTime((SCANMODE) i, now_ms) * scanProfileCurrent_uA(&scanProfiles[i]);
+    }
+
+    return energy;
+}
+
+bool scanProfileHears(const SCANPROFILE *profile, uint32_t windowStart_ms, uint32_t now_ms) {
+    return (now_ms - windowStart_ms) % profile->interval_ms < profile->window_ms;
+}
@@ -0,0 +1,207 @@
+#include "taskTable.hpp"
+#include "logger.hpp"
+#include "eventJournal.hpp"
+#include "doorControl.hpp"
+#include "esp_task_wdt.h"
+#include "freertos/semphr.h"
+#include <atomic>
+
+/* Where every task runs, in one place
+  * Core 0 carries the WiFi, lwIP and Bluetooth host tasks (priorities 18 and up), so the door task sits on core 1
+  * above loop() (priority 1) and can't be held up by network load or a burst of adverts. The supervisor is the
+  * highest of ours on core 1, so a task spinning there still gets restarted. Size stacks from
+  * door_task_stack_free_min_bytes in /metrics after a busy day.
+*/
+static const TASKSPEC taskTable[task_count] = {
+    // name,        stack, prio, core, watchdog
+    { "hdl_sw",     4096,  5,    1,    5000 },
+    { "hdl_ws",     6144,  2,    0,    5000 },
+    { "hdl_pv",     4096,  1,    0,    0 }, // Waits on WiFi and serial for as long as they take
+    { "journal",    3072,  1,    0,    0 }, // A slow flash write isn't a hang, drops are counted instead
+    { "log",        3072,  0,    0,    0 }, // Only runs when nothing else wants core 0
+    { "capture",    3072,  1,    0,    0 }, // Only busy during an RSSI capture, a sector write every 256 adverts
+    { "mqtt",       4096,  1,    0,    0 }, // Blocks for seconds in connect and send while a broker is away
+    { "supervisor", 3072,  6,    1,    0 }, // On the hardware task watchdog instead
+    { "loop",       0,     1,    1,    0 } // Arduino core's loopTask, on the hardware watchdog via enableLoopWDT()
+};
+
+static TaskHandle_t taskHandles[task_count];
+static TaskFunction_t taskFunctions[task_count];
+static std::atomic<uint32_t> lastCheckIn[task_count];
+static std::atomic<uint32_t> taskRestarts[task_count];
+static std::atomic<uint32_t> stopAskedMs[task_count]; // When the supervisor asked the task to end itself, 0 if it hasn't
+static std::atomic<bool> taskStopped[task_count]; // The task has ended itself, ready for its replacement
+/* Guards taskHandles against a restart while /metrics reads them
+  * A mutex rather than a spinlock as the reader walks up to a whole stack for its high water mark, and a scheduler
+  * suspend would only hold this core while a task on the other one deletes itself
+*/
+static SemaphoreHandle_t handleLock = NULL;
+
+// Created on first use, the first task is started from setup() before anything else can get here
+static void lockHandles() {
+    if (handleLock == NULL) {
+        handleLock = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(handleLock, portMAX_DELAY);
+
+    return;
+}
+
+TaskHandle_t startTask(TASKID id, TaskFunction_t function) {
+    const TASKSPEC *spec = &taskTable[id];
+    TaskHandle_t handle = NULL;
+
+    taskFunctions[id] = function;
+    lastCheckIn[id].store(millis(), std::memory_order_relaxed);
+
+    xTaskCreatePinnedToCore(
+        function, /* Function to implement the task */
+        spec->name, /* Name of the task */
+        spec->stack_bytes,  /* Stack size in bytes */
+        NULL,  /* Task input parameter */
+        spec->priority,  /* Priority of the task */
+        &handle,  /* Task handle. */
+        spec->core); /* Core where the task should run */
+
+    lockHandles();
+    taskHandles[id] = handle;
+    xSemaphoreGive(handleLock);
+
+    return handle;
+}
+
+// For a task something else created, call from the task itself
+void adoptTask(TASKID id) {
+    lockHandles();
+    taskHandles[id] = xTaskGetCurrentTaskHandle();
+    xSemaphoreGive(handleLock);
+
+    return;
+}
+
+// Supervised tasks call this each time round their loop, where they hold no locks, as it may end the task
+void taskCheckIn(TASKID id) {
+    lastCheckIn[id].store(millis(), std::memory_order_relaxed);
+
+    if (stopAskedMs[id].load(std::memory_order_acquire) != 0) {
+        lockHandles();
+        taskHandles[id] = NULL;
+        xSemaphoreGive(handleLock);
+        taskStopped[id].store(true, std::memory_order_release);
+        vTaskDelete(NULL);
+    }
+
+    return;
+}
+
+uint32_t getTaskRestarts(TASKID id) {
+    return taskRestarts[id].load(std::memory_order_relaxed);
+}
+
+/* Restarts a task that stopped checking in, without ever deleting it from outside
+  * A task deleted while holding a mutex (the config store's, say) would leave it taken for good, so the task is
+  * asked to end itself at its next check-in, where it holds nothing. Its state lives in module statics rather than
+  * on its stack, so the fresh one started from its table row carries on where it stopped, sockets included.
+  * One that doesn't get back to a check-in within another watchdog period is wedged, maybe with a lock held, and
+  * the board reboots rather than run on without it.
+*/
+static void superviseTask(TASKID id, uint32_t now) {
+    uint32_t asked = stopAskedMs[id].load(std::memory_order_relaxed);
+    uint32_t silent = now - lastCheckIn[id].load(std::memory_order_relaxed);
+
+    if (taskStopped[id].load(std::memory_order_acquire)) {
+        taskStopped[id].store(false, std::memory_order_relaxed);
+        stopAskedMs[id].store(0, std::memory_order_release);
+        taskRestarts[id].fetch_add(1, std::memory_order_relaxed);
+        startTask(id, taskFunctions[id]);
+    } else if (asked == 0 && (int32_t) silent > (int32_t) taskTable[id].watchdog_ms) {
+        LOG_ERROR("Task %s silent for %ums, restarting", taskTable[id].name, silent);
+        journalAppend(journal_task_restart, journal_src_system, id, getUnlockCycles());
+        stopAskedMs[id].store(now | 1, std::memory_order_release); // Never 0
+    } else if (asked != 0 && now - asked > taskTable[id].watchdog_ms) {
+        LOG_ERROR("Task %s never got back to a check-in, rebooting", taskTable[id].name);
+        delay(2 * LOG_DRAIN_INTERVAL_MS); // Let the log task get that out
+        ESP.restart();
+    }
+
+    return;
+}
+
+/* Runs on core 1 above everything it watches
+  * Itself fed to the hardware task watchdog, so if even this can't run the chip resets
+*/
+void handle_task_supervisor( void * parameter ) {
+    esp_task_wdt_add(NULL);
+
+    for(;;) {
+        uint32_t now = millis();
+
+        for (uint8_t i = 0; i < task_count; i++) {
+            if (taskTable[i].watchdog_ms > 0 && taskFunctions[i] != NULL) {
+                superviseTask((TASKID) i, now);
+            }
+        }
+
+        esp_task_wdt_reset();
+        delay(TASK_SUPERVISOR_PERIOD_MS);
+    }
+}
+
+// Stack marks and restarts for the table's tasks
+void renderTaskMetrics(WEBRESPONSE *response) {
+    appendResponse(response, "# HELP door_task_stack_free_min_bytes Lowest free stack seen for the task\n# TYPE door_task_stack_free_min_bytes gauge\n");
+    for (uint8_t i = 0; i < task_count; i++) {
+        lockHandles();
+        bool running = taskHandles[i] != NULL;
+        UBaseType_t free = running ? uxTaskGetStackHighWaterMark(taskHandles[i]) : 0;
+        xSemaphoreGive(handleLock);
+
+        if (running) {
+            appendResponse(response, "door_task_stack_free_min_bytes{task=\"%s\"} %u\n", taskTable[i].name, (unsigned) free);
+        }
+    }
+
+    appendResponse(response, "# HELP door_task_restarts_total Times the supervisor restarted a task that stopped checking in\n# TYPE door_task_restarts_total counter\n");
+    for (uint8_t i = 0; i < task_count; i++) {
+        if (taskTable[i].watchdog_ms > 0) {
+            appendResponse(response, "door_task_restarts_total{task=\"%s\"} %u\n", taskTable[i].name, (unsigned) getTaskRestarts((TASKID) i));
+        }
+    }
+
+    return;
+}
+
+/* Run time of every task on the chip, ours and the system's, as JSON
+  * Needs the FreeRTOS run time stats, which the Arduino core's sdkconfig turns on. Times are microseconds since
+  * boot, so a task's share of a core over an interval is the change in its run_us over the change in uptime_us.
+*/
+void renderTaskReport(WEBRESPONSE *response) {
+    response->content_type = "application/json";
+    response->extra_headers = "Cache-Control: no-store\r\n";
+
+    appendResponse(response, "{\"table\":[");
+    for (uint8_t i = 0; i < task_count; i++) {
+        const TASKSPEC *spec = &taskTable[i];
+        appendResponse(response, "%s{\"name\":\"%s\",\"core\":%d,\"priority\":%u,\"stack_bytes\":%u,\"watchdog_ms\":%u,\"restarts\":%u,\"checkin_age_ms\":%u}",
+            i == 0 ? "" : ",", spec->name, (int) spec->core, (unsigned) spec->priority, (unsigned) spec->stack_bytes, (unsigned) spec->watchdog_ms,
+            (unsigned) getTaskRestarts((TASKID) i), spec->watchdog_ms > 0 ? (unsigned) (millis() - lastCheckIn[i].load(std::memory_order_relaxed)) : 0);
+    }
+    appendResponse(response, "]");
+
+#if defined(configGENERATE_RUN_TIME_STATS) && configGENERATE_RUN_TIME_STATS == 1
+    static TaskStatus_t tasks[TASK_REPORT_MAX]; // Only the web task renders, too big for its stack
+    uint32_t totalRunTime;
+    UBaseType_t count = uxTaskGetSystemState(tasks, TASK_REPORT_MAX, &totalRunTime);
+
+    appendResponse(response, ",\"uptime_us\":%u,\"tasks\":[", (unsigned) totalRunTime);
+    for (UBaseType_t i = 0; i < count; i++) {
+        appendResponse(response, "%s{\"name\":\"%s\",\"priority\":%u,\"run_us\":%u,\"stack_free\":%u}", i == 0 ? "" : ",",
+            tasks[i].pcTaskName, (unsigned) tasks[i].uxBasePriority, (unsigned) tasks[i].ulRunTimeCounter, (unsigned) tasks[i].usStackHighWaterMark);
+    }
+    appendResponse(response, "]");
+#endif
+
+    appendResponse(response, "}");
+
+    return;
+}
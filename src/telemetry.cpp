@@ -0,0 +1,565 @@
+#include "telemetry.hpp"
+#include "beaconRegistry.hpp"
+#include "configStore.hpp"
+#include "doorSchedule.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "mqttClient.hpp"
+#include "taskTable.hpp"
+#include <atomic>
+
+/* MQTT telemetry and commands
+  * Producers copy each door or lock change into a ring and fold RSSI samples into per-beacon totals, under a
+  * spinlock and without formatting anything. Only the telemetry task touches the network: it batches the ring into
+  * one events message, renders a summary every TELEMETRY_SUMMARY_MS, and queues both in an outbox that rides out a
+  * broker outage by dropping the oldest. A slow or missing broker holds up this task and nothing else.
+  *
+  * Topics, under TELEMETRY_TOPIC_PREFIX:
+  *   status          "online" once connected, "offline" as the will, both retained
+  *   events          {"t":<ms>,"events":[...]} door, lock and presence changes with the uptime they happened at
+  *   summary         {"t":<ms>,...,"beacons":[...]} uptime, unlock cycles, heap and each beacon's RSSI since the last one
+  *   cmd/lock, cmd/unlock, cmd/open   payload is a door id, empty for every door, acted on as the web page's are
+  *   cmd/lock_for    payload is minutes, 0 ends a timed lock
+  * A batch too long for one message carries on in another with the same header.
+*/
+
+#define TELEMETRY_ITEM_LEN 320 // One event or beacon, room for a beacon name with every character escaped
+
+typedef struct {
+  uint16_t count;
+  int8_t min;
+  int8_t max;
+  int32_t sum;
+  uint32_t last_ms; // 0 if never heard
+  bool present;
+} RSSITOTALS;
+
+typedef struct {
+  const char *topic; // Under the prefix
+  uint32_t oldest_ms; // Earliest change it carries, 0 for a summary
+  uint16_t len;
+  char payload[TELEMETRY_MESSAGE_LEN];
+} TELEMETRYMESSAGE;
+
+// A message being filled, items go between opening and "]}"
+typedef struct {
+  TELEMETRYMESSAGE *message;
+  const char *topic;
+  const char *opening;
+  bool empty;
+} TELEMETRYBATCH;
+
+static const char *lockNames[] = { "unlocked", "wifi", "switch", "both" };
+
+static portMUX_TYPE telemetryMux = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<bool> collecting(false); // Started with a broker set, producers return straight away otherwise
+static TELEMETRYEVENT eventRing[TELEMETRY_EVENT_RING];
+static uint16_t eventHead = 0;
+static uint16_t eventCount = 0;
+static RSSITOTALS rssiTotals[BEACON_REGISTRY_MAX];
+
+// Only the telemetry task touches these
+static TELEMETRYMESSAGE outbox[TELEMETRY_OUTBOX_LEN];
+static uint8_t outboxHead = 0;
+static uint8_t outboxCount = 0;
+static MQTTCLIENT client;
+static uint32_t reconnectDelayMs = TELEMETRY_RECONNECT_MIN_MS;
+static uint32_t nextConnectMs = 0;
+static uint32_t lastSummaryMs = 0;
+
+static portMUX_TYPE brokerMux = portMUX_INITIALIZER_UNLOCKED;
+static char broker[TELEMETRY_BROKER_LEN + 1];
+static std::atomic<bool> brokerChanged(false);
+static bool started = false;
+static TaskHandle_t telemetry_task = NULL; // Woken by a broker change, or a half full event ring while it sleeps
+// The telemetry task's copy of broker, static so log records can point at it (one logged just before a broker
+// change may come out with the new host, never with freed memory)
+static char connectHost[TELEMETRY_BROKER_LEN + 1];
+
+static std::atomic<bool> connected(false);
+static std::atomic<uint32_t> connects(0);
+static std::atomic<uint32_t> messagesSent(0);
+static std::atomic<uint32_t> messagesDropped(0);
+static std::atomic<uint32_t> eventsDropped(0);
+static std::atomic<uint32_t> commands(0);
+
+// Called with telemetryMux held, a full ring loses its oldest event
+// Returns true once the ring is half full, so a producer knows to wake the task once it has let go of the lock
+static bool pushEvent(uint32_t ms, TELEMETRYEVENTTYPE type, uint8_t subject, uint8_t value, uint8_t detail) {
+    if (eventCount == TELEMETRY_EVENT_RING) {
+        eventHead = (eventHead + 1) % TELEMETRY_EVENT_RING;
+        eventCount--;
+        eventsDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    TELEMETRYEVENT *event = &eventRing[(eventHead + eventCount) % TELEMETRY_EVENT_RING];
+    event->ms = ms;
+    event->type = type;
+    event->subject = subject;
+    event->value = value;
+    event->detail = detail;
+    eventCount++;
+
+    return eventCount == TELEMETRY_EVENT_RING / 2;
+}
+
+// Runs in the door task whenever a door's state or lock changes
+void telemetryDoorChanged(uint8_t door, DOORSTATUS status, DOORLOCKSTATE lock) {
+    if (!collecting.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    uint32_t now = millis();
+    portENTER_CRITICAL(&telemetryMux);
+    bool wake = pushEvent(now, telemetry_door, door, status, lock);
+    portEXIT_CRITICAL(&telemetryMux);
+
+    if (wake) {
+        xTaskNotifyGive(telemetry_task);
+    }
+
+    return;
+}
+
+// Runs for every detection, the first sample after a beacon was away also reports it present
+void telemetryRssiSample(uint8_t beaconIndex, int rssi, uint32_t heardMs) {
+    if (!collecting.load(std::memory_order_relaxed) || beaconIndex >= BEACON_REGISTRY_MAX) {
+        return;
+    }
+
+    int8_t sample = rssi < INT8_MIN ? INT8_MIN : (rssi > INT8_MAX ? INT8_MAX : rssi);
+    bool wake = false;
+    portENTER_CRITICAL(&telemetryMux);
+    RSSITOTALS *totals = &rssiTotals[beaconIndex];
+    if (totals->count == 0 || sample < totals->min) {
+        totals->min = sample;
+    }
+    if (totals->count == 0 || sample > totals->max) {
+        totals->max = sample;
+    }
+    if (totals->count < UINT16_MAX) {
+        totals->count++;
+        totals->sum += sample;
+    }
+    totals->last_ms = heardMs == 0 ? 1 : heardMs;
+    if (!totals->present) {
+        totals->present = true;
+        wake = pushEvent(heardMs, telemetry_presence, beaconIndex, 1, 0);
+    }
+    portEXIT_CRITICAL(&telemetryMux);
+
+    if (wake) {
+        xTaskNotifyGive(telemetry_task);
+    }
+
+    return;
+}
+
+// Beacons unheard for TELEMETRY_PRESENCE_TIMEOUT_MS go away, stamped with when they timed out
+static void checkPresence(uint32_t now) {
+    portENTER_CRITICAL(&telemetryMux);
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        RSSITOTALS *totals = &rssiTotals[i];
+        if (totals->present && now - totals->last_ms >= TELEMETRY_PRESENCE_TIMEOUT_MS) {
+            totals->present = false;
+            pushEvent(totals->last_ms + TELEMETRY_PRESENCE_TIMEOUT_MS, telemetry_presence, i, 0, 0);
+        }
+    }
+    portEXIT_CRITICAL(&telemetryMux);
+
+    return;
+}
+
+// Next free outbox slot, a full outbox loses its oldest message
+static TELEMETRYMESSAGE *claimMessage() {
+    if (outboxCount == TELEMETRY_OUTBOX_LEN) {
+        outboxHead = (outboxHead + 1) % TELEMETRY_OUTBOX_LEN;
+        outboxCount--;
+        messagesDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return &outbox[(outboxHead + outboxCount++) % TELEMETRY_OUTBOX_LEN];
+}
+
+static void closeBatch(TELEMETRYBATCH *batch) {
+    if (batch->message != NULL) {
+        memcpy(&batch->message->payload[batch->message->len], "]}", 2);
+        batch->message->len += 2;
+        batch->message = NULL;
+    }
+
+    return;
+}
+
+static void openBatch(TELEMETRYBATCH *batch, uint32_t ms) {
+    batch->message = claimMessage();
+    batch->message->topic = batch->topic;
+    batch->message->oldest_ms = ms;
+    batch->message->len = strlen(batch->opening);
+    memcpy(batch->message->payload, batch->opening, batch->message->len);
+    batch->empty = true;
+
+    return;
+}
+
+static void appendItem(TELEMETRYBATCH *batch, const char *item, size_t len, uint32_t ms) {
+    if (batch->message != NULL && batch->message->len + 1 + len + 2 > TELEMETRY_MESSAGE_LEN) {
+        closeBatch(batch);
+    }
+    if (batch->message == NULL) {
+        openBatch(batch, ms);
+    }
+
+    if (!batch->empty) {
+        batch->message->payload[batch->message->len++] = ',';
+    }
+    memcpy(&batch->message->payload[batch->message->len], item, len);
+    batch->message->len += len;
+    batch->empty = false;
+
+    return;
+}
+
+// Beacon names come from users, escapes anything that would break the JSON
+static size_t appendBeaconName(char *item, size_t len, uint8_t beaconIndex) {
+    BEACONENTRY *beacon = getBeacon(beaconIndex);
+
+    if (beacon == NULL) {
+        return len + snprintf(&item[len], TELEMETRY_ITEM_LEN - len, "\"%u\"", beaconIndex);
+    }
+
+    item[len++] = '"';
+    for (uint8_t c = 0; c < beacon->matcher.name_len; c++) {
+        char ch = beacon->matcher.name[c];
+        if (ch == '"' || ch == '\\') {
+            item[len++] = '\\';
+        }
+        item[len++] = (uint8_t) ch < 0x20 ? '?' : ch;
+    }
+    item[len++] = '"';
+
+    return len;
+}
+
+static size_t renderEvent(char *item, const TELEMETRYEVENT *event) {
+    size_t len;
+
+    if (event->type == telemetry_door) {
+        return snprintf(item, TELEMETRY_ITEM_LEN, "{\"ms\":%u,\"door\":\"%s\",\"state\":\"%s\",\"lock\":\"%s\"}", (unsigned) event->ms,
+            getDoorSpec(event->subject)->name, event->value == door_open ? "open" : "closed", lockNames[event->detail & 0x03]);
+    }
+
+    len = snprintf(item, TELEMETRY_ITEM_LEN, "{\"ms\":%u,\"beacon\":", (unsigned) event->ms);
+    len = appendBeaconName(item, len, event->subject);
+
+    return len + snprintf(&item[len], TELEMETRY_ITEM_LEN - len, ",\"present\":%s}", event->value ? "true" : "false");
+}
+
+// Once the oldest waiting event is TELEMETRY_BATCH_MS old, everything in the ring goes out together
+static void batchEvents(uint32_t now) {
+    static TELEMETRYEVENT taken[TELEMETRY_EVENT_RING];
+    static char opening[40];
+    char item[TELEMETRY_ITEM_LEN];
+    uint16_t count = 0;
+
+    portENTER_CRITICAL(&telemetryMux);
+    if (eventCount > 0 && now - eventRing[eventHead].ms >= TELEMETRY_BATCH_MS) {
+        for (; count < eventCount; count++) {
+            taken[count] = eventRing[(eventHead + count) % TELEMETRY_EVENT_RING];
+        }
+        eventHead = 0;
+        eventCount = 0;
+    }
+    portEXIT_CRITICAL(&telemetryMux);
+
+    if (count == 0) {
+        return;
+    }
+
+    snprintf(opening, sizeof(opening), "{\"t\":%u,\"events\":[", (unsigned) now);
+    TELEMETRYBATCH batch = { NULL, "events", opening, true };
+    for (uint16_t i = 0; i < count; i++) {
+        appendItem(&batch, item, renderEvent(item, &taken[i]), taken[i].ms == 0 ? 1 : taken[i].ms);
+    }
+    closeBatch(&batch);
+
+    return;
+}
+
+// Health and each beacon heard since the last summary, the RSSI totals start again from here
+static void renderSummary(uint32_t now) {
+    static RSSITOTALS taken[BEACON_REGISTRY_MAX];
+    static char opening[256];
+    char item[TELEMETRY_ITEM_LEN];
+
+    portENTER_CRITICAL(&telemetryMux);
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        taken[i] = rssiTotals[i];
+        rssiTotals[i].count = 0;
+        rssiTotals[i].sum = 0;
+    }
+    portEXIT_CRITICAL(&telemetryMux);
+
+    snprintf(opening, sizeof(opening), "{\"t\":%u,\"uptime_s\":%u,\"unlock_cycles\":%u,\"max_open_latency_ms\":%.1f,\"heap_free\":%u,\"events_dropped\":%u,\"messages_dropped\":%u,\"beacons\":[",
+        (unsigned) now, (unsigned) (now / 1000), (unsigned) getUnlockCycles(), getMaxOpenLatency() / 1000.0, (unsigned) ESP.getFreeHeap(),
+        (unsigned) eventsDropped.load(std::memory_order_relaxed), (unsigned) messagesDropped.load(std::memory_order_relaxed));
+    TELEMETRYBATCH batch = { NULL, "summary", opening, true };
+    for (uint8_t i = 0; i < BEACON_REGISTRY_MAX; i++) {
+        if (getBeacon(i) == NULL) {
+            continue;
+        }
+
+        size_t len = snprintf(item, sizeof(item), "{\"id\":%u,\"name\":", i);
+        len = appendBeaconName(item, len, i);
+        if (taken[i].count > 0) {
+            len += snprintf(&item[len], sizeof(item) - len, ",\"present\":%s,\"samples\":%u,\"min\":%d,\"max\":%d,\"mean\":%.1f}",
+                taken[i].present ? "true" : "false", taken[i].count, taken[i].min, taken[i].max, (double) taken[i].sum / taken[i].count);
+        } else {
+            len += snprintf(&item[len], sizeof(item) - len, ",\"present\":%s,\"samples\":0}", taken[i].present ? "true" : "false");
+        }
+        appendItem(&batch, item, len, 0);
+    }
+    if (batch.message == NULL) {
+        openBatch(&batch, 0); // No beacons registered, the health part still goes out
+    }
+    closeBatch(&batch);
+
+    return;
+}
+
+// Publishes from the oldest, stopping if the connection goes
+static void sendOutbox() {
+    char topic[64];
+
+    while (outboxCount > 0 && mqttConnected(&client)) {
+        TELEMETRYMESSAGE *message = &outbox[outboxHead];
+
+        snprintf(topic, sizeof(topic), TELEMETRY_TOPIC_PREFIX "/%s", message->topic);
+        if (!mqttPublish(&client, topic, message->payload, message->len, false)) {
+            return;
+        }
+        if (message->oldest_ms != 0) {
+            recordTelemetryDelay(millis() - message->oldest_ms);
+        }
+        messagesSent.fetch_add(1, std::memory_order_relaxed);
+        outboxHead = (outboxHead + 1) % TELEMETRY_OUTBOX_LEN;
+        outboxCount--;
+    }
+
+    return;
+}
+
+// cmd/<name>, runs in the telemetry task from mqttPoll()
+static void handleCommand(const char *topic, uint16_t topicLen, const uint8_t *payload, size_t payloadLen) {
+    static const char commandPrefix[] = TELEMETRY_TOPIC_PREFIX "/cmd/";
+    const size_t prefixLen = sizeof(commandPrefix) - 1;
+    char name[16];
+    char arg[8];
+
+    if (topicLen <= prefixLen || topicLen - prefixLen >= sizeof(name) || memcmp(topic, commandPrefix, prefixLen) != 0) {
+        return;
+    }
+    memcpy(name, &topic[prefixLen], topicLen - prefixLen);
+    name[topicLen - prefixLen] = '\0';
+    size_t argLen = payloadLen < sizeof(arg) - 1 ? payloadLen : sizeof(arg) - 1;
+    memcpy(arg, payload, argLen);
+    arg[argLen] = '\0';
+
+    // The log only ever sees the literal names, name and arg are gone by the time it formats a record
+    uint8_t doors = DOOR_ALL;
+    uint8_t detail = 0;
+    DOOREVENTTYPE type;
+    const char *command;
+    if (strcmp(name, "lock_for") == 0) {
+        type = door_event_timed_lock;
+        detail = constrain(atoi(arg), 0, TIMED_LOCK_MAX_MIN);
+        command = "lock_for";
+    } else if (strcmp(name, "lock") == 0) {
+        type = door_event_web_lock;
+        command = "lock";
+    } else if (strcmp(name, "unlock") == 0) {
+        type = door_event_web_unlock;
+        command = "unlock";
+    } else if (strcmp(name, "open") == 0) {
+        type = door_event_web_open;
+        command = "open";
+    } else {
+        LOG_WARN("Unknown MQTT command (%u characters)", (unsigned) (topicLen - prefixLen));
+        return;
+    }
+
+    if (type != door_event_timed_lock && argLen > 0) {
+        int door = atoi(arg);
+        if (door < 0 || door >= getDoorCount()) {
+            LOG_WARN("MQTT command %s for unknown door %d", command, door);
+            return;
+        }
+        doors = 1 << door;
+    }
+
+    if (!postDoorEvent(type, micros(), detail, doors)) {
+        LOG_WARN("Door event queue full, MQTT command %s dropped", command);
+        return;
+    }
+    commands.fetch_add(1, std::memory_order_relaxed);
+
+    return;
+}
+
+// "host" or "host:port"
+static void connectBroker(uint32_t now) {
+    char *host = connectHost;
+    uint16_t port = MQTT_DEFAULT_PORT;
+
+    portENTER_CRITICAL(&brokerMux);
+    memcpy(host, broker, sizeof(connectHost));
+    portEXIT_CRITICAL(&brokerMux);
+
+    char *colon = strrchr(host, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        port = atoi(colon + 1);
+    }
+
+    if (mqttConnect(&client, host, port, TELEMETRY_TOPIC_PREFIX, TELEMETRY_TOPIC_PREFIX "/status", "offline")
+        && mqttPublish(&client, TELEMETRY_TOPIC_PREFIX "/status", "online", 6, true)
+        && mqttSubscribe(&client, TELEMETRY_TOPIC_PREFIX "/cmd/#")) {
+        LOG_INFO("MQTT connected to %s:%u", host, port);
+        connects.fetch_add(1, std::memory_order_relaxed);
+        reconnectDelayMs = TELEMETRY_RECONNECT_MIN_MS;
+        return;
+    }
+
+    mqttDisconnect(&client);
+    LOG_WARN("MQTT connect to %s:%u failed, retrying in %us", host, port, (unsigned) (reconnectDelayMs / 1000));
+    nextConnectMs = now + reconnectDelayMs;
+    reconnectDelayMs = reconnectDelayMs * 2 > TELEMETRY_RECONNECT_MAX_MS ? TELEMETRY_RECONNECT_MAX_MS : reconnectDelayMs * 2;
+
+    return;
+}
+
+// How long the task can sleep while it has no broker connection: until the next reconnect or summary is due
+// Events wait in the ring meanwhile, fewer and fuller messages ride out an outage better, unless it is half full
+static uint32_t idleWaitMs(uint32_t now) {
+    uint32_t wait = (int32_t) (nextConnectMs - now) > 0 ? nextConnectMs - now : 0;
+    uint32_t summaryIn = now - lastSummaryMs < TELEMETRY_SUMMARY_MS ? TELEMETRY_SUMMARY_MS - (now - lastSummaryMs) : 0;
+
+    wait = summaryIn < wait ? summaryIn : wait;
+    portENTER_CRITICAL(&telemetryMux);
+    if (eventCount >= TELEMETRY_EVENT_RING / 2) {
+        uint32_t age = now - eventRing[eventHead].ms;
+        uint32_t batchIn = age < TELEMETRY_BATCH_MS ? TELEMETRY_BATCH_MS - age : 0;
+        wait = batchIn < wait ? batchIn : wait;
+    }
+    portEXIT_CRITICAL(&telemetryMux);
+
+    return wait;
+}
+
+/* Runs at low priority on core 0, with the network stack
+  * Connected, it sleeps in the broker's socket for up to TELEMETRY_POLL_MS, so commands are acted on as they arrive.
+  * Otherwise it sleeps until the next reconnect or summary is due, or for good with no broker set, and a broker
+  * change or a half full event ring wakes it early.
+*/
+void handle_telemetry( void * parameter ) {
+    for(;;) {
+        uint32_t now = millis();
+
+        if (brokerChanged.exchange(false)) {
+            mqttDisconnect(&client);
+            connected.store(false, std::memory_order_relaxed);
+            reconnectDelayMs = TELEMETRY_RECONNECT_MIN_MS;
+            nextConnectMs = now;
+        }
+        if (!collecting.load(std::memory_order_relaxed)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!mqttConnected(&client) && (int32_t) (now - nextConnectMs) >= 0) {
+            connectBroker(now);
+        }
+        checkPresence(now);
+        batchEvents(now);
+        if (now - lastSummaryMs >= TELEMETRY_SUMMARY_MS) {
+            lastSummaryMs = now;
+            renderSummary(now);
+        }
+        sendOutbox();
+
+        if (!mqttConnected(&client) || !mqttPoll(&client, TELEMETRY_POLL_MS)) {
+            if (connected.load(std::memory_order_relaxed)) {
+                nextConnectMs = millis() + reconnectDelayMs;
+            }
+            connected.store(false, std::memory_order_relaxed);
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idleWaitMs(millis())));
+        } else {
+            connected.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+// Starts the telemetry task, it stays idle until a broker is set
+void initTelemetry() {
+    configReadString(config_mqtt_broker, broker, sizeof(broker));
+    initMqttClient(&client, handleCommand);
+    lastSummaryMs = millis();
+    telemetry_task = startTask(task_mqtt, handle_telemetry);
+    started = true;
+    collecting.store(broker[0] != '\0', std::memory_order_relaxed); // Producers can wake the task from here on
+    xTaskNotifyGive(telemetry_task);
+
+    return;
+}
+
+// "host[:port]", empty to turn telemetry off. Stored, and the task reconnects to it straight away
+bool setTelemetryBroker(const char *host) {
+    if (strlen(host) > TELEMETRY_BROKER_LEN || !configWriteString(config_mqtt_broker, host) || !configCommit()) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&brokerMux);
+    strcpy(broker, host);
+    portEXIT_CRITICAL(&brokerMux);
+    collecting.store(started && host[0] != '\0', std::memory_order_relaxed);
+    brokerChanged.store(true, std::memory_order_release);
+    if (started) {
+        xTaskNotifyGive(telemetry_task);
+    }
+
+    return true;
+}
+
+TELEMETRYSTATS getTelemetryStats() {
+    TELEMETRYSTATS stats;
+
+    stats.configured = collecting.load(std::memory_order_relaxed);
+    stats.connected = connected.load(std::memory_order_relaxed);
+    stats.connects = connects.load(std::memory_order_relaxed);
+    stats.messages_sent = messagesSent.load(std::memory_order_relaxed);
+    stats.messages_dropped = messagesDropped.load(std::memory_order_relaxed);
+    stats.events_dropped = eventsDropped.load(std::memory_order_relaxed);
+    stats.commands = commands.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+// The "mqtt" object of the status JSON
+void renderTelemetryStatus(WEBRESPONSE *response) {
+    TELEMETRYSTATS stats = getTelemetryStats();
+    char host[TELEMETRY_BROKER_LEN + 1];
+
+    portENTER_CRITICAL(&brokerMux);
+    memcpy(host, broker, sizeof(host));
+    portEXIT_CRITICAL(&brokerMux);
+
+    appendResponse(response, "{\"broker\":\"");
+    for (const char *c = host; *c != '\0'; c++) {
+        appendResponse(response, (*c == '"' || *c == '\\') ? "\\%c" : ((uint8_t) *c < 0x20 ? "?" : "%c"), *c);
+    }
+    appendResponse(response, "\",\"connected\":%s,\"connects\":%u,\"sent\":%u,\"messages_dropped\":%u,\"events_dropped\":%u,\"commands\":%u}",
+        stats.connected ? "true" : "false", (unsigned) stats.connects, (unsigned) stats.messages_sent,
+        (unsigned) stats.messages_dropped, (unsigned) stats.events_dropped, (unsigned) stats.commands);
+
+    return;
+}
@@ -0,0 +1,165 @@
+#include "thresholdCalibrator.hpp"
+#include "beaconRegistry.hpp"
+
+/* Learns an open threshold per beacon from what its visits looked like
+  * Every visit adds its peak to one of two histograms. The threshold is the lowest one at which no more than the
+  * target share of visits that didn't go through the door would have opened it, the earliest the door can open
+  * without opening for a dog that is just lying nearby. It is capped so most past passages still reach it, otherwise
+  * a dog left waiting at a door that didn't open would look like one lying nearby and push it ever higher.
+  * Updating is one bin increment per visit, memory is fixed.
+*/
+
+static uint8_t binFor(int rssi) {
+    int bin = (rssi - CALIBRATION_RSSI_MIN) / CALIBRATION_BIN_DB;
+
+    if (bin < 0) {
+        return 0;
+    } else if (bin >= CALIBRATION_BINS) {
+        return CALIBRATION_BINS - 1;
+    }
+
+    return bin;
+}
+
+// Counts are halved once the total passes history, so the histogram follows battery and seasonal drift
+static void addPeak(uint16_t *bins, uint16_t *total, uint16_t history, int peak) {
+    bins[binFor(peak)]++;
+    (*total)++;
+
+    if (*total > history) {
+        *total = 0;
+        for (uint8_t i = 0; i < CALIBRATION_BINS; i++) {
+            bins[i] >>= 1;
+            *total += bins[i];
+        }
+    }
+
+    return;
+}
+
+static void endVisit(BEACONCALIBRATION *calibration, bool passed) {
+    if (passed) {
+        addPeak(calibration->passed, &calibration->passed_total, CALIBRATION_HISTORY_PASSAGES, calibration->peak);
+    } else {
+        addPeak(calibration->nearby, &calibration->nearby_total, CALIBRATION_HISTORY_NEARBY, calibration->peak);
+    }
+    calibration->visiting = false;
+
+    return;
+}
+
+// The door task records opens, a visit picks up the first one after it started
+static void noteOpen(BEACONCALIBRATION *calibration, uint32_t lastOpen_ms) {
+    if (!calibration->opened && lastOpen_ms != 0 && (int32_t) (lastOpen_ms - calibration->visit_start_ms) >= 0) {
+        calibration->opened = true;
+        calibration->opened_ms = lastOpen_ms;
+    }
+
+    return;
+}
+
+void resetCalibration(BEACONCALIBRATION *calibration) {
+    memset(calibration, 0, sizeof(BEACONCALIBRATION));
+}
+
+// Every filtered sample of the beacon, lastOpen_ms is when the door last opened (0 if never)
+void updateCalibration(BEACONCALIBRATION *calibration, int filteredRSSI, uint32_t now_ms, uint32_t lastOpen_ms) {
+    if (calibration->visiting && now_ms - calibration->last_heard_ms > CALIBRATION_VISIT_GAP_MS) {
+        serviceCalibration(calibration, now_ms, lastOpen_ms);
+    }
+
+    if (!calibration->visiting) {
+        calibration->visiting = true;
+        calibration->opened = false;
+        calibration->peak = filteredRSSI;
+        calibration->visit_start_ms = now_ms;
+    }
+
+    calibration->last_heard_ms = now_ms;
+    noteOpen(calibration, lastOpen_ms);
+
+    if (filteredRSSI > calibration->peak) {
+        calibration->peak = filteredRSSI;
+    } else if (calibration->opened && filteredRSSI <= calibration->peak - CALIBRATION_PASSAGE_DROP_DB) {
+        endVisit(calibration, true); // Door opened and the dog is now on the other side of it
+    }
+
+    return;
+}
+
+// Ends visits that have timed out, call regularly even when the beacon isn't being heard
+void serviceCalibration(BEACONCALIBRATION *calibration, uint32_t now_ms, uint32_t lastOpen_ms) {
+    if (!calibration->visiting) {
+        return;
+    }
+
+    noteOpen(calibration, lastOpen_ms);
+    bool gone = now_ms - calibration->last_heard_ms > CALIBRATION_VISIT_GAP_MS;
+
+    if (calibration->opened && (int32_t) (calibration->last_heard_ms - calibration->opened_ms) >= 0) {
+        // Out of range soon after the door opened counts as going through, still around means it opened for nothing
+        if (gone && calibration->last_heard_ms - calibration->opened_ms <= CALIBRATION_PASSAGE_WINDOW_MS) {
+            endVisit(calibration, true);
+        } else if (now_ms - calibration->opened_ms > CALIBRATION_PASSAGE_WINDOW_MS) {
+            endVisit(calibration, false);
+        }
+    } else if (gone || now_ms - calibration->visit_start_ms > CALIBRATION_VISIT_MAX_MS) {
+        endVisit(calibration, false);
+    }
+
+    return;
+}
+
+// Returns BEACON_THRESHOLD_GLOBAL until enough visits have been seen
+int computeCalibratedThreshold(const BEACONCALIBRATION *calibration) {
+    if (calibration->passed_total < CALIBRATION_MIN_PASSAGES || calibration->nearby_total < CALIBRATION_MIN_NEARBY) {
+        return BEACON_THRESHOLD_GLOBAL;
+    }
+
+    // Walk down from the strongest bin until opening any lower would catch too many visits that stayed
+    uint32_t allowed = (uint32_t) calibration->nearby_total * CALIBRATION_FALSE_OPEN_PERMILLE / 1000;
+    uint32_t above = 0;
+    int bin = CALIBRATION_BINS - 1;
+
+    for (; bin >= 0; bin--) {
+        above += calibration->nearby[bin];
+        if (above > allowed) {
+            break;
+        }
+    }
+
+    // Peaks land in a bin by rounding down, so the threshold sits on the edge just above the failing bin
+    int threshold = CALIBRATION_RSSI_MIN + (bin + 1) * CALIBRATION_BIN_DB;
+
+    // Walk up from the weakest bin for as long as enough passages would still open the door
+    uint32_t mustReach = (uint32_t) calibration->passed_total * CALIBRATION_COVERAGE_PERMILLE / 1000;
+    uint32_t reaching = calibration->passed_total;
+    uint8_t coverBin = 0;
+
+    while (coverBin < CALIBRATION_BINS - 1 && reaching - calibration->passed[coverBin] >= mustReach) {
+        reaching -= calibration->passed[coverBin];
+        coverBin++;
+    }
+    if (CALIBRATION_RSSI_MIN + coverBin * CALIBRATION_BIN_DB < threshold) {
+        threshold = CALIBRATION_RSSI_MIN + coverBin * CALIBRATION_BIN_DB;
+    }
+
+    return constrain(threshold, CALIBRATION_THRESHOLD_MIN, CALIBRATION_THRESHOLD_MAX);
+}
+
+// Share (in permille) of recorded passages whose peak would have reached threshold
+uint16_t calibrationPassageCoverage(const BEACONCALIBRATION *calibration, int threshold) {
+    uint32_t covered = 0;
+
+    if (calibration->passed_total == 0) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < CALIBRATION_BINS; i++) {
+        if (CALIBRATION_RSSI_MIN + i * CALIBRATION_BIN_DB >= threshold) {
+            covered += calibration->passed[i];
+        }
+    }
+
+    return covered * 1000 / calibration->passed_total;
+}
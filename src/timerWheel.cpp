@@ -0,0 +1,199 @@
+#include "timerWheel.hpp"
+
+#define TIMER_WHEEL_SPAN_BITS (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)
+
+// Index of the slot at level that covers time
+static inline uint8_t slotIndex(uint64_t time, uint8_t level) {
+    return (time >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+// List a timer at level/slot sits in, the level past the top is the overflow list
+static inline TIMERENTRY **slotHead(TIMERWHEEL *wheel, uint8_t level, uint8_t slot) {
+    return level < TIMER_WHEEL_LEVELS ? &wheel->slots[level][slot] : &wheel->overflow;
+}
+
+static void unlinkTimer(TIMERWHEEL *wheel, TIMERENTRY *timer) {
+    TIMERENTRY **head = slotHead(wheel, timer->level, timer->slot);
+
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        *head = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    if (*head == NULL && timer->level < TIMER_WHEEL_LEVELS) {
+        wheel->occupied[timer->level] &= ~((uint64_t) 1 << timer->slot);
+    }
+
+    timer->next = NULL;
+    timer->prev = NULL;
+
+    return;
+}
+
+/* Due (or overdue) timers go in the current level 0 slot. Otherwise the level is picked by the highest
+  * group of bits where the deadline and now differ, so the slot is always ahead of now at that level.
+  * Deadlines past the top level's span wait on the overflow list until the next span starts.
+*/
+static void placeTimer(TIMERWHEEL *wheel, TIMERENTRY *timer) {
+    uint64_t now = wheel->now_ms;
+    uint64_t at = timer->deadline_ms > now ? timer->deadline_ms : now;
+    uint8_t level = 0;
+
+    while (level < TIMER_WHEEL_LEVELS && ((at ^ now) >> (TIMER_WHEEL_BITS * (level + 1))) != 0) {
+        level++;
+    }
+
+    timer->level = level;
+    timer->slot = level < TIMER_WHEEL_LEVELS ? slotIndex(at, level) : 0;
+    TIMERENTRY **head = slotHead(wheel, level, timer->slot);
+    timer->prev = NULL;
+    timer->next = *head;
+    if (timer->next != NULL) {
+        timer->next->prev = timer;
+    }
+    *head = timer;
+    if (level < TIMER_WHEEL_LEVELS) {
+        wheel->occupied[level] |= (uint64_t) 1 << timer->slot;
+    }
+
+    return;
+}
+
+// now_ms has just reached the start of a slot on one or more levels, spread their timers over the levels below
+static void cascadeTimers(TIMERWHEEL *wheel) {
+    for (int8_t level = TIMER_WHEEL_LEVELS; level > 0; level--) {
+        if ((wheel->now_ms & (((uint64_t) 1 << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+            continue;
+        }
+
+        uint8_t slot = level < TIMER_WHEEL_LEVELS ? slotIndex(wheel->now_ms, level) : 0;
+        TIMERENTRY **head = slotHead(wheel, level, slot);
+        TIMERENTRY *timer = *head;
+        *head = NULL;
+        if (level < TIMER_WHEEL_LEVELS) {
+            wheel->occupied[level] &= ~((uint64_t) 1 << slot);
+        }
+
+        while (timer != NULL) {
+            TIMERENTRY *next = timer->next;
+            placeTimer(wheel, timer);
+            timer = next;
+        }
+    }
+
+    return;
+}
+
+void initTimerWheel(TIMERWHEEL *wheel, uint64_t now_ms) {
+    memset(wheel, 0, sizeof(TIMERWHEEL));
+    wheel->now_ms = now_ms;
+
+    return;
+}
+
+void initTimer(TIMERENTRY *timer, TIMERCALLBACK callback) {
+    memset(timer, 0, sizeof(TIMERENTRY));
+    timer->callback = callback;
+
+    return;
+}
+
+// Re-arming an armed timer moves it, a deadline that has already passed fires on the next runTimers()
+void armTimer(TIMERWHEEL *wheel, TIMERENTRY *timer, uint64_t deadline_ms, uint32_t period_ms) {
+    if (timer->armed) {
+        unlinkTimer(wheel, timer);
+    } else {
+        wheel->armed++;
+    }
+
+    timer->deadline_ms = deadline_ms;
+    timer->period_ms = period_ms;
+    timer->armed = true;
+    placeTimer(wheel, timer);
+
+    return;
+}
+
+void cancelTimer(TIMERWHEEL *wheel, TIMERENTRY *timer) {
+    if (!timer->armed) {
+        return;
+    }
+
+    unlinkTimer(wheel, timer);
+    timer->armed = false;
+    wheel->armed--;
+
+    return;
+}
+
+/* Earliest time runTimers() has work to do, a timer expiring or a slot to cascade, TIMER_NEVER if nothing is armed
+  * Lower levels only hold times before the next slot of the level above, so the first occupied slot found wins
+*/
+uint64_t nextTimerTick(const TIMERWHEEL *wheel) {
+    uint64_t now = wheel->now_ms;
+
+    if (wheel->occupied[0] & ((uint64_t) 1 << slotIndex(now, 0))) {
+        return now;
+    }
+
+    for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint8_t current = slotIndex(now, level);
+        uint64_t ahead = wheel->occupied[level] & ~(((uint64_t) 2 << current) - 1); // Slots after current
+
+        if (ahead != 0) {
+            uint64_t base = now & ~(((uint64_t) 1 << (TIMER_WHEEL_BITS * (level + 1))) - 1);
+            return base | ((uint64_t) __builtin_ctzll(ahead) << (TIMER_WHEEL_BITS * level));
+        }
+    }
+
+    if (wheel->overflow != NULL) {
+        return (now | (((uint64_t) 1 << TIMER_WHEEL_SPAN_BITS) - 1)) + 1; // Start of the next span
+    }
+
+    return TIMER_NEVER;
+}
+
+/* Fires everything due by now_ms in deadline order (timers sharing a millisecond in any order), returns how many fired
+  * Callbacks may arm and cancel timers, but one that keeps re-arming itself at or before now never lets this return
+*/
+uint32_t runTimers(TIMERWHEEL *wheel, uint64_t now_ms) {
+    uint32_t fired = 0;
+
+    for(;;) {
+        uint8_t slot = slotIndex(wheel->now_ms, 0);
+
+        while (wheel->slots[0][slot] != NULL) {
+            TIMERENTRY *timer = wheel->slots[0][slot];
+            unlinkTimer(wheel, timer);
+
+            if (timer->period_ms > 0) {
+                // Falling behind skips the missed expiries rather than firing them all at once
+                uint64_t next = timer->deadline_ms + timer->period_ms;
+                timer->deadline_ms = next > now_ms ? next : now_ms + timer->period_ms;
+                placeTimer(wheel, timer);
+            } else {
+                timer->armed = false;
+                wheel->armed--;
+            }
+
+            timer->callback(timer);
+            fired++;
+        }
+
+        uint64_t next = nextTimerTick(wheel);
+        if (next > now_ms) {
+            break;
+        }
+        wheel->now_ms = next;
+        cascadeTimers(wheel);
+    }
+
+    if (now_ms > wheel->now_ms) {
+        wheel->now_ms = now_ms;
+    }
+
+    return fired;
+}
@@ -0,0 +1,586 @@
+#include "webServer.hpp"
+#include "metrics.hpp"
+#include "taskTable.hpp"
+#include <lwip/sockets.h>
+#include <stdarg.h>
+
+static WEBCONNECTION connections[WEB_MAX_CONNECTIONS];
+static int listenFd = -1;
+static const WEBROUTE *routeTable;
+static size_t routeCount;
+static WEBEVENTSOURCE eventSource = NULL;
+static WEBEVENTSOURCE catchUpSource = NULL; // Full current state, for viewers that missed a change
+static uint32_t eventIntervalMs = 1000;
+static uint32_t lastEventMs = 0;
+static char eventBuf[WEB_EVENT_BUF_LEN];
+
+static bool openListenSocket(uint16_t port) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    listenFd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listenFd < 0) {
+        return false;
+    }
+
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listenFd, WEB_MAX_CONNECTIONS) < 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+    return true;
+}
+
+static void closeConnection(WEBCONNECTION *conn) {
+    close(conn->fd);
+    conn->fd = -1;
+    conn->state = conn_free;
+
+    return;
+}
+
+static void acceptConnection() {
+    int fd = accept(listenFd, NULL, NULL);
+    int one = 1;
+
+    if (fd < 0) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+        WEBCONNECTION *conn = &connections[i];
+
+        if (conn->state == conn_free) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Responses go out in one write, don't hold them back
+            conn->fd = fd;
+            conn->state = conn_reading;
+            conn->request_len = 0;
+            resetHttpParser(&conn->parser);
+            conn->response_len = 0;
+            conn->static_len = 0;
+            conn->response_sent = 0;
+            conn->keep_alive = false;
+            conn->event_stream = false;
+            conn->event_owed = false;
+            conn->last_activity_ms = millis();
+            return;
+        }
+    }
+
+    // Every slot is busy
+    close(fd);
+
+    return;
+}
+
+static const char *statusText(uint16_t status) {
+    switch (status) {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 406: return "Not Acceptable";
+        case 414: return "URI Too Long";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Error";
+    }
+}
+
+// Formats into a dynamic response body, silently truncating once the buffer is full
+void appendResponse(WEBRESPONSE *response, const char *format, ...) {
+    va_list args;
+
+    if (response->body_len + 1 >= response->body_cap) {
+        return;
+    }
+
+    va_start(args, format);
+    int written = vsnprintf(response->body + response->body_len, response->body_cap - response->body_len, format, args);
+    va_end(args);
+
+    if (written > 0) {
+        response->body_len += written;
+        if (response->body_len >= response->body_cap) {
+            response->body_len = response->body_cap - 1;
+        }
+    }
+
+    return;
+}
+
+// The body already sits at WEB_HEADER_RESERVE, headers are written immediately in front of it
+static void queueResponse(WEBCONNECTION *conn, const WEBRESPONSE *response) {
+    char headers[WEB_HEADER_RESERVE];
+    size_t bodyLen = response->static_body != NULL ? response->static_len : response->body_len;
+    int headersLen;
+
+    conn->event_stream = response->event_stream && response->static_body == NULL;
+    if (conn->event_stream) {
+        // No length, the body carries on for as long as the connection does
+        headersLen = snprintf(headers, sizeof(headers), "HTTP/1.1 %u %s\r\nContent-Type: %s\r\n%sConnection: keep-alive\r\n\r\n",
+            response->status, statusText(response->status), response->content_type,
+            response->extra_headers != NULL ? response->extra_headers : "");
+    } else {
+        headersLen = snprintf(headers, sizeof(headers),
+            "HTTP/1.1 %u %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n%sConnection: %s\r\n\r\n",
+            response->status, statusText(response->status), response->content_type, (unsigned) bodyLen,
+            response->extra_headers != NULL ? response->extra_headers : "", conn->keep_alive ? "keep-alive" : "close");
+    }
+
+    if (headersLen < 0 || headersLen >= (int) sizeof(headers)) {
+        headersLen = 0; // Can only happen with an oversized extra_headers, send nothing rather than garbage
+        conn->keep_alive = false;
+    }
+
+    conn->response_start = WEB_HEADER_RESERVE - headersLen;
+    memcpy(conn->response + conn->response_start, headers, headersLen);
+    conn->response_len = headersLen + (response->static_body != NULL ? 0 : response->body_len);
+    conn->static_body = response->static_body;
+    conn->static_len = response->static_body != NULL ? response->static_len : 0;
+    conn->response_sent = 0;
+    conn->state = conn_writing;
+
+    return;
+}
+
+static void initResponse(WEBCONNECTION *conn, WEBRESPONSE *response) {
+    response->status = 200;
+    response->content_type = "text/html";
+    response->extra_headers = NULL;
+    response->body = conn->response + WEB_HEADER_RESERVE;
+    response->body_cap = WEB_RESPONSE_BUF_LEN - WEB_HEADER_RESERVE;
+    response->body_len = 0;
+    response->static_body = NULL;
+    response->static_len = 0;
+    response->event_stream = false;
+
+    return;
+}
+
+static uint8_t countStreams() {
+    uint8_t streams = 0;
+
+    for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+        if (connections[i].state == conn_streaming || (connections[i].state == conn_writing && connections[i].event_stream)) {
+            streams++;
+        }
+    }
+
+    return streams;
+}
+
+static void errorResponse(WEBCONNECTION *conn, WEBRESPONSE *response, uint16_t status) {
+    initResponse(conn, response);
+    response->status = status;
+    response->content_type = "text/plain";
+    appendResponse(response, "%s", statusText(status));
+
+    return;
+}
+
+// Exact path match, the hash comparison rules out all but (at most) one route per method
+static void dispatchRoute(WEBCONNECTION *conn, const HTTPREQUEST *request, WEBRESPONSE *response) {
+    uint32_t hash = hashRequestPath(request);
+    bool pathKnown = false;
+
+    for (size_t i = 0; i < routeCount; i++) {
+        const WEBROUTE *route = &routeTable[i];
+
+        if (route->path_hash != hash || route->path_len != request->path_len || memcmp(route->path, request->path, request->path_len) != 0) {
+            continue;
+        }
+        if (route->method != request->method) {
+            pathKnown = true;
+            continue;
+        }
+
+        if (route->param != NULL && !getQueryParam(request, route->param, NULL, 0)) {
+            errorResponse(conn, response, 400);
+            return;
+        }
+        route->handler(request, response);
+        return;
+    }
+
+    errorResponse(conn, response, pathKnown ? 405 : 404);
+
+    return;
+}
+
+// Hands a complete request head to its route and queues the response
+// Any bytes after the head (a pipelined request) are kept for once the response is written
+static void processRequest(WEBCONNECTION *conn, const HTTPREQUEST *request) {
+    WEBRESPONSE response;
+    uint16_t requestEnd = conn->parser.pos;
+    uint32_t started = micros();
+
+    initResponse(conn, &response);
+
+    conn->keep_alive = request->keep_alive;
+    dispatchRoute(conn, request, &response);
+    if (response.event_stream && (eventSource == NULL || countStreams() >= WEB_MAX_STREAMS)) {
+        errorResponse(conn, &response, 503);
+    }
+    recordHttpHandling(micros() - started);
+
+    memmove(conn->request, conn->request + requestEnd, conn->request_len - requestEnd);
+    conn->request_len -= requestEnd;
+    resetHttpParser(&conn->parser);
+
+    queueResponse(conn, &response);
+
+    return;
+}
+
+// Answers a request that can't be handled and closes once that is written, what follows it can't be trusted
+static void rejectRequest(WEBCONNECTION *conn, uint16_t status) {
+    WEBRESPONSE response;
+
+    errorResponse(conn, &response, status);
+    recordHttpRejected(status);
+    conn->keep_alive = false;
+    conn->request_len = 0;
+    queueResponse(conn, &response);
+
+    return;
+}
+
+// Parses whatever has arrived of the next request, and handles or rejects it once that's known
+static void serviceRequest(WEBCONNECTION *conn) {
+    HTTPREQUEST request;
+    uint32_t started = micros();
+    HTTPPARSESTATUS status = parseHttpRequest(&conn->parser, conn->request, conn->request_len, &request);
+
+    recordHttpParse(micros() - started, status == http_parse_done);
+
+    if (status == http_parse_done) {
+        processRequest(conn, &request);
+    } else if (status == http_parse_error) {
+        rejectRequest(conn, conn->parser.error);
+    } else if (conn->request_len == WEB_REQUEST_BUF_LEN) {
+        rejectRequest(conn, 431); // Head doesn't fit the buffer, reject rather than grow
+    }
+
+    return;
+}
+
+static void readConnection(WEBCONNECTION *conn) {
+    int received = recv(conn->fd, conn->request + conn->request_len, WEB_REQUEST_BUF_LEN - conn->request_len, 0);
+
+    if (received < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        return;
+    } else if (received <= 0) {
+        closeConnection(conn); // Client went away
+        return;
+    }
+
+    conn->request_len += received;
+    conn->last_activity_ms = millis();
+
+    serviceRequest(conn);
+
+    return;
+}
+
+static void writeConnection(WEBCONNECTION *conn) {
+    int sent;
+
+    if (conn->response_sent < conn->response_len) {
+        // Headers (and dynamic body), MSG_MORE holds them back so a static body follows in the same segments
+        sent = send(conn->fd, conn->response + conn->response_start + conn->response_sent,
+            conn->response_len - conn->response_sent, conn->static_len > 0 ? MSG_MORE : 0);
+    } else {
+        uint32_t staticSent = conn->response_sent - conn->response_len;
+        sent = send(conn->fd, conn->static_body + staticSent, conn->static_len - staticSent, 0);
+    }
+
+    if (sent < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        return;
+    } else if (sent < 0) {
+        closeConnection(conn);
+        return;
+    }
+
+    conn->response_sent += sent;
+    conn->last_activity_ms = millis();
+
+    if (conn->response_sent < conn->response_len + conn->static_len) {
+        return; // Rest goes out when the socket is writable again
+    }
+
+    if (conn->event_stream) {
+        // From here on response only holds whatever part of an event the socket didn't take
+        conn->state = conn_streaming;
+        conn->response_start = 0;
+        conn->response_len = 0;
+        conn->response_sent = 0;
+        return;
+    }
+
+    if (!conn->keep_alive) {
+        closeConnection(conn);
+        return;
+    }
+
+    conn->state = conn_reading;
+
+    // Client may have pipelined its next request behind the last one
+    if (conn->request_len > 0) {
+        serviceRequest(conn);
+    }
+
+    return;
+}
+
+// Anything a viewer sends on an event stream is ignored, reading just notices when it goes away
+static void drainStream(WEBCONNECTION *conn) {
+    char discard[64];
+    int received = recv(conn->fd, discard, sizeof(discard), 0);
+
+    if (received == 0 || (received < 0 && errno != EWOULDBLOCK && errno != EAGAIN)) {
+        closeConnection(conn);
+    }
+
+    return;
+}
+
+// Sends what's left of the last event once the socket has room again
+static void flushStream(WEBCONNECTION *conn) {
+    int sent = send(conn->fd, conn->response + conn->response_sent, conn->response_len - conn->response_sent, 0);
+
+    if (sent < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        return;
+    } else if (sent < 0) {
+        closeConnection(conn);
+        return;
+    }
+
+    conn->response_sent += sent;
+    conn->last_activity_ms = millis();
+    if (conn->response_sent == conn->response_len) {
+        conn->response_len = 0;
+        conn->response_sent = 0;
+    }
+
+    return;
+}
+
+// Returns false if the viewer is still behind with the last event and this one wasn't sent
+static bool pushEvent(WEBCONNECTION *conn, const char *data, size_t len) {
+    if (conn->response_len > 0) {
+        return false;
+    }
+
+    int sent = send(conn->fd, data, len, 0);
+    if (sent < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        sent = 0;
+    } else if (sent < 0) {
+        closeConnection(conn);
+        return false;
+    }
+
+    // Keep the rest so the stream never ends up with half an event
+    if ((size_t) sent < len) {
+        memcpy(conn->response, data + sent, len - sent);
+        conn->response_len = len - sent;
+        conn->response_sent = 0;
+    }
+    conn->last_activity_ms = millis();
+
+    return true;
+}
+
+/* One render, then the same bytes to every viewer
+  * Events only carry what changed since the last one, so a viewer that misses one is owed the full current state.
+  * It skips changes until its socket has drained, then gets a catch-up event on the next tick instead
+*/
+static void pushEvents() {
+    WEBRESPONSE event;
+    uint8_t delivered = 0;
+    uint8_t skipped = 0;
+    bool catchUp = false;
+    uint32_t started = micros();
+
+    event.body = eventBuf;
+    event.body_cap = sizeof(eventBuf);
+    event.body_len = 0;
+    eventSource(&event);
+    lastEventMs = millis();
+
+    uint32_t rendered = micros();
+    for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+        WEBCONNECTION *conn = &connections[i];
+
+        if (conn->state != conn_streaming) {
+            continue;
+        }
+
+        if (conn->event_owed) {
+            catchUp = catchUp || conn->response_len == 0;
+        } else if (event.body_len > 0) {
+            if (pushEvent(conn, eventBuf, event.body_len)) {
+                delivered++;
+            } else {
+                skipped++;
+                conn->event_owed = catchUpSource != NULL;
+            }
+        } else if ((int32_t) (lastEventMs - conn->last_activity_ms) > WEB_STREAM_KEEPALIVE_MS) {
+            pushEvent(conn, ":\n\n", 3);
+        }
+    }
+
+    if (event.body_len > 0) {
+        recordEventFanout(rendered - started, micros() - rendered, delivered, skipped);
+    }
+
+    if (!catchUp) {
+        return;
+    }
+
+    // The change has gone out to everyone else, so the buffer is free for the catch-up
+    event.body_len = 0;
+    catchUpSource(&event);
+    for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+        WEBCONNECTION *conn = &connections[i];
+
+        if (conn->state == conn_streaming && conn->event_owed && pushEvent(conn, eventBuf, event.body_len)) {
+            conn->event_owed = false;
+        }
+    }
+
+    return;
+}
+
+// Event streams are polled every intervalMs while anyone is watching, can be changed from the request handler
+// catchUp renders everything a viewer needs, for one that fell behind and missed a change (NULL if events aren't deltas)
+void setWebEventSource(WEBEVENTSOURCE source, WEBEVENTSOURCE catchUp, uint32_t intervalMs) {
+    eventSource = source;
+    catchUpSource = catchUp;
+    eventIntervalMs = intervalMs;
+
+    return;
+}
+
+/* Runs forever in the web server task
+  * Sleeps in select() until a socket is ready, so requests are picked up as soon as they arrive
+  * Each connection is a small state machine: reading the request head, then writing the response
+  * An event stream response leaves its connection streaming, fed from the event source between selects
+*/
+void runWebServer(const WEBROUTE *routes, size_t count) {
+    routeTable = routes;
+    routeCount = count;
+
+    // A restarted server task finds the sockets of the one it replaced still open
+    for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+        if (connections[i].state != conn_free) {
+            closeConnection(&connections[i]);
+        }
+        connections[i].fd = -1;
+    }
+    if (listenFd >= 0) {
+        close(listenFd);
+        listenFd = -1;
+    }
+
+    while (!openListenSocket(WEB_SERVER_PORT)) {
+        taskCheckIn(task_web);
+        delay(WEB_SELECT_TIMEOUT_MS);
+    }
+
+    for (;;) {
+        fd_set readFds;
+        fd_set writeFds;
+        int maxFd = listenFd;
+        uint32_t waitMs = WEB_SELECT_TIMEOUT_MS;
+
+        taskCheckIn(task_web);
+        // With viewers connected, wake up in time for the next event
+        if (countStreams() > 0) {
+            uint32_t elapsed = millis() - lastEventMs;
+            uint32_t untilEvent = elapsed >= eventIntervalMs ? 0 : eventIntervalMs - elapsed;
+            if (untilEvent < waitMs) {
+                waitMs = untilEvent;
+            }
+        }
+        struct timeval timeout = { (long) (waitMs / 1000), (long) ((waitMs % 1000) * 1000) };
+
+        FD_ZERO(&readFds);
+        FD_ZERO(&writeFds);
+        FD_SET(listenFd, &readFds);
+
+        for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+            WEBCONNECTION *conn = &connections[i];
+
+            if (conn->state == conn_reading) {
+                FD_SET(conn->fd, &readFds);
+            } else if (conn->state == conn_writing) {
+                FD_SET(conn->fd, &writeFds);
+            } else if (conn->state == conn_streaming) {
+                FD_SET(conn->fd, &readFds);
+                if (conn->response_len > 0) {
+                    FD_SET(conn->fd, &writeFds);
+                }
+            } else {
+                continue;
+            }
+
+            if (conn->fd > maxFd) {
+                maxFd = conn->fd;
+            }
+        }
+
+        if (select(maxFd + 1, &readFds, &writeFds, NULL, &timeout) > 0) {
+            if (FD_ISSET(listenFd, &readFds)) {
+                acceptConnection();
+            }
+
+            for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+                WEBCONNECTION *conn = &connections[i];
+
+                if (conn->state == conn_reading && FD_ISSET(conn->fd, &readFds)) {
+                    readConnection(conn);
+                } else if (conn->state == conn_writing && FD_ISSET(conn->fd, &writeFds)) {
+                    writeConnection(conn);
+                } else if (conn->state == conn_streaming && FD_ISSET(conn->fd, &readFds)) {
+                    drainStream(conn);
+                }
+
+                if (conn->state == conn_streaming && conn->response_len > 0 && FD_ISSET(conn->fd, &writeFds)) {
+                    flushStream(conn);
+                }
+            }
+        }
+
+        if (eventSource != NULL && millis() - lastEventMs >= eventIntervalMs && countStreams() > 0) {
+            pushEvents();
+        }
+
+        // Drop idle keep-alive connections, and viewers that have stopped taking events, so they don't hold a slot forever
+        for (uint8_t i = 0; i < WEB_MAX_CONNECTIONS; i++) {
+            WEBCONNECTION *conn = &connections[i];
+            uint32_t idle = millis() - conn->last_activity_ms;
+
+            if (conn->state == conn_streaming) {
+                if (conn->response_len > 0 && idle > WEB_STREAM_KEEPALIVE_MS) {
+                    closeConnection(conn);
+                }
+            } else if (conn->state != conn_free && idle > WEB_IDLE_TIMEOUT_MS) {
+                closeConnection(conn);
+            }
+        }
+    }
+}
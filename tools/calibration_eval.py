@@ -0,0 +1,38 @@
+# Replays traces through the simulator with the global threshold and with learnt per-beacon thresholds and compares them
+# Traces need "<ms> at-door <name>" lines marking when the dog wanted through, see sim/src/simMain.cpp
+# usage: python tools/calibration_eval.py <trace>... [--sim .pio/build/native/program] [--scan adaptive|fixed]
+
+import argparse
+import re
+import subprocess
+
+SCORE_RE = re.compile(r"at door (\d+): waited mean (\d+)ms, p95 (\d+)ms, not opened by the beacon (\d+) \(owner opened \d+\), opens with no dog (\d+)")
+BEACON_RE = re.compile(r"beacon (\S+): threshold (-?\d+)")
+
+
+def run(sim, trace, scan, calibrate):
+    result = subprocess.run([sim, trace, "--scan", scan, "--calibrate", calibrate], capture_output=True, text=True, check=True)
+    score = SCORE_RE.search(result.stderr)
+    if score is None:
+        raise SystemExit("%s has no at-door lines to score against" % trace)
+    thresholds = " ".join("%s %s" % match for match in BEACON_RE.findall(result.stderr))
+    return [int(value) for value in score.groups()], thresholds
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("traces", nargs="+")
+    parser.add_argument("--sim", default=".pio/build/native/program")
+    parser.add_argument("--scan", default="adaptive")
+    args = parser.parse_args()
+
+    print("%-24s %-7s %8s %8s %8s %8s %10s  %s" % ("trace", "mode", "at door", "wait", "p95", "missed", "no dog", "thresholds"))
+    for trace in args.traces:
+        for calibrate in ("off", "on"):
+            (visits, wait, p95, missed, false_opens), thresholds = run(args.sim, trace, args.scan, calibrate)
+            print("%-24s %-7s %8d %6dms %6dms %8d %10d  %s" % (trace[-24:], "learnt" if calibrate == "on" else "global",
+                visits, wait, p95, missed, false_opens, thresholds))
+
+
+if __name__ == "__main__":
+    main()
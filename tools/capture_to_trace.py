@@ -0,0 +1,95 @@
+# Turns an RSSI capture into a simulator trace, so thresholds and filters can be tuned offline against real adverts
+# Downloads the capture from the device (or the simulator's --serve) a chunk at a time, or reads a saved one, and
+# writes a "beacon" line per beacon seen followed by an "advert" line per record, see sim/src/simMain.cpp
+# usage: python tools/capture_to_trace.py <host[:port]> [-o out.trace] [--save capture.bin]
+#        python tools/capture_to_trace.py --file capture.bin --names 0=Rex,1=Bella [-o out.trace]
+
+import argparse
+import json
+import struct
+import sys
+import urllib.request
+
+# CAPTURERECORD in include/rssiCapture.hpp
+RECORD = struct.Struct("<I6sBBbBBB")
+FLAG_NAME = 0x01
+ERASED_INDEX = 0xFF
+
+
+def download(base):
+    data = b""
+    start = 0
+    while True:
+        with urllib.request.urlopen("%s/api/capture?from=%d" % (base, start), timeout=10) as response:
+            chunk = response.read()
+            start = int(response.headers["X-Capture-Next"])
+        if not chunk:
+            return data
+        data += chunk
+
+
+def beacon_names(base):
+    with urllib.request.urlopen(base + "/api/status", timeout=10) as response:
+        status = json.load(response)
+    return dict((beacon["id"], beacon["name"]) for beacon in status.get("beacons", []))
+
+
+def parse_names(text):
+    names = {}
+    for entry in text.split(","):
+        index, _, name = entry.partition("=")
+        names[int(index)] = name
+    return names
+
+
+def records(data):
+    for offset in range(0, len(data) - len(data) % RECORD.size, RECORD.size):
+        offset_ms, mac, mac_type, index, rssi, channel, flags, _ = RECORD.unpack_from(data, offset)
+        if index == ERASED_INDEX:
+            return
+        yield offset_ms, mac, index, rssi, flags
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("host", nargs="?")
+    parser.add_argument("--file", help="a capture saved earlier with --save, instead of downloading")
+    parser.add_argument("--save", help="also write the raw capture here")
+    parser.add_argument("--names", help="beacon names by registry id, 0=Rex,1=Bella (taken from the device when downloading)")
+    parser.add_argument("-o", "--output")
+    args = parser.parse_args()
+
+    if (args.host is None) == (args.file is None):
+        parser.error("give a host or --file")
+
+    names = parse_names(args.names) if args.names else {}
+    if args.host:
+        base = "http://" + args.host
+        data = download(base)
+        if not args.names:
+            names = beacon_names(base)
+    else:
+        with open(args.file, "rb") as capture:
+            data = capture.read()
+    if args.save:
+        with open(args.save, "wb") as capture:
+            capture.write(data)
+
+    adverts = list(records(data))
+    missing = sorted(set(index for _, _, index, _, _ in adverts if index not in names))
+    if missing:
+        raise SystemExit("no name for beacon ids %s, pass --names" % ", ".join(str(index) for index in missing))
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    out.write("# RSSI capture, %d adverts over %.1fs\n" % (len(adverts), adverts[-1][0] / 1000.0 if adverts else 0))
+    for index in sorted(set(index for _, _, index, _, _ in adverts)):
+        out.write("0 beacon %s\n" % names[index])
+    for offset_ms, mac, index, rssi, flags in adverts:
+        out.write("%d advert %s %s %d\n" % (offset_ms, ":".join("%02X" % byte for byte in mac), names[index] if flags & FLAG_NAME else "-", rssi))
+    if out is not sys.stdout:
+        out.close()
+    print("%d adverts from %d beacons" % (len(adverts), len(set(index for _, _, index, _, _ in adverts))), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
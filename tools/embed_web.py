@@ -0,0 +1,51 @@
+# Gzips web/index.html into include/webPage.h so the control page is served straight from flash
+# Runs before every PlatformIO build (extra_scripts = pre:tools/embed_web.py), or standalone with python
+
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")
+    PROJECT_DIR = env["PROJECT_DIR"]
+except NameError:
+    PROJECT_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+SOURCE = os.path.join(PROJECT_DIR, "web", "index.html")
+OUTPUT = os.path.join(PROJECT_DIR, "include", "webPage.h")
+
+
+def embed():
+    with open(SOURCE, "rb") as f:
+        html = f.read()
+
+    # mtime=0 keeps the output (and so the ETag) identical between builds of the same page
+    compressed = gzip.compress(html, compresslevel=9, mtime=0)
+    etag = hashlib.sha1(compressed).hexdigest()[:16]
+
+    lines = [
+        "// Generated by tools/embed_web.py from web/index.html - do not edit",
+        "#pragma once",
+        "#include <Arduino.h>",
+        "",
+        "#define WEB_PAGE_ETAG \"\\\"%s\\\"\"" % etag,
+        "",
+        "const size_t WEB_PAGE_GZ_LEN = %d;" % len(compressed),
+        "const uint8_t WEB_PAGE_GZ[] PROGMEM = {",
+    ]
+    for i in range(0, len(compressed), 16):
+        lines.append("  " + ", ".join("0x%02x" % b for b in compressed[i:i + 16]) + ",")
+    lines.append("};")
+    content = "\n".join(lines) + "\n"
+
+    # Only touch the header when the page changed so it doesn't force a rebuild
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT) as f:
+            if f.read() == content:
+                return
+
+    with open(OUTPUT, "w") as f:
+        f.write(content)
+
+
+embed()
@@ -0,0 +1,195 @@
+# Throws malformed, oversized, trickled and pipelined requests at the web server, checks each gets the status it
+# should (or a close) and that the server keeps answering, then times keep-alive requests and reads the device's
+# own parse cost from /metrics. Works against the device or the simulator's --serve
+# usage: python tools/http_fuzz.py <host[:port]> [--mutations 500] [--requests 2000] [--seed 1]
+
+import argparse
+import random
+import re
+import select
+import socket
+import time
+
+VALID = b"GET /api/status HTTP/1.1\r\nHost: door\r\n\r\n"
+
+# Request, status it must get back
+CASES = [
+    ("valid", VALID, 200),
+    ("http/1.0", b"GET /api/status HTTP/1.0\r\n\r\n", 200),
+    ("bare lf", b"GET /api/status HTTP/1.1\nHost: door\n\n", 200),
+    ("leading blank line", b"\r\n" + VALID, 200),
+    ("unknown path", b"GET /nope HTTP/1.1\r\n\r\n", 404),
+    ("wrong method", b"POST /api/status HTTP/1.1\r\nContent-Length: 0\r\n\r\n", 405),
+    ("garbage", b"GARBAGE\r\n\r\n", 400),
+    ("lower case method", b"get /api/status HTTP/1.1\r\n\r\n", 400),
+    ("absolute url", b"GET http://door/api/status HTTP/1.1\r\n\r\n", 400),
+    ("no version", b"GET /api/status\r\n\r\n", 400),
+    ("http/2", b"GET /api/status HTTP/2.0\r\n\r\n", 505),
+    ("http/1.2", b"GET /api/status HTTP/1.2\r\n\r\n", 505),
+    ("nul", b"GET /api/status\x00 HTTP/1.1\r\n\r\n", 400),
+    ("stray cr", b"GET /api/status HTTP/1.1\r\nHost: do\ror\r\n\r\n", 400),
+    ("header without colon", b"GET /api/status HTTP/1.1\r\nHost door\r\n\r\n", 400),
+    ("space before colon", b"GET /api/status HTTP/1.1\r\nHost : door\r\n\r\n", 400),
+    ("long target", b"GET /" + b"a" * 400 + b" HTTP/1.1\r\n\r\n", 414),
+    ("long header", b"GET /api/status HTTP/1.1\r\nX-Long: " + b"a" * 600 + b"\r\n\r\n", 431),
+    ("too many headers", b"GET /api/status HTTP/1.1\r\n" + b"X-A: b\r\n" * 40 + b"\r\n", 431),
+    ("head too large", b"GET /api/status HTTP/1.1\r\n" + (b"X-Pad: " + b"a" * 200 + b"\r\n") * 6 + b"\r\n", 431),
+]
+
+STATUS_RE = re.compile(rb"^HTTP/1\.1 (\d{3}) ")
+LENGTH_RE = re.compile(rb"\r\ncontent-length: *(\d+)", re.I)
+
+
+def read_response(sock, buffered=b""):
+    """Returns (status, rest of the buffer), status None if the server closed without answering"""
+    while b"\r\n\r\n" not in buffered:
+        data = sock.recv(4096)
+        if not data:
+            return None, b""
+        buffered += data
+    head, rest = buffered.split(b"\r\n\r\n", 1)
+    match = STATUS_RE.match(head)
+    if match is None:
+        raise ValueError("bad status line %r" % head[:40])
+    length = LENGTH_RE.search(head)
+    length = int(length.group(1)) if length else 0
+    while len(rest) < length:
+        data = sock.recv(4096)
+        if not data:
+            break
+        rest += data
+    return int(match.group(1)), rest[length:]
+
+
+def send_case(host, port, request, trickle=False):
+    """Trickled requests go a byte at a time and stop as soon as an answer arrives, as a rejection can come early"""
+    sock = socket.create_connection((host, port), timeout=5)
+    try:
+        if trickle:
+            for i in range(len(request)):
+                if select.select([sock], [], [], 0)[0]:
+                    break
+                sock.sendall(request[i:i + 1])
+                time.sleep(0.001)
+        else:
+            sock.sendall(request)
+        return read_response(sock)[0]
+    except (ConnectionResetError, BrokenPipeError):
+        return None # Rejected and closed while we were still sending
+    finally:
+        sock.close()
+
+
+def alive(host, port):
+    return send_case(host, port, VALID) == 200
+
+
+def mutate(rng, request):
+    data = bytearray(request)
+    for _ in range(rng.randint(1, 8)):
+        choice = rng.random()
+        pos = rng.randrange(len(data) + 1)
+        if choice < 0.4 and data:
+            data[min(pos, len(data) - 1)] = rng.randrange(256)
+        elif choice < 0.7:
+            data[pos:pos] = bytes(rng.randrange(256) for _ in range(rng.randint(1, 16)))
+        elif choice < 0.9 and data:
+            del data[pos:pos + rng.randint(1, 8)]
+        else:
+            data[pos:pos] = data[pos:pos + rng.randint(1, 400)] # Repeats push lines over their limits
+    return bytes(data)
+
+
+def scrape(host, port):
+    sock = socket.create_connection((host, port), timeout=5)
+    sock.sendall(b"GET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n")
+    data = b""
+    while True:
+        chunk = sock.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    sock.close()
+    values = {}
+    for line in data.split(b"\r\n\r\n", 1)[1].decode().splitlines():
+        if line.startswith("door_http_"):
+            name, value = line.rsplit(" ", 1)
+            values[name] = float(value)
+    return values
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("host")
+    parser.add_argument("--mutations", type=int, default=500)
+    parser.add_argument("--requests", type=int, default=2000)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    host, _, port = args.host.partition(":")
+    port = int(port or 80)
+    rng = random.Random(args.seed)
+    failed = 0
+    before = scrape(host, port)
+
+    for name, request, expected in CASES:
+        for trickle in (False, True):
+            status = send_case(host, port, request, trickle)
+            if status != expected:
+                print("FAIL %s%s: got %s, expected %d" % (name, " (trickled)" if trickle else "", status, expected))
+                failed += 1
+
+    # Three requests in one send, all answered in order on the one connection
+    sock = socket.create_connection((host, port), timeout=5)
+    sock.sendall(VALID + b"GET /nope HTTP/1.1\r\n\r\n" + VALID)
+    statuses = []
+    rest = b""
+    for _ in range(3):
+        status, rest = read_response(sock, rest)
+        statuses.append(status)
+    sock.close()
+    if statuses != [200, 404, 200]:
+        print("FAIL pipelined: got %s" % statuses)
+        failed += 1
+
+    # Mutated requests can get any answer, or none, but mustn't hang or take the server down
+    answered = {}
+    for i in range(args.mutations):
+        try:
+            status = send_case(host, port, mutate(rng, VALID))
+        except socket.timeout:
+            status = "incomplete" # Still waiting for the rest of the head
+        answered[status] = answered.get(status, 0) + 1
+        if status is not None and status != "incomplete" and not 200 <= status < 600:
+            print("FAIL mutation %d: status %s" % (i, status))
+            failed += 1
+        if not alive(host, port):
+            print("FAIL server stopped answering after mutation %d" % i)
+            raise SystemExit(1)
+    print("%d cases, %d mutations: %s" % (len(CASES) * 2 + 1, args.mutations,
+        ", ".join("%s %d" % (status, count) for status, count in sorted(answered.items(), key=lambda item: str(item[0])))))
+
+    # Keep-alive throughput, one request in flight at a time as a browser would
+    sock = socket.create_connection((host, port), timeout=5)
+    rest = b""
+    started = time.monotonic()
+    for _ in range(args.requests):
+        sock.sendall(VALID)
+        status, rest = read_response(sock, rest)
+    elapsed = time.monotonic() - started
+    sock.close()
+    after = scrape(host, port)
+
+    delta = dict((name, after.get(name, 0) - before.get(name, 0)) for name in after)
+    parsed = delta.get("door_http_parsed_total", 0)
+    print("keep-alive: %d requests in %.2fs, %.0f per second" % (args.requests, elapsed, args.requests / elapsed))
+    if parsed > 0:
+        print("device: %d heads parsed, %.1fus parsing per head" % (parsed, delta["door_http_parse_us_total"] / parsed))
+    print("device: rejected " + ", ".join("%s %d" % (re.search(r'"(.*)"', name).group(1), value)
+        for name, value in sorted(delta.items()) if name.startswith("door_http_rejected_total")))
+
+    raise SystemExit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,128 @@
+# Measures push event delivery: connects several viewers to /api/events, changes the threshold and times how long
+# each viewer takes to see it, then reads the device's own render and send cost from /metrics
+# usage: python tools/live_latency.py <host[:port]> [--viewers 3] [--changes 20]
+
+import argparse
+import random
+import re
+import socket
+import threading
+import time
+import urllib.request
+
+THRESHOLD_RE = re.compile(rb'"threshold":(-?\d+)')
+
+
+class Viewer(threading.Thread):
+    def __init__(self, host, port):
+        threading.Thread.__init__(self, daemon=True)
+        self.sock = socket.create_connection((host, port), timeout=30)
+        self.sock.sendall(b"GET /api/events HTTP/1.1\r\nHost: door\r\nAccept: text/event-stream\r\n\r\n")
+        self.seen = {} # threshold -> first time a state event carried it
+        self.events = 0
+        self.lock = threading.Lock()
+
+    def run(self):
+        buffered = b""
+        while True:
+            try:
+                data = self.sock.recv(4096)
+            except OSError:
+                return
+            if not data:
+                return
+            now = time.monotonic()
+            buffered += data
+            while b"\n\n" in buffered:
+                event, buffered = buffered.split(b"\n\n", 1)
+                with self.lock:
+                    self.events += 1
+                    if b"event: state" in event:
+                        match = THRESHOLD_RE.search(event)
+                        if match:
+                            self.seen.setdefault(int(match.group(1)), now)
+
+    def wait_for(self, threshold, timeout):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            with self.lock:
+                if threshold in self.seen:
+                    return self.seen[threshold]
+            time.sleep(0.001)
+        return None
+
+
+def fetch(base, path):
+    with urllib.request.urlopen(base + path, timeout=10) as response:
+        return response.read()
+
+
+def scrape(base):
+    values = {}
+    for line in fetch(base, "/metrics").decode().splitlines():
+        if line.startswith("door_live_") and not line.startswith("door_live_event_delay"):
+            name, value = line.split()
+            values[name] = float(value)
+    return values
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("host")
+    parser.add_argument("--viewers", type=int, default=3)
+    parser.add_argument("--changes", type=int, default=20)
+    args = parser.parse_args()
+
+    host, _, port = args.host.partition(":")
+    port = int(port or 80)
+    base = "http://%s:%d" % (host, port)
+
+    threshold = int(re.search(rb'"threshold":(-?\d+)', fetch(base, "/api/status")).group(1))
+    viewers = [Viewer(host, port) for _ in range(args.viewers)]
+    for viewer in viewers:
+        viewer.start()
+    time.sleep(1)
+    before = scrape(base)
+
+    # Alternate up and down so the threshold ends where it started, each value only needs to be seen once
+    delays = []
+    lost = 0
+    for i in range(args.changes):
+        for viewer in viewers:
+            with viewer.lock:
+                viewer.seen.clear()
+        step = "/rssi/inc" if i % 2 == 0 else "/rssi/dec"
+        threshold += 1 if i % 2 == 0 else -1
+        time.sleep(random.uniform(0, 0.5)) # Changes land anywhere in the push interval, as they would on the device
+        sent = time.monotonic()
+        fetch(base, step)
+        for viewer in viewers:
+            arrived = viewer.wait_for(threshold, 5)
+            if arrived is None:
+                lost += 1
+            else:
+                delays.append((arrived - sent) * 1000)
+
+    after = scrape(base)
+    for viewer in viewers:
+        viewer.sock.close()
+
+    delta = dict((name, after.get(name, 0) - before.get(name, 0)) for name in after)
+    print("viewers %d, changes %d, missed %d" % (args.viewers, args.changes, lost))
+    if delays:
+        print("delivery latency: mean %.0fms, p95 %.0fms, max %.0fms" % (sum(delays) / len(delays), percentile(delays, 0.95), max(delays)))
+    events = delta.get("door_live_events_total", 0)
+    deliveries = delta.get("door_live_deliveries_total", 0)
+    if events > 0:
+        print("device: %d events, render %.0fus per event" % (events, delta["door_live_render_us_total"] / events))
+    if deliveries > 0:
+        print("device: send %.0fus per viewer per event, %d skipped" % (delta["door_live_send_us_total"] / deliveries, delta.get("door_live_skipped_total", 0)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,392 @@
+# Benchmarks MQTT telemetry: command to state event latency, event throughput and batching, and what a broker outage
+# costs. Runs its own minimal QoS 0 broker and the simulator's --serve --mqtt against it, or uses a real broker and a
+# device already pointed at it (/mqtt/broker?host=), in which case the outage test is skipped
+# usage: python tools/mqtt_bench.py --sim .pio/build/native/program [--trace sim/traces/example.trace]
+#        python tools/mqtt_bench.py --broker <host[:port]> --http <device address>
+
+import argparse
+import json
+import random
+import socket
+import struct
+import subprocess
+import threading
+import time
+import urllib.request
+
+PREFIX = "dogdoor" # TELEMETRY_TOPIC_PREFIX in include/telemetry.hpp
+CONNECT, CONNACK, PUBLISH, SUBSCRIBE, SUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 8, 9, 12, 13, 14
+
+
+def encode_length(length):
+    out = b""
+    while True:
+        byte = length & 0x7F
+        length >>= 7
+        out += bytes([byte | (0x80 if length else 0)])
+        if not length:
+            return out
+
+
+def packet(first, body):
+    return bytes([first]) + encode_length(len(body)) + body
+
+
+def string(text):
+    data = text.encode() if isinstance(text, str) else text
+    return struct.pack(">H", len(data)) + data
+
+
+def publish_packet(topic, payload, retain=False):
+    return packet(0x30 | (1 if retain else 0), string(topic) + payload)
+
+
+def read_packet(sock):
+    first = sock.recv(1)
+    if not first:
+        return None, None
+    length, shift = 0, 0
+    while True:
+        byte = sock.recv(1)
+        if not byte:
+            return None, None
+        length |= (byte[0] & 0x7F) << shift
+        shift += 7
+        if not byte[0] & 0x80:
+            break
+    body = b""
+    while len(body) < length:
+        chunk = sock.recv(length - len(body))
+        if not chunk:
+            return None, None
+        body += chunk
+    return first[0], body
+
+
+def parse_publish(first, body):
+    topic_len = struct.unpack(">H", body[:2])[0]
+    start = 2 + topic_len + (2 if first & 0x06 else 0)
+    return body[2:2 + topic_len].decode(), body[start:]
+
+
+def topic_matches(pattern, topic):
+    parts, levels = pattern.split("/"), topic.split("/")
+    for i, part in enumerate(parts):
+        if part == "#":
+            return True
+        if i >= len(levels) or (part != "+" and part != levels[i]):
+            return False
+    return len(parts) == len(levels)
+
+
+class Session(threading.Thread):
+    """One client of the built-in broker"""
+
+    def __init__(self, broker, sock):
+        threading.Thread.__init__(self, daemon=True)
+        self.broker, self.sock = broker, sock
+        self.filters = []
+        self.will = None
+        self.client_id = ""
+        self.send_lock = threading.Lock()
+
+    def send(self, data):
+        with self.send_lock:
+            try:
+                self.sock.sendall(data)
+            except OSError:
+                pass
+
+    def drop(self):
+        try:
+            self.sock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+
+    def run(self):
+        clean = False
+        while True:
+            try:
+                first, body = read_packet(self.sock)
+            except OSError:
+                first = None
+            if first is None:
+                break
+            kind = first >> 4
+            if kind == CONNECT:
+                flags = body[7]
+                pos = 10
+                client_len = struct.unpack(">H", body[pos:pos + 2])[0]
+                self.client_id = body[pos + 2:pos + 2 + client_len].decode()
+                pos += 2 + client_len
+                if flags & 0x04:
+                    topic_len = struct.unpack(">H", body[pos:pos + 2])[0]
+                    topic = body[pos + 2:pos + 2 + topic_len].decode()
+                    pos += 2 + topic_len
+                    message_len = struct.unpack(">H", body[pos:pos + 2])[0]
+                    self.will = (topic, body[pos + 2:pos + 2 + message_len], bool(flags & 0x20))
+                self.send(packet(CONNACK << 4, b"\x00\x00"))
+            elif kind == SUBSCRIBE:
+                packet_id, pos, granted = body[:2], 2, b""
+                while pos < len(body):
+                    topic_len = struct.unpack(">H", body[pos:pos + 2])[0]
+                    self.filters.append(body[pos + 2:pos + 2 + topic_len].decode())
+                    pos += 3 + topic_len
+                    granted += b"\x00"
+                self.send(packet(SUBACK << 4, packet_id + granted))
+                for topic, payload in list(self.broker.retained.items()):
+                    if any(topic_matches(f, topic) for f in self.filters):
+                        self.send(publish_packet(topic, payload, True))
+            elif kind == PUBLISH:
+                topic, payload = parse_publish(first, body)
+                self.broker.route(topic, payload, bool(first & 0x01))
+            elif kind == PINGREQ:
+                self.send(packet(PINGRESP << 4, b""))
+            elif kind == DISCONNECT:
+                clean = True
+                break
+        self.broker.remove(self)
+        if not clean and self.will:
+            self.broker.route(*self.will)
+        self.sock.close()
+
+
+class Broker(threading.Thread):
+    """Just enough of an MQTT 3.1.1 broker for QoS 0: retained messages, wills, + and # filters"""
+
+    def __init__(self):
+        threading.Thread.__init__(self, daemon=True)
+        self.listener = socket.socket()
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen(8)
+        self.port = self.listener.getsockname()[1]
+        self.sessions = []
+        self.retained = {}
+        self.refusing = False
+        self.lock = threading.Lock()
+
+    def run(self):
+        while True:
+            sock, _ = self.listener.accept()
+            if self.refusing:
+                sock.close()
+                continue
+            session = Session(self, sock)
+            with self.lock:
+                self.sessions.append(session)
+            session.start()
+
+    def remove(self, session):
+        with self.lock:
+            if session in self.sessions:
+                self.sessions.remove(session)
+
+    def route(self, topic, payload, retain):
+        if retain:
+            self.retained[topic] = payload
+        with self.lock:
+            sessions = list(self.sessions)
+        for session in sessions:
+            if any(topic_matches(f, topic) for f in session.filters):
+                session.send(publish_packet(topic, payload))
+
+    def drop_client(self, client_id):
+        with self.lock:
+            sessions = [s for s in self.sessions if s.client_id == client_id]
+        for session in sessions:
+            session.drop()
+
+
+class Watcher(threading.Thread):
+    """Subscribes to everything under the prefix and timestamps each message"""
+
+    def __init__(self, host, port):
+        threading.Thread.__init__(self, daemon=True)
+        self.sock = socket.create_connection((host, port), timeout=30)
+        self.sock.sendall(packet(CONNECT << 4, string("MQTT") + b"\x04\x02\x00\x3c" + string("mqtt_bench")))
+        first, _ = read_packet(self.sock)
+        if first is None or first >> 4 != CONNACK:
+            raise SystemExit("broker refused the benchmark's connection")
+        self.sock.sendall(packet(0x82, b"\x00\x01" + string(PREFIX + "/#") + b"\x00"))
+        self.messages = [] # (arrival, topic, payload)
+        self.cond = threading.Condition()
+
+    def run(self):
+        while True:
+            try:
+                first, body = read_packet(self.sock)
+            except OSError:
+                return
+            if first is None:
+                return
+            if first >> 4 == PUBLISH:
+                topic, payload = parse_publish(first, body)
+                with self.cond:
+                    self.messages.append((time.monotonic(), topic, payload))
+                    self.cond.notify_all()
+
+    def publish(self, topic, payload=b""):
+        self.sock.sendall(publish_packet(topic, payload))
+
+    def wait_for(self, start, test, timeout):
+        """First message from index start on that test accepts, or None"""
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while True:
+                for i in range(start, len(self.messages)):
+                    if test(*self.messages[i]):
+                        return self.messages[i]
+                left = deadline - time.monotonic()
+                if left <= 0:
+                    return None
+                self.cond.wait(left)
+
+    def events(self, start=0):
+        out = []
+        with self.cond:
+            messages = self.messages[start:]
+        for arrival, topic, payload in messages:
+            if topic == PREFIX + "/events":
+                out.append((arrival, json.loads(payload)["events"]))
+        return out
+
+
+def has_lock(lock):
+    def test(arrival, topic, payload):
+        if topic != PREFIX + "/events":
+            return False
+        return any(event.get("lock") == lock for event in json.loads(payload)["events"] if "door" in event)
+    return test
+
+
+def is_status(value):
+    return lambda arrival, topic, payload: topic == PREFIX + "/status" and payload == value
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def fetch_json(base, path):
+    with urllib.request.urlopen(base + path, timeout=10) as response:
+        return json.load(response)
+
+
+def latency(watcher, rounds):
+    delays, lost = [], 0
+    for i in range(rounds):
+        command, lock = ("lock", "wifi") if i % 2 == 0 else ("unlock", "unlocked")
+        time.sleep(random.uniform(0.05, 0.25))
+        start = len(watcher.messages)
+        sent = time.monotonic()
+        watcher.publish(PREFIX + "/cmd/" + command)
+        message = watcher.wait_for(start, has_lock(lock), 5)
+        if message is None:
+            lost += 1
+        else:
+            delays.append((message[0] - sent) * 1000)
+    print("command to event latency over %d commands (%d lost): p50 %.0fms, p90 %.0fms, p99 %.0fms, max %.0fms" % (
+        rounds, lost, percentile(delays, 0.5), percentile(delays, 0.9), percentile(delays, 0.99), max(delays)))
+
+
+def throughput(watcher, base, commands, gap_ms):
+    accepted = fetch_json(base, "/api/status")["mqtt"]["commands"] if base else None
+    start = len(watcher.messages)
+    sent = time.monotonic()
+    for i in range(commands):
+        watcher.publish(PREFIX + "/cmd/" + ("lock" if i % 2 == 0 else "unlock"))
+        if gap_ms:
+            time.sleep(gap_ms / 1000.0)
+    watcher.wait_for(start, has_lock("unlocked" if commands % 2 == 0 else "wifi"), 10)
+    time.sleep(1) # Let the last batch land
+    batches = watcher.events(start)
+    events = sum(len([e for e in batch if "door" in e]) for _, batch in batches)
+    elapsed = batches[-1][0] - sent if batches else 0
+    if base:
+        # A burst can outrun the door task's event queue, those commands are refused rather than queued
+        accepted = "%d accepted, " % (fetch_json(base, "/api/status")["mqtt"]["commands"] - accepted)
+    print("burst of %d commands %dms apart: %s%d door events in %d messages (%.1f per message), %.0f events/s" % (
+        commands, gap_ms, accepted or "", events, len(batches), events / max(1, len(batches)), events / elapsed if elapsed else 0))
+
+
+def outage(broker, watcher, base, changes, down_s):
+    before = fetch_json(base, "/api/status")["mqtt"]
+    start = len(watcher.messages)
+    broker.refusing = True
+    broker.drop_client(PREFIX)
+    offline = watcher.wait_for(start, is_status(b"offline"), 5) is not None
+
+    # Lock changes through the web server while the broker is away, each one a door event
+    for i in range(changes):
+        urllib.request.urlopen(base + ("/lock/on" if i % 2 == 0 else "/lock/off"), timeout=10).read()
+        time.sleep(down_s / changes)
+    broker.refusing = False
+    allowed = time.monotonic()
+    back = watcher.wait_for(start, is_status(b"online"), 90)
+    time.sleep(2)
+
+    after = fetch_json(base, "/api/status")["mqtt"]
+    delivered = [e for _, batch in watcher.events(start) for e in batch if "door" in e]
+    last = delivered[-1]["lock"] if delivered else None
+    expected = "wifi" if changes % 2 == 1 else "unlocked"
+    print("outage of %.0fs with %d changes: will published %s, %s, %d events delivered, %d messages and %d events dropped, newest kept %s" % (
+        down_s, changes, "yes" if offline else "NO", "back %.1fs after the broker was" % (back[0] - allowed) if back else "NEVER RECONNECTED",
+        len(delivered), after["messages_dropped"] - before["messages_dropped"], after["events_dropped"] - before["events_dropped"],
+        "yes" if last == expected else "NO"))
+    return offline and back is not None and last == expected
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--sim", help="simulator binary, run with --serve --mqtt against the built-in broker")
+    parser.add_argument("--trace", default="sim/traces/example.trace")
+    parser.add_argument("--broker", help="use this broker instead of the built-in one")
+    parser.add_argument("--http", help="device address, for the status the outage test reads (localhost:8080 with --sim)")
+    parser.add_argument("--rounds", type=int, default=50)
+    parser.add_argument("--burst", type=int, default=200)
+    parser.add_argument("--outage-changes", type=int, default=100)
+    parser.add_argument("--outage-s", type=float, default=5)
+    args = parser.parse_args()
+
+    if (args.sim is None) == (args.broker is None):
+        parser.error("give --sim or --broker")
+
+    broker, sim = None, None
+    if args.sim:
+        broker = Broker()
+        broker.start()
+        host, port = "127.0.0.1", broker.port
+        sim = subprocess.Popen([args.sim, args.trace, "--serve", "--mqtt", "%s:%d" % (host, port)],
+            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        base = "http://" + (args.http or "localhost:8080")
+    else:
+        host, _, port = args.broker.partition(":")
+        port = int(port or 1883)
+        base = "http://" + args.http if args.http else None
+
+    ok = True
+    try:
+        watcher = Watcher(host, port)
+        watcher.start()
+        if watcher.wait_for(0, is_status(b"online"), 30) is None:
+            raise SystemExit("door never reported online")
+
+        latency(watcher, args.rounds)
+        throughput(watcher, base, args.burst, 0)
+        throughput(watcher, base, args.burst // 4, 20)
+        if broker and base:
+            ok = outage(broker, watcher, base, args.outage_changes, args.outage_s)
+        if base:
+            print("device totals: %s" % json.dumps(fetch_json(base, "/api/status")["mqtt"]))
+    finally:
+        if sim:
+            sim.terminate()
+            sim.wait()
+
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
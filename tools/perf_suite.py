@@ -0,0 +1,215 @@
+# End to end performance numbers from the simulator: adverts replayed per second, advert to relay latency, HTTP
+# requests per second and latency, heap allocations (and bytes) per advert and allocations per request, and flash commits per config change.
+# Writes them as JSON, and compares a run against a saved one, exiting 1 if anything got worse than its tolerance
+# usage: python tools/perf_suite.py [--sim .pio/build/native/program] --save perf.json
+#        python tools/perf_suite.py [--sim .pio/build/native/program] --compare perf.json
+
+import argparse
+import http.client
+import json
+import os
+import platform
+import re
+import socket
+import statistics
+import subprocess
+import tempfile
+import threading
+import time
+
+VISIT_MS = 20000 # Rex walks up to the door and away again this often
+ADVERT_INTERVAL_MS = 100
+NEIGHBOUR_INTERVAL_MS = 50 # Someone else's phone, heard throughout
+OPEN_TIME_MS = 2000 # Short, so every visit opens the door again
+
+# name: (better, fraction, floor), a change for the worse beyond both the fraction of the baseline and the floor is a
+# regression. The floor keeps sub-microsecond jitter from counting, the counts come out the same on every run
+METRICS = {
+    "adverts_per_s": ("higher", 0.15, 0),
+    "decision_ns": ("lower", 0.25, 50),
+    "advert_to_relay_p50_us": ("lower", 0.25, 2),
+    "advert_to_relay_p99_us": ("lower", 0.50, 5),
+    "http_requests_per_s": ("higher", 0.15, 0),
+    "http_p50_ms": ("lower", 0.25, 0.2),
+    "http_p99_ms": ("lower", 0.50, 1),
+    "allocations_per_advert": ("lower", 0, 0.01),
+    "allocated_bytes_per_advert": ("lower", 0, 0.1),
+    "allocations_per_request": ("lower", 0, 0.01),
+    "flash_commits_per_change": ("lower", 0, 0.01),
+}
+
+
+def write_trace(path, minutes):
+    # A few beacons and curfews added along the way as config changes, then visits with a neighbour's phone in between
+    lines = ["# Synthetic load for tools/perf_suite.py", "0 beacon Rex", "0 clock 1700000000"]
+    for i in range(3):
+        lines.append("%d beacon Visitor%d" % (500 + i, i))
+        lines.append("%d curfew %02d:00 %02d:30" % (500 + i, 1 + i, 1 + i))
+    for ms in range(1000, minutes * 60000, 10):
+        if ms % NEIGHBOUR_INTERVAL_MS == 0:
+            lines.append("%d advert 5C:11:22:33:44:55 - -88" % ms)
+        if ms % ADVERT_INTERVAL_MS == 40:
+            phase = (ms % VISIT_MS) / VISIT_MS
+            lines.append("%d advert C4:7F:51:00:12:34 Rex %d" % (ms, -96 + int(44 * (1 - abs(2 * phase - 1)))))
+    with open(path, "w") as trace:
+        trace.write("\n".join(lines) + "\n")
+
+
+def replay(sim, trace):
+    result = subprocess.run([sim, trace, "--open-time-ms", str(OPEN_TIME_MS)], capture_output=True, text=True, check=True)
+    out = result.stderr
+
+    def number(pattern):
+        match = re.search(pattern, out)
+        if match is None:
+            raise SystemExit("simulator summary has no line matching %r, is it older than this script?" % pattern)
+        return float(match.group(1))
+
+    latency = re.search(r"advert to relay: \d+ opens, p50 ([\d.]+)us, p99 ([\d.]+)us", out)
+    return {
+        "adverts_per_s": number(r"adverts (\d+)") / max(number(r"in ([\d.]+)s"), 0.001),
+        "decision_ns": number(r"decision path: ([\d.]+)ns"),
+        "advert_to_relay_p50_us": float(latency.group(1)) if latency else 0.0,
+        "advert_to_relay_p99_us": float(latency.group(2)) if latency else 0.0,
+        "allocations_per_advert": number(r"heap: \d+ allocations in the advert path, ([\d.]+) per advert"),
+        "allocated_bytes_per_advert": number(r"heap: .*, \d+ bytes, ([\d.]+) per advert"),
+        "flash_commits_per_change": number(r"config: \d+ changes, \d+ flash commits \(([\d.]+) per change\)"),
+    }
+
+
+def wait_for_port(host, port, timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection((host, port), timeout=1).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def fetch_status(host, port):
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    conn.request("GET", "/api/status")
+    status = json.loads(conn.getresponse().read())
+    conn.close()
+    return status
+
+
+def http_load(host, port, clients, requests):
+    # Each client keeps its connection open and sends its requests back to back
+    times = []
+    lock = threading.Lock()
+
+    def client():
+        conn = http.client.HTTPConnection(host, port, timeout=10)
+        mine = []
+        for _ in range(requests):
+            sent = time.perf_counter()
+            conn.request("GET", "/api/status")
+            conn.getresponse().read()
+            mine.append(time.perf_counter() - sent)
+        conn.close()
+        with lock:
+            times.extend(mine)
+
+    before = fetch_status(host, port)["allocations"]
+    started = time.perf_counter()
+    threads = [threading.Thread(target=client) for _ in range(clients)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.perf_counter() - started
+    after = fetch_status(host, port)["allocations"]
+
+    times.sort()
+    return {
+        "http_requests_per_s": len(times) / elapsed,
+        "http_p50_ms": times[len(times) // 2] * 1000,
+        "http_p99_ms": times[len(times) * 99 // 100] * 1000,
+        "allocations_per_request": (after - before) / (len(times) + 1), # The second status fetch is counted too
+    }
+
+
+def serve(sim, trace, address, clients, requests):
+    host, _, port = address.partition(":")
+    port = int(port or 80)
+    process = subprocess.Popen([sim, trace, "--serve"], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        if not wait_for_port(host, port, 30):
+            raise SystemExit("simulator never started serving on %s" % address)
+        return http_load(host, port, clients, requests)
+    finally:
+        process.terminate()
+        process.wait()
+
+
+def measure(args):
+    with tempfile.TemporaryDirectory() as scratch:
+        trace = os.path.join(scratch, "load.trace")
+        write_trace(trace, args.minutes)
+        replays = [replay(args.sim, trace) for _ in range(args.runs)]
+    served = [serve(args.sim, args.serve_trace, args.http, args.clients, args.requests) for _ in range(args.runs)]
+
+    # Medians over the runs, the counts come out the same every time anyway
+    metrics = {}
+    for runs in (replays, served):
+        for name in runs[0]:
+            metrics[name] = statistics.median(run[name] for run in runs)
+    return metrics
+
+
+def compare(baseline, current, slack):
+    regressions = 0
+    print("%-26s %12s %12s %9s" % ("metric", "baseline", "now", "change"))
+    for name, (better, fraction, floor) in METRICS.items():
+        if name not in baseline or name not in current:
+            print("%-26s %12s %12s" % (name, baseline.get(name, "-"), current.get(name, "-")))
+            continue
+        old, new = baseline[name], current[name]
+        worse = new - old if better == "lower" else old - new
+        regressed = worse > slack * max(fraction * abs(old), floor)
+        change = "%+.1f%%" % (100.0 * (new - old) / old) if old else "%+.2f" % (new - old)
+        print("%-26s %12.2f %12.2f %9s%s" % (name, old, new, change, "  REGRESSED" if regressed else ""))
+        regressions += regressed
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--sim", default=".pio/build/native/program")
+    parser.add_argument("--serve-trace", default="sim/traces/example.trace", help="trace replayed before serving HTTP")
+    parser.add_argument("--http", default="localhost:8080", help="where the simulator serves, WEB_SERVER_PORT")
+    parser.add_argument("--minutes", type=int, default=60, help="length of the synthetic trace")
+    parser.add_argument("--runs", type=int, default=3)
+    parser.add_argument("--clients", type=int, default=4)
+    parser.add_argument("--requests", type=int, default=500, help="per client")
+    parser.add_argument("--save", help="write the results here as a baseline")
+    parser.add_argument("--compare", help="compare against this baseline, exit 1 on a regression")
+    parser.add_argument("--slack", type=float, default=1.0, help="scale every tolerance, e.g. 2 on a noisy machine")
+    args = parser.parse_args()
+
+    current = measure(args)
+    result = {"host": platform.node(), "created": time.strftime("%Y-%m-%dT%H:%M:%S"), "metrics": current}
+
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+        if baseline.get("host") != result["host"]:
+            print("baseline is from %s, timings from another machine don't compare" % baseline.get("host"))
+        regressions = compare(baseline["metrics"], current, args.slack)
+    else:
+        print(json.dumps(result, indent=2))
+        regressions = 0
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(result, f, indent=2)
+            f.write("\n")
+
+    raise SystemExit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+# Replays a trace through the simulator with fixed and adaptive scanning and compares them
+# usage: python tools/scan_benchmark.py <trace> [--sim .pio/build/native/program]
+
+import argparse
+import re
+import subprocess
+
+MATCH_WINDOW_MS = 30000 # An adaptive open this long after the fixed one still counts as the same visit
+
+
+def run(sim, trace, scan):
+    result = subprocess.run([sim, trace, "--scan", scan], capture_output=True, text=True, check=True)
+    opens = [int(line.split()[0]) for line in result.stdout.splitlines() if line.endswith("relay on")]
+    energy = re.search(r"energy model: ([\d.]+)mAh, average ([\d.]+)mA", result.stderr)
+    return opens, float(energy.group(1)), float(energy.group(2))
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("trace")
+    parser.add_argument("--sim", default=".pio/build/native/program")
+    args = parser.parse_args()
+
+    fixed_opens, fixed_mah, fixed_ma = run(args.sim, args.trace, "fixed")
+    adaptive_opens, adaptive_mah, adaptive_ma = run(args.sim, args.trace, "adaptive")
+
+    # Pair each fixed-scan open with the first adaptive open at or after it
+    added = []
+    missed = 0
+    remaining = list(adaptive_opens)
+    for opened in fixed_opens:
+        later = [t for t in remaining if opened <= t <= opened + MATCH_WINDOW_MS]
+        if not later:
+            missed += 1
+            continue
+        added.append(later[0] - opened)
+        remaining.remove(later[0])
+
+    print("              fixed    adaptive")
+    print("opens     %9d %11d" % (len(fixed_opens), len(adaptive_opens)))
+    print("charge    %7.1fmAh %8.1fmAh" % (fixed_mah, adaptive_mah))
+    print("average   %8.1fmA %9.1fmA" % (fixed_ma, adaptive_ma))
+    if fixed_mah > 0:
+        print("saved     %.1f%%" % (100.0 * (fixed_mah - adaptive_mah) / fixed_mah))
+    if added:
+        print("added open latency: mean %.0fms, p95 %dms, max %dms" % (sum(added) / len(added), percentile(added, 0.95), max(added)))
+    print("opens missed by adaptive scanning: %d" % missed)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,79 @@
+# Generates weeks of curfews, timed locks and web opens, replays them through the simulator from boot and from
+# just before each 32 bit millis() wrap, and checks every run opens the door exactly when it should
+# usage: python tools/schedule_check.py [--sim .pio/build/native/program] [--days 14] [--seed 1]
+
+import argparse
+import random
+import subprocess
+import tempfile
+
+EPOCH_S = 1767225600 # Midnight at the start of a day, the sim takes the wall clock as local time
+DAY_MS = 86400000
+CURFEWS = [(22 * 60, 6 * 60 + 30), (12 * 60, 13 * 60)] # Minutes after midnight
+OPEN_TIME_MS = 10000
+WRAP = 1 << 32
+
+
+def in_curfew(ms):
+    minute = ms % DAY_MS // 60000
+    return any(minute >= start or minute < end if start > end else start <= minute < end for start, end in CURFEWS)
+
+
+def generate(days, seed):
+    rng = random.Random(seed)
+    lines = ["0 clock %d" % EPOCH_S]
+    lines += ["0 curfew %02d:%02d %02d:%02d" % (start // 60, start % 60, end // 60, end % 60) for start, end in CURFEWS]
+    expected = []
+    timed_until = 0
+    door_closes = 0
+    t = 1000
+
+    while t < days * DAY_MS:
+        t += rng.randint(60, 1200) * 1000 + 500 # Never on a minute boundary, where the answer depends on ordering
+        if rng.random() < 0.05:
+            minutes = rng.randint(0, 90)
+            timed_until = t + minutes * 60000 if minutes > 0 else 0
+            lines.append("%d web lock-for %d" % (t, minutes))
+            continue
+
+        locked = in_curfew(t) or t < timed_until
+        lines.append("%d web open" % t)
+        if not locked and t >= door_closes:
+            expected.append(t)
+            door_closes = t + OPEN_TIME_MS
+
+    return lines, expected
+
+
+def run(sim, trace, start_ms):
+    result = subprocess.run([sim, trace, "--open-time-ms", str(OPEN_TIME_MS), "--start-ms", str(start_ms)],
+        capture_output=True, text=True, check=True)
+    return [int(line.split()[0]) for line in result.stdout.splitlines() if line.endswith("relay on")]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--sim", default=".pio/build/native/program")
+    parser.add_argument("--days", type=int, default=14)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    lines, expected = generate(args.days, args.seed)
+    with tempfile.NamedTemporaryFile("w", suffix=".trace") as trace:
+        trace.write("\n".join(lines) + "\n")
+        trace.flush()
+
+        failed = False
+        # From boot, wrapping a day in, wrapping near the end, and after a few wraps
+        for start_ms in (0, WRAP - DAY_MS, (WRAP - (args.days - 1) * DAY_MS) % WRAP, 3 * WRAP - DAY_MS // 2):
+            opens = run(args.sim, trace.name, start_ms)
+            wrong = sorted(set(opens).symmetric_difference(expected))
+            print("start %13d: %d commands, %d opens, %d expected, %d wrong%s" % (start_ms, len(lines), len(opens), len(expected),
+                len(wrong), " (first at %dms)" % wrong[0] if wrong else ""))
+            failed = failed or len(wrong) > 0
+
+    raise SystemExit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,171 @@
+# Checks the door task keeps up while the web server is flooded: times lock on/off commands through the door task
+# (door_event_wait_us) with the server idle and then under load from several clients, and reports each task's CPU
+# share over both phases from /api/tasks
+# usage: python tools/task_stress.py <host[:port]> [--clients 6] [--commands 40] [--bound-us 10000]
+
+import argparse
+import json
+import re
+import socket
+import threading
+import time
+
+BUCKET_RE = re.compile(r'^door_event_wait_us_bucket\{le="([^"]+)"\} (\d+)$')
+REQUESTS_PER_CONNECTION = 10
+FLOOD_PATHS = [b"/metrics", b"/api/status", b"/", b"/api/journal", b"/nope"]
+
+
+def get(host, port, path):
+    # Under the flood every connection slot may be taken, keep trying
+    for attempt in range(200):
+        try:
+            return fetch(host, port, path)
+        except OSError:
+            time.sleep(0.02)
+    raise SystemExit("%s: no connection slot came free" % path)
+
+
+def fetch(host, port, path):
+    sock = socket.create_connection((host, port), timeout=10)
+    sock.sendall(b"GET " + path.encode() + b" HTTP/1.1\r\nConnection: close\r\n\r\n")
+    data = b""
+    while True:
+        chunk = sock.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    sock.close()
+    if not data:
+        raise ConnectionError("closed unanswered, the server had no free slot")
+    head, _, body = data.partition(b"\r\n\r\n")
+    return int(head.split(b" ")[1]), body
+
+
+def wait_buckets(host, port):
+    """Cumulative door_event_wait_us buckets as [(upper bound, count)]"""
+    buckets = []
+    for line in get(host, port, "/metrics")[1].decode().splitlines():
+        match = BUCKET_RE.match(line)
+        if match:
+            buckets.append((float(match.group(1)), int(match.group(2))))
+    return buckets
+
+
+def bucket_percentile(before, after, fraction):
+    counts = [(bound, a - b) for (bound, a), (_, b) in zip(after, before)]
+    total = counts[-1][1] if counts else 0
+    for bound, count in counts:
+        if total > 0 and count >= fraction * total:
+            return bound, total
+    return None, total
+
+
+def task_times(host, port):
+    report = json.loads(get(host, port, "/api/tasks")[1])
+    return report.get("uptime_us", 0), dict((task["name"], task["run_us"]) for task in report.get("tasks", []))
+
+
+class Flooder(threading.Thread):
+    """Client sending requests back to back, closing every few so the others (and the commands) get a slot"""
+
+    def __init__(self, host, port, index, stop):
+        threading.Thread.__init__(self, daemon=True)
+        self.host, self.port, self.index, self.stop = host, port, index, stop
+        self.requests = 0
+
+    def run(self):
+        sock = None
+        while not self.stop.is_set():
+            try:
+                if sock is None:
+                    sock = socket.create_connection((self.host, self.port), timeout=5)
+                path = FLOOD_PATHS[(self.index + self.requests) % len(FLOOD_PATHS)]
+                close = self.requests % REQUESTS_PER_CONNECTION == REQUESTS_PER_CONNECTION - 1
+                sock.sendall(b"GET " + path + b" HTTP/1.1\r\nHost: door\r\n" + (b"Connection: close\r\n" if close else b"") + b"\r\n")
+                if not self.read_response(sock) or close:
+                    sock.close()
+                    sock = None
+                self.requests += 1
+            except OSError:
+                if sock is not None:
+                    sock.close()
+                sock = None
+                time.sleep(0.01) # All connection slots taken, try again
+
+    def read_response(self, sock):
+        data = b""
+        while b"\r\n\r\n" not in data:
+            chunk = sock.recv(4096)
+            if not chunk:
+                return False
+            data += chunk
+        head, _, body = data.partition(b"\r\n\r\n")
+        length = re.search(rb"\r\ncontent-length: *(\d+)", head, re.I)
+        length = int(length.group(1)) if length else 0
+        while len(body) < length:
+            chunk = sock.recv(65536)
+            if not chunk:
+                return False
+            body += chunk
+        return True
+
+
+def run_phase(host, port, commands):
+    """Locks and unlocks so the door ends where it started, returns wait buckets and task times either side, and
+    the slowest command round trip, which includes waiting for a connection slot"""
+    before = wait_buckets(host, port), task_times(host, port)
+    slowest = 0
+    for i in range(commands):
+        sent = time.monotonic()
+        get(host, port, "/lock/on" if i % 2 == 0 else "/lock/off")
+        slowest = max(slowest, time.monotonic() - sent)
+        time.sleep(0.05)
+    after = wait_buckets(host, port), task_times(host, port)
+    return before, after, slowest
+
+
+def report(name, before, after, slowest):
+    (buckets_before, (up_before, run_before)), (buckets_after, (up_after, run_after)) = before, after
+    p50, count = bucket_percentile(buckets_before, buckets_after, 0.5)
+    p99, _ = bucket_percentile(buckets_before, buckets_after, 0.99)
+    print("%s: %d door commands, door task wait p50 <= %sus, p99 <= %sus, slowest round trip %.0fms" % (name, count, p50, p99, slowest * 1000))
+    elapsed = up_after - up_before
+    if elapsed > 0:
+        busy = sorted(((run_after[task] - run_before.get(task, 0)) * 100.0 / elapsed, task) for task in run_after)
+        print("  cpu (%% of a core): %s" % ", ".join("%s %.1f" % (task, share) for share, task in reversed(busy) if share >= 0.1))
+    return p99
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("host")
+    parser.add_argument("--clients", type=int, default=6)
+    parser.add_argument("--commands", type=int, default=40)
+    parser.add_argument("--bound-us", type=float, default=10000)
+    args = parser.parse_args()
+
+    host, _, port = args.host.partition(":")
+    port = int(port or 80)
+
+    quiet = report("idle", *run_phase(host, port, args.commands))
+
+    stop = threading.Event()
+    flooders = [Flooder(host, port, i, stop) for i in range(args.clients)]
+    for flooder in flooders:
+        flooder.start()
+    time.sleep(1)
+    started = time.monotonic()
+    sent = sum(flooder.requests for flooder in flooders)
+    loaded = report("flooded", *run_phase(host, port, args.commands))
+    flood_rate = (sum(flooder.requests for flooder in flooders) - sent) / (time.monotonic() - started)
+    stop.set()
+    print("flood: %d clients, about %.0f requests per second" % (args.clients, flood_rate))
+
+    if loaded is None or quiet is None:
+        print("no door commands were timed, is this the device?")
+        raise SystemExit(1)
+    raise SystemExit(0 if loaded <= args.bound_us else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,64 @@
+# Compares the decision path of a simulator built with runtime tuning against one built with -DDOOR_TUNING_FIXED
+# usage: python tools/tuning_bench.py [--sim .pio/build/native/program] [--fixed-sim .pio/build/native_fixed/program]
+
+import argparse
+import os
+import re
+import statistics
+import subprocess
+import tempfile
+
+ADVERT_INTERVAL_MS = 20 # Faster than a real beacon, only the number of detections matters here
+VISIT_MS = 60000 # Each visit walks up to the door and away again over this long
+
+
+def write_trace(path, minutes):
+    # Rex comes and goes, so detections go through every branch of the decision: far, approaching, open, leaving
+    with open(path, "w") as trace:
+        trace.write("# Synthetic load for tools/tuning_bench.py\n0 beacon Rex\n")
+        for ms in range(1000, minutes * 60000, ADVERT_INTERVAL_MS):
+            phase = (ms % VISIT_MS) / VISIT_MS
+            rssi = -96 + int(40 * (1 - abs(2 * phase - 1)))
+            trace.write("%d advert C4:7F:51:00:12:34 Rex %d\n" % (ms, rssi))
+
+
+def run(sim, trace):
+    result = subprocess.run([sim, trace], capture_output=True, text=True, check=True)
+    replayed = re.search(r"in ([\d.]+)s", result.stderr)
+    adverts = re.search(r"adverts (\d+)", result.stderr)
+    decision = re.search(r"decision path: ([\d.]+)ns per detection, (\S+) profile with (\w+) tuning", result.stderr)
+    seconds = max(float(replayed.group(1)), 0.001)
+    return float(decision.group(1)), int(adverts.group(1)) / seconds, decision.group(2), decision.group(3)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--sim", default=".pio/build/native/program")
+    parser.add_argument("--fixed-sim", default=".pio/build/native_fixed/program")
+    parser.add_argument("--minutes", type=int, default=60, help="length of the synthetic trace")
+    parser.add_argument("--runs", type=int, default=5)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as scratch:
+        trace = os.path.join(scratch, "load.trace")
+        write_trace(trace, args.minutes)
+
+        results = {}
+        # Alternate the builds so drift in the machine's load hits both alike
+        for _ in range(args.runs):
+            for sim in (args.sim, args.fixed_sim):
+                results.setdefault(sim, []).append(run(sim, trace))
+
+    print("            profile      ns/detection  adverts/s")
+    medians = {}
+    for sim in (args.sim, args.fixed_sim):
+        runs = results[sim]
+        profile, tuning = runs[0][2], runs[0][3]
+        medians[sim] = statistics.median(r[0] for r in runs)
+        print("%-11s %-12s %12.1f %10.0f" % (tuning, profile, medians[sim], statistics.median(r[1] for r in runs)))
+    if medians[args.sim] > 0:
+        print("fixed build saves %.1f%% of the decision path" % (100.0 * (medians[args.sim] - medians[args.fixed_sim]) / medians[args.sim]))
+
+
+if __name__ == "__main__":
+    main()